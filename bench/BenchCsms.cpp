@@ -0,0 +1,173 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "BenchCsms.h"
+
+#include <chrono>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace MicroOcpp;
+
+#define BENCH_SEND_WINDOW 65536 //bytes which are kept in the send buffer of a /file response
+
+void bench_csms_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
+
+double MicroOcpp::bench_now_us() {
+    return (double) std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace MicroOcpp {
+
+//fills the send buffer with the next part of the generated file
+static void bench_csms_file_pump(BenchCsms& csms, struct mg_connection *c) {
+    auto download = csms.downloads.find(c);
+    if (download == csms.downloads.end()) {
+        return;
+    }
+
+    size_t& remaining = download->second;
+    while (remaining > 0 && c->send.len < BENCH_SEND_WINDOW) {
+        unsigned char buf [4096];
+        size_t offset = csms.file_size - remaining;
+        size_t n = remaining < sizeof(buf) ? remaining : sizeof(buf);
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = (unsigned char) (offset + i); //deterministic content so that the client can verify it
+        }
+        mg_send(c, buf, n);
+        remaining -= n;
+    }
+
+    if (remaining == 0) {
+        csms.downloads.erase(download);
+    }
+}
+
+static void bench_csms_on_http(BenchCsms& csms, struct mg_connection *c, struct mg_http_message *hm) {
+    if (mg_http_get_header(hm, "Upgrade")) {
+        auto accept_time = csms.accept_times.find(c);
+        if (accept_time != csms.accept_times.end()) {
+            csms.accept_to_upgrade_us = bench_now_us() - accept_time->second;
+            csms.accept_times.erase(accept_time);
+        }
+        mg_ws_upgrade(c, hm, "Sec-WebSocket-Protocol: ocpp1.6\r\n");
+        csms.upgrades++;
+        return;
+    }
+
+    if (mg_vcmp(&hm->uri, "/file")) {
+        mg_http_reply(c, 404, "", "not found\n");
+        return;
+    }
+
+    size_t offset = 0;
+    struct mg_str *range = mg_http_get_header(hm, "Range");
+    if (range && range->len > 6 && !strncmp(range->ptr, "bytes=", 6)) {
+        offset = (size_t) strtoul(std::string(range->ptr + 6, range->len - 6).c_str(), nullptr, 10);
+        if (offset > csms.file_size) {
+            mg_http_reply(c, 416, "", "");
+            return;
+        }
+        mg_printf(c, "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lu-%lu/%lu\r\nContent-Length: %lu\r\n\r\n",
+                (unsigned long) offset, (unsigned long) (csms.file_size > 0 ? csms.file_size - 1 : 0), (unsigned long) csms.file_size,
+                (unsigned long) (csms.file_size - offset));
+    } else {
+        mg_printf(c, "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\n\r\n", (unsigned long) csms.file_size);
+    }
+
+    csms.downloads[c] = csms.file_size - offset;
+    bench_csms_file_pump(csms, c);
+}
+
+} //end namespace MicroOcpp
+
+BenchCsms::~BenchCsms() {
+    stop();
+}
+
+bool BenchCsms::start(bool tls, unsigned short port) {
+    stop();
+
+    this->tls = tls;
+
+    std::string addr = "http://127.0.0.1:" + std::to_string(port);
+    listener = mg_http_listen(mgr, addr.c_str(), bench_csms_cb, this);
+    if (!listener) {
+        return false;
+    }
+
+    this->port = mg_ntohs(listener->loc.port);
+    return true;
+}
+
+void BenchCsms::stop() {
+    for (auto c = mgr->conns; c; c = c->next) {
+        if (c->fn_data == this) {
+            c->fn_data = nullptr;
+            c->is_closing = 1;
+        }
+    }
+    listener = nullptr;
+    accept_times.clear();
+    downloads.clear();
+}
+
+std::string BenchCsms::getUrl(const char *host) {
+    return std::string(tls ? "wss://" : "ws://") + host + ":" + std::to_string(port) + "/ocpp";
+}
+
+std::string BenchCsms::getFileUrl(const char *host) {
+    return std::string(tls ? "https://" : "http://") + host + ":" + std::to_string(port) + "/file";
+}
+
+void BenchCsms::closeClients() {
+    for (auto c = mgr->conns; c; c = c->next) {
+        if (c->fn_data == this && c != listener) {
+            c->is_closing = 1;
+        }
+    }
+}
+
+unsigned int BenchCsms::countClients() {
+    unsigned int count = 0;
+    for (auto c = mgr->conns; c; c = c->next) {
+        if (c->fn_data == this && c != listener && c->is_websocket && !c->is_closing) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void bench_csms_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
+    if (!fn_data) {
+        return;
+    }
+
+    BenchCsms& csms = *reinterpret_cast<BenchCsms*>(fn_data);
+
+    if (ev == MG_EV_ACCEPT) {
+        csms.accepted++;
+        csms.accept_times[c] = bench_now_us();
+        if (csms.tls) {
+            struct mg_tls_opts opts;
+            memset(&opts, 0, sizeof(opts));
+            opts.cert = csms.cert_path.c_str();
+            opts.certkey = csms.key_path.c_str();
+            mg_tls_init(c, &opts);
+        }
+    } else if (ev == MG_EV_HTTP_MSG) {
+        bench_csms_on_http(csms, c, (struct mg_http_message *) ev_data);
+    } else if (ev == MG_EV_WS_MSG) {
+        struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
+        csms.messages++;
+        csms.bytes += wm->data.len;
+        mg_ws_send(c, wm->data.ptr, wm->data.len, WEBSOCKET_OP_TEXT);
+    } else if (ev == MG_EV_WRITE || ev == MG_EV_POLL) {
+        bench_csms_file_pump(csms, c);
+    } else if (ev == MG_EV_CLOSE) {
+        csms.accept_times.erase(c);
+        csms.downloads.erase(c);
+    }
+}
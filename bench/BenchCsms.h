@@ -0,0 +1,60 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_BENCHCSMS_H
+#define MO_BENCHCSMS_H
+
+#include "mongoose.h"
+
+#include <string>
+#include <map>
+
+namespace MicroOcpp {
+
+/*
+ * In-process stand-in for the OCPP server. Accepts WS / WSS upgrades with subprotocol ocpp1.6 and echoes every
+ * text frame back to the sender, so that a CALL sent by the client returns as the next incoming message.
+ *
+ * Also serves GET /file with a generated body of file_size bytes and Range support for the HTTP transfer
+ * benchmark. Runs on the mg_mgr of the client; every mg_mgr_poll serves both sides
+ */
+class BenchCsms {
+public:
+    struct mg_mgr *mgr {nullptr};
+    struct mg_connection *listener {nullptr};
+    bool tls = false;
+    std::string cert_path; //server certificate and key (PEM files) for WSS
+    std::string key_path;
+    unsigned short port = 0; //port of the listener. Resolved after start() if 0
+
+    size_t file_size = 0; //size of /file
+
+    //statistics
+    unsigned long accepted = 0;
+    unsigned long upgrades = 0;
+    unsigned long messages = 0;
+    size_t bytes = 0;
+    double accept_to_upgrade_us = 0.; //time between TCP accept and WS upgrade request of the last conn. Includes the TLS handshake
+
+    std::map<struct mg_connection*, double> accept_times; //conns which haven't sent the upgrade request yet
+    std::map<struct mg_connection*, size_t> downloads; //remaining body bytes of /file responses
+
+    BenchCsms(struct mg_mgr *mgr) : mgr(mgr) { }
+    ~BenchCsms();
+
+    bool start(bool tls, unsigned short port = 0);
+    void stop();
+
+    std::string getUrl(const char *host = "127.0.0.1"); //ws[s]://host:port/ocpp
+    std::string getFileUrl(const char *host = "127.0.0.1"); //http://host:port/file
+
+    void closeClients(); //close all accepted conns, e.g. to measure the reconnect cost of the client
+    unsigned int countClients();
+};
+
+double bench_now_us(); //monotonic clock in microseconds
+
+} //end namespace MicroOcpp
+
+#endif
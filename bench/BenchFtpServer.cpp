@@ -0,0 +1,283 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "BenchFtpServer.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+using namespace MicroOcpp;
+
+#define BENCH_SEND_WINDOW 65536 //bytes which are kept in the send buffer of the data conn
+
+void bench_ftp_ctrl_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
+void bench_ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
+
+namespace MicroOcpp {
+
+static void bench_ftp_retr_pump(BenchFtpServer::Session& session, struct mg_connection *c) {
+    auto server = session.server;
+
+    size_t budget = (size_t) -1;
+    if (server->rtt_ms > 0) {
+        uint64_t now = mg_millis();
+        if (now - session.flow_window_start >= server->rtt_ms) {
+            session.flow_window_start = now;
+            session.flow_window_bytes = 0;
+        }
+        budget = server->flow_window > session.flow_window_bytes ? server->flow_window - session.flow_window_bytes : 0;
+    }
+
+    while (session.remaining > 0 && c->send.len < BENCH_SEND_WINDOW && budget > 0) {
+        unsigned char buf [4096];
+        size_t offset = server->file_size - session.remaining;
+        size_t n = session.remaining < sizeof(buf) ? session.remaining : sizeof(buf);
+        if (n > budget) {
+            n = budget;
+        }
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = (unsigned char) (offset + i); //same content as the HTTP stand-in
+        }
+        mg_send(c, buf, n);
+        session.remaining -= n;
+        server->bytes_sent += n;
+        session.flow_window_bytes += n;
+        budget -= n;
+    }
+
+    if (session.remaining == 0) {
+        c->is_draining = 1; //the close event of the data conn sends 226
+    }
+}
+
+static void bench_ftp_on_cmd(BenchFtpServer::Session& session, struct mg_connection *c, const std::string& line) {
+    using Transfer = BenchFtpServer::Session::Transfer;
+    auto server = session.server;
+
+    size_t sp = line.find(' ');
+    std::string cmd = line.substr(0, sp);
+    std::string arg = sp == std::string::npos ? "" : line.substr(sp + 1);
+    for (auto& ch : cmd) {
+        ch = (char) toupper((unsigned char) ch);
+    }
+
+    if (cmd == "USER") {
+        mg_printf(c, "331 Password required\r\n");
+    } else if (cmd == "PASS") {
+        mg_printf(c, "230 Logged in\r\n");
+    } else if (cmd == "FEAT") {
+        mg_printf(c, "211-Features:\r\n SIZE\r\n REST STREAM\r\n211 End\r\n");
+    } else if (cmd == "CWD") {
+        mg_printf(c, "250 OK\r\n");
+    } else if (cmd == "TYPE" || cmd == "PBSZ" || cmd == "PROT") {
+        mg_printf(c, "200 OK\r\n");
+    } else if (cmd == "SIZE") {
+        mg_printf(c, "213 %lu\r\n", (unsigned long) server->file_size);
+    } else if (cmd == "PASV") {
+        session.closeData();
+        session.data_listener = mg_listen(c->mgr, "tcp://127.0.0.1:0", bench_ftp_data_cb, &session);
+        if (!session.data_listener) {
+            mg_printf(c, "425 Cannot open data connection\r\n");
+            return;
+        }
+        unsigned short port = mg_ntohs(session.data_listener->loc.port);
+        mg_printf(c, "227 Entering Passive Mode (127,0,0,1,%u,%u)\r\n", (unsigned) (port >> 8), (unsigned) (port & 0xFF));
+    } else if (cmd == "REST") {
+        session.rest_offset = (size_t) strtoul(arg.c_str(), nullptr, 10);
+        mg_printf(c, "350 Restarting at %lu\r\n", (unsigned long) session.rest_offset);
+    } else if (cmd == "RETR") {
+        if (session.rest_offset > server->file_size) {
+            mg_printf(c, "550 Invalid offset\r\n");
+            return;
+        }
+        session.transfer = Transfer::Retr;
+        session.remaining = server->file_size - session.rest_offset;
+        session.transfer_requested = true;
+        if (session.data_conn) {
+            session.startTransfer();
+        }
+    } else if (cmd == "STOR" || cmd == "APPE") {
+        session.transfer = Transfer::Stor;
+        session.transfer_requested = true;
+        if (session.data_conn) {
+            session.startTransfer();
+        }
+    } else if (cmd == "AUTH") {
+        mg_printf(c, "502 TLS not supported\r\n"); //FTPS is out of scope of the stand-in
+    } else if (cmd == "QUIT") {
+        mg_printf(c, "221 Bye\r\n");
+        c->is_draining = 1;
+    } else {
+        mg_printf(c, "502 Command not implemented\r\n");
+    }
+}
+
+} //end namespace MicroOcpp
+
+void BenchFtpServer::Session::startTransfer() {
+    transfer_requested = false;
+    transfer_started = true;
+    flow_window_start = 0;
+    flow_window_bytes = 0;
+    mg_printf(ctrl_conn, "150 Opening data connection\r\n");
+    if (transfer == Transfer::Retr) {
+        bench_ftp_retr_pump(*this, data_conn);
+    }
+}
+
+void BenchFtpServer::Session::closeData() {
+    if (data_listener) {
+        data_listener->fn_data = nullptr;
+        data_listener->is_closing = 1;
+        data_listener = nullptr;
+    }
+    if (data_conn) {
+        data_conn->fn_data = nullptr;
+        data_conn->is_closing = 1;
+        data_conn = nullptr;
+    }
+    transfer = Transfer::None;
+    transfer_requested = false;
+    transfer_started = false;
+}
+
+BenchFtpServer::~BenchFtpServer() {
+    stop();
+}
+
+bool BenchFtpServer::start(unsigned short port) {
+    stop();
+
+    std::string addr = "tcp://127.0.0.1:" + std::to_string(port);
+    listener = mg_listen(mgr, addr.c_str(), bench_ftp_ctrl_cb, this);
+    if (!listener) {
+        return false;
+    }
+
+    this->port = mg_ntohs(listener->loc.port);
+    return true;
+}
+
+void BenchFtpServer::stop() {
+    for (auto& session : sessions) {
+        session->closeData();
+        session->ctrl_conn->fn_data = nullptr;
+        session->ctrl_conn->is_closing = 1;
+    }
+    sessions.clear();
+
+    if (listener) {
+        listener->fn_data = nullptr;
+        listener->is_closing = 1;
+        listener = nullptr;
+    }
+}
+
+BenchFtpServer::Session *BenchFtpServer::getSession(struct mg_connection *ctrl_conn) {
+    for (auto& session : sessions) {
+        if (session->ctrl_conn == ctrl_conn) {
+            return session.get();
+        }
+    }
+    return nullptr;
+}
+
+void BenchFtpServer::removeSession(struct mg_connection *ctrl_conn) {
+    for (auto session = sessions.begin(); session != sessions.end(); session++) {
+        if ((*session)->ctrl_conn == ctrl_conn) {
+            (*session)->closeData();
+            sessions.erase(session);
+            return;
+        }
+    }
+}
+
+std::string BenchFtpServer::getUrl(const char *fname, const char *host) {
+    return std::string("ftp://bench:bench@") + host + ":" + std::to_string(port) + "/" + fname;
+}
+
+void bench_ftp_ctrl_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
+    (void) ev_data;
+    if (!fn_data) {
+        return;
+    }
+
+    BenchFtpServer& server = *reinterpret_cast<BenchFtpServer*>(fn_data);
+
+    if (ev == MG_EV_ACCEPT) {
+        std::unique_ptr<BenchFtpServer::Session> session {new BenchFtpServer::Session()};
+        session->server = &server;
+        session->ctrl_conn = c;
+        server.sessions.push_back(std::move(session));
+        server.sessions_accepted++;
+        mg_printf(c, "220 MicroOcppMongoose bench\r\n");
+    } else if (ev == MG_EV_READ) {
+        auto session = server.getSession(c);
+        if (!session) {
+            c->recv.len = 0;
+            return;
+        }
+        while (true) {
+            const char *lf = (const char*) memchr(c->recv.buf, '\n', c->recv.len);
+            if (!lf) {
+                break;
+            }
+            size_t line_len = (size_t) (lf - (const char*) c->recv.buf);
+            std::string line ((const char*) c->recv.buf, line_len > 0 && lf[-1] == '\r' ? line_len - 1 : line_len);
+            mg_iobuf_del(&c->recv, 0, line_len + 1);
+            bench_ftp_on_cmd(*session, c, line);
+        }
+    } else if (ev == MG_EV_CLOSE) {
+        server.removeSession(c);
+    }
+}
+
+void bench_ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
+    (void) ev_data;
+    if (!fn_data) {
+        return;
+    }
+
+    auto& session = *reinterpret_cast<BenchFtpServer::Session*>(fn_data);
+    using Transfer = BenchFtpServer::Session::Transfer;
+
+    if (ev == MG_EV_ACCEPT) {
+        if (session.data_conn) {
+            c->fn_data = nullptr;
+            c->is_closing = 1; //only one data conn per PASV
+            return;
+        }
+        session.data_conn = c;
+        if (session.data_listener) {
+            session.data_listener->fn_data = nullptr;
+            session.data_listener->is_closing = 1;
+            session.data_listener = nullptr;
+        }
+        if (session.transfer_requested) {
+            session.startTransfer();
+        }
+    } else if (ev == MG_EV_READ) {
+        if (session.transfer == Transfer::Stor) {
+            session.server->bytes_received += c->recv.len;
+        }
+        c->recv.len = 0;
+    } else if (ev == MG_EV_WRITE || ev == MG_EV_POLL) {
+        if (c == session.data_conn && session.transfer == Transfer::Retr && session.transfer_started) {
+            bench_ftp_retr_pump(session, c);
+        }
+    } else if (ev == MG_EV_CLOSE) {
+        if (c != session.data_conn) {
+            return;
+        }
+        session.data_conn = nullptr;
+        if (session.transfer_started) {
+            mg_printf(session.ctrl_conn, session.remaining == 0 ? "226 Transfer complete\r\n" : "426 Transfer aborted\r\n");
+        }
+        session.transfer = Transfer::None;
+        session.transfer_requested = false;
+        session.transfer_started = false;
+        session.rest_offset = 0;
+    }
+}
@@ -0,0 +1,233 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "BenchProxy.h"
+#include "BenchCsms.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#endif
+
+using namespace MicroOcpp;
+
+void bench_proxy_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
+
+namespace MicroOcpp {
+
+//close with RST instead of FIN and detach the conn from the proxy
+static void bench_proxy_rst(struct mg_connection *c) {
+    struct linger l;
+    l.l_onoff = 1;
+    l.l_linger = 0;
+#if defined(_WIN32)
+    setsockopt((SOCKET) (size_t) c->fd, SOL_SOCKET, SO_LINGER, (const char*) &l, sizeof(l));
+#else
+    setsockopt((int) (size_t) c->fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+#endif
+    c->fn_data = nullptr;
+    c->is_closing = 1;
+}
+
+} //end namespace MicroOcpp
+
+BenchProxy::~BenchProxy() {
+    stop();
+}
+
+bool BenchProxy::start(const char *upstream_url, unsigned short port) {
+    stop();
+
+    this->upstream_url = upstream_url;
+
+    std::string addr = "tcp://127.0.0.1:" + std::to_string(port);
+    listener = mg_listen(mgr, addr.c_str(), bench_proxy_cb, this);
+    if (!listener) {
+        return false;
+    }
+
+    this->port = mg_ntohs(listener->loc.port);
+    return true;
+}
+
+void BenchProxy::stop() {
+    reset();
+    if (listener) {
+        listener->fn_data = nullptr;
+        listener->is_closing = 1;
+        listener = nullptr;
+    }
+}
+
+std::string BenchProxy::getUrl(const char *scheme, const char *path) {
+    return std::string(scheme) + "://127.0.0.1:" + std::to_string(port) + path;
+}
+
+void BenchProxy::stall(bool stalled) {
+    this->stalled = stalled;
+}
+
+void BenchProxy::blackhole() {
+    for (auto& pipe : pipes) {
+        pipe->blackholed = true;
+        pipe->up.queue.clear();
+        pipe->down.queue.clear();
+    }
+}
+
+void BenchProxy::reset() {
+    for (auto& pipe : pipes) {
+        if (pipe->downstream) {
+            bench_proxy_rst(pipe->downstream);
+        }
+        if (pipe->upstream) {
+            bench_proxy_rst(pipe->upstream);
+        }
+    }
+    pipes.clear();
+}
+
+void BenchProxy::refuse(bool refusing) {
+    this->refusing = refusing;
+}
+
+unsigned int BenchProxy::countPipes() {
+    return (unsigned int) pipes.size();
+}
+
+BenchProxy::Pipe *BenchProxy::getPipe(struct mg_connection *c) {
+    for (auto& pipe : pipes) {
+        if (pipe->downstream == c || pipe->upstream == c) {
+            return pipe.get();
+        }
+    }
+    return nullptr;
+}
+
+void BenchProxy::removePipe(Pipe *pipe) {
+    pipes.erase(std::remove_if(pipes.begin(), pipes.end(), [pipe] (const std::unique_ptr<Pipe>& p) {
+            return p.get() == pipe;
+        }), pipes.end());
+}
+
+void BenchProxy::enqueue(Pipe& pipe, bool upwards, const char *data, size_t len) {
+    Direction& dir = upwards ? pipe.up : pipe.down;
+    BenchImpairment& imp = upwards ? up : down;
+
+    double now = bench_now_us();
+
+    //transmission on the emulated link
+    double start = std::max(now, dir.link_free_us);
+    double tx_us = imp.bandwidth > 0 ? (double) len * 1000000. / (double) imp.bandwidth : 0.;
+    dir.link_free_us = start + tx_us;
+
+    //propagation delay
+    double delay_us = imp.latency_ms * 1000.;
+    if (imp.jitter_ms > 0) {
+        delay_us += std::uniform_real_distribution<double>(0., imp.jitter_ms * 1000.)(rng);
+    }
+    if (imp.drop_rate > 0. && std::uniform_real_distribution<double>(0., 1.)(rng) < imp.drop_rate) {
+        delay_us += imp.rto_ms * 1000.;
+        chunks_dropped++;
+    }
+
+    Chunk chunk;
+    chunk.release_us = std::max(dir.link_free_us + delay_us, dir.last_release_us); //TCP doesn't reorder
+    chunk.data.assign(data, len);
+    dir.last_release_us = chunk.release_us;
+    dir.queue.push_back(std::move(chunk));
+}
+
+void BenchProxy::flush(Pipe& pipe, bool upwards) {
+    Direction& dir = upwards ? pipe.up : pipe.down;
+    struct mg_connection *target = upwards ? pipe.upstream : pipe.downstream;
+
+    if (!target) {
+        dir.queue.clear();
+        return;
+    }
+
+    if (!stalled && !pipe.blackholed) {
+        double now = bench_now_us();
+        while (!dir.queue.empty() && dir.queue.front().release_us <= now) {
+            auto& chunk = dir.queue.front();
+            mg_send(target, chunk.data.data(), chunk.data.size());
+            dir.bytes += chunk.data.size();
+            (upwards ? bytes_up : bytes_down) += chunk.data.size();
+            dir.queue.pop_front();
+        }
+    }
+
+    if (dir.eof && dir.queue.empty()) {
+        target->is_draining = 1; //forward the close of the sender after the last byte
+    }
+}
+
+void bench_proxy_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
+    (void) ev_data;
+    if (!fn_data) {
+        return;
+    }
+
+    BenchProxy& proxy = *reinterpret_cast<BenchProxy*>(fn_data);
+
+    if (ev == MG_EV_ACCEPT) {
+        if (proxy.refusing) {
+            proxy.pipes_refused++;
+            bench_proxy_rst(c);
+            return;
+        }
+
+        std::unique_ptr<BenchProxy::Pipe> pipe {new BenchProxy::Pipe()};
+        pipe->downstream = c;
+        pipe->upstream = mg_connect(c->mgr, proxy.upstream_url.c_str(), bench_proxy_cb, &proxy);
+        if (!pipe->upstream) {
+            bench_proxy_rst(c);
+            return;
+        }
+        proxy.pipes.push_back(std::move(pipe));
+        proxy.pipes_opened++;
+        return;
+    }
+
+    BenchProxy::Pipe *pipe = proxy.getPipe(c);
+    if (!pipe) {
+        if (c != proxy.listener && ev != MG_EV_CLOSE) {
+            c->is_closing = 1;
+        }
+        return;
+    }
+
+    bool from_downstream = c == pipe->downstream;
+
+    if (ev == MG_EV_READ) {
+        if (!pipe->blackholed) {
+            proxy.enqueue(*pipe, from_downstream, (const char*) c->recv.buf, c->recv.len);
+        }
+        c->recv.len = 0;
+        proxy.flush(*pipe, from_downstream);
+    } else if (ev == MG_EV_POLL || ev == MG_EV_WRITE) {
+        proxy.flush(*pipe, true);
+        proxy.flush(*pipe, false);
+    } else if (ev == MG_EV_CLOSE) {
+        if (from_downstream) {
+            pipe->downstream = nullptr;
+            pipe->up.eof = true;
+            pipe->down.queue.clear();
+        } else {
+            pipe->upstream = nullptr;
+            pipe->down.eof = true;
+            pipe->up.queue.clear();
+        }
+
+        if (!pipe->downstream && !pipe->upstream) {
+            proxy.removePipe(pipe);
+        } else {
+            proxy.flush(*pipe, from_downstream);
+        }
+    }
+}
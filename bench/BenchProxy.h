@@ -0,0 +1,114 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_BENCHPROXY_H
+#define MO_BENCHPROXY_H
+
+#include "mongoose.h"
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <random>
+
+namespace MicroOcpp {
+
+/*
+ * Impairment of one direction of the proxied TCP stream. TCP delivers in order and without gaps, so the
+ * impairments are emulated on the stream as the endpoints would see them:
+ *
+ * - latency / jitter: each chunk is held back by latency_ms plus a random share of jitter_ms, but never
+ *   overtakes the previous chunk
+ * - bandwidth: the chunks are released at no more than bandwidth bytes per second
+ * - drop_rate: a dropped segment reaches the receiver after the retransmission timeout rto_ms, and
+ *   everything behind it waits as well (head-of-line blocking)
+ */
+struct BenchImpairment {
+    unsigned long latency_ms = 0;
+    unsigned long jitter_ms = 0;
+    size_t bandwidth = 0; //bytes per second. 0 for unlimited
+    double drop_rate = 0.; //probability in [0, 1] that a chunk needs a retransmission
+    unsigned long rto_ms = 200;
+};
+
+/*
+ * In-process TCP proxy between a client and one of the stand-in servers. Runs on the same mg_mgr. Besides the
+ * per-direction impairments, it injects the following faults into the existing conns:
+ *
+ * - stall: no data is forwarded until the stall ends. Nothing gets lost
+ * - blackhole: the existing conns stay open but silently discard all data in both directions, like a
+ *   half-open socket or a NAT rebinding. New conns work normally
+ * - reset: close all conns with RST
+ * - refuse: reject new conns, e.g. while the server is down
+ */
+class BenchProxy {
+public:
+    struct Chunk {
+        double release_us;
+        std::string data;
+    };
+
+    struct Direction {
+        std::deque<Chunk> queue;
+        double last_release_us = 0.; //release time of the last queued chunk. Keeps the order
+        double link_free_us = 0.; //time when the emulated link has sent the last chunk
+        size_t bytes = 0;
+        bool eof = false; //the sender has closed. Close the receiver when the queue is empty
+    };
+
+    struct Pipe {
+        struct mg_connection *downstream {nullptr}; //accepted conn of the client
+        struct mg_connection *upstream {nullptr}; //conn to the server
+        Direction up; //client to server
+        Direction down; //server to client
+        bool blackholed = false;
+    };
+
+    struct mg_mgr *mgr {nullptr};
+    struct mg_connection *listener {nullptr};
+    std::string upstream_url; //tcp://host:port of the server
+    unsigned short port = 0;
+
+    BenchImpairment up; //client to server
+    BenchImpairment down; //server to client
+
+    bool stalled = false;
+    bool refusing = false;
+
+    //statistics
+    unsigned long pipes_opened = 0;
+    unsigned long pipes_refused = 0;
+    unsigned long chunks_dropped = 0; //number of emulated retransmissions
+    size_t bytes_up = 0;
+    size_t bytes_down = 0;
+
+    std::vector<std::unique_ptr<Pipe>> pipes;
+    std::mt19937 rng {1}; //fixed seed so that a scenario is reproducible
+
+    BenchProxy(struct mg_mgr *mgr) : mgr(mgr) { }
+    ~BenchProxy();
+
+    bool start(const char *upstream_url, unsigned short port = 0);
+    void stop();
+
+    std::string getUrl(const char *scheme, const char *path = ""); //scheme://127.0.0.1:port/path
+
+    void stall(bool stalled);
+    void blackhole();
+    void reset();
+    void refuse(bool refusing);
+
+    unsigned int countPipes();
+
+    //internal
+    Pipe *getPipe(struct mg_connection *c);
+    void removePipe(Pipe *pipe);
+    void enqueue(Pipe& pipe, bool upwards, const char *data, size_t len);
+    void flush(Pipe& pipe, bool upwards);
+};
+
+} //end namespace MicroOcpp
+
+#endif
@@ -0,0 +1,81 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "BenchReport.h"
+
+#include <algorithm>
+
+using namespace MicroOcpp;
+
+FILE *BenchReport::out = stdout;
+
+BenchReport::BenchReport(const char *bench, const char *transport) {
+    line = "{\"bench\":\"";
+    line += bench;
+    line += "\"";
+    if (transport) {
+        add("transport", transport);
+    }
+}
+
+BenchReport::~BenchReport() {
+    fprintf(out, "%s}\n", line.c_str());
+    fflush(out);
+}
+
+BenchReport& BenchReport::add(const char *key, const char *val) {
+    line += ",\"";
+    line += key;
+    line += "\":\"";
+    line += val;
+    line += "\"";
+    return *this;
+}
+
+BenchReport& BenchReport::add(const char *key, double val) {
+    char buf [32];
+    snprintf(buf, sizeof(buf), "%.1f", val);
+    line += ",\"";
+    line += key;
+    line += "\":";
+    line += buf;
+    return *this;
+}
+
+BenchReport& BenchReport::add(const char *key, unsigned long val) {
+    line += ",\"";
+    line += key;
+    line += "\":";
+    line += std::to_string(val);
+    return *this;
+}
+
+BenchReport& BenchReport::add(const char *key, bool val) {
+    line += ",\"";
+    line += key;
+    line += "\":";
+    line += val ? "true" : "false";
+    return *this;
+}
+
+BenchReport& BenchReport::addSamples(std::vector<double> samples) {
+    add("samples", (unsigned long) samples.size());
+    if (samples.empty()) {
+        return *this;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.;
+    for (auto s : samples) {
+        sum += s;
+    }
+    auto percentile = [&samples] (double p) {
+        return samples[std::min(samples.size() - 1, (size_t) (p * (double) samples.size()))];
+    };
+    add("mean_us", sum / (double) samples.size());
+    add("p50_us", percentile(0.5));
+    add("p90_us", percentile(0.9));
+    add("p99_us", percentile(0.99));
+    add("max_us", samples.back());
+    return *this;
+}
@@ -0,0 +1,39 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_BENCHREPORT_H
+#define MO_BENCHREPORT_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+namespace MicroOcpp {
+
+/*
+ * Writes one benchmark result as JSON object in a single line when going out of scope:
+ *
+ *     BenchReport("ws_rtt", "ws").add("window", 16UL).addSamples(samples);
+ */
+class BenchReport {
+private:
+    std::string line;
+public:
+    static FILE *out; //stdout by default
+
+    BenchReport(const char *bench, const char *transport = nullptr);
+    ~BenchReport();
+
+    BenchReport& add(const char *key, const char *val);
+    BenchReport& add(const char *key, double val);
+    BenchReport& add(const char *key, unsigned long val);
+    BenchReport& add(const char *key, bool val);
+
+    //count, mean and percentiles of samples in microseconds
+    BenchReport& addSamples(std::vector<double> samples);
+};
+
+} //end namespace MicroOcpp
+
+#endif
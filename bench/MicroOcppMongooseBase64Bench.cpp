@@ -0,0 +1,276 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Throughput of base64.hpp in GB/s for each vector kernel which the CPU supports and for the previous per-character
+ * implementation (transport "ref"):
+ *
+ * - base64_encode: encode_base64, GB/s of binary input
+ * - base64_decode: decode_base64, GB/s of base64 input
+ * - base64_strict: decode_base64_strict, GB/s of base64 input
+ *
+ * Each kernel is checked against the reference before it is measured. Runs without network and Mongoose
+ */
+
+#include "BenchReport.h"
+
+#include "base64.hpp"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace MicroOcpp;
+
+namespace {
+
+/*
+ * The previous implementation of base64.hpp (Densaugeo/base64_arduino, MIT License), standard alphabet
+ */
+namespace ref {
+
+unsigned char binary_to_base64(unsigned char v) {
+    if (v < 26) return v + 'A';
+    if (v < 52) return v + 71;
+    if (v < 62) return v - 4;
+    if (v == 62) return '+';
+    if (v == 63) return '/';
+    return 64;
+}
+
+unsigned char base64_to_binary(unsigned char c) {
+    if ('A' <= c && c <= 'Z') return c - 'A';
+    if ('a' <= c && c <= 'z') return c - 71;
+    if ('0' <= c && c <= '9') return c + 4;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return 255;
+}
+
+unsigned int decode_base64_length(const unsigned char input[], unsigned int input_length) {
+    const unsigned char *start = input;
+    while (base64_to_binary(input[0]) < 64 && (unsigned int) (input - start) < input_length) {
+        ++input;
+    }
+    input_length = (unsigned int) (input - start);
+    return input_length/4*3 + (input_length % 4 ? input_length % 4 - 1 : 0);
+}
+
+unsigned int encode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
+    unsigned int full_sets = input_length/3;
+    for (unsigned int i = 0; i < full_sets; ++i) {
+        output[0] = binary_to_base64(                         input[0] >> 2);
+        output[1] = binary_to_base64((input[0] & 0x03) << 4 | input[1] >> 4);
+        output[2] = binary_to_base64((input[1] & 0x0F) << 2 | input[2] >> 6);
+        output[3] = binary_to_base64( input[2] & 0x3F);
+        input += 3;
+        output += 4;
+    }
+    switch (input_length % 3) {
+        case 0:
+            output[0] = '\0';
+            break;
+        case 1:
+            output[0] = binary_to_base64(                         input[0] >> 2);
+            output[1] = binary_to_base64((input[0] & 0x03) << 4);
+            output[2] = '=';
+            output[3] = '=';
+            output[4] = '\0';
+            break;
+        case 2:
+            output[0] = binary_to_base64(                         input[0] >> 2);
+            output[1] = binary_to_base64((input[0] & 0x03) << 4 | input[1] >> 4);
+            output[2] = binary_to_base64((input[1] & 0x0F) << 2);
+            output[3] = '=';
+            output[4] = '\0';
+            break;
+    }
+    return (input_length + 2)/3*4;
+}
+
+unsigned int decode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
+    unsigned int output_length = decode_base64_length(input, input_length);
+    for (unsigned int i = 2; i < output_length; i += 3) {
+        output[0] = base64_to_binary(input[0]) << 2 | base64_to_binary(input[1]) >> 4;
+        output[1] = base64_to_binary(input[1]) << 4 | base64_to_binary(input[2]) >> 2;
+        output[2] = base64_to_binary(input[2]) << 6 | base64_to_binary(input[3]);
+        input += 4;
+        output += 3;
+    }
+    switch (output_length % 3) {
+        case 1:
+            output[0] = base64_to_binary(input[0]) << 2 | base64_to_binary(input[1]) >> 4;
+            break;
+        case 2:
+            output[0] = base64_to_binary(input[0]) << 2 | base64_to_binary(input[1]) >> 4;
+            output[1] = base64_to_binary(input[1]) << 4 | base64_to_binary(input[2]) >> 2;
+            break;
+    }
+    return output_length;
+}
+
+} //end namespace ref
+
+struct Base64Options {
+    std::string sizes = "64,1024,16384,1048576"; //binary input sizes
+    double min_ms = 200.; //measurement time per size and kernel
+    std::string out = "-";
+};
+
+volatile unsigned int sink; //keeps the results alive
+
+double now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//runs fn until min_ms have passed and returns the GB/s of bytes per run
+double measure(const Base64Options& opts, size_t bytes, std::function<unsigned int()> fn) {
+    unsigned long runs = 0;
+    unsigned long batch = 1;
+    double t_start = now_us();
+    double elapsed_us = 0.;
+    do {
+        for (unsigned long i = 0; i < batch; i++) {
+            sink = fn();
+        }
+        runs += batch;
+        batch *= 2;
+        elapsed_us = now_us() - t_start;
+    } while (elapsed_us < opts.min_ms * 1000.);
+
+    return (double) bytes * (double) runs / (elapsed_us * 1000.);
+}
+
+bool runSize(const Base64Options& opts, size_t size, int kernel) {
+    const char *name = kernel >= 0 ? base64_kernel_name(kernel) : "ref";
+
+    std::vector<unsigned char> bin (size);
+    for (size_t i = 0; i < size; i++) {
+        bin[i] = (unsigned char) rand();
+    }
+    std::vector<unsigned char> b64 (encode_base64_length((unsigned int) size) + 1);
+    std::vector<unsigned char> dec (decode_base64_max_length((unsigned int) b64.size()) + 1);
+    unsigned int b64_len = ref::encode_base64(bin.data(), (unsigned int) size, b64.data());
+
+    if (kernel >= 0) {
+        std::vector<unsigned char> check (b64.size());
+        if (encode_base64(bin.data(), (unsigned int) size, check.data()) != b64_len ||
+                memcmp(check.data(), b64.data(), b64_len) ||
+                decode_base64(b64.data(), b64_len, dec.data()) != size ||
+                memcmp(dec.data(), bin.data(), size) ||
+                decode_base64_strict(b64.data(), b64_len, dec.data()) != (int) size) {
+            fprintf(stderr, "kernel %s: result differs from the reference\n", name);
+            return false;
+        }
+    }
+
+    double enc_gbps = measure(opts, size, [&] () {
+        return kernel >= 0 ?
+            encode_base64(bin.data(), (unsigned int) size, b64.data()) :
+            ref::encode_base64(bin.data(), (unsigned int) size, b64.data());
+    });
+
+    double dec_gbps = measure(opts, b64_len, [&] () {
+        return kernel >= 0 ?
+            decode_base64(b64.data(), b64_len, dec.data()) :
+            ref::decode_base64(b64.data(), b64_len, dec.data());
+    });
+
+    BenchReport("base64_encode", name)
+        .add("size", (unsigned long) size)
+        .add("gb_per_s", enc_gbps);
+
+    BenchReport("base64_decode", name)
+        .add("size", (unsigned long) size)
+        .add("gb_per_s", dec_gbps);
+
+    if (kernel >= 0) {
+        double strict_gbps = measure(opts, b64_len, [&] () {
+            return (unsigned int) decode_base64_strict(b64.data(), b64_len, dec.data());
+        });
+        BenchReport("base64_strict", name)
+            .add("size", (unsigned long) size)
+            .add("gb_per_s", strict_gbps);
+    }
+
+    return true;
+}
+
+bool parseArgs(int argc, char **argv, Base64Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc) {
+            return false;
+        }
+        const char *val = argv[++i];
+        if (arg == "--sizes") {
+            opts.sizes = val;
+        } else if (arg == "--min-ms") {
+            opts.min_ms = strtod(val, nullptr);
+        } else if (arg == "--out") {
+            opts.out = val;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} //end namespace
+
+int main(int argc, char **argv) {
+    Base64Options opts;
+    if (!parseArgs(argc, argv, opts)) {
+        fprintf(stderr, "usage: %s [--sizes 64,1024,16384,1048576] [--min-ms MS] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<size_t> sizes;
+    for (const char *p = opts.sizes.c_str(); *p;) {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p) {
+            fprintf(stderr, "invalid --sizes\n");
+            return 1;
+        }
+        if (n > 0) {
+            sizes.push_back((size_t) n);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (opts.out != "-") {
+        BenchReport::out = fopen(opts.out.c_str(), "w");
+        if (!BenchReport::out) {
+            fprintf(stderr, "cannot open %s\n", opts.out.c_str());
+            return 1;
+        }
+    }
+
+    int default_kernel = base64_kernel();
+
+    BenchReport("meta")
+        .add("default_kernel", base64_kernel_name(default_kernel));
+
+    bool success = true;
+    for (auto size : sizes) {
+        success &= runSize(opts, size, -1);
+        for (int kernel = BASE64_KERNEL_SCALAR; kernel <= BASE64_KERNEL_NEON; kernel++) {
+            if (base64_use_kernel(kernel)) {
+                success &= runSize(opts, size, kernel);
+            }
+        }
+        base64_use_kernel(default_kernel);
+    }
+
+    if (BenchReport::out != stdout) {
+        fclose(BenchReport::out);
+    }
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,739 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Loopback benchmark of the Mongoose adapter. Starts the stand-in servers of BenchCsms.h and BenchFtpServer.h on
+ * the same mg_mgr as the clients and measures:
+ *
+ * - ws_connect:   time from applying the backend URL until the WS connection is open (WS and WSS)
+ * - ws_reconnect: time from a server-side close until the client is connected again
+ * - ws_rtt:       sendTXT -> echo round-trip latency, one message in flight
+ * - ws_rate:      echoed messages per second with a window of messages in flight
+ * - ftp_download, ftp_upload, http_download: transfer throughput
+ * - ftp_segmented: throughput of MongooseFtpSegmentedDownload for 1 to K parallel sessions when each data conn is
+ *                  capped by an emulated round-trip time (BenchFtpServer::rtt_ms)
+ * - gzip:          compression ratio and deflate CPU time of MongooseFtpGzipStage for a diagnostics log, for several
+ *                  levels and windows, and the FTP upload with and without gzip_upload (build flag MO_FTP_GZIP)
+ * - snapshot:      time to load and store the WS configs as binary snapshot (WsConnSnapshotContainer) and as JSON
+ *                  with the MicroOcpp configuration store, on the default filesystem
+ *
+ * Every result is written as one JSON object per line, e.g.
+ *
+ *     {"bench":"ws_rtt","transport":"ws","samples":1000,"mean_us":41.2,"p50_us":38.0,...}
+ *
+ * The debug output of MicroOcpp goes to stdout as well. Use --out to write the results into a separate file.
+ * Only Mongoose v7 is supported
+ */
+
+#include "BenchCsms.h"
+#include "BenchFtpServer.h"
+#include "BenchReport.h"
+
+#include "MicroOcppMongooseClient.h"
+#include "MicroOcppMongooseFtp.h"
+#include "MicroOcppMongooseFtpSegmented.h"
+#include "MicroOcppMongooseFtpGzip.h"
+#include "MicroOcppMongooseHttp.h"
+#include "MicroOcppMongooseSnapshot.h"
+#include <MicroOcpp/Core/Configuration.h>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(MO_MG_VERSION_614)
+#error "the benchmark requires Mongoose v7"
+#endif
+
+using namespace MicroOcpp;
+
+namespace {
+
+struct BenchOptions {
+    unsigned int messages = 1000; //ws_rtt samples
+    unsigned long rate_duration_ms = 3000; //ws_rate measurement period
+    unsigned int window = 16; //ws_rate messages in flight
+    size_t payload = 64; //padding of each OCPP message in bytes
+    unsigned int reconnects = 10;
+    size_t transfer_size = 8 * 1024 * 1024; //file size of the FTP and HTTP transfers
+    unsigned long timeout_ms = 10000; //max wait time of each single step
+    std::string cert; //PEM files of the WSS stand-in. WSS is skipped if not set
+    std::string key;
+    std::string ca; //CA of the WSS stand-in for the client. Empty disables verification
+    std::string tls_host = "localhost"; //host name of the WSS URL. Must match the certificate if ca is set
+    std::string segments = "1,2,4,8"; //ftp_segmented: max numbers of parallel sessions
+    unsigned long rtt_ms = 20; //ftp_segmented: emulated round-trip time of each data conn
+    size_t flow_window = 65536; //ftp_segmented: bytes in flight per data conn and round trip
+    unsigned int iterations = 200; //snapshot: loads and stores per format
+    std::string only; //comma-separated list of benchmark groups (ws, wss, ftp, http, segmented, gzip, snapshot). Empty runs all
+    std::string out = "-";
+};
+
+bool selected(const BenchOptions& opts, const char *group) {
+    if (opts.only.empty()) {
+        return true;
+    }
+    std::string list = "," + opts.only + ",";
+    return list.find(std::string(",") + group + ",") != std::string::npos;
+}
+
+//poll the event loop until cond is true. Returns false on timeout
+bool waitFor(struct mg_mgr *mgr, const BenchOptions& opts, std::function<bool()> cond, std::function<void()> loop = nullptr) {
+    double t_start = bench_now_us();
+    while (!cond()) {
+        if (bench_now_us() - t_start >= opts.timeout_ms * 1000.) {
+            return false;
+        }
+        mg_mgr_poll(mgr, 0);
+        if (loop) {
+            loop();
+        }
+    }
+    return true;
+}
+
+/*
+ * WS / WSS benchmarks on one MOcppMongooseClient instance
+ */
+void benchWs(struct mg_mgr *mgr, const BenchOptions& opts, MOcppMongooseClient& client, bool tls) {
+    const char *transport = tls ? "wss" : "ws";
+
+    BenchCsms csms {mgr};
+    csms.cert_path = opts.cert;
+    csms.key_path = opts.key;
+    if (!csms.start(tls)) {
+        BenchReport("ws_connect", transport).add("error", "cannot start stand-in server");
+        return;
+    }
+
+    auto loop = [&client] () {client.loop();};
+
+    /*
+     * connect
+     */
+    double t_start = bench_now_us();
+    client.setBackendUrl(csms.getUrl(tls ? opts.tls_host.c_str() : "127.0.0.1").c_str());
+    client.reloadConfigs();
+
+    if (!waitFor(mgr, opts, [&client] () {return client.isConnected();}, loop)) {
+        BenchReport("ws_connect", transport).add("error", "timeout");
+        client.setBackendUrl("");
+        client.reloadConfigs();
+        return;
+    }
+
+    BenchReport("ws_connect", transport)
+        .add("connect_us", bench_now_us() - t_start)
+        .add("accept_to_upgrade_us", csms.accept_to_upgrade_us); //includes the TLS handshake for WSS
+
+    /*
+     * reconnect after server-side close
+     */
+    std::vector<double> reconnect_samples;
+    for (unsigned int i = 0; i < opts.reconnects; i++) {
+        t_start = bench_now_us();
+        csms.closeClients();
+        if (!waitFor(mgr, opts, [&client] () {return !client.isConnected();}, loop) ||
+                !waitFor(mgr, opts, [&client] () {return client.isConnected();}, loop)) {
+            break;
+        }
+        reconnect_samples.push_back(bench_now_us() - t_start);
+    }
+    BenchReport("ws_reconnect", transport).addSamples(reconnect_samples);
+
+    /*
+     * round-trip latency
+     */
+    unsigned long received = 0;
+    ReceiveTXTcallback onReceive = [&received] (const char*, size_t) {
+        received++;
+        return true;
+    };
+    client.setReceiveTXTcallback(onReceive);
+
+    std::string pad (opts.payload, 'x');
+    auto makeMsg = [&pad] (unsigned long id) {
+        return std::string("[2,\"") + std::to_string(id) + "\",\"DataTransfer\",{\"vendorId\":\"bench\",\"data\":\"" + pad + "\"}]";
+    };
+
+    std::vector<double> rtt_samples;
+    rtt_samples.reserve(opts.messages);
+    for (unsigned int i = 0; i < opts.messages; i++) {
+        auto msg = makeMsg(i);
+        unsigned long expected = received + 1;
+        double t_send = bench_now_us();
+        if (!client.sendTXT(msg.c_str(), msg.length()) ||
+                !waitFor(mgr, opts, [&received, expected] () {return received >= expected;}, loop)) {
+            break;
+        }
+        rtt_samples.push_back(bench_now_us() - t_send);
+    }
+    BenchReport("ws_rtt", transport).add("msg_bytes", (unsigned long) makeMsg(0).length()).addSamples(rtt_samples);
+
+    /*
+     * message rate with window
+     */
+    received = 0;
+    unsigned long sent = 0;
+    t_start = bench_now_us();
+    double t_end = t_start + opts.rate_duration_ms * 1000.;
+    bool send_failure = false;
+    while (bench_now_us() < t_end) {
+        while (sent - received < opts.window) {
+            auto msg = makeMsg(sent);
+            if (!client.sendTXT(msg.c_str(), msg.length())) {
+                send_failure = true;
+                break;
+            }
+            sent++;
+        }
+        if (send_failure) {
+            break;
+        }
+        mg_mgr_poll(mgr, 0);
+        client.loop();
+    }
+    double elapsed_s = (bench_now_us() - t_start) / 1000000.;
+    BenchReport("ws_rate", transport)
+        .add("window", (unsigned long) opts.window)
+        .add("sent", sent)
+        .add("received", received)
+        .add("msgs_per_s", elapsed_s > 0. ? (double) received / elapsed_s : 0.)
+        .add("send_failure", send_failure);
+
+    ReceiveTXTcallback discard = [] (const char*, size_t) {return true;};
+    client.setReceiveTXTcallback(discard);
+
+    client.setBackendUrl("");
+    client.reloadConfigs();
+    waitFor(mgr, opts, [&csms] () {return csms.countClients() == 0;});
+}
+
+/*
+ * FTP transfers against the stand-in
+ */
+void benchFtp(struct mg_mgr *mgr, const BenchOptions& opts) {
+    BenchFtpServer server {mgr};
+    server.file_size = opts.transfer_size;
+    if (!server.start()) {
+        BenchReport("ftp_download", "ftp").add("error", "cannot start stand-in server");
+        return;
+    }
+
+    //download and verify the generated content
+    {
+        MongooseFtpClient ftp {mgr};
+        size_t received = 0;
+        bool content_ok = true;
+        bool closed = false;
+
+        double t_start = bench_now_us();
+        ftp.getFile(server.getUrl("bench.bin").c_str(), [&received, &content_ok] (unsigned char *data, size_t len) {
+                    for (size_t i = 0; i < len; i++) {
+                        content_ok &= data[i] == (unsigned char) (received + i);
+                    }
+                    received += len;
+                    return len;
+                }, [&closed] () {
+                    closed = true;
+                });
+
+        bool finished = waitFor(mgr, opts, [&closed] () {return closed;}, [&ftp] () {ftp.loop();});
+        double duration_s = (bench_now_us() - t_start) / 1000000.;
+
+        BenchReport("ftp_download", "ftp")
+            .add("bytes", (unsigned long) received)
+            .add("duration_us", duration_s * 1000000.)
+            .add("mb_per_s", duration_s > 0. ? (double) received / duration_s / 1000000. : 0.)
+            .add("success", finished && ftp.transfer_complete && received == opts.transfer_size && content_ok);
+    }
+
+    //upload
+    {
+        MongooseFtpClient ftp {mgr};
+        size_t sent = 0;
+        bool closed = false;
+        size_t received_before = server.bytes_received;
+
+        double t_start = bench_now_us();
+        ftp.postFile(server.getUrl("bench-up.bin").c_str(), [&sent, &opts] (unsigned char *out, size_t size) {
+                    size_t n = std::min(size, opts.transfer_size - sent);
+                    memset(out, 'u', n);
+                    sent += n;
+                    return n;
+                }, [&closed] () {
+                    closed = true;
+                });
+
+        bool finished = waitFor(mgr, opts, [&closed] () {return closed;}, [&ftp] () {ftp.loop();});
+        double duration_s = (bench_now_us() - t_start) / 1000000.;
+        size_t received = server.bytes_received - received_before;
+
+        BenchReport("ftp_upload", "ftp")
+            .add("bytes", (unsigned long) received)
+            .add("duration_us", duration_s * 1000000.)
+            .add("mb_per_s", duration_s > 0. ? (double) received / duration_s / 1000000. : 0.)
+            .add("success", finished && ftp.transfer_complete && received == opts.transfer_size);
+    }
+}
+
+/*
+ * HTTP downloads against the stand-in. The second download reuses the keep-alive conn
+ */
+void benchHttp(struct mg_mgr *mgr, const BenchOptions& opts) {
+    BenchCsms csms {mgr};
+    csms.file_size = opts.transfer_size;
+    if (!csms.start(false)) {
+        BenchReport("http_download", "http").add("error", "cannot start stand-in server");
+        return;
+    }
+
+    MongooseHttpClient http {mgr};
+
+    for (int i = 0; i < 2; i++) {
+        size_t received = 0;
+        bool content_ok = true;
+        bool closed = false;
+
+        double t_start = bench_now_us();
+        http.getFile(csms.getFileUrl().c_str(), [&received, &content_ok] (unsigned char *data, size_t len) {
+                    for (size_t i = 0; i < len; i++) {
+                        content_ok &= data[i] == (unsigned char) (received + i);
+                    }
+                    received += len;
+                    return len;
+                }, [&closed] () {
+                    closed = true;
+                });
+
+        bool finished = waitFor(mgr, opts, [&closed] () {return closed;}, [&http] () {http.loop();});
+        double duration_s = (bench_now_us() - t_start) / 1000000.;
+
+        BenchReport("http_download", "http")
+            .add("bytes", (unsigned long) received)
+            .add("duration_us", duration_s * 1000000.)
+            .add("mb_per_s", duration_s > 0. ? (double) received / duration_s / 1000000. : 0.)
+            .add("reused_conn", http.conn_reused)
+            .add("success", finished && http.transfer_complete && received == opts.transfer_size && content_ok);
+    }
+}
+
+/*
+ * Segmented FTP download with an emulated round-trip time. A single data conn is capped at flow_window / rtt_ms,
+ * so the throughput should scale with the number of sessions until the loopback or the client saturates
+ */
+void benchFtpSegmented(struct mg_mgr *mgr, const BenchOptions& opts) {
+    BenchFtpServer server {mgr};
+    server.file_size = opts.transfer_size;
+    server.rtt_ms = opts.rtt_ms;
+    server.flow_window = opts.flow_window;
+    if (!server.start()) {
+        BenchReport("ftp_segmented", "ftp").add("error", "cannot start stand-in server");
+        return;
+    }
+
+    double base_mb_per_s = 0.;
+
+    for (const char *p = opts.segments.c_str(); *p;) {
+        char *end;
+        unsigned long k = strtoul(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        p = *end == ',' ? end + 1 : end;
+        if (k < 1) {
+            continue;
+        }
+
+        MongooseFtpSegmentedDownload download {mgr};
+        size_t received = 0;
+        bool content_ok = true;
+        bool closed = false;
+        bool success = false;
+        unsigned long sessions_before = server.sessions_accepted;
+
+        double t_start = bench_now_us();
+        download.getFile(server.getUrl("bench.bin").c_str(), (unsigned int) k,
+                [&received, &content_ok] (size_t offset, unsigned char *data, size_t len) {
+                    for (size_t i = 0; i < len; i++) {
+                        content_ok &= data[i] == (unsigned char) (offset + i);
+                    }
+                    received += len;
+                    return len;
+                }, [&closed, &success] (bool ok) {
+                    closed = true;
+                    success = ok;
+                });
+
+        bool finished = waitFor(mgr, opts, [&closed] () {return closed;}, [&download] () {download.loop();});
+        double duration_s = (bench_now_us() - t_start) / 1000000.;
+        double mb_per_s = duration_s > 0. ? (double) received / duration_s / 1000000. : 0.;
+        if (k == 1) {
+            base_mb_per_s = mb_per_s;
+        }
+
+        BenchReport("ftp_segmented", "ftp")
+            .add("segments_max", k)
+            .add("segments", (unsigned long) download.getSegmentCount())
+            .add("sessions", server.sessions_accepted - sessions_before) //including the SIZE / REST probe
+            .add("rtt_ms", opts.rtt_ms)
+            .add("flow_window", (unsigned long) opts.flow_window)
+            .add("bytes", (unsigned long) received)
+            .add("duration_us", duration_s * 1000000.)
+            .add("mb_per_s", mb_per_s)
+            .add("speedup", base_mb_per_s > 0. ? mb_per_s / base_mb_per_s : 0.)
+            .add("success", finished && success && received == opts.transfer_size && content_ok);
+
+        waitFor(mgr, opts, [&server] () {return server.sessions.empty();});
+    }
+}
+
+#if MO_FTP_GZIP
+
+//diagnostics-like log: timestamped lines with recurring messages and changing values
+std::string makeLog(size_t size) {
+    static const char *msgs [] = {
+        "[MO] info (WebSocket): connected to wss://csms.example.com/ocpp/cp-0042",
+        "[MO] debug (Transaction): meter value Energy.Active.Import.Register=%lu Wh",
+        "[MO] warning (Connector): connector 1 status changed to Charging",
+        "[MO] debug (Heartbeat): send Heartbeat, req id %lu",
+        "[MO] info (Firmware): download progress %lu bytes",
+    };
+    std::string log;
+    char line [160];
+    unsigned long i = 0;
+    while (log.size() < size) {
+        char msg [128];
+        snprintf(msg, sizeof(msg), msgs[(i * 7) % (sizeof(msgs) / sizeof(msgs[0]))], i * 131UL);
+        snprintf(line, sizeof(line), "2024-05-%02lu %02lu:%02lu:%02lu.%03lu %s\n",
+                1 + (i / 86400) % 28, (i / 3600) % 24, (i / 60) % 60, i % 60, (i * 37) % 1000, msg);
+        log += line;
+        i++;
+    }
+    log.resize(size);
+    return log;
+}
+
+struct GzipInput {
+    const std::string *data;
+    size_t pos;
+};
+
+size_t gzipRead(void *ctx, unsigned char *buf, size_t size) {
+    auto& in = *reinterpret_cast<GzipInput*>(ctx);
+    size_t n = std::min(size, in.data->size() - in.pos);
+    memcpy(buf, in.data->data() + in.pos, n);
+    in.pos += n;
+    return n;
+}
+
+/*
+ * gzip compression of FTP uploads. The stage alone for a few levels and windows, then the upload over the stand-in
+ * with and without compression
+ */
+void benchGzip(struct mg_mgr *mgr, const BenchOptions& opts) {
+    std::string log = makeLog(opts.transfer_size);
+
+    const int levels [] = {1, MO_FTP_GZIP_LEVEL, 9};
+    const int windows [] = {9, MO_FTP_GZIP_WINDOW_BITS, 15};
+    for (auto level : levels) {
+        for (auto window_bits : windows) {
+            MongooseFtpGzipStage stage;
+            if (!stage.init(level, window_bits, MO_FTP_GZIP_MEM_LEVEL)) {
+                BenchReport("gzip", "stage").add("error", "deflateInit failed");
+                continue;
+            }
+            GzipInput in {&log, 0};
+            unsigned char out [4096];
+            bool ok = true;
+            double t_start = bench_now_us();
+            while (!stage.isFinished()) {
+                size_t n = stage.read(out, sizeof(out), gzipRead, &in);
+                if (n > sizeof(out)) {
+                    ok = false;
+                    break;
+                }
+            }
+            double cpu_us = bench_now_us() - t_start;
+
+            BenchReport("gzip", "stage")
+                .add("level", (unsigned long) level)
+                .add("window_bits", (unsigned long) window_bits)
+                .add("mem_level", (unsigned long) MO_FTP_GZIP_MEM_LEVEL)
+                .add("bytes_in", (unsigned long) stage.bytes_in)
+                .add("bytes_out", (unsigned long) stage.bytes_out)
+                .add("ratio", stage.bytes_out > 0 ? (double) stage.bytes_in / (double) stage.bytes_out : 0.)
+                .add("cpu_us", cpu_us)
+                .add("cpu_us_per_mb", stage.bytes_in > 0 ? cpu_us * 1000000. / (double) stage.bytes_in : 0.)
+                .add("success", ok && stage.bytes_in == log.size());
+        }
+    }
+
+    BenchFtpServer server {mgr};
+    if (!server.start()) {
+        BenchReport("gzip", "ftp").add("error", "cannot start stand-in server");
+        return;
+    }
+
+    for (int compress = 0; compress <= 1; compress++) {
+        MongooseFtpClient ftp {mgr};
+        ftp.gzip_upload = compress;
+        size_t sent = 0;
+        bool closed = false;
+        size_t received_before = server.bytes_received;
+
+        double t_start = bench_now_us();
+        ftp.postFile(server.getUrl("diagnostics.log").c_str(), [&sent, &log] (unsigned char *out, size_t size) {
+                    size_t n = std::min(size, log.size() - sent);
+                    memcpy(out, log.data() + sent, n);
+                    sent += n;
+                    return n;
+                }, [&closed] () {
+                    closed = true;
+                });
+
+        bool finished = waitFor(mgr, opts, [&closed] () {return closed;}, [&ftp] () {ftp.loop();});
+        double duration_s = (bench_now_us() - t_start) / 1000000.;
+        size_t received = server.bytes_received - received_before;
+
+        BenchReport report ("gzip", compress ? "ftp_gzip" : "ftp");
+        report.add("bytes_in", (unsigned long) sent)
+            .add("bytes_on_wire", (unsigned long) received)
+            .add("ratio", received > 0 ? (double) sent / (double) received : 0.)
+            .add("duration_us", duration_s * 1000000.)
+            .add("success", finished && ftp.transfer_complete && sent == log.size());
+        if (compress && ftp.gzip) {
+            report.add("deflate_ms", ftp.gzip->cpu_ms);
+        }
+    }
+}
+
+#endif //MO_FTP_GZIP
+
+/*
+ * Load and store times of the WS configs. JSON goes through the MicroOcpp configuration store like MO_WSCONN_FN
+ * without MO_WSCONN_SNAPSHOT, the snapshot through WsConnSnapshotContainer like with it. Each store changes one
+ * value, so that neither path can skip it
+ */
+void benchSnapshot(const BenchOptions& opts) {
+    struct OCPP_FilesystemOpt fsopt;
+    fsopt.use = true;
+    fsopt.mount = true;
+    fsopt.formatFsOnFail = true;
+    auto filesystem = makeDefaultFilesystemAdapter(fsopt);
+    if (!filesystem) {
+        BenchReport("snapshot", "json").add("error", "no filesystem");
+        return;
+    }
+
+    const char *json_fn = MO_FILENAME_PREFIX "bench-conn.jsn";
+    const char *snapshot_fn = MO_FILENAME_PREFIX "bench-conn.bin";
+
+    configuration_init(filesystem);
+
+    auto backend_url = declareConfiguration<const char*>(MO_CONFIG_EXT_PREFIX "BackendUrl", "", json_fn);
+    auto cb_id = declareConfiguration<const char*>(MO_CONFIG_EXT_PREFIX "ChargeBoxId", "", json_fn);
+    auto auth_key = declareConfiguration<const char*>("AuthorizationKey", "", json_fn);
+    auto ping_interval = declareConfiguration<int>("WebSocketPingInterval", 5, json_fn);
+    auto reconnect_interval = declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "ReconnectInterval", 10, json_fn);
+    auto stale_timeout = declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "StaleTimeout", 300, json_fn);
+
+    const char *url = "wss://csms.example.com/ocpp";
+    const char *cp_id = "cp-0042";
+    std::string key_hex (40, 'a');
+
+    backend_url->setString(url);
+    cb_id->setString(cp_id);
+    auth_key->setString(key_hex.c_str());
+    reconnect_interval->setInt(10);
+    stale_timeout->setInt(300);
+
+    //not registered in the MicroOcpp configuration store. The JSON file is only the migration source and doesn't exist
+    WsConnSnapshotContainer snapshot {filesystem, MO_FILENAME_PREFIX "bench-conn-migrate.jsn", snapshot_fn};
+    snapshot.createConfiguration(TConfig::String, MO_CONFIG_EXT_PREFIX "BackendUrl")->setString(url);
+    snapshot.createConfiguration(TConfig::String, MO_CONFIG_EXT_PREFIX "ChargeBoxId")->setString(cp_id);
+    snapshot.createConfiguration(TConfig::String, "AuthorizationKey")->setString(key_hex.c_str());
+    snapshot.createConfiguration(TConfig::Int, MO_CONFIG_EXT_PREFIX "ReconnectInterval")->setInt(10);
+    snapshot.createConfiguration(TConfig::Int, MO_CONFIG_EXT_PREFIX "StaleTimeout")->setInt(300);
+    auto snapshot_ping_interval = snapshot.createConfiguration(TConfig::Int, "WebSocketPingInterval");
+
+    std::vector<double> json_store, json_load, snapshot_store, snapshot_load;
+    bool json_ok = true, snapshot_ok = true;
+
+    for (unsigned int i = 0; i < opts.iterations; i++) {
+        double t_start = bench_now_us();
+        ping_interval->setInt((int) i);
+        json_ok &= configuration_save();
+        json_store.push_back(bench_now_us() - t_start);
+
+        ping_interval->setInt(-1); //configuration_load() must restore the stored value
+        t_start = bench_now_us();
+        json_ok &= configuration_load(json_fn);
+        json_load.push_back(bench_now_us() - t_start);
+        json_ok &= ping_interval->getInt() == (int) i;
+
+        t_start = bench_now_us();
+        snapshot_ping_interval->setInt((int) i);
+        snapshot_ok &= snapshot.save();
+        snapshot_store.push_back(bench_now_us() - t_start);
+
+        snapshot_ping_interval->setInt(-1); //load() must restore the stored value
+        t_start = bench_now_us();
+        snapshot_ok &= snapshot.load();
+        snapshot_load.push_back(bench_now_us() - t_start);
+        snapshot_ok &= snapshot_ping_interval->getInt() == (int) i;
+    }
+
+    size_t json_size = 0, snapshot_size = 0;
+    filesystem->stat(json_fn, &json_size);
+    filesystem->stat(snapshot_fn, &snapshot_size);
+
+    BenchReport("snapshot_store", "json").add("file_bytes", (unsigned long) json_size).add("success", json_ok).addSamples(json_store);
+    BenchReport("snapshot_load", "json").add("file_bytes", (unsigned long) json_size).add("success", json_ok).addSamples(json_load);
+    BenchReport("snapshot_store", "snapshot").add("file_bytes", (unsigned long) snapshot_size).add("success", snapshot_ok).addSamples(snapshot_store);
+    BenchReport("snapshot_load", "snapshot").add("file_bytes", (unsigned long) snapshot_size).add("success", snapshot_ok).addSamples(snapshot_load);
+
+    filesystem->remove(json_fn);
+    removeWsConnSnapshot(*filesystem, snapshot_fn);
+    configuration_deinit(); //the WS benchmarks run without filesystem
+}
+
+bool parseArgs(int argc, char **argv, BenchOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc) {
+            return false;
+        }
+        const char *val = argv[++i];
+        if (arg == "--messages") {
+            opts.messages = (unsigned int) strtoul(val, nullptr, 10);
+        } else if (arg == "--rate-duration-ms") {
+            opts.rate_duration_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--window") {
+            opts.window = std::max(1U, (unsigned int) strtoul(val, nullptr, 10));
+        } else if (arg == "--payload") {
+            opts.payload = (size_t) strtoul(val, nullptr, 10);
+        } else if (arg == "--reconnects") {
+            opts.reconnects = (unsigned int) strtoul(val, nullptr, 10);
+        } else if (arg == "--transfer-size") {
+            opts.transfer_size = (size_t) strtoul(val, nullptr, 10);
+        } else if (arg == "--timeout-ms") {
+            opts.timeout_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--cert") {
+            opts.cert = val;
+        } else if (arg == "--key") {
+            opts.key = val;
+        } else if (arg == "--ca") {
+            opts.ca = val;
+        } else if (arg == "--tls-host") {
+            opts.tls_host = val;
+        } else if (arg == "--segments") {
+            opts.segments = val;
+        } else if (arg == "--rtt-ms") {
+            opts.rtt_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--flow-window") {
+            opts.flow_window = std::max((size_t) 1, (size_t) strtoul(val, nullptr, 10));
+        } else if (arg == "--iterations") {
+            opts.iterations = (unsigned int) strtoul(val, nullptr, 10);
+        } else if (arg == "--only") {
+            opts.only = val;
+        } else if (arg == "--out") {
+            opts.out = val;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} //end namespace
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    if (!parseArgs(argc, argv, opts)) {
+        fprintf(stderr,
+                "usage: %s [--messages N] [--rate-duration-ms MS] [--window N] [--payload BYTES] [--reconnects N]\n"
+                "          [--transfer-size BYTES] [--timeout-ms MS] [--cert PEM --key PEM [--ca PEM] [--tls-host HOST]]\n"
+                "          [--segments 1,2,4,8] [--rtt-ms MS] [--flow-window BYTES] [--iterations N]\n"
+                "          [--only ws,wss,ftp,http,segmented,gzip,snapshot] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    if (opts.out != "-") {
+        BenchReport::out = fopen(opts.out.c_str(), "w");
+        if (!BenchReport::out) {
+            fprintf(stderr, "cannot open %s\n", opts.out.c_str());
+            return 1;
+        }
+    }
+
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+
+    BenchReport("meta")
+        .add("mg_version", MG_VERSION)
+        .add("payload", (unsigned long) opts.payload)
+        .add("transfer_size", (unsigned long) opts.transfer_size);
+
+    if (selected(opts, "snapshot")) {
+        benchSnapshot(opts); //before the WS client declares its configs
+    }
+
+    if (selected(opts, "ws") || selected(opts, "wss")) {
+        //non-persistent client without filesystem. The URL is set per benchmark
+        MOcppMongooseClient client {&mgr, "", "bench-cp", nullptr, 0, opts.ca.c_str(), nullptr, ProtocolVersion(1,6), true};
+
+        //reconnect immediately and don't interfere with pings
+        declareConfiguration<int>(MO_CONFIG_EXT_PREFIX "ReconnectInterval", 10, MO_WSCONN_FN)->setInt(0);
+        declareConfiguration<int>("WebSocketPingInterval", 5, MO_WSCONN_FN)->setInt(0);
+
+        if (selected(opts, "ws")) {
+            benchWs(&mgr, opts, client, false);
+        }
+
+        if (selected(opts, "wss")) {
+            if (opts.cert.empty() || opts.key.empty()) {
+                BenchReport("ws_connect", "wss").add("skipped", "requires --cert and --key");
+            } else {
+                benchWs(&mgr, opts, client, true);
+            }
+        }
+    }
+
+    if (selected(opts, "ftp")) {
+        benchFtp(&mgr, opts);
+    }
+
+    if (selected(opts, "http")) {
+        benchHttp(&mgr, opts);
+    }
+
+    if (selected(opts, "segmented")) {
+        benchFtpSegmented(&mgr, opts);
+    }
+
+    if (selected(opts, "gzip")) {
+#if MO_FTP_GZIP
+        benchGzip(&mgr, opts);
+#else
+        BenchReport("gzip").add("skipped", "requires MO_FTP_GZIP");
+#endif
+    }
+
+    for (int i = 0; i < 10; i++) {
+        mg_mgr_poll(&mgr, 0); //let the stand-ins close their conns
+    }
+    mg_mgr_free(&mgr);
+
+    if (BenchReport::out != stdout) {
+        fclose(BenchReport::out);
+    }
+
+    return 0;
+}
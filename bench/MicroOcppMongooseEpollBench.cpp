@@ -0,0 +1,318 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Compares mg_mgr_poll with MongooseEpollPoller for 10, 1k and 10k WS connections on one mg_mgr:
+ *
+ * - epoll_idle:   CPU time of the client thread per second while all conns are idle (WS pings off)
+ * - epoll_active: echoed messages per second with one message in flight per conn, round-trip latency and CPU
+ *                 time per message
+ *
+ * The echo stand-in of BenchCsms.h runs on its own thread and its CPU time isn't counted. More than 1024 conns need
+ * a Mongoose build with MG_ENABLE_POLL=1 for both the clients and the stand-in (see CMakeLists.txt). The
+ * benchmark raises RLIMIT_NOFILE to the hard limit. Only Mongoose v7 on Linux
+ */
+
+#include "BenchCsms.h"
+#include "BenchReport.h"
+
+#include "MicroOcppMongooseClient.h"
+#include "MicroOcppMongooseEpoll.h"
+#include <MicroOcpp/Core/ConfigurationContainer.h>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if !MO_MG_EPOLL
+#error "the epoll benchmark requires MO_MG_EPOLL"
+#endif
+
+using namespace MicroOcpp;
+
+namespace {
+
+struct EpollOptions {
+    std::string conns = "10,1000,10000";
+    unsigned long connect_timeout_ms = 60000;
+    unsigned long idle_ms = 3000;
+    unsigned long active_ms = 3000;
+    int max_wait_ms = 100; //poll timeout of both backends
+    size_t payload = 64;
+    std::string out = "-";
+};
+
+double thread_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec * 1000000. + (double) ts.tv_nsec / 1000.;
+}
+
+struct EchoClient {
+    std::unique_ptr<MOcppMongooseClient> client;
+    bool kicked = false;
+    double sent_us = 0.;
+};
+
+void runBackend(const EpollOptions& opts, unsigned int n_conns, bool epoll, const std::string& url) {
+    const char *backend = epoll ? "epoll" : "mg_mgr_poll";
+    const std::string msg = "[2,\"1\",\"DataTransfer\",{\"vendorId\":\"bench\",\"data\":\"" + std::string(opts.payload, 'x') + "\"}]";
+
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+
+    {
+        MongooseEpollPoller poller {&mgr};
+        std::function<void(int)> poll = [&mgr, &poller, epoll] (int ms) {
+            if (epoll) {
+                poller.poll(ms);
+            } else {
+                mg_mgr_poll(&mgr, ms);
+            }
+        };
+
+        bool active = false;
+        unsigned long echoes = 0;
+        std::vector<double> rtt_samples;
+
+        std::vector<std::unique_ptr<EchoClient>> clients;
+        for (unsigned int i = 0; i < n_conns; i++) {
+            std::unique_ptr<EchoClient> ec {new EchoClient()};
+            std::string cb_id = "epoll-" + std::to_string(i);
+            std::shared_ptr<ConfigurationContainer> config_store = makeConfigurationContainerVolatile(MO_WSCONN_FN, false);
+            ec->client.reset(new MOcppMongooseClient(&mgr, url.c_str(), cb_id.c_str(), nullptr, 0, nullptr, nullptr,
+                    ProtocolVersion(1,6), true, config_store));
+            config_store->getConfiguration("WebSocketPingInterval")->setInt(0);
+            config_store->getConfiguration(MO_CONFIG_EXT_PREFIX "ReconnectInterval")->setInt(1);
+
+            EchoClient *ec_ptr = ec.get();
+            ReceiveTXTcallback cb = [ec_ptr, &active, &echoes, &rtt_samples, &msg] (const char *, size_t) {
+                if (!active) {
+                    return true; //stay idle
+                }
+                double now = bench_now_us();
+                rtt_samples.push_back(now - ec_ptr->sent_us);
+                echoes++;
+                ec_ptr->sent_us = now;
+                ec_ptr->client->sendTXT(msg.c_str(), msg.length());
+                return true;
+            };
+            ec->client->setReceiveTXTcallback(cb);
+            clients.push_back(std::move(ec));
+        }
+
+        auto loop = [&] () {
+            poll(opts.max_wait_ms);
+            for (auto& ec : clients) {
+                ec->client->loop();
+            }
+        };
+
+        /*
+         * connect
+         */
+        double t_start = bench_now_us();
+        unsigned int connected = 0;
+        while (connected < n_conns && bench_now_us() - t_start < opts.connect_timeout_ms * 1000.) {
+            poll(1); //don't wait for the tick during the ramp-up
+            connected = 0;
+            for (auto& ec : clients) {
+                ec->client->loop();
+                if (ec->client->isConnected()) {
+                    connected++;
+                }
+            }
+        }
+        double connect_ms = (bench_now_us() - t_start) / 1000.;
+
+        /*
+         * idle
+         */
+        unsigned long loops = 0;
+        double cpu_start = thread_cpu_us();
+        t_start = bench_now_us();
+        while (bench_now_us() - t_start < opts.idle_ms * 1000.) {
+            loop();
+            loops++;
+        }
+        double idle_s = (bench_now_us() - t_start) / 1000000.;
+        double idle_cpu_us = thread_cpu_us() - cpu_start;
+
+        BenchReport idle_report ("epoll_idle", backend);
+        idle_report
+            .add("conns", (unsigned long) n_conns)
+            .add("connected", (unsigned long) connected)
+            .add("connect_ms", connect_ms)
+            .add("cpu_ms_per_s", idle_s > 0. ? idle_cpu_us / 1000. / idle_s : 0.)
+            .add("loops_per_s", idle_s > 0. ? (double) loops / idle_s : 0.);
+        if (epoll) {
+            idle_report
+                .add("registered", poller.getStats().registered)
+                .add("spins", poller.getStats().spins)
+                .add("timeouts", poller.getStats().timeouts);
+        }
+
+        /*
+         * active
+         */
+        active = true;
+        for (auto& ec : clients) {
+            if (ec->client->isConnected()) {
+                ec->sent_us = bench_now_us();
+                ec->client->sendTXT(msg.c_str(), msg.length());
+            }
+        }
+        cpu_start = thread_cpu_us();
+        t_start = bench_now_us();
+        while (bench_now_us() - t_start < opts.active_ms * 1000.) {
+            loop();
+        }
+        double active_s = (bench_now_us() - t_start) / 1000000.;
+        double active_cpu_us = thread_cpu_us() - cpu_start;
+        active = false;
+
+        BenchReport("epoll_active", backend)
+            .add("conns", (unsigned long) n_conns)
+            .add("connected", (unsigned long) connected)
+            .add("echoes", echoes)
+            .add("msgs_per_s", active_s > 0. ? (double) echoes / active_s : 0.)
+            .add("cpu_us_per_msg", echoes > 0 ? active_cpu_us / (double) echoes : 0.)
+            .addSamples(rtt_samples);
+
+        clients.clear();
+        for (int i = 0; i < 10; i++) {
+            mg_mgr_poll(&mgr, 0); //send the close frames
+        }
+    }
+
+    mg_mgr_free(&mgr);
+}
+
+bool parseArgs(int argc, char **argv, EpollOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc) {
+            return false;
+        }
+        const char *val = argv[++i];
+        if (arg == "--conns") {
+            opts.conns = val;
+        } else if (arg == "--connect-timeout-ms") {
+            opts.connect_timeout_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--idle-ms") {
+            opts.idle_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--active-ms") {
+            opts.active_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--max-wait-ms") {
+            opts.max_wait_ms = (int) strtol(val, nullptr, 10);
+        } else if (arg == "--payload") {
+            opts.payload = (size_t) strtoul(val, nullptr, 10);
+        } else if (arg == "--out") {
+            opts.out = val;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} //end namespace
+
+int main(int argc, char **argv) {
+    EpollOptions opts;
+    if (!parseArgs(argc, argv, opts)) {
+        fprintf(stderr,
+                "usage: %s [--conns 10,1000,10000] [--connect-timeout-ms MS] [--idle-ms MS] [--active-ms MS]\n"
+                "          [--max-wait-ms MS] [--payload BYTES] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<unsigned int> conn_counts;
+    for (const char *p = opts.conns.c_str(); *p;) {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p) {
+            fprintf(stderr, "invalid --conns\n");
+            return 1;
+        }
+        if (n > 0) {
+            conn_counts.push_back((unsigned int) n);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max; //client and server side of each conn need a fd
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (opts.out != "-") {
+        BenchReport::out = fopen(opts.out.c_str(), "w");
+        if (!BenchReport::out) {
+            fprintf(stderr, "cannot open %s\n", opts.out.c_str());
+            return 1;
+        }
+    }
+
+    //echo stand-in on its own thread
+    std::atomic<bool> csms_running {true};
+    std::atomic<bool> csms_ready {false};
+    std::atomic<bool> csms_failed {false};
+    std::string url;
+    std::thread csms_thread ([&] () {
+        struct mg_mgr mgr;
+        mg_mgr_init(&mgr);
+        {
+            BenchCsms csms {&mgr};
+            if (csms.start(false)) {
+                url = csms.getUrl();
+                csms_ready = true;
+                while (csms_running) {
+                    mg_mgr_poll(&mgr, 10);
+                }
+            } else {
+                csms_failed = true;
+            }
+        }
+        mg_mgr_poll(&mgr, 0);
+        mg_mgr_free(&mgr);
+    });
+    while (!csms_ready && !csms_failed) {
+        std::this_thread::yield();
+    }
+
+    if (csms_ready) {
+        BenchReport("meta")
+            .add("mg_version", MG_VERSION)
+            .add("fd_limit", (unsigned long) (getrlimit(RLIMIT_NOFILE, &rl) == 0 ? rl.rlim_cur : 0))
+            .add("max_wait_ms", (unsigned long) opts.max_wait_ms)
+            .add("payload", (unsigned long) opts.payload);
+
+        for (auto n_conns : conn_counts) {
+            runBackend(opts, n_conns, false, url);
+            runBackend(opts, n_conns, true, url);
+        }
+    } else {
+        fprintf(stderr, "cannot start stand-in server\n");
+    }
+
+    csms_running = false;
+    csms_thread.join();
+
+    if (BenchReport::out != stdout) {
+        fclose(BenchReport::out);
+    }
+
+    return csms_ready ? 0 : 1;
+}
@@ -0,0 +1,538 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Fleet simulator. Runs many isolated MOcppMongooseClient instances in one process, each with its own charge box
+ * ID, credentials and in-memory config store. The clients are spread over a few event loops, i.e. threads with
+ * one mg_mgr each. Every client plays the same traffic profile:
+ *
+ *     # comment
+ *     on_connect BootNotification {"chargePointVendor":"bench","chargePointModel":"$id"}
+ *     every 10000 Heartbeat {}
+ *     every 60000 StatusNotification {"connectorId":1,"errorCode":"NoError","status":"Available"}
+ *
+ * $id is replaced by the charge box ID. The periodic messages start with a random phase so that the fleet
+ * doesn't send in lockstep. Without --url, the echo stand-in of BenchCsms.h runs on its own thread and returns
+ * every CALL as its response.
+ *
+ * Reports the aggregate connect rate, message throughput and latency percentiles as JSON lines (see
+ * BenchReport.h). Only Mongoose v7 is supported
+ */
+
+#include "BenchCsms.h"
+#include "BenchReport.h"
+
+#include "MicroOcppMongooseClient.h"
+#include <MicroOcpp/Core/Configuration.h>
+#include <MicroOcpp/Core/ConfigurationContainer.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(MO_MG_VERSION_614)
+#error "the fleet simulator requires Mongoose v7"
+#endif
+
+using namespace MicroOcpp;
+
+namespace {
+
+struct FleetOptions {
+    std::string url; //backend URL without charge box ID. Empty starts the local echo stand-in
+    unsigned int clients = 100;
+    unsigned int loops = 4; //threads with one mg_mgr each
+    std::string id_prefix = "fleet-";
+    std::string auth_key; //may contain $id. Empty for no Basic auth
+    std::string ca; //CA for WSS. Empty disables verification
+    double connect_rate = 50.; //new clients per second during the ramp-up
+    unsigned long duration_ms = 30000; //from the start of the ramp-up until the end of the measurement
+    std::string profile; //traffic profile file. Empty for the default profile
+    std::string out = "-";
+};
+
+struct ProfileEntry {
+    unsigned long interval_ms = 0; //0 for on_connect
+    std::string action;
+    std::string payload;
+};
+
+const char *default_profile =
+    "on_connect BootNotification {\"chargePointVendor\":\"bench\",\"chargePointModel\":\"$id\"}\n"
+    "every 10000 Heartbeat {}\n";
+
+bool parseProfile(const std::string& text, std::vector<ProfileEntry>& profile) {
+    size_t pos = 0;
+    unsigned int line_nr = 0;
+    while (pos < text.length()) {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) {
+            eol = text.length();
+        }
+        std::string line = text.substr(pos, eol - pos);
+        pos = eol + 1;
+        line_nr++;
+
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t begin = line.find_first_not_of(" \t");
+        if (begin == std::string::npos || line[begin] == '#') {
+            continue;
+        }
+        line = line.substr(begin);
+
+        ProfileEntry entry;
+        char action [64];
+        int consumed = 0;
+        if (sscanf(line.c_str(), "on_connect %63s %n", action, &consumed) >= 1 && consumed > 0) {
+            entry.interval_ms = 0;
+        } else if (sscanf(line.c_str(), "every %lu %63s %n", &entry.interval_ms, action, &consumed) >= 2 && consumed > 0 &&
+                entry.interval_ms > 0) {
+            //periodic
+        } else {
+            fprintf(stderr, "profile line %u: cannot parse \"%s\"\n", line_nr, line.c_str());
+            return false;
+        }
+        entry.action = action;
+        entry.payload = line.substr((size_t) consumed);
+        if (entry.payload.empty()) {
+            entry.payload = "{}";
+        }
+        profile.push_back(std::move(entry));
+    }
+    return true;
+}
+
+std::string replaceId(std::string str, const std::string& id) {
+    size_t pos;
+    while ((pos = str.find("$id")) != std::string::npos) {
+        str.replace(pos, 3, id);
+    }
+    return str;
+}
+
+//statistics of one event loop. Merged after the threads have finished
+struct FleetStats {
+    unsigned long clients_started = 0;
+    unsigned long clients_connected = 0; //clients which have been connected at least once
+    unsigned long connects = 0; //all established conns, including reconnects
+    unsigned long disconnects = 0;
+    unsigned long calls_sent = 0;
+    unsigned long calls_failed = 0; //sendTXT rejected the message
+    unsigned long responses = 0;
+    unsigned long call_errors = 0; //CALLERROR responses
+    unsigned long incoming_calls = 0; //CALLs initiated by the server
+    double first_connected_us = 0.;
+    double last_connected_us = 0.;
+    std::vector<double> connect_samples; //time from the first loop() until the first established conn
+    std::vector<double> latency_samples; //CALL -> response
+
+    void merge(const FleetStats& other) {
+        clients_started += other.clients_started;
+        clients_connected += other.clients_connected;
+        connects += other.connects;
+        disconnects += other.disconnects;
+        calls_sent += other.calls_sent;
+        calls_failed += other.calls_failed;
+        responses += other.responses;
+        call_errors += other.call_errors;
+        incoming_calls += other.incoming_calls;
+        if (other.clients_connected > 0) {
+            if (first_connected_us == 0. || other.first_connected_us < first_connected_us) {
+                first_connected_us = other.first_connected_us;
+            }
+            last_connected_us = std::max(last_connected_us, other.last_connected_us);
+        }
+        connect_samples.insert(connect_samples.end(), other.connect_samples.begin(), other.connect_samples.end());
+        latency_samples.insert(latency_samples.end(), other.latency_samples.begin(), other.latency_samples.end());
+    }
+};
+
+class FleetClient {
+public:
+    std::string cb_id;
+    std::string auth_key;
+    std::unique_ptr<MOcppMongooseClient> client;
+    double start_us = 0.; //when loop() is called for the first time. The deferred init then connects
+    bool started = false;
+    bool connected = false;
+    bool ever_connected = false;
+    std::vector<double> phase_us; //offset of each periodic profile entry after connecting
+    std::vector<double> next_send_us; //due time of each periodic profile entry
+    unsigned long msg_seq = 0;
+    std::map<std::string, double> pending; //message ID -> send time
+
+    FleetStats *stats {nullptr};
+    const std::vector<ProfileEntry> *profile {nullptr};
+
+    void sendCall(const ProfileEntry& entry) {
+        std::string msg_id = std::to_string(++msg_seq);
+        std::string msg = "[2,\"" + msg_id + "\",\"" + entry.action + "\"," + replaceId(entry.payload, cb_id) + "]";
+        if (!client->sendTXT(msg.c_str(), msg.length())) {
+            stats->calls_failed++;
+            return;
+        }
+        pending[msg_id] = bench_now_us();
+        stats->calls_sent++;
+    }
+
+    //[<type>,"<id>",... Returns false if the message is not an OCPP-J message
+    static bool parseHeader(const char *msg, size_t len, int& type, std::string& msg_id) {
+        size_t i = 0;
+        while (i < len && (msg[i] == '[' || msg[i] == ' ')) {
+            i++;
+        }
+        if (i >= len || msg[i] < '2' || msg[i] > '4') {
+            return false;
+        }
+        type = msg[i] - '0';
+        const char *id_begin = (const char*) memchr(msg + i, '"', len - i);
+        if (!id_begin) {
+            return false;
+        }
+        id_begin++;
+        const char *id_end = (const char*) memchr(id_begin, '"', len - (size_t) (id_begin - msg));
+        if (!id_end) {
+            return false;
+        }
+        msg_id.assign(id_begin, (size_t) (id_end - id_begin));
+        return true;
+    }
+
+    void onReceive(const char *msg, size_t len) {
+        int type;
+        std::string msg_id;
+        if (!parseHeader(msg, len, type, msg_id)) {
+            return;
+        }
+
+        auto call = pending.find(msg_id);
+        if (call != pending.end()) {
+            //CALLRESULT or CALLERROR, or the echo of the CALL by the stand-in
+            stats->latency_samples.push_back(bench_now_us() - call->second);
+            stats->responses++;
+            if (type == 4) {
+                stats->call_errors++;
+            }
+            pending.erase(call);
+        } else if (type == 2) {
+            //the simulated charger doesn't implement any server-initiated operation
+            stats->incoming_calls++;
+            std::string resp = "[4,\"" + msg_id + "\",\"NotImplemented\",\"\",{}]";
+            client->sendTXT(resp.c_str(), resp.length());
+        }
+    }
+
+    void loop(double now) {
+        if (!started) {
+            if (now < start_us) {
+                return;
+            }
+            started = true;
+            stats->clients_started++;
+        }
+
+        client->loop();
+
+        bool is_connected = client->isConnected();
+        if (is_connected && !connected) {
+            stats->connects++;
+            if (!ever_connected) {
+                ever_connected = true;
+                stats->clients_connected++;
+                stats->connect_samples.push_back(now - start_us);
+                if (stats->first_connected_us == 0.) {
+                    stats->first_connected_us = now;
+                }
+                stats->last_connected_us = now;
+            }
+            pending.clear(); //responses of the previous conn are lost
+            for (size_t i = 0; i < phase_us.size(); i++) {
+                next_send_us[i] = now + phase_us[i];
+            }
+            for (auto& entry : *profile) {
+                if (entry.interval_ms == 0) {
+                    sendCall(entry);
+                }
+            }
+        } else if (!is_connected && connected) {
+            stats->disconnects++;
+        }
+        connected = is_connected;
+
+        if (!connected) {
+            return;
+        }
+
+        for (size_t i = 0; i < profile->size(); i++) {
+            const auto& entry = (*profile)[i];
+            if (entry.interval_ms > 0 && now >= next_send_us[i]) {
+                sendCall(entry);
+                next_send_us[i] += entry.interval_ms * 1000.;
+                if (next_send_us[i] < now) {
+                    next_send_us[i] = now + entry.interval_ms * 1000.; //don't burst after a stall of the loop
+                }
+            }
+        }
+    }
+};
+
+/*
+ * One event loop with its share of the fleet
+ */
+void runLoop(const FleetOptions& opts, const std::vector<ProfileEntry>& profile, std::string backend_url,
+        unsigned int loop_index, double t_start, FleetStats& stats) {
+
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+
+    std::mt19937 rng {loop_index + 1};
+
+    std::vector<std::unique_ptr<FleetClient>> fleet;
+    for (unsigned int i = loop_index; i < opts.clients; i += opts.loops) {
+        char cb_id [64];
+        snprintf(cb_id, sizeof(cb_id), "%s%05u", opts.id_prefix.c_str(), i);
+
+        std::unique_ptr<FleetClient> fc {new FleetClient()};
+        fc->cb_id = cb_id;
+        fc->auth_key = replaceId(opts.auth_key, fc->cb_id);
+        fc->stats = &stats;
+        fc->profile = &profile;
+        fc->start_us = t_start + (opts.connect_rate > 0. ? (double) i * 1000000. / opts.connect_rate : 0.);
+
+        for (auto& entry : profile) {
+            double phase = 0.;
+            if (entry.interval_ms > 0) {
+                phase = std::uniform_real_distribution<double>(0., entry.interval_ms * 1000.)(rng);
+            }
+            fc->phase_us.push_back(phase);
+            fc->next_send_us.push_back(0.);
+        }
+
+        //each client keeps its WS configs in a private store which isn't visible to the other clients
+        std::shared_ptr<ConfigurationContainer> config_store = makeConfigurationContainerVolatile(MO_WSCONN_FN, false);
+
+        fc->client.reset(new MOcppMongooseClient(&mgr,
+                backend_url.c_str(),
+                fc->cb_id.c_str(),
+                (unsigned char*) fc->auth_key.c_str(), fc->auth_key.length(),
+                opts.ca.empty() ? nullptr : opts.ca.c_str(),
+                nullptr,
+                ProtocolVersion(1,6),
+                true,
+                config_store));
+
+        FleetClient *fc_ptr = fc.get();
+        ReceiveTXTcallback cb = [fc_ptr] (const char *msg, size_t len) {
+            fc_ptr->onReceive(msg, len);
+            return true;
+        };
+        fc->client->setReceiveTXTcallback(cb);
+
+        fleet.push_back(std::move(fc));
+    }
+
+    double t_end = t_start + opts.duration_ms * 1000.;
+    double now;
+    while ((now = bench_now_us()) < t_end) {
+        mg_mgr_poll(&mgr, 1);
+        now = bench_now_us();
+        for (auto& fc : fleet) {
+            fc->loop(now);
+        }
+    }
+
+    fleet.clear();
+    for (int i = 0; i < 10; i++) {
+        mg_mgr_poll(&mgr, 0); //send the close frames
+    }
+    mg_mgr_free(&mgr);
+}
+
+bool parseArgs(int argc, char **argv, FleetOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc) {
+            return false;
+        }
+        const char *val = argv[++i];
+        if (arg == "--url") {
+            opts.url = val;
+        } else if (arg == "--clients") {
+            opts.clients = (unsigned int) strtoul(val, nullptr, 10);
+        } else if (arg == "--loops") {
+            opts.loops = std::max(1U, (unsigned int) strtoul(val, nullptr, 10));
+        } else if (arg == "--id-prefix") {
+            opts.id_prefix = val;
+        } else if (arg == "--auth-key") {
+            opts.auth_key = val;
+        } else if (arg == "--ca") {
+            opts.ca = val;
+        } else if (arg == "--connect-rate") {
+            opts.connect_rate = strtod(val, nullptr);
+        } else if (arg == "--duration-ms") {
+            opts.duration_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--profile") {
+            opts.profile = val;
+        } else if (arg == "--out") {
+            opts.out = val;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readFile(const char *path, std::string& content) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf [1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        content.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+} //end namespace
+
+int main(int argc, char **argv) {
+    FleetOptions opts;
+    if (!parseArgs(argc, argv, opts)) {
+        fprintf(stderr,
+                "usage: %s [--url ws[s]://HOST:PORT/PATH] [--clients N] [--loops N] [--id-prefix PREFIX]\n"
+                "          [--auth-key KEY] [--ca PEM] [--connect-rate PER_S] [--duration-ms MS] [--profile FILE]\n"
+                "          [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    std::string profile_text = default_profile;
+    if (!opts.profile.empty()) {
+        profile_text.clear();
+        if (!readFile(opts.profile.c_str(), profile_text)) {
+            fprintf(stderr, "cannot open %s\n", opts.profile.c_str());
+            return 1;
+        }
+    }
+    std::vector<ProfileEntry> profile;
+    if (!parseProfile(profile_text, profile)) {
+        return 1;
+    }
+
+    if (opts.out != "-") {
+        BenchReport::out = fopen(opts.out.c_str(), "w");
+        if (!BenchReport::out) {
+            fprintf(stderr, "cannot open %s\n", opts.out.c_str());
+            return 1;
+        }
+    }
+
+    //local echo stand-in on its own thread, so that it doesn't share an event loop with the fleet
+    std::atomic<bool> csms_running {true};
+    std::atomic<bool> csms_ready {false};
+    std::atomic<bool> csms_failed {false};
+    std::string backend_url = opts.url;
+    std::thread csms_thread;
+    unsigned long csms_messages = 0;
+
+    if (backend_url.empty()) {
+        std::string csms_url;
+        csms_thread = std::thread([&] () {
+            struct mg_mgr mgr;
+            mg_mgr_init(&mgr);
+            {
+                BenchCsms csms {&mgr};
+                if (csms.start(false)) {
+                    csms_url = csms.getUrl();
+                    csms_ready = true;
+                    while (csms_running) {
+                        mg_mgr_poll(&mgr, 1);
+                    }
+                    csms_messages = csms.messages;
+                } else {
+                    csms_failed = true;
+                }
+            }
+            mg_mgr_poll(&mgr, 0);
+            mg_mgr_free(&mgr);
+        });
+        while (!csms_ready && !csms_failed) {
+            std::this_thread::yield();
+        }
+        if (csms_failed) {
+            csms_thread.join();
+            fprintf(stderr, "cannot start stand-in server\n");
+            return 1;
+        }
+        backend_url = csms_url;
+    }
+
+    BenchReport("meta")
+        .add("mg_version", MG_VERSION)
+        .add("url", backend_url.c_str())
+        .add("clients", (unsigned long) opts.clients)
+        .add("loops", (unsigned long) opts.loops)
+        .add("connect_rate", opts.connect_rate)
+        .add("duration_ms", opts.duration_ms);
+
+    std::vector<FleetStats> loop_stats (opts.loops);
+    std::vector<std::thread> threads;
+    double t_start = bench_now_us();
+    for (unsigned int i = 0; i < opts.loops; i++) {
+        threads.emplace_back(runLoop, std::cref(opts), std::cref(profile), backend_url, i, t_start, std::ref(loop_stats[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (csms_thread.joinable()) {
+        csms_running = false;
+        csms_thread.join();
+    }
+
+    FleetStats stats;
+    for (auto& s : loop_stats) {
+        stats.merge(s);
+    }
+
+    double duration_s = opts.duration_ms / 1000.;
+    double ramp_s = (stats.last_connected_us - t_start) / 1000000.;
+
+    BenchReport("fleet_connect")
+        .add("clients_started", stats.clients_started)
+        .add("clients_connected", stats.clients_connected)
+        .add("connects", stats.connects)
+        .add("disconnects", stats.disconnects)
+        .add("connects_per_s", ramp_s > 0. ? (double) stats.clients_connected / ramp_s : 0.)
+        .addSamples(stats.connect_samples);
+
+    BenchReport("fleet_messages")
+        .add("calls_sent", stats.calls_sent)
+        .add("calls_failed", stats.calls_failed)
+        .add("responses", stats.responses)
+        .add("call_errors", stats.call_errors)
+        .add("incoming_calls", stats.incoming_calls)
+        .add("unanswered", stats.calls_sent - std::min(stats.calls_sent, stats.responses))
+        .add("msgs_per_s", duration_s > 0. ? (double) stats.responses / duration_s : 0.)
+        .add("stand_in_messages", csms_messages)
+        .addSamples(stats.latency_samples);
+
+    if (BenchReport::out != stdout) {
+        fclose(BenchReport::out);
+    }
+
+    return 0;
+}
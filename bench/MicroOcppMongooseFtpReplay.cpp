@@ -0,0 +1,288 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Replays recorded FTP server transcripts through MongooseFtpReplyParser and the command FIFO of MongooseFtpClient,
+ * in the same way as the read handler of the ctrl conn. Each transcript is split into reads of 1 byte, of a few
+ * bytes, at random positions and passed as a whole, and the matched replies must be the same for every split:
+ *
+ * - login:     multi-line greeting, USER / PASS and the pipelined transfer setup
+ * - feat:      multi-line FEAT reply with REST STREAM and text lines which look like reply codes
+ * - pipelined: several replies of pipelined commands in one read, including a preliminary 150 reply
+ * - bare_lf:   line ends without CR
+ * - overflow:  the FIFO accepts MO_FTP_CMD_QUEUE commands and wraps around
+ *
+ * Prints one line per transcript and split. Returns 0 if all transcripts pass. Runs without network
+ */
+
+#include "MicroOcppMongooseFtp.h"
+#include "MicroOcppMongooseFtpReply.h"
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace MicroOcpp;
+
+namespace {
+
+typedef MongooseFtpClient::Cmd Cmd;
+
+const char *cmdName(Cmd cmd) {
+    switch (cmd) {
+        case Cmd::Greeting: return "Greeting";
+        case Cmd::AuthTls: return "AUTH TLS";
+        case Cmd::User: return "USER";
+        case Cmd::Pass: return "PASS";
+        case Cmd::Feat: return "FEAT";
+        case Cmd::Cwd: return "CWD";
+        case Cmd::Type: return "TYPE";
+        case Cmd::Pbsz: return "PBSZ";
+        case Cmd::Prot: return "PROT";
+        case Cmd::Size: return "SIZE";
+        case Cmd::Pasv: return "PASV";
+        case Cmd::Rest: return "REST";
+        case Cmd::Retr: return "RETR";
+        case Cmd::Appe: return "APPE";
+        default: return "UNDEFINED";
+    }
+}
+
+struct Transcript {
+    const char *name;
+    std::vector<Cmd> cmds; //commands which the client has sent, in order
+    std::string server; //everything the server has sent
+    std::vector<std::string> expected; //"<cmd> <code>" for each final reply, "<cmd> <code> prelim" for 1xx
+    bool expect_rest; //REST STREAM in the FEAT reply
+};
+
+struct ReplayResult {
+    std::vector<std::string> replies;
+    bool rest_supported = false;
+    bool error = false;
+};
+
+/*
+ * Passes the transcript in reads of the given sizes (repeated) to the parser. Same loop as the MG_COMPAT_EV_READ
+ * handler of ftp_ctrl_cb: parse all complete lines and keep the incomplete rest in the recv buffer
+ */
+ReplayResult replay(const Transcript& transcript, const std::vector<size_t>& read_sizes) {
+    MongooseFtpClient session {nullptr};
+    ReplayResult result;
+
+    for (auto cmd : transcript.cmds) {
+        if (!session.expectReply(cmd)) {
+            result.error = true;
+            return result;
+        }
+    }
+
+    std::string recv;
+    size_t pos = 0;
+    size_t read_index = 0;
+    while (pos < transcript.server.size()) {
+        size_t n = read_sizes[read_index++ % read_sizes.size()];
+        if (n > transcript.server.size() - pos) {
+            n = transcript.server.size() - pos;
+        }
+        recv.append(transcript.server, pos, n);
+        pos += n;
+
+        size_t offset = 0;
+        while (true) {
+            MongooseFtpReplyLine line;
+            size_t consumed = session.reply_parser.next(recv.data() + offset, recv.size() - offset, line);
+            if (consumed == 0) {
+                break;
+            }
+            offset += consumed;
+
+            if (!line.final) {
+                if (session.peekCmd() == Cmd::Feat && ftp_line_contains(line, "REST STREAM")) {
+                    result.rest_supported = true;
+                }
+                continue;
+            }
+
+            char reply [64];
+            if (line.code > 0 && line.code < 200) {
+                snprintf(reply, sizeof(reply), "%s %i prelim", cmdName(session.peekCmd()), line.code);
+            } else {
+                snprintf(reply, sizeof(reply), "%s %i", cmdName(session.popCmd()), line.code);
+            }
+            result.replies.push_back(reply);
+        }
+        recv.erase(0, offset);
+
+        if (recv.size() > MO_FTP_CTRL_LINE_MAX) {
+            result.error = true;
+            return result;
+        }
+    }
+
+    if (!recv.empty() || session.reply_parser.isInReply() || session.peekCmd() != Cmd::UNDEFINED) {
+        result.error = true; //transcript not fully consumed
+    }
+    return result;
+}
+
+bool check(const Transcript& transcript, const char *split, const std::vector<size_t>& read_sizes) {
+    auto result = replay(transcript, read_sizes);
+    bool pass = !result.error && result.replies == transcript.expected && result.rest_supported == transcript.expect_rest;
+    printf("%s %s (%s)\n", pass ? "PASS" : "FAIL", transcript.name, split);
+    if (!pass) {
+        for (size_t i = 0; i < result.replies.size() || i < transcript.expected.size(); i++) {
+            printf("    got: %-24s expected: %s\n",
+                    i < result.replies.size() ? result.replies[i].c_str() : "-",
+                    i < transcript.expected.size() ? transcript.expected[i].c_str() : "-");
+        }
+        if (result.error) {
+            printf("    transcript not consumed completely\n");
+        }
+    }
+    return pass;
+}
+
+std::vector<Transcript> makeTranscripts() {
+    std::vector<Transcript> transcripts;
+
+    transcripts.push_back({"login",
+        {Cmd::Greeting, Cmd::User, Cmd::Pass, Cmd::Cwd, Cmd::Type, Cmd::Size, Cmd::Pasv},
+        "220-Welcome to the firmware server\r\n"
+        "220-220 lines in the banner are text\r\n"
+        "220 ready\r\n"
+        "331 Password required for user\r\n"
+        "230 Logged in\r\n"
+        "250 CWD successful\r\n"
+        "200 Type set to I\r\n"
+        "213 1048576\r\n"
+        "227 Entering Passive Mode (127,0,0,1,195,80)\r\n",
+        {"Greeting 220", "USER 331", "PASS 230", "CWD 250", "TYPE 200", "SIZE 213", "PASV 227"},
+        false});
+
+    transcripts.push_back({"feat",
+        {Cmd::Size, Cmd::Feat, Cmd::Type},
+        "213 4096\r\n"
+        "211-Features:\r\n"
+        " MDTM\r\n"
+        "211-not the end\r\n"
+        " REST STREAM\r\n"
+        "211End without space is text\r\n"
+        " SIZE\r\n"
+        "211 End\r\n"
+        "200 Type set to I\r\n",
+        {"SIZE 213", "FEAT 211", "TYPE 200"},
+        true});
+
+    transcripts.push_back({"feat_without_rest",
+        {Cmd::Feat},
+        "211-Features:\r\n"
+        " SIZE\r\n"
+        " UTF8\r\n"
+        "211 End\r\n",
+        {"FEAT 211"},
+        false});
+
+    transcripts.push_back({"pipelined",
+        {Cmd::Cwd, Cmd::Type, Cmd::Pbsz, Cmd::Prot, Cmd::Pasv, Cmd::Rest, Cmd::Retr},
+        "250 ok\r\n200 Type set\r\n200 PBSZ=0\r\n200 Protection level set\r\n"
+        "227 Entering Passive Mode (10,0,0,2,4,1).\r\n350 Restarting at 512\r\n"
+        "150 Opening BINARY mode data connection\r\n226 Transfer complete\r\n",
+        {"CWD 250", "TYPE 200", "PBSZ 200", "PROT 200", "PASV 227", "REST 350", "RETR 150 prelim", "RETR 226"},
+        false});
+
+    transcripts.push_back({"bare_lf",
+        {Cmd::Greeting, Cmd::User, Cmd::Feat},
+        "220 ready\n"
+        "230 no password needed\n"
+        "211-Features:\n"
+        " REST STREAM\n"
+        "211 End\n",
+        {"Greeting 220", "USER 230", "FEAT 211"},
+        true});
+
+    transcripts.push_back({"error_replies",
+        {Cmd::Cwd, Cmd::Size, Cmd::Pasv},
+        "550 No such directory\r\n"
+        "550-File not found\r\n"
+        " detail\r\n"
+        "550 End\r\n"
+        "421 Service not available, closing control connection\r\n",
+        {"CWD 550", "SIZE 550", "PASV 421"},
+        false});
+
+    return transcripts;
+}
+
+bool checkOverflow() {
+    MongooseFtpClient session {nullptr};
+    bool pass = true;
+
+    //fill and drain the FIFO several times, so that head wraps around
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < MO_FTP_CMD_QUEUE; i++) {
+            pass &= session.expectReply((i % 2) ? Cmd::Type : Cmd::Cwd);
+        }
+        pass &= !session.expectReply(Cmd::Pasv); //full
+        for (size_t i = 0; i < MO_FTP_CMD_QUEUE / 2; i++) {
+            pass &= session.popCmd() == ((i % 2) ? Cmd::Type : Cmd::Cwd);
+        }
+        for (size_t i = 0; i < MO_FTP_CMD_QUEUE / 2; i++) {
+            pass &= session.expectReply(Cmd::Size);
+        }
+        for (size_t i = MO_FTP_CMD_QUEUE / 2; i < MO_FTP_CMD_QUEUE; i++) {
+            pass &= session.popCmd() == ((i % 2) ? Cmd::Type : Cmd::Cwd);
+        }
+        for (size_t i = 0; i < MO_FTP_CMD_QUEUE / 2; i++) {
+            pass &= session.popCmd() == Cmd::Size;
+        }
+        pass &= session.popCmd() == Cmd::UNDEFINED;
+    }
+
+    session.expectReply(Cmd::Feat);
+    session.clearCmds();
+    pass &= session.peekCmd() == Cmd::UNDEFINED;
+
+    printf("%s overflow\n", pass ? "PASS" : "FAIL");
+    return pass;
+}
+
+} //end namespace
+
+int main() {
+    bool success = true;
+
+    srand(1);
+
+    for (auto& transcript : makeTranscripts()) {
+        success &= check(transcript, "1 read", {transcript.server.size()});
+        success &= check(transcript, "1-byte reads", {1});
+        success &= check(transcript, "2-byte reads", {2});
+        success &= check(transcript, "3/5/7-byte reads", {3, 5, 7});
+
+        //split directly before and after each line end
+        for (size_t i = 0; i < transcript.server.size(); i++) {
+            if (transcript.server[i] == '\n') {
+                success &= check(transcript, "split at LF", {i, 1, transcript.server.size()});
+                success &= check(transcript, "split after LF", {i + 1, transcript.server.size()});
+                break;
+            }
+        }
+
+        for (int i = 0; i < 20; i++) {
+            std::vector<size_t> read_sizes;
+            for (int k = 0; k < 8; k++) {
+                read_sizes.push_back(1 + (size_t) rand() % 40);
+            }
+            success &= check(transcript, "random reads", read_sizes);
+        }
+    }
+
+    success &= checkOverflow();
+
+    printf("%s\n", success ? "all transcripts passed" : "FAILED");
+    return success ? 0 : 1;
+}
@@ -0,0 +1,485 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Runs network impairment scenarios against MOcppMongooseClient. The client connects to the WS stand-in of
+ * BenchCsms.h through BenchProxy.h, sends one OCPP message per send_interval and counts the echoes. A scenario
+ * is a script with timed proxy events (see bench/scenarios/), e.g.
+ *
+ *     # server disappears without FIN
+ *     duration 45000
+ *     config StaleTimeout 20
+ *     at 5000 blackhole
+ *
+ * Script commands:
+ *
+ *     name <text>
+ *     duration <ms>                      (default 30000)
+ *     send_interval <ms>                 (default 1000, 0 sends no messages)
+ *     grace <ms>                         (wait time for late echoes after the end, default 5000)
+ *     config <key> <int>                 (ReconnectInterval, StaleTimeout or WebSocketPingInterval)
+ *     at <ms> impair <up|down|both> [latency=<ms>] [jitter=<ms>] [bandwidth=<B/s>] [drop=<0..1>] [rto=<ms>]
+ *     at <ms> clear                      (remove all impairments)
+ *     at <ms> stall <on|off>
+ *     at <ms> blackhole
+ *     at <ms> reset
+ *     at <ms> refuse <on|off>
+ *     at <ms> fault                      (reference point of the detect / reconnect times)
+ *     at <ms> download <bytes>           (HTTP download through the proxy)
+ *
+ * Without explicit fault, the first stall, blackhole, reset, refuse or impair event is the reference point.
+ * Each scenario produces one JSON line with time-to-detect, time-to-reconnect and the message statistics.
+ * Only Mongoose v7 is supported
+ */
+
+#include "BenchCsms.h"
+#include "BenchProxy.h"
+#include "BenchReport.h"
+
+#include "MicroOcppMongooseClient.h"
+#include "MicroOcppMongooseHttp.h"
+#include <MicroOcpp/Core/Configuration.h>
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(MO_MG_VERSION_614)
+#error "the scenarios require Mongoose v7"
+#endif
+
+using namespace MicroOcpp;
+
+namespace {
+
+struct ScenarioEvent {
+    unsigned long at_ms = 0;
+    std::vector<std::string> args; //command and arguments
+};
+
+struct Scenario {
+    std::string name;
+    unsigned long duration_ms = 30000;
+    unsigned long send_interval_ms = 1000;
+    unsigned long grace_ms = 5000;
+    std::vector<std::pair<std::string, int>> configs;
+    std::vector<ScenarioEvent> events;
+};
+
+std::vector<std::string> splitWords(const std::string& line) {
+    std::vector<std::string> words;
+    std::istringstream ss {line};
+    std::string word;
+    while (ss >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+bool loadScenario(const char *path, Scenario& scenario) {
+    std::ifstream file {path};
+    if (!file) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+
+    scenario.name = path;
+    size_t slash = scenario.name.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        scenario.name = scenario.name.substr(slash + 1);
+    }
+    size_t dot = scenario.name.rfind('.');
+    if (dot != std::string::npos) {
+        scenario.name = scenario.name.substr(0, dot);
+    }
+
+    std::string line;
+    unsigned int line_nr = 0;
+    while (std::getline(file, line)) {
+        line_nr++;
+        auto words = splitWords(line.substr(0, line.find('#')));
+        if (words.empty()) {
+            continue;
+        }
+
+        bool valid = true;
+        if (words[0] == "name" && words.size() >= 2) {
+            scenario.name = words[1];
+        } else if (words[0] == "duration" && words.size() == 2) {
+            scenario.duration_ms = strtoul(words[1].c_str(), nullptr, 10);
+        } else if (words[0] == "send_interval" && words.size() == 2) {
+            scenario.send_interval_ms = strtoul(words[1].c_str(), nullptr, 10);
+        } else if (words[0] == "grace" && words.size() == 2) {
+            scenario.grace_ms = strtoul(words[1].c_str(), nullptr, 10);
+        } else if (words[0] == "config" && words.size() == 3) {
+            scenario.configs.emplace_back(words[1], atoi(words[2].c_str()));
+        } else if (words[0] == "at" && words.size() >= 3) {
+            ScenarioEvent event;
+            event.at_ms = strtoul(words[1].c_str(), nullptr, 10);
+            event.args.assign(words.begin() + 2, words.end());
+            scenario.events.push_back(std::move(event));
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "%s:%u: invalid line: %s\n", path, line_nr, line.c_str());
+            return false;
+        }
+    }
+
+    std::stable_sort(scenario.events.begin(), scenario.events.end(), [] (const ScenarioEvent& a, const ScenarioEvent& b) {
+        return a.at_ms < b.at_ms;
+    });
+    return true;
+}
+
+//applies "key=value" arguments to imp. Returns false on unknown keys
+bool parseImpairment(const std::vector<std::string>& args, size_t from, BenchImpairment& imp) {
+    for (size_t i = from; i < args.size(); i++) {
+        size_t eq = args[i].find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = args[i].substr(0, eq);
+        const char *val = args[i].c_str() + eq + 1;
+        if (key == "latency") {
+            imp.latency_ms = strtoul(val, nullptr, 10);
+        } else if (key == "jitter") {
+            imp.jitter_ms = strtoul(val, nullptr, 10);
+        } else if (key == "bandwidth") {
+            imp.bandwidth = (size_t) strtoul(val, nullptr, 10);
+        } else if (key == "drop") {
+            imp.drop_rate = atof(val);
+        } else if (key == "rto") {
+            imp.rto_ms = strtoul(val, nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void setWsConfig(const std::string& key, int val) {
+    std::string full_key = key;
+    if (key == "ReconnectInterval" || key == "StaleTimeout") {
+        full_key = MO_CONFIG_EXT_PREFIX + key;
+    }
+    declareConfiguration<int>(full_key.c_str(), val, MO_WSCONN_FN)->setInt(val);
+}
+
+struct Download {
+    std::unique_ptr<MongooseHttpClient> http;
+    size_t size = 0;
+    size_t received = 0;
+    bool closed = false;
+    double start_us = 0.;
+    double end_us = 0.;
+};
+
+void runScenario(struct mg_mgr *mgr, BenchCsms& csms, BenchProxy& proxy, MOcppMongooseClient& client, const Scenario& scenario) {
+
+    proxy.up = BenchImpairment();
+    proxy.down = BenchImpairment();
+    proxy.stall(false);
+    proxy.refuse(false);
+    proxy.reset();
+
+    //wait until the client has seen the reset of the previous scenario
+    double t_wait = bench_now_us();
+    while (client.isConnected() && bench_now_us() - t_wait < 5000000.) {
+        mg_mgr_poll(mgr, 1);
+        client.loop();
+    }
+
+    //connect without impairments and without waiting for the reconnect interval
+    setWsConfig("ReconnectInterval", 0);
+    client.setBackendUrl(proxy.getUrl("ws", "/ocpp").c_str());
+    client.reloadConfigs();
+
+    t_wait = bench_now_us();
+    while (!client.isConnected()) {
+        if (bench_now_us() - t_wait >= 30000000.) {
+            BenchReport("scenario").add("name", scenario.name.c_str()).add("error", "initial connect timeout");
+            return;
+        }
+        mg_mgr_poll(mgr, 1);
+        client.loop();
+    }
+
+    //defaults of MOcppMongooseClient, then the overrides of the scenario
+    setWsConfig("ReconnectInterval", 10);
+    setWsConfig("StaleTimeout", 300);
+    setWsConfig("WebSocketPingInterval", 5);
+    for (auto& config : scenario.configs) {
+        setWsConfig(config.first, config.second);
+    }
+
+    /*
+     * message tracking
+     */
+    std::map<unsigned long, double> in_flight; //message id -> send time
+    std::vector<double> rtt_samples;
+    unsigned long sent = 0, rejected = 0, echoed = 0, next_id = 0;
+
+    ReceiveTXTcallback onReceive = [&] (const char *msg, size_t len) {
+        //echo of [2,"<id>",...]
+        std::string text (msg, len);
+        unsigned long id = strtoul(text.c_str() + std::min(text.size(), (size_t) 4), nullptr, 10);
+        auto entry = in_flight.find(id);
+        if (entry != in_flight.end()) {
+            rtt_samples.push_back(bench_now_us() - entry->second);
+            in_flight.erase(entry);
+            echoed++;
+        }
+        return true;
+    };
+    client.setReceiveTXTcallback(onReceive);
+
+    std::vector<std::unique_ptr<Download>> downloads;
+
+    /*
+     * timeline
+     */
+    double t_start = bench_now_us();
+    double fault_us = -1., detect_us = -1., reconnect_us = -1.;
+    unsigned long disconnects = 0, connects = 0;
+    bool connected = true;
+    size_t next_event = 0;
+    double next_send_us = t_start;
+    const char *error = nullptr;
+
+    auto elapsed_ms = [&t_start] () {return (bench_now_us() - t_start) / 1000.;};
+
+    while (elapsed_ms() < scenario.duration_ms + scenario.grace_ms) {
+        bool grace = elapsed_ms() >= scenario.duration_ms;
+
+        while (!grace && next_event < scenario.events.size() && scenario.events[next_event].at_ms <= elapsed_ms()) {
+            auto& args = scenario.events[next_event++].args;
+            auto& cmd = args[0];
+            bool is_fault = true;
+
+            if (cmd == "impair" && args.size() >= 2) {
+                BenchImpairment imp;
+                if (!parseImpairment(args, 2, imp)) {
+                    error = "invalid impair arguments";
+                } else if (args[1] == "up") {
+                    proxy.up = imp;
+                } else if (args[1] == "down") {
+                    proxy.down = imp;
+                } else if (args[1] == "both") {
+                    proxy.up = imp;
+                    proxy.down = imp;
+                } else {
+                    error = "invalid impair direction";
+                }
+            } else if (cmd == "clear") {
+                proxy.up = BenchImpairment();
+                proxy.down = BenchImpairment();
+                is_fault = false;
+            } else if (cmd == "stall" && args.size() == 2) {
+                proxy.stall(args[1] == "on");
+                is_fault = args[1] == "on";
+            } else if (cmd == "blackhole") {
+                proxy.blackhole();
+            } else if (cmd == "reset") {
+                proxy.reset();
+            } else if (cmd == "refuse" && args.size() == 2) {
+                proxy.refuse(args[1] == "on");
+                is_fault = args[1] == "on";
+            } else if (cmd == "fault") {
+                fault_us = bench_now_us();
+            } else if (cmd == "download" && args.size() == 2) {
+                std::unique_ptr<Download> download {new Download()};
+                download->size = (size_t) strtoul(args[1].c_str(), nullptr, 10);
+                download->http.reset(new MongooseHttpClient(mgr));
+                download->start_us = bench_now_us();
+                csms.file_size = download->size;
+                auto d = download.get();
+                download->http->getFile(proxy.getUrl("http", "/file").c_str(), [d] (unsigned char*, size_t len) {
+                        d->received += len;
+                        return len;
+                    }, [d] () {
+                        d->closed = true;
+                        d->end_us = bench_now_us();
+                    });
+                downloads.push_back(std::move(download));
+                is_fault = false;
+            } else {
+                error = "unknown event";
+            }
+
+            if (is_fault && fault_us < 0.) {
+                fault_us = bench_now_us();
+            }
+        }
+
+        if (error) {
+            break;
+        }
+
+        //one message per send_interval while the scenario runs
+        if (!grace && scenario.send_interval_ms > 0 && bench_now_us() >= next_send_us) {
+            next_send_us += scenario.send_interval_ms * 1000.;
+            unsigned long id = next_id++;
+            std::string msg = "[2,\"" + std::to_string(id) + "\",\"Heartbeat\",{}]";
+            if (client.sendTXT(msg.c_str(), msg.length())) {
+                in_flight[id] = bench_now_us();
+                sent++;
+            } else {
+                rejected++; //not connected. The OCPP layer would keep the message in its queue
+            }
+        }
+
+        if (grace && in_flight.empty()) {
+            bool downloads_done = true;
+            for (auto& download : downloads) {
+                downloads_done &= download->closed;
+            }
+            if (downloads_done) {
+                break;
+            }
+        }
+
+        mg_mgr_poll(mgr, 1);
+        client.loop();
+        for (auto& download : downloads) {
+            download->http->loop();
+        }
+
+        //connection state transitions
+        if (connected != client.isConnected()) {
+            connected = client.isConnected();
+            if (connected) {
+                connects++;
+                if (fault_us >= 0. && detect_us >= 0. && reconnect_us < 0.) {
+                    reconnect_us = bench_now_us();
+                }
+            } else {
+                disconnects++;
+                if (fault_us >= 0. && detect_us < 0.) {
+                    detect_us = bench_now_us();
+                }
+            }
+        }
+    }
+
+    BenchReport report ("scenario");
+    report.add("name", scenario.name.c_str());
+    if (error) {
+        report.add("error", error);
+    }
+    report.add("fault_at_ms", fault_us >= 0. ? (fault_us - t_start) / 1000. : -1.)
+        .add("time_to_detect_ms", fault_us >= 0. && detect_us >= 0. ? (detect_us - fault_us) / 1000. : -1.)
+        .add("time_to_reconnect_ms", fault_us >= 0. && reconnect_us >= 0. ? (reconnect_us - fault_us) / 1000. : -1.)
+        .add("disconnects", disconnects)
+        .add("connects", connects)
+        .add("messages_sent", sent)
+        .add("messages_rejected", rejected)
+        .add("messages_echoed", echoed)
+        .add("messages_lost", (unsigned long) in_flight.size())
+        .add("pipes_opened", proxy.pipes_opened)
+        .add("pipes_refused", proxy.pipes_refused)
+        .add("chunks_dropped", proxy.chunks_dropped)
+        .addSamples(rtt_samples);
+
+    for (size_t i = 0; i < downloads.size(); i++) {
+        auto& download = downloads[i];
+        double duration_s = ((download->closed ? download->end_us : bench_now_us()) - download->start_us) / 1000000.;
+        BenchReport("scenario_download")
+            .add("name", scenario.name.c_str())
+            .add("index", (unsigned long) i)
+            .add("bytes", (unsigned long) download->received)
+            .add("duration_us", duration_s * 1000000.)
+            .add("kb_per_s", duration_s > 0. ? (double) download->received / duration_s / 1000. : 0.)
+            .add("retries", (unsigned long) download->http->retry_count)
+            .add("success", download->closed && download->http->transfer_complete && download->received == download->size);
+    }
+
+    ReceiveTXTcallback discard = [] (const char*, size_t) {return true;};
+    client.setReceiveTXTcallback(discard);
+}
+
+} //end namespace
+
+int main(int argc, char **argv) {
+    std::vector<std::string> paths;
+    std::string out_path = "-";
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (arg.compare(0, 2, "--")) {
+            paths.push_back(arg);
+        } else {
+            paths.clear();
+            break;
+        }
+    }
+
+    if (paths.empty()) {
+        fprintf(stderr, "usage: %s [--out FILE] SCENARIO_FILE...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<Scenario> scenarios;
+    for (auto& path : paths) {
+        Scenario scenario;
+        if (!loadScenario(path.c_str(), scenario)) {
+            return 1;
+        }
+        scenarios.push_back(std::move(scenario));
+    }
+
+    if (out_path != "-") {
+        BenchReport::out = fopen(out_path.c_str(), "w");
+        if (!BenchReport::out) {
+            fprintf(stderr, "cannot open %s\n", out_path.c_str());
+            return 1;
+        }
+    }
+
+    struct mg_mgr mgr;
+    mg_mgr_init(&mgr);
+
+    int ret = 0;
+    {
+        BenchCsms csms {&mgr};
+        BenchProxy proxy {&mgr};
+        if (!csms.start(false) || !proxy.start(("tcp://127.0.0.1:" + std::to_string(csms.port)).c_str())) {
+            fprintf(stderr, "cannot start stand-in servers\n");
+            ret = 1;
+        } else {
+            //non-persistent client without filesystem
+            MOcppMongooseClient client {&mgr, "", "bench-cp", nullptr, 0, "", nullptr, ProtocolVersion(1,6), true};
+
+            for (auto& scenario : scenarios) {
+                runScenario(&mgr, csms, proxy, client, scenario);
+            }
+
+            client.setBackendUrl("");
+            client.reloadConfigs();
+            for (int i = 0; i < 10; i++) {
+                mg_mgr_poll(&mgr, 0);
+            }
+        }
+    }
+
+    for (int i = 0; i < 10; i++) {
+        mg_mgr_poll(&mgr, 0); //let the stand-ins close their conns
+    }
+    mg_mgr_free(&mgr);
+
+    if (BenchReport::out != stdout) {
+        fclose(BenchReport::out);
+    }
+
+    return ret;
+}
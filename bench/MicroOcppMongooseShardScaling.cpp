@@ -0,0 +1,337 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Scaling benchmark of MongooseShardedRuntime. Runs the same client population on 1, 2, 4, ... 32 shards and
+ * measures for each shard count:
+ *
+ * - shard_connect: time until all clients are connected and connects per second
+ * - shard_echo:    echoed messages per second with one message in flight per client, and the round-trip latency
+ * - shard_balance: distribution of the clients and the busy ratio over the shards
+ *
+ * The echo stand-ins of BenchCsms.h run on --servers threads of their own. With many shards, the stand-ins can
+ * become the bottleneck. Then increase --servers or use an external echo server with --url. Shard counts above the
+ * number of cores are measured as well and marked as oversubscribed. Only Mongoose v7 is supported
+ */
+
+#include "BenchCsms.h"
+#include "BenchReport.h"
+
+#include "MicroOcppMongooseShards.h"
+#include <MicroOcpp/Core/ConfigurationContainer.h>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(MO_MG_VERSION_614)
+#error "the shard scaling benchmark requires Mongoose v7"
+#endif
+
+#if !MO_MG_SHARDS
+#error "the shard scaling benchmark requires MO_MG_SHARDS"
+#endif
+
+using namespace MicroOcpp;
+
+namespace {
+
+struct ScalingOptions {
+    std::string shards = "1,2,4,8,16,32"; //shard counts to measure
+    unsigned int clients = 2000;
+    unsigned int servers = 4; //echo stand-in threads. Ignored with --url
+    std::string url; //external echo server
+    unsigned long connect_timeout_ms = 30000;
+    unsigned long duration_ms = 5000; //echo measurement period
+    size_t payload = 64;
+    bool pin = true;
+    std::string out = "-";
+};
+
+//per-client state. Only accessed on the shard thread of the client, or after the runtime has stopped
+struct ScaleClient {
+    double added_us = 0.;
+    double connected_us = 0.;
+    bool kicked = false; //connected and the first message has been sent
+    double sent_us = 0.;
+    unsigned long echoes = 0;
+    std::vector<double> rtt_samples;
+};
+
+std::atomic<bool> measuring {false};
+std::atomic<unsigned long> connected_count {0};
+
+std::string makeMsg(const ScalingOptions& opts) {
+    return "[2,\"1\",\"DataTransfer\",{\"vendorId\":\"bench\",\"data\":\"" + std::string(opts.payload, 'x') + "\"}]";
+}
+
+void runShardCount(const ScalingOptions& opts, unsigned int n_shards, const std::vector<std::string>& urls) {
+    const std::string msg = makeMsg(opts);
+
+    connected_count = 0;
+    measuring = false;
+
+    std::vector<std::unique_ptr<ScaleClient>> states;
+    for (unsigned int i = 0; i < opts.clients; i++) {
+        states.emplace_back(new ScaleClient());
+    }
+
+    std::vector<MongooseShardedRuntime::ClientId> ids;
+
+    double t_start;
+    double t_all_connected = 0.;
+    std::vector<MongooseShardMetrics> metrics;
+    double duration_s = 0.;
+
+    {
+        MongooseShardedRuntime runtime {n_shards, opts.pin};
+        runtime.start();
+
+        t_start = bench_now_us();
+
+        for (unsigned int i = 0; i < opts.clients; i++) {
+            ScaleClient *state = states[i].get();
+            state->added_us = bench_now_us();
+            std::string backend_url = urls[i % urls.size()];
+            std::string cb_id = "shard-" + std::to_string(i);
+
+            ids.push_back(runtime.addClient([state, backend_url, cb_id, &msg] (struct mg_mgr *mgr) {
+                std::shared_ptr<ConfigurationContainer> config_store = makeConfigurationContainerVolatile(MO_WSCONN_FN, false);
+                std::unique_ptr<MOcppMongooseClient> client {new MOcppMongooseClient(mgr,
+                        backend_url.c_str(), cb_id.c_str(), nullptr, 0, nullptr, nullptr, ProtocolVersion(1,6), true, config_store)};
+
+                MOcppMongooseClient *client_ptr = client.get();
+                ReceiveTXTcallback cb = [state, client_ptr, &msg] (const char *, size_t) {
+                    double now = bench_now_us();
+                    if (measuring) {
+                        state->rtt_samples.push_back(now - state->sent_us);
+                        state->echoes++;
+                    }
+                    state->sent_us = now;
+                    client_ptr->sendTXT(msg.c_str(), msg.length());
+                    return true;
+                };
+                client->setReceiveTXTcallback(cb);
+                return client;
+            }));
+        }
+
+        //kick off each client once it is connected
+        while (connected_count < opts.clients && bench_now_us() - t_start < opts.connect_timeout_ms * 1000.) {
+            for (unsigned int i = 0; i < opts.clients; i++) {
+                ScaleClient *state = states[i].get();
+                runtime.post(ids[i], [state, &msg] (MOcppMongooseClient& client) {
+                    if (!state->kicked && client.isConnected()) {
+                        state->kicked = true;
+                        state->connected_us = bench_now_us();
+                        state->sent_us = state->connected_us;
+                        client.sendTXT(msg.c_str(), msg.length());
+                        connected_count++;
+                    }
+                });
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        t_all_connected = bench_now_us();
+
+        double t_measure = bench_now_us();
+        measuring = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(opts.duration_ms));
+        measuring = false;
+        duration_s = (bench_now_us() - t_measure) / 1000000.;
+
+        for (unsigned int i = 0; i < runtime.getShardCount(); i++) {
+            metrics.push_back(runtime.getMetrics(i));
+        }
+
+        runtime.stop();
+    } //destroys the clients
+
+    std::vector<double> connect_samples;
+    std::vector<double> rtt_samples;
+    unsigned long echoes = 0;
+    for (auto& state : states) {
+        if (state->kicked) {
+            connect_samples.push_back(state->connected_us - state->added_us);
+        }
+        echoes += state->echoes;
+        rtt_samples.insert(rtt_samples.end(), state->rtt_samples.begin(), state->rtt_samples.end());
+    }
+
+    bool oversubscribed = n_shards > std::thread::hardware_concurrency();
+    double connect_s = (t_all_connected - t_start) / 1000000.;
+
+    BenchReport("shard_connect")
+        .add("shards", (unsigned long) n_shards)
+        .add("oversubscribed", oversubscribed)
+        .add("clients", (unsigned long) opts.clients)
+        .add("connected", (unsigned long) connected_count)
+        .add("connect_all_ms", connect_s * 1000.)
+        .add("connects_per_s", connect_s > 0. ? (double) connected_count / connect_s : 0.)
+        .addSamples(connect_samples);
+
+    BenchReport("shard_echo")
+        .add("shards", (unsigned long) n_shards)
+        .add("oversubscribed", oversubscribed)
+        .add("echoes", echoes)
+        .add("msgs_per_s", duration_s > 0. ? (double) echoes / duration_s : 0.)
+        .addSamples(rtt_samples);
+
+    unsigned long clients_min = -1UL, clients_max = 0;
+    double busy_sum = 0., busy_max = 0., poll_us_max = 0.;
+    for (auto& m : metrics) {
+        clients_min = std::min(clients_min, m.clients);
+        clients_max = std::max(clients_max, m.clients);
+        busy_sum += m.busy_ratio;
+        busy_max = std::max(busy_max, m.busy_ratio);
+        poll_us_max = std::max(poll_us_max, m.poll_us_max);
+    }
+
+    BenchReport("shard_balance")
+        .add("shards", (unsigned long) n_shards)
+        .add("pinned", !metrics.empty() && metrics.front().cpu >= 0)
+        .add("clients_min", metrics.empty() ? 0UL : clients_min)
+        .add("clients_max", clients_max)
+        .add("busy_ratio_avg", metrics.empty() ? 0. : busy_sum / (double) metrics.size())
+        .add("busy_ratio_max", busy_max)
+        .add("poll_us_max", poll_us_max);
+}
+
+bool parseArgs(int argc, char **argv, ScalingOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc) {
+            return false;
+        }
+        const char *val = argv[++i];
+        if (arg == "--shards") {
+            opts.shards = val;
+        } else if (arg == "--clients") {
+            opts.clients = std::max(1U, (unsigned int) strtoul(val, nullptr, 10));
+        } else if (arg == "--servers") {
+            opts.servers = std::max(1U, (unsigned int) strtoul(val, nullptr, 10));
+        } else if (arg == "--url") {
+            opts.url = val;
+        } else if (arg == "--connect-timeout-ms") {
+            opts.connect_timeout_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--duration-ms") {
+            opts.duration_ms = strtoul(val, nullptr, 10);
+        } else if (arg == "--payload") {
+            opts.payload = (size_t) strtoul(val, nullptr, 10);
+        } else if (arg == "--pin") {
+            opts.pin = strcmp(val, "0") != 0;
+        } else if (arg == "--out") {
+            opts.out = val;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} //end namespace
+
+int main(int argc, char **argv) {
+    ScalingOptions opts;
+    if (!parseArgs(argc, argv, opts)) {
+        fprintf(stderr,
+                "usage: %s [--shards 1,2,4,8,16,32] [--clients N] [--servers N | --url ws://HOST:PORT/PATH]\n"
+                "          [--connect-timeout-ms MS] [--duration-ms MS] [--payload BYTES] [--pin 0|1] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<unsigned int> shard_counts;
+    for (const char *p = opts.shards.c_str(); *p;) {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p) {
+            fprintf(stderr, "invalid --shards\n");
+            return 1;
+        }
+        if (n > 0) {
+            shard_counts.push_back((unsigned int) n);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (opts.out != "-") {
+        BenchReport::out = fopen(opts.out.c_str(), "w");
+        if (!BenchReport::out) {
+            fprintf(stderr, "cannot open %s\n", opts.out.c_str());
+            return 1;
+        }
+    }
+
+    //echo stand-ins on their own threads
+    std::atomic<bool> servers_running {true};
+    std::vector<std::thread> server_threads;
+    std::vector<std::string> urls;
+
+    if (!opts.url.empty()) {
+        urls.push_back(opts.url);
+    } else {
+        std::vector<std::string> server_urls (opts.servers);
+        std::atomic<unsigned int> servers_ready {0};
+        std::atomic<bool> servers_failed {false};
+        for (unsigned int i = 0; i < opts.servers; i++) {
+            server_threads.emplace_back([&, i] () {
+                struct mg_mgr mgr;
+                mg_mgr_init(&mgr);
+                {
+                    BenchCsms csms {&mgr};
+                    if (csms.start(false)) {
+                        server_urls[i] = csms.getUrl();
+                        servers_ready++;
+                        while (servers_running) {
+                            mg_mgr_poll(&mgr, 1);
+                        }
+                    } else {
+                        servers_failed = true;
+                    }
+                }
+                mg_mgr_poll(&mgr, 0);
+                mg_mgr_free(&mgr);
+            });
+        }
+        while (servers_ready < opts.servers && !servers_failed) {
+            std::this_thread::yield();
+        }
+        urls = server_urls;
+        if (servers_failed) {
+            fprintf(stderr, "cannot start stand-in server\n");
+            urls.clear();
+        }
+    }
+
+    if (!urls.empty()) {
+        BenchReport("meta")
+            .add("mg_version", MG_VERSION)
+            .add("cores", (unsigned long) std::thread::hardware_concurrency())
+            .add("clients", (unsigned long) opts.clients)
+            .add("servers", (unsigned long) (opts.url.empty() ? opts.servers : 0))
+            .add("payload", (unsigned long) opts.payload);
+
+        for (auto n_shards : shard_counts) {
+            runShardCount(opts, n_shards, urls);
+        }
+    }
+
+    servers_running = false;
+    for (auto& thread : server_threads) {
+        thread.join();
+    }
+
+    if (BenchReport::out != stdout) {
+        fclose(BenchReport::out);
+    }
+
+    return urls.empty() ? 1 : 0;
+}
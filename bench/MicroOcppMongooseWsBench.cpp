@@ -0,0 +1,300 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+/*
+ * Microbenchmark of the WS payload kernels of MicroOcppMongooseWs.h for message sizes from 64 B to 1 MB:
+ *
+ * - ws_mask:  GB/s of ws_mask_copy for each kernel which the CPU supports (transport = kernel)
+ * - ws_frame: GB/s of building a masked client frame in the send buffer with mg_ws_send and with ws_send_masked
+ * - ws_utf8:  GB/s and ns per message of ws_utf8_valid for each kernel, for ASCII-only OCPP messages and for
+ *             messages with multi-byte characters, and the time relative to copying the message with memcpy
+ *
+ * The frames are built on a detached client conn without socket; the send buffer is reset after each frame.
+ * Runs without network. ws_frame only with Mongoose v7
+ */
+
+#include "BenchReport.h"
+
+#include "MicroOcppMongooseWs.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace MicroOcpp;
+
+namespace {
+
+struct WsBenchOptions {
+    std::string sizes = "64,256,1024,4096,16384,65536,262144,1048576";
+    double min_ms = 200.; //measurement time per size and kernel
+    std::string out = "-";
+};
+
+volatile size_t sink; //keeps the results alive
+
+double now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//runs fn until min_ms have passed and returns the GB/s of bytes per run
+double measure(const WsBenchOptions& opts, size_t bytes, std::function<size_t()> fn) {
+    unsigned long runs = 0;
+    unsigned long batch = 1;
+    double t_start = now_us();
+    double elapsed_us = 0.;
+    do {
+        for (unsigned long i = 0; i < batch; i++) {
+            sink = fn();
+        }
+        runs += batch;
+        batch *= 2;
+        elapsed_us = now_us() - t_start;
+    } while (elapsed_us < opts.min_ms * 1000.);
+
+    return (double) bytes * (double) runs / (elapsed_us * 1000.);
+}
+
+bool checkMask(int kernel) {
+    const unsigned char key [4] = {0x12, 0x34, 0x56, 0x78};
+    std::vector<unsigned char> src (300), dst (300);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = (unsigned char) rand();
+    }
+    for (size_t len = 0; len <= src.size(); len++) {
+        ws_mask_copy(dst.data(), src.data(), len, key);
+        for (size_t i = 0; i < len; i++) {
+            if (dst[i] != (src[i] ^ key[i % 4])) {
+                fprintf(stderr, "kernel %s: wrong result for %zu bytes\n", ws_kernel_name(kernel), len);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool runMask(const WsBenchOptions& opts, const std::vector<size_t>& sizes) {
+    int default_kernel = ws_mask_kernel();
+    bool success = true;
+
+    for (int kernel = MO_WS_KERNEL_BYTE; kernel <= MO_WS_KERNEL_NEON; kernel++) {
+        if (!ws_mask_use_kernel(kernel)) {
+            continue;
+        }
+        if (!checkMask(kernel)) {
+            success = false;
+            continue;
+        }
+        for (auto size : sizes) {
+            std::vector<unsigned char> src (size, 'x'), dst (size);
+            const unsigned char key [4] = {0x12, 0x34, 0x56, 0x78};
+            double gbps = measure(opts, size, [&] () {
+                ws_mask_copy(dst.data(), src.data(), size, key);
+                return (size_t) dst[size - 1];
+            });
+            BenchReport("ws_mask", ws_kernel_name(kernel))
+                .add("size", (unsigned long) size)
+                .add("gb_per_s", gbps);
+        }
+    }
+
+    ws_mask_use_kernel(default_kernel);
+    return success;
+}
+
+//OCPP-like message of at least size bytes. With multibyte, the strings contain 2-, 3- and 4-byte characters
+std::string makeText(size_t size, bool multibyte) {
+    const char *ascii = "[2,\"1\",\"DataTransfer\",{\"vendorId\":\"bench\",\"data\":\"Charging station 01\"}]";
+    const char *utf8 = "[2,\"1\",\"DataTransfer\",{\"vendorId\":\"bench\",\"data\":\"Lades\xC3\xA4ule \xE6\x9D\xB1\xE4\xBA\xAC \xF0\x9F\x9A\x97\"}]";
+    std::string text;
+    while (text.size() < size) {
+        text += multibyte ? utf8 : ascii;
+    }
+    return text;
+}
+
+bool runUtf8(const WsBenchOptions& opts, const std::vector<size_t>& sizes) {
+    int default_kernel = ws_utf8_kernel();
+    bool success = true;
+
+    for (int multibyte = 0; multibyte <= 1; multibyte++) {
+        for (auto size : sizes) {
+            std::string text = makeText(size, multibyte);
+            std::string invalid = text;
+            invalid[invalid.size() / 2] = (char) 0xC0; //overlong lead byte
+
+            std::vector<char> copy (text.size());
+            double copy_gbps = measure(opts, text.size(), [&] () {
+                memcpy(copy.data(), text.data(), text.size());
+                return (size_t) copy[text.size() - 1];
+            });
+
+            for (int kernel = MO_WS_KERNEL_BYTE; kernel <= MO_WS_KERNEL_NEON; kernel++) {
+                if (!ws_utf8_use_kernel(kernel)) {
+                    continue;
+                }
+                if (!ws_utf8_valid((const unsigned char*) text.data(), text.size()) ||
+                        ws_utf8_valid((const unsigned char*) invalid.data(), invalid.size())) {
+                    fprintf(stderr, "kernel %s: wrong result for %zu bytes\n", ws_kernel_name(kernel), text.size());
+                    success = false;
+                    continue;
+                }
+
+                double gbps = measure(opts, text.size(), [&] () {
+                    return (size_t) ws_utf8_valid((const unsigned char*) text.data(), text.size());
+                });
+
+                BenchReport("ws_utf8", ws_kernel_name(kernel))
+                    .add("size", (unsigned long) text.size())
+                    .add("text", multibyte ? "multibyte" : "ascii")
+                    .add("gb_per_s", gbps)
+                    .add("ns_per_msg", gbps > 0. ? (double) text.size() / gbps : 0.)
+                    .add("vs_memcpy", gbps > 0. ? copy_gbps / gbps : 0.);
+            }
+        }
+    }
+
+    ws_utf8_use_kernel(default_kernel);
+    return success;
+}
+
+#if !defined(MO_MG_VERSION_614)
+
+//unmasks the frame in the send buffer and compares it with msg
+bool checkFrame(struct mg_connection *c, const std::string& msg) {
+    const unsigned char *p = c->send.buf;
+    size_t hdr_len = (p[1] & 0x7F) == 127 ? 14 : (p[1] & 0x7F) == 126 ? 8 : 6;
+    if (c->send.len != hdr_len + msg.size() || p[0] != (0x80 | WEBSOCKET_OP_TEXT) || !(p[1] & 0x80)) {
+        return false;
+    }
+    const unsigned char *key = p + hdr_len - 4;
+    for (size_t i = 0; i < msg.size(); i++) {
+        if ((p[hdr_len + i] ^ key[i % 4]) != (unsigned char) msg[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool runFrame(const WsBenchOptions& opts, const std::vector<size_t>& sizes) {
+    struct mg_connection c;
+    memset(&c, 0, sizeof(c));
+    c.is_client = 1;
+    c.is_websocket = 1;
+
+    bool success = true;
+
+    for (auto size : sizes) {
+        std::string msg (size, 'x');
+
+        ws_send_masked(&c, msg.data(), msg.size(), WEBSOCKET_OP_TEXT);
+        bool valid = checkFrame(&c, msg);
+        c.send.len = 0;
+        mg_ws_send(&c, msg.data(), msg.size(), WEBSOCKET_OP_TEXT);
+        valid &= checkFrame(&c, msg);
+        c.send.len = 0;
+        if (!valid) {
+            fprintf(stderr, "invalid frame for %zu bytes\n", size);
+            success = false;
+            continue;
+        }
+
+        double mg_gbps = measure(opts, size, [&] () {
+            size_t n = mg_ws_send(&c, msg.data(), msg.size(), WEBSOCKET_OP_TEXT);
+            c.send.len = 0;
+            return n;
+        });
+        double mo_gbps = measure(opts, size, [&] () {
+            size_t n = ws_send_masked(&c, msg.data(), msg.size(), WEBSOCKET_OP_TEXT);
+            c.send.len = 0;
+            return n;
+        });
+
+        BenchReport("ws_frame", "mg_ws_send")
+            .add("size", (unsigned long) size)
+            .add("gb_per_s", mg_gbps);
+        BenchReport("ws_frame", "ws_send_masked")
+            .add("size", (unsigned long) size)
+            .add("kernel", ws_kernel_name(ws_mask_kernel()))
+            .add("gb_per_s", mo_gbps);
+    }
+
+    mg_iobuf_free(&c.send);
+    return success;
+}
+
+#endif //!MO_MG_VERSION_614
+
+bool parseArgs(int argc, char **argv, WsBenchOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc) {
+            return false;
+        }
+        const char *val = argv[++i];
+        if (arg == "--sizes") {
+            opts.sizes = val;
+        } else if (arg == "--min-ms") {
+            opts.min_ms = strtod(val, nullptr);
+        } else if (arg == "--out") {
+            opts.out = val;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} //end namespace
+
+int main(int argc, char **argv) {
+    WsBenchOptions opts;
+    if (!parseArgs(argc, argv, opts)) {
+        fprintf(stderr, "usage: %s [--sizes 64,256,...,1048576] [--min-ms MS] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<size_t> sizes;
+    for (const char *p = opts.sizes.c_str(); *p;) {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p) {
+            fprintf(stderr, "invalid --sizes\n");
+            return 1;
+        }
+        if (n > 0) {
+            sizes.push_back((size_t) n);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (opts.out != "-") {
+        BenchReport::out = fopen(opts.out.c_str(), "w");
+        if (!BenchReport::out) {
+            fprintf(stderr, "cannot open %s\n", opts.out.c_str());
+            return 1;
+        }
+    }
+
+    BenchReport("meta")
+        .add("mg_version", MG_VERSION)
+        .add("mask_kernel", ws_kernel_name(ws_mask_kernel()))
+        .add("utf8_kernel", ws_kernel_name(ws_utf8_kernel()));
+
+    bool success = runMask(opts, sizes);
+    success &= runUtf8(opts, sizes);
+#if !defined(MO_MG_VERSION_614)
+    success &= runFrame(opts, sizes);
+#endif
+
+    if (BenchReport::out != stdout) {
+        fclose(BenchReport::out);
+    }
+
+    return success ? 0 : 1;
+}
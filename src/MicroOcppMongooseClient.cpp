@@ -3,7 +3,12 @@
 // GPL-3.0 License (see LICENSE)
 
 #include "MicroOcppMongooseClient.h"
+#include "MicroOcppMongooseSnapshot.h"
+#include "MicroOcppMongooseTls.h"
+#include "MicroOcppMongooseWs.h"
 #include <MicroOcpp/Core/Configuration.h>
+#include <MicroOcpp/Core/ConfigurationContainer.h>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
 #include <MicroOcpp/Debug.h>
 
 #define DEBUG_MSG_INTERVAL 5000UL
@@ -27,13 +32,26 @@ MOcppMongooseClient::MOcppMongooseClient(struct mg_mgr *mgr,
             unsigned char *auth_key_factory, size_t auth_key_factory_len,
             const char *ca_certificate,
             std::shared_ptr<FilesystemAdapter> filesystem,
-            ProtocolVersion protocolVersion) : mgr(mgr), protocolVersion(protocolVersion) {
-    
+            ProtocolVersion protocolVersion,
+            bool deferred_init,
+            std::shared_ptr<ConfigurationContainer> config_store) : mgr(mgr), protocolVersion(protocolVersion), config_store(config_store) {
+
+    boot_start = mocpp_tick_ms();
+
     bool readonly;
     
-    if (filesystem) {
+    if (config_store) {
+        //isolated client. The WS configs stay in RAM and don't touch the global configuration registry
+        MO_DBG_DEBUG("WS configs in private store");
+        readonly = false;
+    } else if (filesystem) {
         configuration_init(filesystem);
 
+#if MO_WSCONN_SNAPSHOT
+        //the WS configs are declared in this container and stored as snapshot instead of JSON
+        addConfigurationContainer(std::make_shared<WsConnSnapshotContainer>(filesystem, MO_WSCONN_FN));
+#endif
+
         //all credentials are persistent over reboots
         readonly = false;
     } else {
@@ -42,10 +60,10 @@ MOcppMongooseClient::MOcppMongooseClient(struct mg_mgr *mgr,
         readonly = true;
     }
 
-    setting_backend_url_str = declareConfiguration<const char*>(
-        MO_CONFIG_EXT_PREFIX "BackendUrl", backend_url_factory, MO_WSCONN_FN, readonly, true);
-    setting_cb_id_str = declareConfiguration<const char*>(
-        MO_CONFIG_EXT_PREFIX "ChargeBoxId", charge_box_id_factory, MO_WSCONN_FN, readonly, true);
+    setting_backend_url_str = declareWsConfig(
+        MO_CONFIG_EXT_PREFIX "BackendUrl", backend_url_factory, readonly);
+    setting_cb_id_str = declareWsConfig(
+        MO_CONFIG_EXT_PREFIX "ChargeBoxId", charge_box_id_factory, readonly);
     
     if (auth_key_factory_len > MO_AUTHKEY_LEN_MAX) {
         MO_DBG_WARN("auth_key_factory too long - will be cropped");
@@ -54,26 +72,24 @@ MOcppMongooseClient::MOcppMongooseClient(struct mg_mgr *mgr,
     char auth_key_hex [2 * MO_AUTHKEY_LEN_MAX + 1];
     auth_key_hex[0] = '\0';
     if (auth_key_factory) {
-        for (size_t i = 0; i < auth_key_factory_len; i += 2) {
+        for (size_t i = 0; i < auth_key_factory_len; i++) {
             snprintf(auth_key_hex + 2 * i, 3, "%02X", auth_key_factory[i]);
         }
     }
-    setting_auth_key_hex_str = declareConfiguration<const char*>(
-        "AuthorizationKey", auth_key_hex, MO_WSCONN_FN, readonly, true);
-    registerConfigurationValidator("AuthorizationKey", validateAuthorizationKeyHex);
-
-    ws_ping_interval_int = declareConfiguration<int>(
-        "WebSocketPingInterval", 5, MO_WSCONN_FN);
-    reconnect_interval_int = declareConfiguration<int>(
-        MO_CONFIG_EXT_PREFIX "ReconnectInterval", 10, MO_WSCONN_FN);
-    stale_timeout_int = declareConfiguration<int>(
-        MO_CONFIG_EXT_PREFIX "StaleTimeout", 300, MO_WSCONN_FN);
-
-    configuration_load(MO_WSCONN_FN); //load configs with values stored on flash
+    setting_auth_key_hex_str = declareWsConfig(
+        "AuthorizationKey", auth_key_hex, readonly);
+    if (!config_store) {
+        registerConfigurationValidator("AuthorizationKey", validateAuthorizationKeyHex);
+    } //else: the private store is only written by the setters, which validate the key themselves
 
-    ca_cert = ca_certificate;
+    ws_ping_interval_int = declareWsConfig(
+        "WebSocketPingInterval", 5);
+    reconnect_interval_int = declareWsConfig(
+        MO_CONFIG_EXT_PREFIX "ReconnectInterval", 10);
+    stale_timeout_int = declareWsConfig(
+        MO_CONFIG_EXT_PREFIX "StaleTimeout", 300);
 
-    reloadConfigs(); //load WS creds with configs values
+    setCaCert(ca_certificate);
 
 #if defined(MO_MG_VERSION_614)
     MO_DBG_DEBUG("use MG version %s (tested with 6.14)", MG_VERSION);
@@ -81,7 +97,14 @@ MOcppMongooseClient::MOcppMongooseClient(struct mg_mgr *mgr,
     MO_DBG_DEBUG("use MG version %s (tested with 7.8)", MG_VERSION);
 #endif
 
-    maintainWsConn();
+    if (deferred_init) {
+        MO_DBG_DEBUG("defer loading WS configs to loop()");
+    } else {
+        loadConfigs();
+        maintainWsConn();
+    }
+
+    boot_timings.construct_ms = mocpp_tick_ms() - boot_start;
 }
 
 MOcppMongooseClient::MOcppMongooseClient(struct mg_mgr *mgr,
@@ -116,9 +139,72 @@ MOcppMongooseClient::~MOcppMongooseClient() {
 }
 
 void MOcppMongooseClient::loop() {
+    if (!configs_loaded) {
+        //deferred init: load configs in this loop() call and connect in the next one
+        loadConfigs();
+        return;
+    }
+
     maintainWsConn();
 }
 
+void MOcppMongooseClient::loadConfigs() {
+    auto t_start = mocpp_tick_ms();
+
+    if (config_store) {
+        //private store has no file. Nothing to load
+    } else {
+        configuration_load(MO_WSCONN_FN); //load configs with values stored on flash
+    }
+    configs_loaded = true;
+
+    boot_timings.config_load_ms = mocpp_tick_ms() - t_start;
+
+    reloadConfigs(); //load WS creds with configs values
+}
+
+bool MOcppMongooseClient::saveConfigs() {
+    if (config_store) {
+        return true; //private store is volatile
+    }
+
+    return configuration_save();
+}
+
+std::shared_ptr<Configuration> MOcppMongooseClient::declareWsConfig(const char *key, const char *factory_default, bool readonly) {
+    if (!config_store) {
+        return declareConfiguration<const char*>(key, factory_default, MO_WSCONN_FN, readonly, true);
+    }
+
+    auto config = config_store->getConfiguration(key);
+    if (!config) {
+        config = config_store->createConfiguration(TConfig::String, key);
+        if (!config) {
+            MO_DBG_ERR("OOM");
+            return nullptr;
+        }
+        config->setString(factory_default ? factory_default : "");
+    }
+    return config;
+}
+
+std::shared_ptr<Configuration> MOcppMongooseClient::declareWsConfig(const char *key, int factory_default) {
+    if (!config_store) {
+        return declareConfiguration<int>(key, factory_default, MO_WSCONN_FN);
+    }
+
+    auto config = config_store->getConfiguration(key);
+    if (!config) {
+        config = config_store->createConfiguration(TConfig::Int, key);
+        if (!config) {
+            MO_DBG_ERR("OOM");
+            return nullptr;
+        }
+        config->setInt(factory_default);
+    }
+    return config;
+}
+
 bool MOcppMongooseClient::sendTXT(const char *msg, size_t length) {
     if (!websocket || !isConnectionOpen()) {
         return false;
@@ -129,9 +215,15 @@ bool MOcppMongooseClient::sendTXT(const char *msg, size_t length) {
         sent = 0;
         return false;
     } else {
+#if MO_MG_WS_MASK
+        sent = ws_send_masked(websocket, msg, length, WEBSOCKET_OP_TEXT);
+#else
         mg_send_websocket_frame(websocket, WEBSOCKET_OP_TEXT, msg, length);
         sent = length;
+#endif
     }
+#elif MO_MG_WS_MASK
+    sent = ws_send_masked(websocket, msg, length, WEBSOCKET_OP_TEXT);
 #else
     sent = mg_ws_send(websocket, msg, length, WEBSOCKET_OP_TEXT);
 #endif
@@ -191,6 +283,13 @@ void MOcppMongooseClient::maintainWsConn() {
 
     last_reconnection_attempt = mocpp_tick_ms();
 
+    ca_cert_conn = ca_cert;
+
+    if (!boot_timings.connect_attempted) {
+        boot_timings.connect_attempted = true;
+        boot_timings.first_connect_attempt_ms = mocpp_tick_ms() - boot_start;
+    }
+
     /*
      * determine auth token
      */
@@ -322,9 +421,19 @@ void MOcppMongooseClient::setBackendUrl(const char *backend_url_cstr) {
         return;
     }
 
+    if (credentials_update.active) {
+        credentials_update.backend_url = backend_url_cstr;
+        credentials_update.backend_url_staged = true;
+        return;
+    }
+
+    if (!configs_loaded) {
+        loadConfigs(); //don't overwrite the stored configs with their factory defaults
+    }
+
     if (setting_backend_url_str) {
         setting_backend_url_str->setString(backend_url_cstr);
-        configuration_save();
+        saveConfigs();
     }
 }
 
@@ -334,9 +443,19 @@ void MOcppMongooseClient::setChargeBoxId(const char *cb_id_cstr) {
         return;
     }
 
+    if (credentials_update.active) {
+        credentials_update.cb_id = cb_id_cstr;
+        credentials_update.cb_id_staged = true;
+        return;
+    }
+
+    if (!configs_loaded) {
+        loadConfigs(); //don't overwrite the stored configs with their factory defaults
+    }
+
     if (setting_cb_id_str) {
         setting_cb_id_str->setString(cb_id_cstr);
-        configuration_save();
+        saveConfigs();
     }
 }
 
@@ -357,23 +476,110 @@ void MOcppMongooseClient::setAuthKey(const unsigned char *auth_key, size_t len)
 
     char auth_key_hex [2 * MO_AUTHKEY_LEN_MAX + 1];
     auth_key_hex[0] = '\0';
-    for (size_t i = 0; i < len; i += 2) {
+    for (size_t i = 0; i < len; i++) {
         snprintf(auth_key_hex + 2 * i, 3, "%02X", auth_key[i]);
     }
 
+    if (credentials_update.active) {
+        credentials_update.auth_key_hex = auth_key_hex;
+        credentials_update.auth_key_hex_staged = true;
+        return;
+    }
+
+    if (!configs_loaded) {
+        loadConfigs(); //don't overwrite the stored configs with their factory defaults
+    }
+
     if (setting_auth_key_hex_str) {
         setting_auth_key_hex_str->setString(auth_key_hex);
-        configuration_save();
+        saveConfigs();
     }
 }
 
+void MOcppMongooseClient::beginCredentialsUpdate() {
+    if (credentials_update.active) {
+        MO_DBG_WARN("discard previous credentials update");
+    }
+    credentials_update = CredentialsUpdate();
+    credentials_update.active = true;
+}
+
+bool MOcppMongooseClient::commitCredentialsUpdate() {
+    if (!credentials_update.active) {
+        MO_DBG_ERR("no credentials update in progress");
+        return false;
+    }
+
+    CredentialsUpdate update = std::move(credentials_update);
+    credentials_update = CredentialsUpdate();
+
+    if (!configs_loaded) {
+        loadConfigs(); //don't overwrite the stored configs with their factory defaults
+    }
+
+    //keep the previous values to roll back if one of the updates fails
+    std::string prev_backend_url = setting_backend_url_str ? setting_backend_url_str->getString() : "";
+    std::string prev_cb_id = setting_cb_id_str ? setting_cb_id_str->getString() : "";
+    std::string prev_auth_key_hex = setting_auth_key_hex_str ? setting_auth_key_hex_str->getString() : "";
+
+    bool success = true;
+
+    if (update.backend_url_staged && setting_backend_url_str) {
+        success &= setting_backend_url_str->setString(update.backend_url.c_str());
+    }
+
+    if (update.cb_id_staged && setting_cb_id_str) {
+        success &= setting_cb_id_str->setString(update.cb_id.c_str());
+    }
+
+    if (update.auth_key_hex_staged && setting_auth_key_hex_str) {
+        success &= setting_auth_key_hex_str->setString(update.auth_key_hex.c_str());
+    }
+
+    if (!success) {
+        MO_DBG_ERR("OOM. Discard credentials update");
+        if (update.backend_url_staged && setting_backend_url_str) {
+            setting_backend_url_str->setString(prev_backend_url.c_str());
+        }
+        if (update.cb_id_staged && setting_cb_id_str) {
+            setting_cb_id_str->setString(prev_cb_id.c_str());
+        }
+        if (update.auth_key_hex_staged && setting_auth_key_hex_str) {
+            setting_auth_key_hex_str->setString(prev_auth_key_hex.c_str());
+        }
+        return false;
+    }
+
+    //all credentials are stored in the same file, so a single save writes them together
+    if (!saveConfigs()) {
+        MO_DBG_ERR("could not store credentials");
+        success = false;
+    }
+
+    reloadConfigs();
+
+    return success;
+}
+
+void MOcppMongooseClient::abortCredentialsUpdate() {
+    credentials_update = CredentialsUpdate();
+}
+
 void MOcppMongooseClient::setCaCert(const char *ca_cert_cstr) {
     ca_cert = ca_cert_cstr; //updated ca_cert takes immediate effect
+
+#if MO_MG_CA_CACHE
+    ca_store = getTlsCaStore(ca_cert); //parse once here instead of on each connection
+#endif
 }
 
 void MOcppMongooseClient::reloadConfigs() {
 
-    reconnect(); //closes WS connection; will be reopened in next maintainWsConn execution
+    //keep the WS credentials of the current connection to check if they are affected by this reload
+    std::string url_prev = url;
+    unsigned char auth_key_prev [MO_AUTHKEY_LEN_MAX + 1];
+    size_t auth_key_len_prev = auth_key_len;
+    memcpy(auth_key_prev, auth_key, auth_key_len);
 
     /*
      * reload WS credentials from configs
@@ -407,15 +613,27 @@ void MOcppMongooseClient::reloadConfigs() {
 
     if (backend_url.empty()) {
         MO_DBG_DEBUG("empty URL closes connection");
-        return;
+    } else {
+        url = backend_url;
+
+        if (url.back() != '/' && !cb_id.empty()) {
+            url.append("/");
+        }
+        url.append(cb_id);
     }
 
-    url = backend_url;
+    /*
+     * only close the WS connection if the reload affects it. Other WS configs (e.g. ping interval) apply live
+     */
 
-    if (url.back() != '/' && !cb_id.empty()) {
-        url.append("/");
+    if (url != url_prev ||
+            auth_key_len != auth_key_len_prev ||
+            memcmp(auth_key, auth_key_prev, auth_key_len) ||
+            ca_cert != ca_cert_conn) {
+        reconnect(); //closes WS connection; will be reopened in next maintainWsConn execution
+    } else {
+        MO_DBG_DEBUG("WS credentials unchanged - keep connection");
     }
-    url.append(cb_id);
 }
 
 int MOcppMongooseClient::printAuthKey(unsigned char *buf, size_t size) {
@@ -432,6 +650,16 @@ void MOcppMongooseClient::setConnectionOpen(bool open) {
     if (open) {
         connection_established = true;
         last_connection_established = mocpp_tick_ms();
+
+        if (!boot_timings.connected) {
+            boot_timings.connected = true;
+            boot_timings.first_connected_ms = mocpp_tick_ms() - boot_start;
+            MO_DBG_INFO("boot timings: constructor %lu ms, config load %lu ms, first connect trial after %lu ms, connected after %lu ms",
+                    boot_timings.construct_ms,
+                    boot_timings.config_load_ms,
+                    boot_timings.first_connect_attempt_ms,
+                    boot_timings.first_connected_ms);
+        }
     } else {
         connection_closing = true;
     }
@@ -455,6 +683,21 @@ unsigned long MOcppMongooseClient::getLastConnected() {
     return last_connection_established;
 }
 
+void MOcppMongooseClient::updatePingRtt() {
+    ping_rtt = mocpp_tick_ms() - last_hb;
+}
+
+size_t MOcppMongooseClient::getSendBufferOccupancy() {
+    if (!websocket) {
+        return 0;
+    }
+#if defined(MO_MG_VERSION_614)
+    return websocket->send_mbuf.len;
+#else
+    return websocket->send.len;
+#endif
+}
+
 #if defined(MO_MG_VERSION_614)
 
 void ws_cb(struct mg_connection *nc, int ev, void *ev_data, void *user_data) {
@@ -513,6 +756,15 @@ void ws_cb(struct mg_connection *nc, int ev, void *ev_data, void *user_data) {
         case MG_EV_WEBSOCKET_FRAME: {
             struct websocket_message *wm = (struct websocket_message *) ev_data;
 
+#if MO_MG_WS_UTF8
+            if ((wm->flags & 0x0F) != WEBSOCKET_OP_BINARY && !ws_utf8_valid(wm->data, wm->size)) {
+                MO_DBG_WARN("connection %s -- invalid UTF-8 in text frame, close", osock->getUrl());
+                ws_close(nc, MO_WS_CLOSE_INVALID_DATA, "invalid UTF-8");
+                osock->setConnectionOpen(false);
+                break;
+            }
+#endif
+
             if (!osock->getReceiveTXTcallback()((const char *) wm->data, wm->size)) { //forward message to Context
                 MO_DBG_ERR("processing WS input failed");
                 (void)0;
@@ -521,6 +773,10 @@ void ws_cb(struct mg_connection *nc, int ev, void *ev_data, void *user_data) {
             break;
         }
         case MG_EV_WEBSOCKET_CONTROL_FRAME: {
+            struct websocket_message *wm = (struct websocket_message *) ev_data;
+            if ((wm->flags & 0x0F) == WEBSOCKET_OP_PONG) {
+                osock->updatePingRtt();
+            }
             osock->updateRcvTimer();
             break;
         }
@@ -540,6 +796,12 @@ void ws_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
         (void)0;
     }
 
+#if MO_MG_CA_CACHE
+    if (ev == MG_EV_CLOSE) {
+        releaseTlsCaStore(c);
+    }
+#endif
+
     MOcppMongooseClient *osock = reinterpret_cast<MOcppMongooseClient*>(fn_data);
     if (!osock) {
         if (ev == MG_EV_ERROR || ev == MG_EV_CLOSE) {
@@ -565,9 +827,20 @@ void ws_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
             }
             struct mg_tls_opts opts;
             memset(&opts, 0, sizeof(struct mg_tls_opts));
-            opts.ca = ca_string;
             opts.srvname = mg_url_host(osock->getUrl());
-            mg_tls_init(c, &opts);
+#if MO_MG_CA_CACHE
+            auto ca_store = osock->getCaStore();
+            if (ca_string && ca_store && ca_store->getCaCert() == ca_string) {
+                mg_tls_init(c, &opts);
+                if (c->tls) {
+                    ca_store->apply(c, opts.srvname);
+                }
+            } else
+#endif
+            {
+                opts.ca = ca_string;
+                mg_tls_init(c, &opts);
+            }
         } else {
             MO_DBG_WARN("Insecure connection (WS)");
         }
@@ -595,11 +868,23 @@ void ws_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
         osock->updateRcvTimer();
     } else if (ev == MG_EV_WS_MSG) {
         struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
+#if MO_MG_WS_UTF8
+        if ((wm->flags & 0x0F) != WEBSOCKET_OP_BINARY && !ws_utf8_valid((const unsigned char*) wm->data.ptr, wm->data.len)) {
+            MO_DBG_WARN("connection %s -- invalid UTF-8 in text frame, close", osock->getUrl());
+            ws_close(c, MO_WS_CLOSE_INVALID_DATA, "invalid UTF-8");
+            osock->setConnectionOpen(false);
+            return;
+        }
+#endif
         if (!osock->getReceiveTXTcallback()((const char*) wm->data.ptr, wm->data.len)) {
             MO_DBG_WARN("processing input message failed");
         }
         osock->updateRcvTimer();
     } else if (ev == MG_EV_WS_CTL) {
+        struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
+        if ((wm->flags & 0x0F) == WEBSOCKET_OP_PONG) {
+            osock->updatePingRtt();
+        }
         osock->updateRcvTimer();
     }
 
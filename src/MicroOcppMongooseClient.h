@@ -11,22 +11,29 @@
 #endif
 
 #include "mongoose.h"
+#include "MicroOcppMongooseTls.h"
 #include <MicroOcpp/Core/Connection.h>
 #include <MicroOcpp/Version.h>
 
 #include <string>
 #include <memory>
+#include <stdint.h>
 
 #ifndef MO_WSCONN_FN
 #define MO_WSCONN_FN (MO_FILENAME_PREFIX "ws-conn.jsn")
 #endif
 
+#ifndef MO_WSCONN_SNAPSHOT
+#define MO_WSCONN_SNAPSHOT 0 //store the WS configs as binary snapshot (see MicroOcppMongooseSnapshot.h). MO_WSCONN_FN is only the migration and fallback source
+#endif
+
 #define MO_AUTHKEY_LEN_MAX 20 //AuthKey in Bytes. Hex value has double length
 
 namespace MicroOcpp {
 
 class FilesystemAdapter;
 class Configuration;
+class ConfigurationContainer;
 
 class MOcppMongooseClient : public MicroOcpp::Connection {
 private:
@@ -36,8 +43,12 @@ private:
     std::string cb_id;
     std::string url; //url = backend_url + '/' + cb_id
     unsigned char auth_key [MO_AUTHKEY_LEN_MAX + 1]; //AuthKey in bytes encoding ("FF01" = {0xFF, 0x01})
-    size_t auth_key_len;
-    const char *ca_cert; //zero-copy. The host system must ensure that this pointer remains valid during the lifetime of this class
+    size_t auth_key_len {0};
+    const char *ca_cert {nullptr}; //zero-copy. The host system must ensure that this pointer remains valid during the lifetime of this class
+    const char *ca_cert_conn {nullptr}; //ca_cert which the current WS connection has been opened with
+#if MO_MG_CA_CACHE
+    std::shared_ptr<TlsCaStore> ca_store; //ca_cert in parsed form
+#endif
     std::shared_ptr<Configuration> setting_backend_url_str;
     std::shared_ptr<Configuration> setting_cb_id_str;
     std::shared_ptr<Configuration> setting_auth_key_hex_str;
@@ -47,6 +58,7 @@ private:
     std::shared_ptr<Configuration> stale_timeout_int; //inactivity period after which the connection will be closed
     std::shared_ptr<Configuration> ws_ping_interval_int; //heartbeat intervall in s. 0 sets hb off
     unsigned long last_hb {0};
+    unsigned long ping_rtt {0};
     bool connection_established {false};
     unsigned long last_connection_established {-1UL / 2UL};
     bool connection_closing {false};
@@ -54,10 +66,44 @@ private:
     ProtocolVersion protocolVersion;
     const ProtocolVersion * machedProtocolVersion = nullptr;
 
+    struct CredentialsUpdate {
+        bool active = false;
+        bool backend_url_staged = false;
+        bool cb_id_staged = false;
+        bool auth_key_hex_staged = false;
+        std::string backend_url;
+        std::string cb_id;
+        std::string auth_key_hex;
+    };
+    CredentialsUpdate credentials_update; //staged WS credentials between begin- and commitCredentialsUpdate()
+
+    std::shared_ptr<ConfigurationContainer> config_store; //private store of the WS configs. nullptr to use the global MO_WSCONN_FN
+    std::shared_ptr<Configuration> declareWsConfig(const char *key, const char *factory_default, bool readonly);
+    std::shared_ptr<Configuration> declareWsConfig(const char *key, int factory_default);
+
+    bool configs_loaded {false}; //false until MO_WSCONN_FN has been loaded from flash
+    unsigned long boot_start {0};
+
     void reconnect();
 
+    void loadConfigs();
+    bool saveConfigs();
+
     void maintainWsConn();
 
+public:
+    struct BootTimings {
+        unsigned long construct_ms = 0; //duration of the constructor
+        unsigned long config_load_ms = 0; //duration of loading MO_WSCONN_FN from flash
+        unsigned long first_connect_attempt_ms = 0; //time from construction until the first WS connection trial
+        unsigned long first_connected_ms = 0; //time from construction until the first established WS connection
+        bool connect_attempted = false;
+        bool connected = false;
+    };
+
+private:
+    BootTimings boot_timings;
+
 public:
     MOcppMongooseClient(struct mg_mgr *mgr, 
             const char *backend_url_factory, 
@@ -65,7 +111,9 @@ public:
             unsigned char *auth_key_factory, size_t auth_key_factory_len,
             const char *ca_cert = nullptr, //zero-copy, the string must outlive this class and mg_mgr. Forwards this string to Mongoose as ssl_ca_cert (see https://github.com/cesanta/mongoose/blob/ab650ec5c99ceb52bb9dc59e8e8ec92a2724932b/mongoose.h#L4192)
             std::shared_ptr<MicroOcpp::FilesystemAdapter> filesystem = nullptr,
-            ProtocolVersion protocolVersion = ProtocolVersion(1,6));
+            ProtocolVersion protocolVersion = ProtocolVersion(1,6),
+            bool deferred_init = false, //if true, return immediately and load the configs from flash and connect during the next loop() calls
+            std::shared_ptr<MicroOcpp::ConfigurationContainer> config_store = nullptr); //if set, keep the WS configs in this store instead of the global MO_WSCONN_FN. Allows several isolated clients in one process
     
     //DEPRECATED: will be removed in a future release
     MOcppMongooseClient(struct mg_mgr *mgr, 
@@ -97,13 +145,23 @@ public:
     void setAuthKey(const unsigned char *auth_key, size_t len); //set the auth key in bytes-encoded format
     void setCaCert(const char *ca_cert); //forwards this string to Mongoose as ssl_ca_cert (see https://github.com/cesanta/mongoose/blob/ab650ec5c99ceb52bb9dc59e8e8ec92a2724932b/mongoose.h#L4192)
 
-    void reloadConfigs();
+    //update multiple WS credentials at once. Between begin and commit, the setters above only stage the
+    //changes in RAM. `commitCredentialsUpdate()` sets them all or none, stores them with a single save and applies
+    //them with a single `reloadConfigs()`. Returns false if setting or storing failed
+    void beginCredentialsUpdate();
+    bool commitCredentialsUpdate();
+    void abortCredentialsUpdate(); //discard staged changes
+
+    void reloadConfigs(); //apply WS config updates. Reconnects only if the URL, AuthorizationKey or CA cert have changed
 
     const char *getBackendUrl() {return backend_url.c_str();}
     const char *getChargeBoxId() {return cb_id.c_str();}
     const char *getAuthKey() {return (const char*)auth_key;} //DEPRECATED: will be removed in a future release
     int printAuthKey(unsigned char *buf, size_t size);
     const char *getCaCert() {return ca_cert ? ca_cert : "";}
+#if MO_MG_CA_CACHE
+    std::shared_ptr<TlsCaStore> getCaStore() {return ca_store;}
+#endif
 
     const char *getUrl() {return url.c_str();}
 
@@ -115,8 +173,13 @@ public:
     void updateRcvTimer();
     unsigned long getLastRecv(); //get time of last successful receive in millis
     unsigned long getLastConnected(); //get time of last connection establish
+    void updatePingRtt(); //call when receiving the pong
+    unsigned long getPingRtt() {return ping_rtt;} //round-trip time of the last ping in millis. 0 if not measured yet
+    size_t getSendBufferOccupancy(); //bytes which are waiting in the WS send buffer
     void setMatchedProtocolVersion(const ProtocolVersion* version){machedProtocolVersion = version;}
     const ProtocolVersion* getMatchedProtocolVersion(){return machedProtocolVersion;}
+
+    const BootTimings& getBootTimings() {return boot_timings;}
 };
 
 }
@@ -76,6 +76,33 @@ void ocpp_setCaCert(OCPP_Connection *sock, const char *ca_cert) {
     mgsock->setCaCert(ca_cert);
 }
 
+void ocpp_beginCredentialsUpdate(OCPP_Connection *sock) {
+    if (!sock) {
+        MO_DBG_ERR("invalid argument");
+        return;
+    }
+    auto mgsock = reinterpret_cast<MOcppMongooseClient*>(sock);
+    mgsock->beginCredentialsUpdate();
+}
+
+bool ocpp_commitCredentialsUpdate(OCPP_Connection *sock) {
+    if (!sock) {
+        MO_DBG_ERR("invalid argument");
+        return false;
+    }
+    auto mgsock = reinterpret_cast<MOcppMongooseClient*>(sock);
+    return mgsock->commitCredentialsUpdate();
+}
+
+void ocpp_abortCredentialsUpdate(OCPP_Connection *sock) {
+    if (!sock) {
+        MO_DBG_ERR("invalid argument");
+        return;
+    }
+    auto mgsock = reinterpret_cast<MOcppMongooseClient*>(sock);
+    mgsock->abortCredentialsUpdate();
+}
+
 void ocpp_reloadConfigs(OCPP_Connection *sock) {
     if (!sock) {
         MO_DBG_ERR("invalid argument");
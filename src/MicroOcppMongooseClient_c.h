@@ -37,6 +37,11 @@ void ocpp_setChargeBoxId(OCPP_Connection *sock, const char *cb_id);
 void ocpp_setAuthKey(OCPP_Connection *sock, const char *auth_key);
 void ocpp_setCaCert(OCPP_Connection *sock, const char *ca_cert);
 
+//update multiple WS credentials with a single save and reload. See `MOcppMongooseClient::beginCredentialsUpdate()`
+void ocpp_beginCredentialsUpdate(OCPP_Connection *sock);
+bool ocpp_commitCredentialsUpdate(OCPP_Connection *sock);
+void ocpp_abortCredentialsUpdate(OCPP_Connection *sock);
+
 void ocpp_reloadConfigs(OCPP_Connection *sock);
 
 const char *ocpp_getBackendUrl(OCPP_Connection *sock);
@@ -0,0 +1,76 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSECOMPAT_H
+#define MO_MONGOOSECOMPAT_H
+
+/*
+ * Internal helpers which map the connection API of MG v6.14 and v7 to the same names. Used by the
+ * protocols which are implemented on plain TCP conns (FTP, HTTP transfers)
+ */
+
+#include "mongoose.h"
+
+#if defined(MO_MG_VERSION_614)
+inline void mg_compat_drain_conn(mg_connection *c) {
+    c->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+inline void mg_compat_close_conn(mg_connection *c) {
+    c->flags |= MG_F_CLOSE_IMMEDIATELY;
+}
+
+inline void mg_compat_iobuf_resize(struct mbuf *buf, size_t new_size) {
+    mbuf_resize(buf, new_size);
+}
+
+inline void mg_compat_iobuf_consume(struct mbuf *buf, size_t len) {
+    mbuf_remove(buf, len);
+}
+
+inline void mg_compat_pause_recv(mg_connection *c, bool pause) {
+    (void)c;
+    (void)pause; //not supported by MG v6.14. Incoming data is held in the recv buffer until the rate limiter releases it
+}
+
+#define MG_COMPAT_EV_READ MG_EV_RECV
+#define MG_COMPAT_EV_READ_LEN(ev_data) ((size_t) *(int*) ev_data)
+#define MG_COMPAT_EV_WRITE MG_EV_SEND
+#define MG_COMPAT_RECV recv_mbuf
+#define MG_COMPAT_SEND send_mbuf
+#define MG_COMPAT_FN handler
+#define MG_COMPAT_FN_DATA user_data
+#define MG_COMPAT_IS_TLS(c) ((c->flags & MG_F_SSL) == MG_F_SSL)
+#else
+inline void mg_compat_drain_conn(mg_connection *c) {
+    c->is_draining = 1;
+}
+
+inline void mg_compat_close_conn(mg_connection *c) {
+    c->is_closing = 1;
+}
+
+inline void mg_compat_iobuf_resize(struct mg_iobuf *buf, size_t new_size) {
+    mg_iobuf_resize(buf, new_size);
+}
+
+inline void mg_compat_iobuf_consume(struct mg_iobuf *buf, size_t len) {
+    mg_iobuf_del(buf, 0, len);
+}
+
+inline void mg_compat_pause_recv(mg_connection *c, bool pause) {
+    c->is_full = pause ? 1 : 0; //stop reading from the socket so that TCP flow control slows down the sender
+}
+
+#define MG_COMPAT_EV_READ MG_EV_READ
+#define MG_COMPAT_EV_READ_LEN(ev_data) ((size_t) *(long*) ev_data)
+#define MG_COMPAT_EV_WRITE MG_EV_WRITE
+#define MG_COMPAT_RECV recv
+#define MG_COMPAT_SEND send
+#define MG_COMPAT_FN fn
+#define MG_COMPAT_FN_DATA fn_data
+#define MG_COMPAT_IS_TLS(c) (c->tls != nullptr)
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEDIGEST_H
+#define MO_MONGOOSEDIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MO_SHA256_SIZE 32
+#define MO_SHA256_HEX_SIZE (2 * MO_SHA256_SIZE + 1) //including terminating 0
+
+namespace MicroOcpp {
+
+/*
+ * Incremental checksums for verifying downloads while they are received, so that the file
+ * doesn't need to be read again after writing it
+ */
+
+//CRC-32 (IEEE 802.3), table-driven. Pass the result of the previous call as crc to continue
+uint32_t digest_crc32(const unsigned char *data, size_t len, uint32_t crc = 0);
+
+class Sha256 {
+private:
+    uint32_t state [8];
+    uint64_t total_len;
+    unsigned char block [64];
+    size_t block_len;
+
+    void transform(const unsigned char *chunk);
+public:
+    Sha256();
+
+    void reset();
+    void update(const unsigned char *data, size_t len);
+    void finish(unsigned char digest [MO_SHA256_SIZE]); //the context must be reset before the next update
+};
+
+void digest_to_hex(const unsigned char *digest, size_t len, char *out); //out must hold 2 * len + 1 chars
+
+} //end namespace MicroOcpp
+
+#endif
@@ -0,0 +1,225 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseEpoll.h"
+
+#if MO_MG_EPOLL
+
+#include <MicroOcpp/Debug.h>
+
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace MicroOcpp;
+
+#define MO_EPOLL_WAKEUP_TAG (-1) //epoll_event data of the wakeup eventfd
+
+//TLS records which the TLS lib has already taken from the socket but Mongoose hasn't read yet. FIONREAD doesn't see them
+static bool tls_pending(struct mg_connection *c) {
+    if (!c->is_tls || !c->tls || c->is_tls_hs) {
+        return false;
+    }
+#if MG_ENABLE_OPENSSL
+    return SSL_pending(((struct mg_tls*) c->tls)->ssl) > 0;
+#elif MG_ENABLE_MBEDTLS
+    mbedtls_ssl_context *ssl = &((struct mg_tls*) c->tls)->ssl;
+    return mbedtls_ssl_get_bytes_avail(ssl) > 0 || mbedtls_ssl_check_pending(ssl);
+#else
+    return false;
+#endif
+}
+
+MongooseEpollPoller::MongooseEpollPoller(struct mg_mgr *mgr) : mgr(mgr) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        MO_DBG_ERR("epoll_create1: %i", errno);
+        return;
+    }
+
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd >= 0) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = MO_EPOLL_WAKEUP_TAG;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev) != 0) {
+            MO_DBG_WARN("cannot register wakeup fd: %i", errno);
+            close(wakeup_fd);
+            wakeup_fd = -1;
+        }
+    }
+
+    events.resize(MO_MG_EPOLL_MAX_EVENTS);
+}
+
+MongooseEpollPoller::~MongooseEpollPoller() {
+    if (wakeup_fd >= 0) {
+        close(wakeup_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+bool MongooseEpollPoller::isValid() {
+    return epoll_fd >= 0;
+}
+
+void MongooseEpollPoller::sync() {
+    for (auto& reg : registrations) {
+        reg.second.seen = false;
+    }
+
+    for (struct mg_connection *c = mgr->conns; c; c = c->next) {
+        if (!c->fd) {
+            continue; //no socket yet, e.g. while resolving
+        }
+        int fd = (int) (size_t) c->fd;
+
+        auto reg = registrations.find(fd);
+        if (reg != registrations.end() && reg->second.conn_id == c->id) {
+            reg->second.seen = true;
+            continue;
+        }
+
+        //new conn, or a new conn which has got the fd of a closed one. The kernel has removed the closed socket from the set
+        Registration r;
+        r.conn_id = c->id;
+        r.send_len = c->send.len;
+        r.edge = !c->is_listening && !c->is_udp; //accept and UDP recv take one item per mg_mgr_poll. Keep them level-triggered
+        r.seen = true;
+
+        struct epoll_event ev;
+        ev.events = r.edge ? (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) : EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            if (errno != EEXIST || epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+                MO_DBG_WARN("cannot register fd %i: %i", fd, errno);
+                continue;
+            }
+        }
+        registrations[fd] = r;
+    }
+
+    for (auto reg = registrations.begin(); reg != registrations.end();) {
+        if (!reg->second.seen) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, reg->first, nullptr); //usually closed already. Ignore errors
+            reg = registrations.erase(reg);
+        } else {
+            reg++;
+        }
+    }
+
+    stats.registered = (unsigned long) registrations.size();
+}
+
+bool MongooseEpollPoller::hasPendingWork() {
+    for (struct mg_connection *c = mgr->conns; c; c = c->next) {
+        if (c->is_closing || (c->is_draining && c->send.len == 0)) {
+            return true; //Mongoose closes the conn in the next mg_mgr_poll
+        }
+        if (!c->fd) {
+            continue;
+        }
+        auto reg = registrations.find((int) (size_t) c->fd);
+        if (reg == registrations.end()) {
+            continue;
+        }
+        if (reg->second.hot) {
+            return true;
+        }
+        if (c->send.len > reg->second.send_len && !c->is_connecting) {
+            return true; //new outgoing data since the last mg_mgr_poll. An unchanged remainder waits for EPOLLOUT
+        }
+    }
+    return false;
+}
+
+void MongooseEpollPoller::afterPoll() {
+    for (struct mg_connection *c = mgr->conns; c; c = c->next) {
+        if (!c->fd) {
+            continue;
+        }
+        auto reg = registrations.find((int) (size_t) c->fd);
+        if (reg == registrations.end() || reg->second.conn_id != c->id) {
+            continue;
+        }
+        Registration& r = reg->second;
+        r.send_len = c->send.len;
+
+        //Mongoose reads once per conn and mg_mgr_poll and not at all while the recv buffer is full. Edge-triggered
+        //sockets with a remainder won't signal again, so check the socket and the TLS lib for unread bytes
+        r.hot = false;
+        if (r.edge) {
+            if (tls_pending(c)) {
+                r.hot = true;
+            } else if (r.readable || c->is_full) {
+                int avail = 0;
+                if (ioctl(reg->first, FIONREAD, &avail) == 0 && avail > 0) {
+                    r.hot = true;
+                }
+            }
+        }
+        r.readable = r.hot;
+    }
+}
+
+void MongooseEpollPoller::poll(int max_wait_ms) {
+    stats.polls++;
+
+    if (epoll_fd < 0) {
+        mg_mgr_poll(mgr, max_wait_ms);
+        return;
+    }
+
+    sync();
+
+    int timeout = max_wait_ms;
+    if (hasPendingWork()) {
+        timeout = 0;
+        stats.spins++;
+    }
+
+    int n = epoll_wait(epoll_fd, events.data(), (int) events.size(), timeout);
+    if (n < 0 && errno != EINTR) {
+        MO_DBG_ERR("epoll_wait: %i", errno);
+    }
+
+    bool socket_events = false;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.fd == MO_EPOLL_WAKEUP_TAG) {
+            uint64_t val;
+            while (read(wakeup_fd, &val, sizeof(val)) > 0); //reset the counter
+            stats.wakeups++;
+            continue;
+        }
+        socket_events = true;
+        auto reg = registrations.find(events[i].data.fd);
+        if (reg != registrations.end() && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            reg->second.readable = true;
+        }
+    }
+    if (socket_events) {
+        stats.event_wakeups++;
+    } else if (n == 0 && timeout > 0) {
+        stats.timeouts++;
+    }
+
+    mg_mgr_poll(mgr, 0);
+
+    afterPoll();
+}
+
+void MongooseEpollPoller::wakeup() {
+    if (wakeup_fd < 0) {
+        return; //poll() returns after max_wait_ms
+    }
+    uint64_t val = 1;
+    if (write(wakeup_fd, &val, sizeof(val)) < 0) {
+        //counter overflow. The poller is awake anyway
+    }
+}
+
+#endif //MO_MG_EPOLL
@@ -0,0 +1,100 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEEPOLL_H
+#define MO_MONGOOSEEPOLL_H
+
+/*
+ * epoll event backend for an mg_mgr on Linux. Drop-in replacement for mg_mgr_poll(mgr, ms):
+ *
+ *     MongooseEpollPoller poller {&mgr};
+ *     while (true) {
+ *         poller.poll(100); //instead of mg_mgr_poll(&mgr, 100)
+ *         client.loop();
+ *     }
+ *
+ * The poller waits in epoll_wait on the sockets of all conns of the mg_mgr (edge-triggered for TCP conns) and
+ * then lets Mongoose do the I/O with mg_mgr_poll(mgr, 0). Idle conns cost nothing while waiting, and an idle
+ * mg_mgr only wakes up at the end of max_wait_ms instead of rescanning all sockets on every poll. The callbacks of
+ * MOcppMongooseClient, MongooseFtpClient and MongooseHttpClient run exactly as with mg_mgr_poll.
+ *
+ * mg_mgr_poll(mgr, 0) itself still visits all conns. The Mongoose build should use poll() instead of select()
+ * (compile mongoose.c with MG_ENABLE_POLL=1) if the mg_mgr holds more than FD_SETSIZE (1024) sockets.
+ * Only Mongoose v7
+ */
+#ifndef MO_MG_EPOLL
+#define MO_MG_EPOLL 0
+#endif
+
+#if MO_MG_EPOLL
+
+#if !defined(__linux__)
+#error "MO_MG_EPOLL requires Linux"
+#endif
+
+#if defined(MO_MG_VERSION_614)
+#error "MO_MG_EPOLL requires Mongoose v7"
+#endif
+
+#include "mongoose.h"
+
+#include <vector>
+#include <unordered_map>
+#include <sys/epoll.h>
+
+#ifndef MO_MG_EPOLL_MAX_EVENTS
+#define MO_MG_EPOLL_MAX_EVENTS 256 //events which are fetched with one epoll_wait
+#endif
+
+namespace MicroOcpp {
+
+class MongooseEpollPoller {
+public:
+    struct Stats {
+        unsigned long polls = 0;
+        unsigned long event_wakeups = 0; //epoll_wait returned socket events
+        unsigned long wakeups = 0; //epoll_wait returned because of wakeup()
+        unsigned long timeouts = 0; //epoll_wait returned after max_wait_ms without events
+        unsigned long spins = 0; //no wait because Mongoose had pending work, e.g. unread (TLS) bytes or an outgoing message
+        unsigned long registered = 0; //sockets in the epoll set
+    };
+
+private:
+    struct Registration {
+        unsigned long conn_id {0}; //detects reused fds of closed conns
+        size_t send_len {0}; //c->send.len after the last mg_mgr_poll
+        bool edge {false}; //edge-triggered
+        bool readable {false}; //EPOLLIN in the last epoll_wait
+        bool hot {false}; //unread bytes left in the socket or the TLS lib after the last mg_mgr_poll, also of full conns
+        bool seen {false};
+    };
+
+    struct mg_mgr *mgr {nullptr};
+    int epoll_fd {-1};
+    int wakeup_fd {-1};
+    std::unordered_map<int, Registration> registrations; //fd -> conn
+    std::vector<struct epoll_event> events;
+    Stats stats;
+
+    void sync(); //(un)registers the sockets of new and closed conns
+    bool hasPendingWork();
+    void afterPoll();
+
+public:
+    MongooseEpollPoller(struct mg_mgr *mgr);
+    ~MongooseEpollPoller();
+
+    bool isValid(); //false if epoll isn't available. Then poll() falls back to mg_mgr_poll
+
+    void poll(int max_wait_ms); //see mg_mgr_poll
+
+    void wakeup(); //interrupts a waiting poll(). Thread-safe
+
+    const Stats& getStats() {return stats;}
+};
+
+} //end namespace MicroOcpp
+
+#endif //MO_MG_EPOLL
+#endif
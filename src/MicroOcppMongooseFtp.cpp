@@ -3,6 +3,7 @@
 // GPL-3.0 License (see LICENSE)
 
 #include "MicroOcppMongooseFtp.h"
+#include "MicroOcppMongooseCompat.h"
 #include <MicroOcpp/Debug.h>
 #include <MicroOcpp/Platform.h>
 
@@ -10,20 +11,28 @@ using namespace MicroOcpp;
 
 void ftp_ctrl_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
 void ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
+void ftp_upload_pump(MongooseFtpClient& session, struct mg_connection *c);
+void ftp_download_pump(MongooseFtpClient& session, struct mg_connection *c);
+size_t ftp_download_write(MongooseFtpClient& session, unsigned char *buf, size_t avail, bool& held_back); //returns consumed bytes or > avail on error
+int ftp_download_finish(MongooseFtpClient& session, struct mg_connection *c); //after 226: completes the transfer when all bytes are passed
+void ftp_pool_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
+
+//result of processing a reply line on the ctrl conn
+#define FTP_REPLY_CONTINUE 0 //continue with next line
+#define FTP_REPLY_STOP     1 //connection is closing
+#define FTP_REPLY_RELEASE  2 //transfer finished, release ctrl conn
+
+int ftp_ctrl_on_reply(MongooseFtpClient& session, struct mg_connection *c, const MongooseFtpReplyLine& line);
+int ftp_ctrl_on_login(MongooseFtpClient& session, struct mg_connection *c);
+int ftp_ctrl_on_pasv(MongooseFtpClient& session, struct mg_connection *c, const MongooseFtpReplyLine& line);
+int ftp_ctrl_abort(MongooseFtpClient& session, struct mg_connection *c);
+void ftp_ctrl_quit(MongooseFtpClient& session); //QUIT on the ctrl conn, if it's still open
 
 #define MG_COMPAT_NOSSL   0
 #define MG_COMPAT_OPENSSL 1
 #define MG_COMPAT_MBEDTLS 2
 
 #if defined(MO_MG_VERSION_614)
-void mg_compat_drain_conn(mg_connection *c) {
-    c->flags |= MG_F_SEND_AND_CLOSE;
-}
-
-void mg_compat_iobuf_resize(struct mbuf *buf, size_t new_size) {
-    mbuf_resize(buf, new_size);
-};
-
 //TLS lib internals not exposed in MG v6.14 interface. Cast them to copies of their definition (see mongoose.c)
 #if MG_SSL_IF == MG_SSL_IF_OPENSSL
 #define MG_COMPAT_TLS MG_COMPAT_OPENSSL
@@ -58,11 +67,6 @@ void *mg_compat_get_tls(struct mg_connection *c) {
 }
 #endif
 
-#define MG_COMPAT_EV_READ MG_EV_RECV
-#define MG_COMPAT_RECV recv_mbuf
-#define MG_COMPAT_SEND send_mbuf
-#define MG_COMPAT_FN_DATA user_data
-#define MG_COMPAT_IS_TLS(c) ((c->flags & MG_F_SSL) == MG_F_SSL)
 #define MG_COMPAT_EV_TLS_HS 100500 //event number not used by MG
 
 #ifdef MO_FTP_OVERRIDE_CIPHERSUITES
@@ -88,14 +92,6 @@ void *mg_compat_get_tls(struct mg_connection *c) {
 #define MO_FTP_USE_CIPHERSUITES nullptr
 #endif
 #else
-void mg_compat_drain_conn(mg_connection *c) {
-    c->is_draining = 1;
-}
-
-void mg_compat_iobuf_resize(struct mg_iobuf *buf, size_t new_size) {
-    mg_iobuf_resize(buf, new_size);
-};
-
 #if MG_ENABLE_OPENSSL
 #define MG_COMPAT_TLS MG_COMPAT_OPENSSL
 SSL *mg_compat_get_tls(struct mg_connection *c) {
@@ -112,11 +108,6 @@ void *mg_compat_get_tls(struct mg_connection *c) {
 }
 #endif
 
-#define MG_COMPAT_EV_READ MG_EV_READ
-#define MG_COMPAT_RECV recv
-#define MG_COMPAT_SEND send
-#define MG_COMPAT_FN_DATA fn_data
-#define MG_COMPAT_IS_TLS(c) (c->tls != nullptr)
 #define MG_COMPAT_EV_TLS_HS MG_EV_TLS_HS
 #endif
 
@@ -162,12 +153,29 @@ int MongooseFtpClient::upgradeTls(struct mg_connection *conn) {
     #else
     struct mg_tls_opts opts;
     memset(&opts, 0, sizeof(opts));
-    //opts.ca = CERT; //TODO
+    opts.srvname = mg_url_host(url.c_str());
+    #if MO_MG_CA_CACHE
+    if (ca_store) {
+        mg_tls_init(conn, &opts);
+        if (!conn->tls || !ca_store->apply(conn, opts.srvname)) {
+            return -1;
+        }
+        return 0;
+    }
+    #endif
+    opts.ca = ca_cert && *ca_cert ? ca_cert : nullptr;
     mg_tls_init(conn, &opts);
     return 0;
     #endif
 }
 
+void MongooseFtpClient::setCaCert(const char *ca_cert) {
+    this->ca_cert = ca_cert;
+#if MO_MG_CA_CACHE
+    ca_store = getTlsCaStore(ca_cert);
+#endif
+}
+
 int MongooseFtpClient::upgradeTlsCtrlConn() {
     if (!ctrl_conn) {
         MO_DBG_ERR("internal error");
@@ -239,23 +247,156 @@ void MongooseFtpClient::loop() {
         ftp_data_cb(data_conn, MG_EV_CONNECT, &ev_data, (void*)this);
     }
     #endif
+
+    if (session_pool) {
+        session_pool->loop();
+    }
+
+    if (checkStall()) {
+        return; //the close event of the ctrl conn schedules a retry or calls onClose
+    }
+
+    updateProgress();
+
+    if (retry_pending && mocpp_tick_ms() - retry_scheduled >= retry_delay) {
+        retry_pending = false;
+
+        MO_DBG_INFO("resume download %s at %zu bytes (retry %u/%u)", fname.c_str(), transfer_bytes, retry_count, max_retries);
+
+        if (!openCtrlConn()) {
+            MO_DBG_ERR("cannot open ctrl ch");
+            if (!scheduleRetry() && onClose) {
+                onClose();
+                onClose = nullptr;
+            }
+        }
+    }
 }
 
-bool MongooseFtpClient::getFile(const char *ftp_url_raw, std::function<size_t(unsigned char *data, size_t len)> fileWriter, std::function<void()> onClose) {
-    
-    MO_DBG_WARN("FTP download experimental. Please test, evaluate and report the results on GitHub");
-    
-    if (!ftp_url_raw || !fileWriter) {
-        MO_DBG_ERR("invalid args");
+bool MongooseFtpClient::scheduleRetry() {
+    if (method != Method::Retrieve || transfer_complete || !retry_allowed) {
         return false;
     }
 
-    MO_DBG_DEBUG("init download %s", ftp_url_raw);
+    if (retry_count >= max_retries) {
+        MO_DBG_WARN("download failed after %u retries", retry_count);
+        return false;
+    }
 
-    if (!readUrl(ftp_url_raw)) {
+    releaseDataConn();
+
+    //exponential backoff
+    retry_delay = retry_delay_ms;
+    for (unsigned int i = 0; i < retry_count && retry_delay < MO_FTP_RETRY_DELAY_MAX; i++) {
+        retry_delay *= 2;
+    }
+
+    retry_count++;
+    retry_pending = true;
+    retry_scheduled = mocpp_tick_ms();
+
+    MO_DBG_WARN("download interrupted at %zu bytes, retry in %lu ms", transfer_bytes, retry_delay);
+    return true;
+}
+
+void MongooseFtpClient::reportTransfer() {
+    if (method != Method::Retrieve && method != Method::Append) {
+        return;
+    }
+    transfer_end = mocpp_tick_ms();
+    auto stats = getStats();
+    MO_DBG_INFO("%s %s: %zu bytes in %lu ms (avg %lu B/s, peak %lu B/s), %u stalls",
+            method == Method::Retrieve ? "download" : "upload",
+            transfer_complete ? "complete" : "failed",
+            stats.bytes,
+            stats.duration_ms,
+            stats.avg_rate,
+            stats.peak_rate,
+            stats.stall_count);
+    if (method != Method::Retrieve) {
+        return;
+    }
+    MO_DBG_INFO("download %u retries, %zu bytes re-transferred",
+            retry_count,
+            getBytesRetransferred());
+    if (digest_sha256) {
+        char hex [MO_SHA256_HEX_SIZE];
+        getSha256Hex(hex);
+        MO_DBG_INFO("SHA-256: %s", hex);
+    }
+    if (digest_crc32) {
+        MO_DBG_INFO("CRC-32: %08lx", (unsigned long) crc32_value);
+    }
+}
+
+void MongooseFtpClient::updateProgress() {
+    if (!ctrl_conn || !data_conn_accepted) {
+        return; //no transfer running
+    }
+
+    auto now = mocpp_tick_ms();
+    if (now - sample_time < progress_interval_ms) {
+        return;
+    }
+
+    current_rate = (unsigned long) (1000ULL * (transfer_bytes - sample_bytes) / (now - sample_time));
+    if (current_rate > peak_rate) {
+        peak_rate = current_rate;
+    }
+    sample_time = now;
+    sample_bytes = transfer_bytes;
+
+    if (onProgress) {
+        MongooseFtpProgress progress;
+        progress.bytes = transfer_bytes;
+        progress.total = transfer_total;
+        progress.rate = current_rate;
+        if (transfer_total > transfer_bytes && current_rate > 0) {
+            progress.eta_ms = (unsigned long) (1000ULL * (transfer_total - transfer_bytes) / current_rate);
+        }
+        onProgress(progress);
+    }
+}
+
+bool MongooseFtpClient::checkStall() {
+    if (stall_timeout_ms == 0 || !ctrl_conn || (cmd_queue_len == 0 && !data_conn && !server_done)) {
+        return false; //watchdog off or not waiting for anything
+    }
+
+    if (mocpp_tick_ms() - last_activity < stall_timeout_ms) {
         return false;
     }
 
+    stall_count++;
+    MO_DBG_WARN("no progress on %s for %lu ms, abort %s", data_conn ? "data ch" : "ctrl ch", stall_timeout_ms, fname.c_str());
+
+    //close immediately. Draining would wait for the stalled peer to read the send buffer
+    if (data_conn) {
+        data_conn->MG_COMPAT_FN_DATA = nullptr;
+        mg_compat_close_conn(data_conn);
+        data_conn_accepted = false;
+        data_conn = nullptr;
+    }
+    mg_compat_close_conn(ctrl_conn);
+    trackActivity(); //don't abort twice until the close event arrives
+    return true;
+}
+
+MongooseFtpStats MongooseFtpClient::getStats() {
+    MongooseFtpStats stats;
+    stats.bytes = transfer_bytes;
+    if (transfer_start) {
+        stats.duration_ms = (transfer_end ? transfer_end : mocpp_tick_ms()) - transfer_start;
+    }
+    if (stats.duration_ms > 0) {
+        stats.avg_rate = (unsigned long) (1000ULL * transfer_bytes / stats.duration_ms);
+    }
+    stats.peak_rate = peak_rate > stats.avg_rate ? peak_rate : stats.avg_rate; //transfers shorter than one interval
+    stats.stall_count = stall_count;
+    return stats;
+}
+
+bool MongooseFtpClient::openCtrlConn() {
     if (ctrl_conn) {
         MO_DBG_WARN("close dangling ctrl channel");
         ctrl_conn->MG_COMPAT_FN_DATA = nullptr;
@@ -263,52 +404,341 @@ bool MongooseFtpClient::getFile(const char *ftp_url_raw, std::function<size_t(un
         ctrl_conn = nullptr;
     }
 
+    ctrl_opened = false;
+    ctrl_closed = false;
+    ctrl_reused = false;
+    server_done = false;
+    data_tail.clear(); //a resumed download fetches these bytes again
+    request_start = mocpp_tick_ms();
+    trackActivity();
+    ttfb_ms = 0;
+    first_byte = false;
+
+    //resuming requires the FEAT check after login. Only take pooled sessions if that's not necessary
+    if (session_pool && !(method == Method::Retrieve && getResumeOffset() > 0 && !rest_supported)) {
+        ctrl_conn = session_pool->take(getSessionKey());
+    }
+
+    if (ctrl_conn) {
+        //logged-in session, continue directly after login
+        MO_DBG_DEBUG("reuse ctrl conn %s", url.c_str());
+        ctrl_conn->MG_COMPAT_FN = ftp_ctrl_cb;
+        ctrl_conn->MG_COMPAT_FN_DATA = this;
+        ctrl_opened = true;
+        ctrl_reused = true;
+        clearCmds();
+        return sendTransferSetup();
+    }
+
     ctrl_conn = mg_connect(mgr, url.c_str(), ftp_ctrl_cb, this);
 
+    clearCmds();
+    expectReply(Cmd::Greeting);
+
+    return ctrl_conn != nullptr;
+}
+
+void MongooseFtpClient::releaseDataConn() {
+    if (data_conn) {
+        data_conn->MG_COMPAT_FN_DATA = nullptr;
+        mg_compat_drain_conn(data_conn);
+        data_conn_accepted = false;
+        data_conn = nullptr;
+    }
+}
+
+bool MongooseFtpClient::releaseCtrlConn() {
     if (!ctrl_conn) {
         return false;
     }
 
-    this->method = Method::Retrieve;
-    this->fileWriter = fileWriter;
-    this->onClose = onClose;
+    releaseDataConn(); //onClose may delete this session. The data conn must not reference it anymore
+
+    auto c = ctrl_conn;
+    ctrl_conn = nullptr;
+    clearCmds();
+
+    if (session_pool && session_pool->park(getSessionKey(), c)) {
+        MO_DBG_DEBUG("keep ctrl conn %s", url.c_str());
+    } else {
+        c->MG_COMPAT_FN_DATA = nullptr;
+        mg_printf(c, "QUIT\r\n");
+        mg_compat_drain_conn(c);
+    }
+
+    ctrl_closed = true;
+    reportTransfer();
+    if (onClose) {
+        onClose();
+        onClose = nullptr;
+    }
+    return true;
+}
+
+namespace MicroOcpp {
+static const char *ftp_cmd_names [] = {
+    nullptr, //Greeting
+    "AUTH TLS",
+    "USER",
+    "PASS",
+    "FEAT",
+    "CWD",
+    "TYPE",
+    "PBSZ",
+    "PROT",
+    "SIZE",
+    "PASV",
+    "REST",
+    "RETR",
+    "APPE"
+};
+}
+
+bool MongooseFtpClient::sendCmd(Cmd cmd, const char *arg) {
+    if (!ctrl_conn || cmd == Cmd::Greeting || cmd >= Cmd::UNDEFINED) {
+        MO_DBG_ERR("invalid args");
+        return false;
+    }
+
+    if (!expectReply(cmd)) {
+        return false;
+    }
 
+    trackActivity(); //the watchdog measures the reply time from here
+
+    const char *name = ftp_cmd_names[static_cast<size_t>(cmd)];
+    if (arg) {
+        mg_printf(ctrl_conn, "%s %s\r\n", name, arg);
+    } else {
+        mg_printf(ctrl_conn, "%s\r\n", name);
+    }
     return true;
 }
 
-bool MongooseFtpClient::postFile(const char *ftp_url_raw, std::function<size_t(unsigned char *out, size_t buffsize)> fileReader, std::function<void()> onClose) {
+bool MongooseFtpClient::expectReply(Cmd cmd) {
+    if (cmd_queue_len >= MO_FTP_CMD_QUEUE) {
+        MO_DBG_ERR("too many pipelined commands");
+        return false;
+    }
+    cmd_queue[(cmd_queue_head + cmd_queue_len) % MO_FTP_CMD_QUEUE] = cmd;
+    cmd_queue_len++;
+    return true;
+}
+
+MongooseFtpClient::Cmd MongooseFtpClient::peekCmd() {
+    return cmd_queue_len > 0 ? cmd_queue[cmd_queue_head] : Cmd::UNDEFINED;
+}
+
+MongooseFtpClient::Cmd MongooseFtpClient::popCmd() {
+    if (cmd_queue_len == 0) {
+        return Cmd::UNDEFINED;
+    }
+    auto cmd = cmd_queue[cmd_queue_head];
+    cmd_queue_head = (cmd_queue_head + 1) % MO_FTP_CMD_QUEUE;
+    cmd_queue_len--;
+    return cmd;
+}
+
+void MongooseFtpClient::clearCmds() {
+    cmd_queue_head = 0;
+    cmd_queue_len = 0;
+    reply_parser.reset();
+}
+
+bool MongooseFtpClient::sendTransferSetup() {
+    bool success = true;
+
+    MO_DBG_VERBOSE("select directory %s", dir.empty() ? "/" : dir.c_str());
+    success &= sendCmd(Cmd::Cwd, dir.empty() ? "/" : dir.c_str());
+    success &= sendCmd(Cmd::Type, "I"); //binary mode, otherwise the byte offsets of SIZE and REST are undefined
+
+    if (method == Method::Size) {
+        MO_DBG_VERBOSE("query size and REST support");
+        success &= sendCmd(Cmd::Size, fname.c_str());
+        success &= sendCmd(Cmd::Feat);
+        return success;
+    }
+
+    if (method == Method::Retrieve && range_len == 0) {
+        success &= sendCmd(Cmd::Size, fname.c_str()); //for progress reporting
+    }
+
+    MO_DBG_VERBOSE("enter passive mode");
+    if (!proto.compare("ftps://")) {
+        success &= sendCmd(Cmd::Pbsz, "0");
+        success &= sendCmd(Cmd::Prot, "P");
+    }
+    success &= sendCmd(Cmd::Pasv);
+    return success;
+}
+
+std::string MongooseFtpClient::getSessionKey() {
+    return proto + user + "@" + url;
+}
+
+void MongooseFtpClient::trackFirstByte() {
+    if (!first_byte) {
+        first_byte = true;
+        ttfb_ms = mocpp_tick_ms() - request_start;
+        MO_DBG_DEBUG("time to first byte: %lu ms (%s ctrl conn)", ttfb_ms, ctrl_reused ? "reused" : "new");
+    }
+}
+
+bool MongooseFtpClient::getFile(const char *ftp_url_raw, std::function<size_t(unsigned char *data, size_t len)> fileWriter, std::function<void()> onClose) {
+    if (!fileWriter) {
+        MO_DBG_ERR("invalid args");
+        return false;
+    }
+    this->fileWriter = fileWriter;
+    this->sink = nullptr;
+    return initDownload(ftp_url_raw, 0, 0, onClose);
+}
+
+bool MongooseFtpClient::getFile(const char *ftp_url_raw, MongooseFtpSink& sink, std::function<void()> onClose) {
+    this->fileWriter = nullptr;
+    this->sink = &sink;
+    return initDownload(ftp_url_raw, 0, 0, onClose);
+}
+
+bool MongooseFtpClient::initDownload(const char *ftp_url_raw, size_t range_start, size_t range_len, std::function<void()> onClose) {
     
-    MO_DBG_WARN("FTP upload experimental. Please test, evaluate and report the results on GitHub");
+    MO_DBG_WARN("FTP download experimental. Please test, evaluate and report the results on GitHub");
     
-    if (!ftp_url_raw || !fileReader) {
+    if (!ftp_url_raw) {
         MO_DBG_ERR("invalid args");
         return false;
     }
 
-    MO_DBG_DEBUG("init upload %s", ftp_url_raw);
+    MO_DBG_DEBUG("init download %s", ftp_url_raw);
 
     if (!readUrl(ftp_url_raw)) {
         return false;
     }
 
-    if (ctrl_conn) {
-        MO_DBG_WARN("close dangling ctrl channel");
-        ctrl_conn->MG_COMPAT_FN_DATA = nullptr;
-        mg_compat_drain_conn(ctrl_conn);
-        ctrl_conn = nullptr;
+    this->method = Method::Retrieve;
+    this->transfer_bytes = 0;
+    this->onClose = onClose;
+
+    transfer_complete = false;
+    transfer_bytes_received = 0;
+    copy_bytes = 0;
+    transfer_start = 0;
+    transfer_end = 0;
+    transfer_total = range_len;
+    current_rate = 0;
+    peak_rate = 0;
+    stall_count = 0;
+    retry_allowed = true;
+    retry_pending = false;
+    retry_count = 0;
+    rest_supported = false;
+    this->range_start = range_start; //before openCtrlConn. A pooled session sends the transfer setup right away
+    this->range_len = range_len;
+    file_size = 0;
+    file_size_known = false; //checked against the received bytes
+    sha256.reset();
+    crc32_value = 0;
+
+    return openCtrlConn();
+}
+
+bool MongooseFtpClient::getFileRange(const char *ftp_url, size_t range_start, size_t range_len, std::function<size_t(unsigned char *data, size_t len)> fileWriter, std::function<void()> onClose) {
+    if (!fileWriter) {
+        MO_DBG_ERR("invalid args");
+        return false;
     }
+    this->fileWriter = fileWriter;
+    this->sink = nullptr;
+    return initDownload(ftp_url, range_start, range_len, onClose);
+}
 
-    ctrl_conn = mg_connect(mgr, url.c_str(), ftp_ctrl_cb, this);
+bool MongooseFtpClient::querySize(const char *ftp_url_raw, std::function<void()> onClose) {
 
-    if (!ctrl_conn) {
+    if (!ftp_url_raw) {
+        MO_DBG_ERR("invalid args");
         return false;
     }
 
-    this->method = Method::Append;
+    MO_DBG_DEBUG("query size %s", ftp_url_raw);
+
+    if (!readUrl(ftp_url_raw)) {
+        return false;
+    }
+
+    this->method = Method::Size;
+    this->onClose = onClose;
+
+    file_size = 0;
+    file_size_known = false;
+    transfer_complete = false;
+    retry_pending = false;
+    rest_supported = false;
+
+    return openCtrlConn();
+}
+
+bool MongooseFtpClient::postFile(const char *ftp_url_raw, std::function<size_t(unsigned char *out, size_t buffsize)> fileReader, std::function<void()> onClose) {
+    if (!fileReader) {
+        MO_DBG_ERR("invalid args");
+        return false;
+    }
     this->fileReader = fileReader;
+    this->source = nullptr;
+    return initUpload(ftp_url_raw, onClose);
+}
+
+bool MongooseFtpClient::postFile(const char *ftp_url_raw, MongooseFtpSource& source, std::function<void()> onClose) {
+    this->fileReader = nullptr;
+    this->source = &source;
+    return initUpload(ftp_url_raw, onClose);
+}
+
+bool MongooseFtpClient::initUpload(const char *ftp_url_raw, std::function<void()> onClose) {
+    
+    MO_DBG_WARN("FTP upload experimental. Please test, evaluate and report the results on GitHub");
+    
+    if (!ftp_url_raw) {
+        MO_DBG_ERR("invalid args");
+        return false;
+    }
+
+    MO_DBG_DEBUG("init upload %s", ftp_url_raw);
+
+    if (!readUrl(ftp_url_raw)) {
+        return false;
+    }
+
+    this->method = Method::Append;
+    this->transfer_bytes = 0;
     this->onClose = onClose;
 
-    return true;
+    transfer_complete = false;
+    retry_pending = false;
+    copy_bytes = 0;
+    transfer_start = 0;
+    transfer_end = 0;
+    transfer_total = 0;
+    current_rate = 0;
+    peak_rate = 0;
+    stall_count = 0;
+
+#if MO_FTP_GZIP
+    gzip.reset();
+    if (gzip_upload) {
+        gzip.reset(new MongooseFtpGzipStage());
+        if (!gzip->init()) {
+            gzip.reset();
+            return false;
+        }
+
+        const char *suffix = ".gz";
+        if (fname.length() < strlen(suffix) || fname.compare(fname.length() - strlen(suffix), strlen(suffix), suffix)) {
+            fname += suffix;
+        }
+    }
+#endif
+
+    return openCtrlConn();
 }
 
 void ftp_ctrl_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
@@ -317,6 +747,12 @@ void ftp_ctrl_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
         (void)0;
     }
 
+#if MO_MG_CA_CACHE
+    if (ev == MG_EV_CLOSE) {
+        releaseTlsCaStore(c);
+    }
+#endif
+
 #if defined(MO_MG_VERSION_614)
     if (ev == MG_EV_CONNECT && *(int *) ev_data != 0) {
         MO_DBG_WARN("connection error %d", *(int *) ev_data);
@@ -360,174 +796,322 @@ void ftp_ctrl_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
     } else if (ev == MG_EV_CLOSE) {
         MO_DBG_DEBUG("connection %s -- closed", session.url.c_str());
         session.ctrl_closed = true;
+        session.ctrl_conn = nullptr;
+        if (session.scheduleRetry()) {
+            return; //MongooseFtpClient::loop() reopens the ctrl conn and resumes the download
+        }
+        session.releaseDataConn();
+        session.reportTransfer();
         if (session.onClose) {
             session.onClose();
             session.onClose = nullptr;
         }
-        session.ctrl_conn = nullptr;
-    } else if (ev == MG_COMPAT_EV_READ || ev == MG_COMPAT_EV_TLS_HS) {
-        // read multi-line command
-        char *line_next = (char*) c->MG_COMPAT_RECV.buf;
-        while (line_next < (char*) c->MG_COMPAT_RECV.buf + c->MG_COMPAT_RECV.len) {
-
-            // take current line
-            char *line = line_next;
-
-            // null-terminate current line and find begin of next line
-            while (line_next + 1 < (char*)c->MG_COMPAT_RECV.buf + c->MG_COMPAT_RECV.len && *line_next != '\n') {
-                line_next++;
+        return;
+    } else if (ev == MG_COMPAT_EV_TLS_HS) { // Just completed AUTH TLS handshake
+        MO_DBG_DEBUG("select user %s", session.user.empty() ? "anonymous" : session.user.c_str());
+        session.sendCmd(MongooseFtpClient::Cmd::User, session.user.empty() ? "anonymous" : session.user.c_str());
+    } else if (ev == MG_EV_POLL) {
+        if (session.server_done && !session.transfer_complete) {
+            //226 has been received. Wait until the data conn has passed all bytes
+            int action = ftp_download_finish(session, c);
+            if (action == FTP_REPLY_RELEASE) {
+                session.releaseCtrlConn(); //may delete session
+                return;
+            }
+        }
+    } else if (ev == MG_COMPAT_EV_READ) {
+        session.ctrl_last_recv = mocpp_tick_ms();
+        session.trackActivity();
+
+        //process all complete reply lines. Several replies can arrive in one read if commands are pipelined
+        size_t offset = 0;
+        int action = FTP_REPLY_CONTINUE;
+        while (action == FTP_REPLY_CONTINUE) {
+            MongooseFtpReplyLine line;
+            size_t consumed = session.reply_parser.next((const char*) c->MG_COMPAT_RECV.buf + offset, c->MG_COMPAT_RECV.len - offset, line);
+            if (consumed == 0) {
+                break; //wait for the rest of the line
             }
-            *line_next = '\0';
-            line_next++;
+            offset += consumed;
 
-            MO_DBG_DEBUG("RECV: %s", line);
+            MO_DBG_DEBUG("RECV: %.*s", (int) line.len, line.text);
 
-            if (!session.proto.compare("ftps://") && !MG_COMPAT_IS_TLS(c)) { //tls not initialized yet
-                if (!strncmp("220", line, 3)) {
-                    MO_DBG_VERBOSE("start AUTH TLS");
-                    mg_printf(c, "AUTH TLS\r\n");
-                    break;
-                } else if (!strncmp("234", line, 3)) { // Proceed with TLS negotiation
-                    MO_DBG_VERBOSE("upgrade to TLS");
-
-                    #if defined(MO_MG_VERSION_614)
-                    session.ctrl_tls_want_upgrade = true; //triggers TLS upgrade in FtpClient::loop() function (this "indirection" is needed for backwards compatibility with MG v6.14)
-                    #else
-                    session.upgradeTlsCtrlConn();
-                    #endif
-
-                    //keep msg in read buffer so that next poll will execute this state machine (enter case `ev == MG_COMPAT_EV_TLS_HS`)
-                    return;
-                } else {
-                    MO_DBG_WARN("TLS negotiation failure: %s", line);
-                    if (session.data_conn) {
-                        mg_compat_drain_conn(session.data_conn);
-                    }
-                    mg_printf(c, "QUIT\r\n");
-                    mg_compat_drain_conn(c);
-                    break;
-                }
-            } else if (!strncmp("530", line, 3)     // Not logged in
-                    || !strncmp("220", line, 3)     // Service ready for new user
-                    || ev == MG_COMPAT_EV_TLS_HS) { // Just completed AUTH TLS handshake
-                MO_DBG_DEBUG("select user %s", session.user.empty() ? "anonymous" : session.user.c_str());
-                mg_printf(c, "USER %s\r\n", session.user.empty() ? "anonymous" : session.user.c_str());
-                break;
-            } else if (!strncmp("331", line, 3)) { // User name okay, need password
-                MO_DBG_DEBUG("enter pass %.2s***", session.pass.empty() ? "-" : session.pass.c_str());
-                mg_printf(c, "PASS %s\r\n", session.pass.c_str());
-                break;
-            } else if (!strncmp("230", line, 3)) { // User logged in, proceed
-                MO_DBG_VERBOSE("select directory %s", session.dir.empty() ? "/" : session.dir.c_str());
-                mg_printf(c, "CWD %s\r\n", session.dir.empty() ? "/" : session.dir.c_str());
-                break;
-            } else if (!strncmp("250", line, 3)) { // Requested file action okay, completed
-                MO_DBG_VERBOSE("enter passive mode");
-                if (!session.proto.compare("ftps://")) {
-                    mg_printf(c, "PBSZ 0\r\n");
-                    mg_printf(c, "PROT P\r\n");
-                }
-                mg_printf(c, "PASV\r\n");
-                break;
-            } else if (!strncmp("227", line, 3)) { // Entering Passive Mode (h1,h2,h3,h4,p1,p2)
+            action = ftp_ctrl_on_reply(session, c, line);
+        }
 
-                // parse address field. Replace all non-digits by delimiter character ' '
-                for (size_t i = 3; line + i < line_next; i++) {
-                    if (line[i] < '0' || line[i] > '9') {
-                        line[i] = (unsigned char) ' ';
-                    }
-                }
+        if (action == FTP_REPLY_RELEASE) {
+            c->MG_COMPAT_RECV.len = 0;
+            session.releaseCtrlConn(); //may delete session
+            return;
+        } else if (action == FTP_REPLY_STOP) {
+            c->MG_COMPAT_RECV.len = 0; //connection is closing, discard further replies
+        } else {
+            mg_compat_iobuf_consume(&c->MG_COMPAT_RECV, offset); //keep incomplete line for the next read
+            if (c->MG_COMPAT_RECV.len > MO_FTP_CTRL_LINE_MAX) {
+                MO_DBG_ERR("reply line exceeds %u bytes", (unsigned int) MO_FTP_CTRL_LINE_MAX);
+                c->MG_COMPAT_RECV.len = 0;
+                ftp_ctrl_abort(session, c);
+            }
+        }
+    }
 
-                unsigned int h1 = 0, h2 = 0, h3 = 0, h4 = 0, p1 = 0, p2 = 0;
+    if (dbg_track_send_len != c->MG_COMPAT_SEND.len && c->MG_COMPAT_SEND.buf) {
+        MO_DBG_DEBUG("SEND: %.*s", (int) c->MG_COMPAT_SEND.len, (const char*) c->MG_COMPAT_SEND.buf);
+    }
+}
 
-                auto ret = sscanf((const char *)c->MG_COMPAT_RECV.buf + 3, "%u %u %u %u %u %u", &h1, &h2, &h3, &h4, &p1, &p2);
-                if (ret == 6) {
-                    unsigned int port = 256U * p1 + p2;
+void ftp_ctrl_quit(MongooseFtpClient& session) {
+    if (session.ctrl_conn) {
+        mg_printf(session.ctrl_conn, "QUIT\r\n");
+    }
+}
 
-                    char url [64] = {'\0'};
-                    auto ret = snprintf(url, 64, "tcp://%u.%u.%u.%u:%u", h1, h2, h3, h4, port);
-                    if (ret < 0 || ret >= 64) {
-                        MO_DBG_ERR("url format failure");
-                        mg_printf(c, "QUIT\r\n");
-                        mg_compat_drain_conn(c);
-                        break;
-                    }
-                    MO_DBG_DEBUG("FTP upload address: %s", url);
-                    session.data_url = url;
-
-                    if (session.data_conn) {
-                        MO_DBG_WARN("close dangling data channel");
-                        session.data_conn->MG_COMPAT_FN_DATA = nullptr;
-                        mg_compat_drain_conn(session.data_conn);
-                        session.data_conn_accepted = false;
-                        session.data_conn = nullptr;
-                    }
+int ftp_ctrl_abort(MongooseFtpClient& session, struct mg_connection *c) {
+    if (session.data_conn) {
+        mg_compat_drain_conn(session.data_conn);
+    }
+    session.clearCmds(); //replies which arrive until the conn is closed (e.g. 226) must not complete the transfer
+    mg_printf(c, "QUIT\r\n");
+    mg_compat_drain_conn(c);
+    return FTP_REPLY_STOP;
+}
 
-                    session.data_conn = mg_connect(c->mgr, url, ftp_data_cb, &session);
+int ftp_ctrl_on_reply(MongooseFtpClient& session, struct mg_connection *c, const MongooseFtpReplyLine& line) {
+    using Cmd = MongooseFtpClient::Cmd;
 
-                    if (!session.data_conn) {
-                        MO_DBG_ERR("cannot open data ch");
-                        mg_printf(c, "QUIT\r\n");
-                        mg_compat_drain_conn(c);
-                        break;
-                    }
+    if (!line.final) {
+        //intermediate line of a multi-line reply. Only the feature list of FEAT is of interest
+        if (session.peekCmd() == Cmd::Feat && ftp_line_contains(line, "REST STREAM")) {
+            session.rest_supported = true;
+        }
+        return FTP_REPLY_CONTINUE;
+    }
 
-                    //success -> wait for data_conn to establish connection, ftp_data_cb will send next command
-                } else {
-                    MO_DBG_ERR("could not process ftp data address");
-                    mg_printf(c, "QUIT\r\n");
-                    mg_compat_drain_conn(c);
-                    break;
-                }
+    if (line.code == 0) {
+        MO_DBG_WARN("malformed reply (closing connection): %.*s", (int) line.len, line.text);
+        return ftp_ctrl_abort(session, c);
+    }
 
-            } else if (!strncmp("150", line, 3)    // File status okay; about to open data connection
-                    || !strncmp("125", line, 3)) { // Data connection already open
-                MO_DBG_DEBUG("data connection accepted");
-                session.data_conn_accepted = true;
-                (void)0;
-            } else if (!strncmp("226", line, 3)) { // Closing data connection. Requested file action successful (for example, file transfer or file abort)
-                MO_DBG_INFO("FTP success: %s", line);
-                if (session.data_conn) {
-                    mg_compat_drain_conn(session.data_conn);
-                }
-                mg_printf(c, "QUIT\r\n");
-                mg_compat_drain_conn(c);
+    if (line.code < 200) {
+        //positive preliminary reply. The command will receive a further reply
+        if (session.peekCmd() == Cmd::Retr || session.peekCmd() == Cmd::Appe) { // 150 File status okay; about to open data connection, or 125 Data connection already open
+            MO_DBG_DEBUG("data connection accepted");
+            session.data_conn_accepted = true;
+            if (session.transfer_bytes == 0) {
+                session.transfer_start = mocpp_tick_ms();
+                session.throttle_ms = 0;
+            }
+            session.sample_time = mocpp_tick_ms();
+            session.sample_bytes = session.transfer_bytes;
+            if (session.method == MongooseFtpClient::Method::Append && session.data_conn) {
+                ftp_upload_pump(session, session.data_conn); //send first chunks without waiting for next poll
+            }
+        }
+        return FTP_REPLY_CONTINUE;
+    }
+
+    if (line.code == 421) { // Service not available, closing control connection. Can be the reply to any command
+        MO_DBG_WARN("FTP server closes connection: %.*s", (int) line.len, line.text);
+        return ftp_ctrl_abort(session, c);
+    }
+
+    auto cmd = session.popCmd();
+
+    switch (cmd) {
+        case Cmd::Greeting:
+            if (line.code != 220) { // Service ready for new user
                 break;
-            } else if (!strncmp("55", line, 2)) { // Requested action not taken / aborted
-                MO_DBG_WARN("FTP failure: %s", line);
-                if (session.data_conn) {
-                    mg_compat_drain_conn(session.data_conn);
-                }
-                mg_printf(c, "QUIT\r\n");
-                mg_compat_drain_conn(c);
+            }
+            if (!session.proto.compare("ftps://") && !MG_COMPAT_IS_TLS(c)) { //tls not initialized yet
+                MO_DBG_VERBOSE("start AUTH TLS");
+                session.sendCmd(Cmd::AuthTls);
+            } else {
+                MO_DBG_DEBUG("select user %s", session.user.empty() ? "anonymous" : session.user.c_str());
+                session.sendCmd(Cmd::User, session.user.empty() ? "anonymous" : session.user.c_str());
+            }
+            return FTP_REPLY_CONTINUE;
+        case Cmd::AuthTls:
+            if (line.code != 234) { // Proceed with TLS negotiation
+                MO_DBG_WARN("TLS negotiation failure: %.*s", (int) line.len, line.text);
+                return ftp_ctrl_abort(session, c);
+            }
+            MO_DBG_VERBOSE("upgrade to TLS");
+
+            #if defined(MO_MG_VERSION_614)
+            session.ctrl_tls_want_upgrade = true; //triggers TLS upgrade in FtpClient::loop() function (this "indirection" is needed for backwards compatibility with MG v6.14)
+            #else
+            session.upgradeTlsCtrlConn();
+            #endif
+
+            //the login continues with event MG_COMPAT_EV_TLS_HS
+            return FTP_REPLY_CONTINUE;
+        case Cmd::User:
+            if (line.code == 331) { // User name okay, need password
+                MO_DBG_DEBUG("enter pass %.2s***", session.pass.empty() ? "-" : session.pass.c_str());
+                session.sendCmd(Cmd::Pass, session.pass.c_str());
+                return FTP_REPLY_CONTINUE;
+            } else if (line.code == 230) { // User logged in, proceed
+                return ftp_ctrl_on_login(session, c);
+            }
+            break;
+        case Cmd::Pass:
+            if (line.code == 230 || line.code == 202) { // User logged in, proceed
+                return ftp_ctrl_on_login(session, c);
+            }
+            break;
+        case Cmd::Feat:
+            // Reply to FEAT. Multi-line: "211-Features:", " REST STREAM", ..., "211 End". 5xx if FEAT isn't supported at all
+            if (line.code >= 400 && line.code < 500) {
                 break;
-            } else if (!strncmp("200", line, 3)) { //PBSZ -> 0 and PROT -> P accepted
-                MO_DBG_INFO("PBSZ/PROT success: %s", line);
+            }
+            if (session.method == MongooseFtpClient::Method::Size) {
+                //probe complete
+                session.transfer_complete = true;
+                return FTP_REPLY_RELEASE;
+            }
+            if (!session.rest_supported) {
+                MO_DBG_ERR("server does not support REST STREAM - cannot resume download");
+                session.retry_allowed = false;
+                return ftp_ctrl_abort(session, c);
+            }
+            return session.sendTransferSetup() ? FTP_REPLY_CONTINUE : ftp_ctrl_abort(session, c);
+        case Cmd::Cwd:
+            if (line.code == 250) { // Requested file action okay, completed
+                MO_DBG_VERBOSE("directory selected");
+                return FTP_REPLY_CONTINUE;
+            }
+            break;
+        case Cmd::Type:
+        case Cmd::Pbsz:
+        case Cmd::Prot:
+            if (line.code == 200) { //TYPE, PBSZ or PROT accepted
+                MO_DBG_DEBUG("command okay: %.*s", (int) line.len, line.text);
+                return FTP_REPLY_CONTINUE;
+            }
+            break;
+        case Cmd::Size:
+            if (line.code == 213) { // File status
+                unsigned long long file_size = 0;
+                size_t i = 3;
+                while (i < line.len && line.text[i] == ' ') {
+                    i++;
+                }
+                bool valid = i < line.len;
+                for (; i < line.len && line.text[i] >= '0' && line.text[i] <= '9'; i++) {
+                    file_size = 10ULL * file_size + (unsigned long long) (line.text[i] - '0');
+                }
+                if (valid) {
+                    session.file_size = (size_t) file_size;
+                    session.file_size_known = true;
+                    MO_DBG_DEBUG("file size %zu", session.file_size);
+                    if (session.method == MongooseFtpClient::Method::Retrieve && session.range_len == 0 && session.file_size > session.range_start) {
+                        session.transfer_total = session.file_size - session.range_start;
+                    }
+                }
             } else {
-                MO_DBG_WARN("unkown commad (closing connection): %s", line);
+                MO_DBG_DEBUG("file size unknown: %.*s", (int) line.len, line.text);
+            }
+            return FTP_REPLY_CONTINUE; //when probing, the reply to the pipelined FEAT completes the probe
+        case Cmd::Pasv:
+            if (line.code == 227) { // Entering Passive Mode (h1,h2,h3,h4,p1,p2)
+                return ftp_ctrl_on_pasv(session, c, line);
+            }
+            break;
+        case Cmd::Rest:
+            if (line.code == 350) { // Requested file action pending further information (REST accepted)
+                MO_DBG_DEBUG("REST accepted: %.*s", (int) line.len, line.text);
+                return FTP_REPLY_CONTINUE;
+            }
+            session.retry_allowed = false;
+            break;
+        case Cmd::Retr:
+            if (line.code == 226 || line.code == 250) { // Closing data connection. Requested file action successful
+                MO_DBG_INFO("FTP success: %.*s", (int) line.len, line.text);
+                //the server has sent all bytes, but the data conn can still hold bytes which fileWriter or the rate
+                //limiter hasn't accepted yet. The transfer is complete when they have been passed
+                session.server_done = true;
+                return ftp_download_finish(session, c);
+            }
+            break;
+        case Cmd::Appe:
+            if (line.code == 226 || line.code == 250) { // Closing data connection. Requested file action successful
+                MO_DBG_INFO("FTP success: %.*s", (int) line.len, line.text);
+                session.transfer_complete = true;
                 if (session.data_conn) {
                     mg_compat_drain_conn(session.data_conn);
                 }
-                mg_printf(c, "QUIT\r\n");
-                mg_compat_drain_conn(c);
-                break;
+                return FTP_REPLY_RELEASE;
             }
+            break;
+        default:
+            MO_DBG_WARN("unexpected reply (closing connection): %.*s", (int) line.len, line.text);
+            return ftp_ctrl_abort(session, c);
+    }
 
-            size_t consumed = line_next - line;
+    MO_DBG_WARN("FTP failure: %.*s", (int) line.len, line.text);
+    if (line.code >= 500) {
+        session.retry_allowed = false; //permanent error
+    }
+    return ftp_ctrl_abort(session, c);
+}
 
-            if (consumed > c->MG_COMPAT_RECV.len) {
-                MO_DBG_ERR("invalid state");
-                break;
-            }
+int ftp_ctrl_on_login(MongooseFtpClient& session, struct mg_connection *c) {
+    if (session.method == MongooseFtpClient::Method::Retrieve && session.getResumeOffset() > 0 && !session.rest_supported) {
+        MO_DBG_DEBUG("check REST support");
+        session.sendCmd(MongooseFtpClient::Cmd::Feat);
+        return FTP_REPLY_CONTINUE;
+    }
+
+    return session.sendTransferSetup() ? FTP_REPLY_CONTINUE : ftp_ctrl_abort(session, c);
+}
+
+int ftp_ctrl_on_pasv(MongooseFtpClient& session, struct mg_connection *c, const MongooseFtpReplyLine& line) {
 
-            c->MG_COMPAT_RECV.len -= consumed;
+    //parse address field. The numbers h1,h2,h3,h4,p1,p2 are the only digits after the reply code
+    unsigned int val [6] = {0};
+    size_t n = 0;
+    for (size_t i = 3; i < line.len && n < 6;) {
+        if (line.text[i] >= '0' && line.text[i] <= '9') {
+            unsigned int v = 0;
+            for (; i < line.len && line.text[i] >= '0' && line.text[i] <= '9' && v <= 255; i++) {
+                v = 10 * v + (unsigned int) (line.text[i] - '0');
+            }
+            val[n++] = v;
+        } else {
+            i++;
         }
-        c->MG_COMPAT_RECV.len = 0;
     }
 
-    if (dbg_track_send_len != c->MG_COMPAT_SEND.len && c->MG_COMPAT_SEND.buf) {
-        MO_DBG_DEBUG("SEND: %.*s", (int) c->MG_COMPAT_SEND.len, (const char*) c->MG_COMPAT_SEND.buf);
+    if (n != 6 || val[0] > 255 || val[1] > 255 || val[2] > 255 || val[3] > 255 || val[4] > 255 || val[5] > 255) {
+        MO_DBG_ERR("could not process ftp data address");
+        return ftp_ctrl_abort(session, c);
+    }
+
+    unsigned int port = 256U * val[4] + val[5];
+
+    char url [64] = {'\0'};
+    auto ret = snprintf(url, 64, "tcp://%u.%u.%u.%u:%u", val[0], val[1], val[2], val[3], port);
+    if (ret < 0 || ret >= 64) {
+        MO_DBG_ERR("url format failure");
+        return ftp_ctrl_abort(session, c);
     }
+    MO_DBG_DEBUG("FTP data address: %s", url);
+    session.data_url = url;
+
+    if (session.data_conn) {
+        MO_DBG_WARN("close dangling data channel");
+        session.releaseDataConn();
+    }
+
+    session.data_conn = mg_connect(c->mgr, url, ftp_data_cb, &session);
+
+    if (!session.data_conn) {
+        MO_DBG_ERR("cannot open data ch");
+        return ftp_ctrl_abort(session, c);
+    }
+
+    //success -> wait for data_conn to establish connection, ftp_data_cb will send next command
+    return FTP_REPLY_CONTINUE;
 }
 
 void ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
@@ -536,6 +1120,12 @@ void ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
         (void)0;
     }
 
+#if MO_MG_CA_CACHE
+    if (ev == MG_EV_CLOSE) {
+        releaseTlsCaStore(c);
+    }
+#endif
+
 #if defined(MO_MG_VERSION_614)
     if (ev == MG_EV_CONNECT && *(int *) ev_data != 0) {
         MO_DBG_WARN("connection error %d", *(int *) ev_data);
@@ -571,7 +1161,8 @@ void ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
 
     MongooseFtpClient& session = *reinterpret_cast<MongooseFtpClient*>(fn_data);
 
-    auto dbg_track_send_len = session.ctrl_conn->MG_COMPAT_SEND.len;
+    //the ctrl conn can be closed while the data conn is still open
+    auto dbg_track_send_len = session.ctrl_conn ? session.ctrl_conn->MG_COMPAT_SEND.len : 0;
 
     if (ev == MG_EV_CONNECT) {
         
@@ -589,16 +1180,31 @@ void ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
         MO_DBG_DEBUG("connection %s -- connected!", session.data_url.c_str());
         if (session.method == MongooseFtpClient::Method::Retrieve) {
             MO_DBG_DEBUG("get file %s", session.fname.c_str());
-            mg_printf(session.ctrl_conn, "RETR %s\r\n", session.fname.c_str());
+            if (session.getResumeOffset() > 0) {
+                //start at the range begin plus the number of bytes which fileWriter has already committed
+                char offset [24];
+                snprintf(offset, sizeof(offset), "%zu", session.getResumeOffset());
+                session.sendCmd(MongooseFtpClient::Cmd::Rest, offset);
+            }
+            session.sendCmd(MongooseFtpClient::Cmd::Retr, session.fname.c_str());
         } else if (session.method == MongooseFtpClient::Method::Append) {
             MO_DBG_DEBUG("post file %s", session.fname.c_str());
-            mg_printf(session.ctrl_conn, "APPE %s\r\n", session.fname.c_str());
+            session.sendCmd(MongooseFtpClient::Cmd::Appe, session.fname.c_str());
         } else {
             MO_DBG_ERR("unsupported method");
-            mg_printf(session.ctrl_conn, "QUIT\r\n");
+            ftp_ctrl_quit(session);
         }
     } else if (ev == MG_EV_CLOSE) {
         MO_DBG_DEBUG("connection %s -- closed", session.data_url.c_str());
+        if (session.method == MongooseFtpClient::Method::Retrieve && (session.fileWriter || session.sink) && c->MG_COMPAT_RECV.len > 0) {
+            ftp_download_pump(session, c);
+            if (c->MG_COMPAT_RECV.len > 0) {
+                //keep the held back bytes. The ctrl conn passes them before completing the transfer
+                session.data_tail.assign((unsigned char*)c->MG_COMPAT_RECV.buf, (unsigned char*)c->MG_COMPAT_RECV.buf + c->MG_COMPAT_RECV.len);
+                session.copy_bytes += c->MG_COMPAT_RECV.len;
+                c->MG_COMPAT_RECV.len = 0;
+            }
+        }
         session.data_conn_accepted = false;
         session.data_conn = nullptr;
     } else if (ev == MG_COMPAT_EV_READ) {
@@ -606,62 +1212,237 @@ void ftp_data_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
         //receive payload
         if (session.method == MongooseFtpClient::Method::Retrieve) {
 
-            if (!session.fileWriter) {
+            if (!session.fileWriter && !session.sink) {
                 MO_DBG_ERR("invalid state");
                 c->MG_COMPAT_RECV.len = 0;
-                mg_printf(session.ctrl_conn, "QUIT\r\n");
+                ftp_ctrl_quit(session);
                 mg_compat_drain_conn(c);
                 return;
             }
 
-            auto ret = session.fileWriter((unsigned char*)c->MG_COMPAT_RECV.buf, c->MG_COMPAT_RECV.len);
+            session.transfer_bytes_received += MG_COMPAT_EV_READ_LEN(ev_data);
+            session.trackFirstByte();
+
+            ftp_download_pump(session, c);
+        } //else: ignore incoming messages if Method is not Retrieve
+    } else if (ev == MG_COMPAT_EV_WRITE || ev == MG_EV_POLL) {
+        //refill as soon as the socket has accepted data, poll only as fallback
+        ftp_upload_pump(session, c);
+
+        if (ev == MG_EV_POLL && session.method == MongooseFtpClient::Method::Retrieve && (session.fileWriter || session.sink) && c->MG_COMPAT_RECV.len > 0) {
+            //pass data which has been held back by the rate limiter or a partial fileWriter
+            ftp_download_pump(session, c);
+        }
+    }
+
+    if (session.ctrl_conn && dbg_track_send_len != session.ctrl_conn->MG_COMPAT_SEND.len && session.ctrl_conn->MG_COMPAT_SEND.buf) {
+        MO_DBG_DEBUG("SEND: %.*s", (int) session.ctrl_conn->MG_COMPAT_SEND.len, (const char*) session.ctrl_conn->MG_COMPAT_SEND.buf);
+    }
+}
+
+void ftp_upload_pump(MongooseFtpClient& session, struct mg_connection *c) {
+    if (session.method != MongooseFtpClient::Method::Append || !session.data_conn_accepted) {
+        return;
+    }
+
+    if (!session.fileReader && !session.source) {
+        MO_DBG_ERR("invalid state");
+        ftp_ctrl_quit(session);
+        mg_compat_drain_conn(c);
+        return;
+    }
+
+    size_t chunk_size = session.upload_chunk_size > 0 ? session.upload_chunk_size : MO_FTP_UPLOAD_CHUNK_SIZE;
+
+    //double buffering: keep up to two chunks in the send buffer. When the socket has sent one chunk, read the
+    //next one from the file while the other chunk is still being sent
+    if (c->MG_COMPAT_SEND.size < 2 * chunk_size) {
+        mg_compat_iobuf_resize(&c->MG_COMPAT_SEND, 2 * chunk_size);
+        if (c->MG_COMPAT_SEND.size < 2 * chunk_size) {
+            MO_DBG_ERR("OOM");
+            return; //try again with next poll
+        }
+    }
+
+    while (c->MG_COMPAT_SEND.len <= chunk_size) {
+        size_t want = session.acquireTokens(chunk_size);
+        if (want == 0) {
+            return; //rate limit reached. Continue with next poll
+        }
 
-            if (ret <= c->MG_COMPAT_RECV.len) {
-                c->MG_COMPAT_RECV.len -= ret;
+        size_t ret = session.readPayload((unsigned char*)c->MG_COMPAT_SEND.buf + c->MG_COMPAT_SEND.len, want);
+
+        if (ret < want) {
+            session.releaseTokens(want - ret); //short read or EOF
+        }
+
+        if (ret > want) {
+            MO_DBG_ERR("read error, abort upload");
+            //on a regular close of the data conn, the server would store the truncated file and confirm it with
+            //226. Discard the pending chunks, close the data conn immediately and abort on the ctrl conn
+            session.data_conn_accepted = false;
+            session.retry_allowed = false;
+            c->MG_COMPAT_SEND.len = 0;
+            if (session.ctrl_conn) {
+                mg_printf(session.ctrl_conn, "ABOR\r\n");
+                ftp_ctrl_abort(session, session.ctrl_conn);
             } else {
-                MO_DBG_ERR("write error");
-                c->MG_COMPAT_RECV.len = 0;
-                mg_printf(session.ctrl_conn, "QUIT\r\n");
+                mg_compat_close_conn(c);
             }
-        } //else: ignore incoming messages if Method is not Retrieve
-    } else if (ev == MG_EV_POLL) {
-        if (session.method == MongooseFtpClient::Method::Append && session.data_conn_accepted) {
+            return;
+        }
 
-            if (!session.fileReader) {
-                MO_DBG_ERR("invalid state");
-                mg_printf(session.ctrl_conn, "QUIT\r\n");
-                mg_compat_drain_conn(c);
-                return;
+        if (ret == 0) {
+            auto duration = mocpp_tick_ms() - session.transfer_start;
+            MO_DBG_INFO("finished file reading: %zu bytes in %lu ms (%lu B/s, throttled %lu ms)",
+                    session.transfer_bytes, duration,
+                    session.getTransferRate(), session.throttle_ms);
+            #if MO_FTP_GZIP
+            if (session.gzip) {
+                MO_DBG_INFO("gzip: %zu -> %zu bytes (ratio %lu%%), deflate took %lu ms",
+                        session.gzip->bytes_in, session.gzip->bytes_out,
+                        session.gzip->bytes_in > 0 ? (unsigned long) (100ULL * session.gzip->bytes_out / session.gzip->bytes_in) : 0UL,
+                        session.gzip->cpu_ms);
             }
+            #endif
+            session.data_conn_accepted = false;
+            mg_compat_drain_conn(c);
 
-            if (c->MG_COMPAT_SEND.len == 0) { //fill send buff
-                if (c->MG_COMPAT_SEND.size < 512) {
-                    mg_compat_iobuf_resize(&c->MG_COMPAT_SEND, 512);
-                }
+            //on MG v7 and MbedTLS, call mbedtls_ssl_close_notify() when closing
+            #if !defined(MO_MG_VERSION_614) && MG_COMPAT_TLS == MG_COMPAT_MBEDTLS
+            if (auto tls = mg_compat_get_tls(c)) {
+                MO_DBG_DEBUG("TLS shutdown");
+                mbedtls_ssl_close_notify(tls);
+            }
+            #endif
+            return;
+        }
 
-                c->MG_COMPAT_SEND.len = session.fileReader((unsigned char*)c->MG_COMPAT_SEND.buf, c->MG_COMPAT_SEND.size);
+        c->MG_COMPAT_SEND.len += ret;
+        session.transfer_bytes += ret;
+        session.trackActivity();
+        session.trackFirstByte();
+    }
+}
 
-                if (c->MG_COMPAT_SEND.len == 0) {
-                    MO_DBG_DEBUG("finished file reading");
-                    session.data_conn_accepted = false;
-                    mg_compat_drain_conn(c);
+size_t ftp_download_write(MongooseFtpClient& session, unsigned char *buf, size_t avail, bool& held_back) {
 
-                    //on MG v7 and MbedTLS, call mbedtls_ssl_close_notify() when closing
-                    #if !defined(MO_MG_VERSION_614) && MG_COMPAT_TLS == MG_COMPAT_MBEDTLS
-                    if (auto tls = mg_compat_get_tls(c)) {
-                        MO_DBG_DEBUG("TLS shutdown");
-                        mbedtls_ssl_close_notify(tls);
-                    }
-                    #endif
-                    return;
-                }
-            }
+    size_t len = avail;
+    if (session.range_len > 0 && len > session.range_len - session.transfer_bytes) {
+        len = session.range_len - session.transfer_bytes; //don't pass bytes beyond the range end
+    }
+
+    size_t want = len;
+    len = session.acquireTokens(len);
+    held_back = len < want;
+
+    size_t ret = 0;
+    if (len > 0) {
+        ret = session.writePayload(buf, len);
+    }
+
+    if (ret > len) {
+        return avail + 1;
+    }
+
+    if (ret < len) {
+        session.releaseTokens(len - ret); //fileWriter is busy. The remainder is passed again with the next call
+    }
+
+    //hash the accepted bytes while they are still in RAM. The remainder is passed again with the next call
+    if (session.digest_sha256) {
+        session.sha256.update(buf, ret);
+    }
+    if (session.digest_crc32) {
+        session.crc32_value = digest_crc32(buf, ret, session.crc32_value);
+    }
+    session.transfer_bytes += ret;
+    if (ret > 0) {
+        session.trackActivity();
+    }
+    return ret;
+}
+
+void ftp_download_pump(MongooseFtpClient& session, struct mg_connection *c) {
+
+    bool held_back = false;
+    size_t ret = ftp_download_write(session, (unsigned char*)c->MG_COMPAT_RECV.buf, c->MG_COMPAT_RECV.len, held_back);
+
+    if (ret <= c->MG_COMPAT_RECV.len) {
+        if (ret < c->MG_COMPAT_RECV.len) {
+            session.copy_bytes += c->MG_COMPAT_RECV.len - ret; //the remainder is shifted to the buffer begin
+        }
+        mg_compat_iobuf_consume(&c->MG_COMPAT_RECV, ret);
+    } else {
+        MO_DBG_ERR("write error");
+        c->MG_COMPAT_RECV.len = 0;
+        session.retry_allowed = false;
+        if (session.ctrl_conn) {
+            ftp_ctrl_abort(session, session.ctrl_conn);
+        } else {
+            mg_compat_drain_conn(c);
         }
+        return;
     }
 
-    if (dbg_track_send_len != session.ctrl_conn->MG_COMPAT_SEND.len && session.ctrl_conn->MG_COMPAT_SEND.buf) {
-        MO_DBG_DEBUG("SEND: %.*s", (int) session.ctrl_conn->MG_COMPAT_SEND.len, (const char*) session.ctrl_conn->MG_COMPAT_SEND.buf);
+    //hold back the sender while the rate limiter keeps data in the recv buffer
+    mg_compat_pause_recv(c, held_back);
+
+    if (session.range_len > 0 && session.transfer_bytes >= session.range_len) {
+        //range complete. The server would continue until the end of the file
+        MO_DBG_DEBUG("range complete");
+        session.transfer_complete = true;
+        c->MG_COMPAT_RECV.len = 0;
+        mg_compat_drain_conn(c);
+        if (session.ctrl_conn) {
+            mg_printf(session.ctrl_conn, "ABOR\r\nQUIT\r\n");
+            mg_compat_drain_conn(session.ctrl_conn);
+        }
+    }
+}
+
+int ftp_download_finish(MongooseFtpClient& session, struct mg_connection *c) {
+
+    if (!session.data_tail.empty()) {
+        //bytes which were still in the recv buffer when the data conn closed
+        bool held_back = false;
+        size_t ret = ftp_download_write(session, session.data_tail.data(), session.data_tail.size(), held_back);
+        if (ret > session.data_tail.size()) {
+            MO_DBG_ERR("write error");
+            session.data_tail.clear();
+            session.retry_allowed = false;
+            return ftp_ctrl_abort(session, c);
+        }
+        session.data_tail.erase(session.data_tail.begin(), session.data_tail.begin() + ret);
+        if (session.range_len > 0 && session.transfer_bytes >= session.range_len) {
+            session.data_tail.clear(); //bytes beyond the range end
+        }
     }
+
+    if (session.data_conn || !session.data_tail.empty()) {
+        return FTP_REPLY_CONTINUE; //fileWriter or the rate limiter holds back the remaining bytes. Retry with next poll
+    }
+
+    size_t expected = 0;
+    bool expected_known = false;
+    if (session.range_len > 0) {
+        expected = session.range_len;
+        expected_known = true;
+    } else if (session.file_size_known && session.file_size >= session.range_start) {
+        expected = session.file_size - session.range_start;
+        expected_known = true;
+    }
+
+    if (expected_known && session.transfer_bytes != expected) {
+        MO_DBG_WARN("download incomplete: %zu of %zu bytes", session.transfer_bytes, expected);
+        if (session.transfer_bytes > expected) {
+            session.retry_allowed = false; //file has changed on the server
+        }
+        return ftp_ctrl_abort(session, c); //the close event of the ctrl conn resumes the download
+    }
+
+    session.transfer_complete = true;
+    return FTP_REPLY_RELEASE;
 }
 
 bool MongooseFtpClient::readUrl(const char *ftp_url_raw) {
@@ -739,3 +1520,263 @@ bool MongooseFtpClient::readUrl(const char *ftp_url_raw) {
 
     return true;
 }
+
+size_t MongooseFtpClient::acquireTokens(size_t want) {
+    if (!rate_limiter || !rate_limiter->isEnabled() || want == 0) {
+        return want;
+    }
+
+    size_t granted = rate_limiter->acquire(want);
+
+    if (granted < want) {
+        trackActivity(); //held back on purpose, not stalled
+    }
+
+    if (granted < want && !throttled) {
+        throttled = true;
+        throttle_since = mocpp_tick_ms();
+    } else if (granted > 0 && throttled) {
+        throttled = false;
+        throttle_ms += mocpp_tick_ms() - throttle_since;
+    }
+
+    return granted;
+}
+
+void MongooseFtpClient::releaseTokens(size_t unused) {
+    if (rate_limiter && rate_limiter->isEnabled()) {
+        rate_limiter->release(unused);
+    }
+}
+
+void MongooseFtpClient::getSha256(unsigned char digest [MO_SHA256_SIZE]) {
+    Sha256 copy = sha256; //finish a copy so that the running context stays intact
+    copy.finish(digest);
+}
+
+void MongooseFtpClient::getSha256Hex(char out [MO_SHA256_HEX_SIZE]) {
+    unsigned char digest [MO_SHA256_SIZE];
+    getSha256(digest);
+    digest_to_hex(digest, MO_SHA256_SIZE, out);
+}
+
+size_t MongooseFtpClient::writePayload(unsigned char *data, size_t len) {
+    if (!sink) {
+        return fileWriter(data, len);
+    }
+
+    //copy into the blocks of the sink. This is the only copy on the way from the recv buffer to the file
+    size_t written = 0;
+    while (written < len) {
+        size_t block_size = 0;
+        unsigned char *block = sink->getBlock(block_size);
+        if (!block) {
+            return len + 1; //write error
+        }
+        if (block_size == 0) {
+            break; //sink busy. Continue with next poll
+        }
+        size_t n = len - written < block_size ? len - written : block_size;
+        memcpy(block, data + written, n);
+        copy_bytes += n;
+        if (!sink->commitBlock(n)) {
+            return len + 1;
+        }
+        written += n;
+    }
+    return written;
+}
+
+size_t MongooseFtpClient::readPayload(unsigned char *out, size_t bufsize) {
+#if MO_FTP_GZIP
+    if (gzip) {
+        return gzip->read(out, bufsize, [] (void *ctx, unsigned char *buf, size_t size) -> size_t {
+            return reinterpret_cast<MongooseFtpClient*>(ctx)->readRawPayload(buf, size);
+        }, this);
+    }
+#endif
+    return readRawPayload(out, bufsize);
+}
+
+size_t MongooseFtpClient::readRawPayload(unsigned char *out, size_t bufsize) {
+    if (!source) {
+        return fileReader(out, bufsize);
+    }
+
+    size_t read = 0;
+    while (read < bufsize) {
+        size_t block_size = 0;
+        const unsigned char *block = source->getBlock(block_size);
+        if (!block || block_size == 0) {
+            break; //end of file
+        }
+        size_t n = bufsize - read < block_size ? bufsize - read : block_size;
+        memcpy(out + read, block, n);
+        copy_bytes += n;
+        source->consume(n);
+        read += n;
+    }
+    return read;
+}
+
+unsigned long MongooseFtpClient::getCopyBytesPerMB() {
+    return transfer_bytes > 0 ? (unsigned long) (1048576ULL * copy_bytes / transfer_bytes) : 0UL;
+}
+
+unsigned long MongooseFtpClient::getTransferRate() {
+    unsigned long duration = mocpp_tick_ms() - transfer_start;
+    return duration > 0 ? (unsigned long) (1000ULL * transfer_bytes / duration) : 0UL;
+}
+
+void MongooseFtpRateLimiter::refill() {
+    unsigned long now = mocpp_tick_ms();
+
+    if (!initialized) {
+        initialized = true;
+        effective_rate = rate;
+        tokens = burst;
+        last_refill = now;
+        last_backoff_check = now;
+    }
+
+    if (effective_rate > rate) {
+        effective_rate = rate; //rate has been lowered at runtime
+    }
+
+    if (congested && now - last_backoff_check >= backoff_interval_ms) {
+        last_backoff_check = now;
+        if (congested()) {
+            //multiplicative decrease
+            effective_rate = effective_rate / 2 > min_rate ? effective_rate / 2 : min_rate;
+            backoff_count++;
+            MO_DBG_DEBUG("back-off, FTP rate limit %zu B/s", effective_rate);
+        } else if (effective_rate < rate) {
+            //additive increase
+            effective_rate += rate / 8 + 1;
+            if (effective_rate > rate) {
+                effective_rate = rate;
+            }
+        }
+    }
+
+    unsigned long dt = now - last_refill;
+    size_t add = (size_t) ((unsigned long long) effective_rate * dt / 1000ULL);
+    if (add > 0) {
+        //only advance the refill timestamp when at least one token has been added, so that fractions aren't lost
+        tokens = tokens + add < burst ? tokens + add : burst;
+        last_refill = now;
+    }
+}
+
+size_t MongooseFtpRateLimiter::acquire(size_t want) {
+    if (!isEnabled()) {
+        return want;
+    }
+
+    refill();
+
+    size_t granted = want < tokens ? want : tokens;
+    tokens -= granted;
+    return granted;
+}
+
+void MongooseFtpRateLimiter::release(size_t unused) {
+    tokens = tokens + unused < burst ? tokens + unused : burst;
+}
+
+size_t MongooseFtpRateLimiter::getEffectiveRate() {
+    if (!isEnabled()) {
+        return 0;
+    }
+    refill();
+    return effective_rate;
+}
+
+MongooseFtpSessionPool::MongooseFtpSessionPool() {
+
+}
+
+MongooseFtpSessionPool::~MongooseFtpSessionPool() {
+    for (auto& entry : entries) {
+        entry.conn->MG_COMPAT_FN_DATA = nullptr;
+        mg_printf(entry.conn, "QUIT\r\n");
+        mg_compat_drain_conn(entry.conn);
+    }
+}
+
+bool MongooseFtpSessionPool::park(const std::string& key, struct mg_connection *c) {
+    if (!c || c->MG_COMPAT_SEND.len > 0 || entries.size() >= max_sessions || idle_timeout_ms == 0) {
+        return false;
+    }
+
+    c->MG_COMPAT_FN = ftp_pool_cb;
+    c->MG_COMPAT_FN_DATA = this;
+
+    Entry entry;
+    entry.key = key;
+    entry.conn = c;
+    entry.parked_since = mocpp_tick_ms();
+    entries.push_back(std::move(entry));
+    return true;
+}
+
+struct mg_connection *MongooseFtpSessionPool::take(const std::string& key) {
+    for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+        if (entry->key == key) {
+            auto c = entry->conn;
+            entries.erase(entry);
+            reuse_count++;
+            return c;
+        }
+    }
+    return nullptr;
+}
+
+void MongooseFtpSessionPool::remove(struct mg_connection *c) {
+    for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+        if (entry->conn == c) {
+            entries.erase(entry);
+            return;
+        }
+    }
+}
+
+void MongooseFtpSessionPool::loop() {
+    auto entry = entries.begin();
+    while (entry != entries.end()) {
+        if (mocpp_tick_ms() - entry->parked_since >= idle_timeout_ms) {
+            MO_DBG_DEBUG("close idle ctrl conn");
+            entry->conn->MG_COMPAT_FN_DATA = nullptr;
+            mg_printf(entry->conn, "QUIT\r\n");
+            mg_compat_drain_conn(entry->conn);
+            entry = entries.erase(entry);
+        } else {
+            entry++;
+        }
+    }
+}
+
+void ftp_pool_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
+#if MO_MG_CA_CACHE
+    if (ev == MG_EV_CLOSE) {
+        releaseTlsCaStore(c);
+    }
+#endif
+
+    auto pool = reinterpret_cast<MongooseFtpSessionPool*>(fn_data);
+
+    if (ev == MG_COMPAT_EV_READ) {
+        //idle session doesn't expect any message. Usually the server announces to close it (421)
+        MO_DBG_DEBUG("idle ctrl conn RECV: %.*s", (int) c->MG_COMPAT_RECV.len, (const char*) c->MG_COMPAT_RECV.buf);
+        c->MG_COMPAT_RECV.len = 0;
+        if (pool) {
+            pool->remove(c);
+        }
+        c->MG_COMPAT_FN_DATA = nullptr;
+        mg_compat_drain_conn(c);
+    } else if (ev == MG_EV_CLOSE) {
+        if (pool) {
+            pool->remove(c);
+        }
+    }
+}
@@ -11,13 +11,156 @@
 #endif
 
 #include "mongoose.h"
+#include "MicroOcppMongooseTls.h"
+#include "MicroOcppMongooseDigest.h"
+#include "MicroOcppMongooseFtpGzip.h"
+#include "MicroOcppMongooseFtpReply.h"
+
+#include <MicroOcpp/Platform.h>
 
 #include <string>
 #include <memory>
 #include <functional>
+#include <vector>
+
+#ifndef MO_FTP_MAX_RETRIES
+#define MO_FTP_MAX_RETRIES 3 //number of times an interrupted download is resumed
+#endif
+
+#ifndef MO_FTP_RETRY_DELAY
+#define MO_FTP_RETRY_DELAY 5000UL //delay before the first resume trial in ms. Doubles with each retry
+#endif
+
+#define MO_FTP_RETRY_DELAY_MAX 300000UL
+
+#ifndef MO_FTP_POOL_IDLE_TIMEOUT
+#define MO_FTP_POOL_IDLE_TIMEOUT 30000UL //time in ms which a logged-in ctrl conn is kept open for the next transfer
+#endif
+
+#ifndef MO_FTP_UPLOAD_CHUNK_SIZE
+#define MO_FTP_UPLOAD_CHUNK_SIZE 4096 //default size of upload chunks. The data conn buffers up to two chunks
+#endif
+
+#ifndef MO_FTP_PROGRESS_INTERVAL
+#define MO_FTP_PROGRESS_INTERVAL 1000UL //interval of progress reports and rate measurements in ms
+#endif
+
+#ifndef MO_FTP_STALL_TIMEOUT
+#define MO_FTP_STALL_TIMEOUT 30000UL //abort transfer if neither channel makes progress for this time in ms. 0 disables
+#endif
+
+#define MO_FTP_CMD_QUEUE 8 //max number of pipelined commands awaiting their reply
+
+#ifndef MO_FTP_RATE_BURST
+#define MO_FTP_RATE_BURST 8192 //default bucket capacity of the rate limiter in bytes
+#endif
 
 namespace MicroOcpp {
 
+/*
+ * Keeps logged-in ctrl conns (including TLS session) open after a transfer, so that the next transfer
+ * to the same server and user can skip the connection setup, AUTH TLS and login
+ */
+class MongooseFtpSessionPool {
+private:
+    struct Entry {
+        std::string key;
+        struct mg_connection *conn {nullptr};
+        unsigned long parked_since {0};
+    };
+    std::vector<Entry> entries;
+public:
+    unsigned long idle_timeout_ms = MO_FTP_POOL_IDLE_TIMEOUT;
+    size_t max_sessions = 2;
+    unsigned int reuse_count = 0;
+
+    MongooseFtpSessionPool();
+    ~MongooseFtpSessionPool(); //closes all idle sessions
+
+    bool park(const std::string& key, struct mg_connection *c);
+    struct mg_connection *take(const std::string& key); //returns nullptr if no session is available
+    void remove(struct mg_connection *c);
+
+    void loop(); //closes sessions after idle timeout
+
+    size_t size() {return entries.size();}
+};
+
+struct MongooseFtpProgress {
+    size_t bytes = 0; //bytes transferred so far
+    size_t total = 0; //expected number of bytes. 0 if unknown
+    unsigned long rate = 0; //bytes per second during the last progress interval
+    unsigned long eta_ms = 0; //estimated remaining time. 0 if unknown
+};
+
+struct MongooseFtpStats {
+    size_t bytes = 0;
+    unsigned long duration_ms = 0;
+    unsigned long avg_rate = 0; //bytes per second
+    unsigned long peak_rate = 0; //highest rate of all progress intervals
+    unsigned int stall_count = 0; //number of times the watchdog aborted the transfer
+};
+
+/*
+ * Token bucket which caps the throughput of the FTP data channel, so that a large transfer doesn't starve the
+ * OCPP WebSocket on a narrow uplink. Can be shared between several FtpClients to cap their aggregate rate.
+ *
+ * Optional back-off: if congested() returns true, the effective rate is halved (down to min_rate) and recovers
+ * stepwise when the congestion is gone. E.g. to react on the WebSocket:
+ *
+ *     limiter->congested = [ws] () {return ws->getSendBufferOccupancy() > 1024 || ws->getPingRtt() > 2000;};
+ */
+class MongooseFtpRateLimiter {
+private:
+    size_t tokens = 0;
+    size_t effective_rate = 0;
+    unsigned long last_refill = 0;
+    unsigned long last_backoff_check = 0;
+    bool initialized = false;
+
+    void refill();
+public:
+    size_t rate = 0; //bytes per second. 0 disables rate shaping
+    size_t burst = MO_FTP_RATE_BURST; //max bytes which can pass at once after an idle period
+
+    std::function<bool()> congested; //optional
+    size_t min_rate = 1024; //lower bound for the back-off in bytes per second
+    unsigned long backoff_interval_ms = 500;
+    unsigned int backoff_count = 0;
+
+    bool isEnabled() {return rate > 0;}
+    size_t acquire(size_t want); //takes up to want tokens from the bucket and returns the number of bytes which may pass now
+    void release(size_t unused); //returns acquired tokens which haven't been used, e.g. after a short write
+    size_t getEffectiveRate(); //configured rate after back-off
+};
+
+/*
+ * Block-based alternatives to fileWriter / fileReader. The sink or source owns the blocks (e.g. aligned to
+ * flash pages or a memory-mapped file) and the FtpClient copies the payload once between the Mongoose
+ * iobuf and the blocks. Virtual calls instead of std::function and no shifting of partially consumed iobufs
+ */
+class MongooseFtpSink {
+public:
+    virtual ~MongooseFtpSink() = default;
+
+    //returns the next writable block and its size. On error nullptr. If the sink is busy, size 0 (retry with next poll)
+    virtual unsigned char *getBlock(size_t& size) = 0;
+
+    //len bytes have been written to the block of the last getBlock call. Returns false on error
+    virtual bool commitBlock(size_t len) = 0;
+};
+
+class MongooseFtpSource {
+public:
+    virtual ~MongooseFtpSource() = default;
+
+    //returns the next readable block and its size. nullptr or size 0 at the end of the file
+    virtual const unsigned char *getBlock(size_t& size) = 0;
+
+    //len bytes of the block of the last getBlock call have been read
+    virtual void consume(size_t len) = 0;
+};
+
 class MongooseFtpClient {
 public:
     struct mg_mgr *mgr {nullptr};
@@ -33,25 +176,150 @@ public:
 
     std::string data_url;
 
+    const char *ca_cert {nullptr}; //zero-copy. Nullptr disables CA verification
+#if MO_MG_CA_CACHE
+    std::shared_ptr<TlsCaStore> ca_store;
+#endif
+    void setCaCert(const char *ca_cert); //the string must outlive this class. Shares the parsed CA store with other connections using the same string
+
     bool readUrl(const char *ftp_url);
 
+    std::shared_ptr<MongooseFtpSessionPool> session_pool; //optional. Nullptr closes the ctrl conn after each transfer
+    bool ctrl_reused = false; //true if the ctrl conn has been taken from the session pool
+    unsigned long request_start = 0;
+    unsigned long ttfb_ms = 0; //time from getFile / postFile until the first payload byte
+    bool first_byte = false;
+
+    bool openCtrlConn();
+    bool releaseCtrlConn(); //returns ctrl conn to the session pool or closes it, then calls onClose
+    void releaseDataConn(); //detaches the data conn from this session and closes it after sending pending data
+    std::string getSessionKey();
+    void trackFirstByte();
+
     std::function<size_t(unsigned char *data, size_t len)> fileWriter;
     std::function<size_t(unsigned char *out, size_t bufsize)> fileReader;
+    MongooseFtpSink *sink {nullptr}; //replaces fileWriter if set. Not owned by the FtpClient
+    MongooseFtpSource *source {nullptr}; //replaces fileReader if set. Not owned by the FtpClient
+    size_t writePayload(unsigned char *data, size_t len); //passes to sink or fileWriter. Returns a value > len on error
+    size_t readPayload(unsigned char *out, size_t bufsize); //reads from source or fileReader and compresses if enabled
+
+#if MO_FTP_GZIP
+    bool gzip_upload = false; //compress uploads on the fly and append ".gz" to the remote file name
+    std::unique_ptr<MongooseFtpGzipStage> gzip;
+#endif
+    size_t readRawPayload(unsigned char *out, size_t bufsize); //reads from source or fileReader without compression
+
+    size_t copy_bytes = 0; //bytes copied by the FtpClient during the current transfer (into or out of blocks and iobuf shifts)
+    unsigned long getCopyBytesPerMB(); //copy_bytes per MB of payload
     std::function<void()> onClose;
 
     bool ctrl_opened = false;
     bool ctrl_closed = false;
     unsigned long ctrl_last_recv = 0;
 
+    //progress reporting and no-progress watchdog. Executed in loop()
+    std::function<void(const MongooseFtpProgress&)> onProgress;
+    unsigned long progress_interval_ms = MO_FTP_PROGRESS_INTERVAL;
+    unsigned long stall_timeout_ms = MO_FTP_STALL_TIMEOUT;
+    size_t transfer_total = 0; //downloads: set by SIZE or the range length. Uploads: can be set by the caller after postFile
+    unsigned long last_activity = 0; //last progress on either channel
+    size_t sample_bytes = 0;
+    unsigned long sample_time = 0;
+    unsigned long current_rate = 0;
+    unsigned long peak_rate = 0;
+    unsigned int stall_count = 0;
+    unsigned long transfer_end = 0;
+    void trackActivity() {last_activity = mocpp_tick_ms();}
+    void updateProgress();
+    bool checkStall(); //aborts both channels if there is no progress. Returns true if aborted
+    MongooseFtpStats getStats();
+
+    //commands on the ctrl conn. Commands are pipelined where the protocol allows it and replies are matched in order
+    enum class Cmd : unsigned char {
+        Greeting, //no command, but the server sends a reply after connecting
+        AuthTls,
+        User,
+        Pass,
+        Feat,
+        Cwd,
+        Type,
+        Pbsz,
+        Prot,
+        Size,
+        Pasv,
+        Rest,
+        Retr,
+        Appe,
+        UNDEFINED
+    };
+    MongooseFtpReplyParser reply_parser;
+    Cmd cmd_queue [MO_FTP_CMD_QUEUE];
+    size_t cmd_queue_head = 0;
+    size_t cmd_queue_len = 0;
+    bool sendCmd(Cmd cmd, const char *arg = nullptr); //sends the command and expects its reply
+    bool expectReply(Cmd cmd); //expect reply without sending a command
+    Cmd peekCmd(); //command which the next reply answers. UNDEFINED if none
+    Cmd popCmd();
+    void clearCmds();
+    bool sendTransferSetup(); //pipeline CWD, TYPE, PBSZ, PROT and PASV / SIZE after login
+
     enum class Method {
         Retrieve,  //download file
         Append,    //upload file
+        Size,      //query file size and REST support
         UNDEFINED
     };
     Method method = Method::UNDEFINED;
 
     bool data_conn_accepted = false;
 
+    std::shared_ptr<MongooseFtpRateLimiter> rate_limiter; //optional. Nullptr transfers at full speed
+    bool throttled = false;
+    unsigned long throttle_since = 0;
+    unsigned long throttle_ms = 0; //total time in which the transfer has been held back by the rate limiter
+    size_t acquireTokens(size_t want); //returns want if there is no rate limiter
+    void releaseTokens(size_t unused); //gives back the part of acquireTokens() which hasn't been transferred
+    unsigned long getTransferRate(); //achieved rate of the current transfer in bytes per second
+
+    size_t upload_chunk_size = MO_FTP_UPLOAD_CHUNK_SIZE; //max bytes per fileReader call
+    unsigned long transfer_start = 0;
+    size_t transfer_bytes = 0; //bytes committed by fileWriter or read from fileReader
+    size_t transfer_bytes_received = 0; //bytes received on the data conn including all retries
+    bool transfer_complete = false;
+    bool server_done = false; //download: 226 received, but fileWriter hasn't accepted all bytes yet
+    std::vector<unsigned char> data_tail; //download: bytes left in the recv buffer when the data conn closed
+
+    //resume interrupted downloads with REST
+    unsigned int max_retries = MO_FTP_MAX_RETRIES;
+    unsigned long retry_delay_ms = MO_FTP_RETRY_DELAY;
+    unsigned int retry_count = 0;
+    bool retry_allowed = true; //false after permanent errors
+    bool retry_pending = false;
+    unsigned long retry_scheduled = 0;
+    unsigned long retry_delay = 0;
+    bool rest_supported = false;
+
+    size_t range_start = 0; //first byte to download
+    size_t range_len = 0; //number of bytes to download. 0 means until the end of the file
+    size_t getResumeOffset() {return range_start + transfer_bytes;}
+
+    //optional integrity check of downloads, computed while receiving. The digests cover all bytes which have been
+    //committed by fileWriter (including resumed parts) and can be read in onClose
+    bool digest_sha256 = false;
+    bool digest_crc32 = false;
+    Sha256 sha256;
+    uint32_t crc32_value = 0;
+    void getSha256(unsigned char digest [MO_SHA256_SIZE]); //can be called multiple times
+    void getSha256Hex(char out [MO_SHA256_HEX_SIZE]);
+    uint32_t getCrc32() {return crc32_value;}
+
+    size_t file_size = 0; //result of querySize()
+    bool file_size_known = false;
+
+    bool scheduleRetry(); //returns true if the download will be resumed in loop()
+    void reportTransfer();
+    size_t getBytesRetransferred() {return transfer_bytes_received > transfer_bytes ? transfer_bytes_received - transfer_bytes : 0;}
+
 #if defined(MO_MG_VERSION_614)
     //upgrade TLS in FtpClient::loop and not in cb fn (MG flags cannot be manipulated during mg_poll in MG v6.14)
     bool ctrl_tls_want_upgrade = false;
@@ -65,16 +333,40 @@ public:
     MongooseFtpClient(struct mg_mgr *mgr);
     ~MongooseFtpClient();
 
-    void loop(); //need to loop during TLS negotiation when using Mongoose v6.14
+    void loop(); //need to loop during TLS negotiation when using Mongoose v6.14 and to resume interrupted downloads
 
     bool getFile(const char *ftp_url, // ftp[s]://[user[:pass]@]host[:port][/directory]/filename
             std::function<size_t(unsigned char *data, size_t len)> fileWriter,
             std::function<void()> onClose);
+
+    //download into the blocks of sink. The sink must outlive the transfer
+    bool getFile(const char *ftp_url,
+            MongooseFtpSink& sink,
+            std::function<void()> onClose);
+
+    bool initDownload(const char *ftp_url, size_t range_start, size_t range_len, std::function<void()> onClose); //common part of getFile and getFileRange
     
+    //download only the byte range [range_start, range_start + range_len). Requires REST support on the server
+    bool getFileRange(const char *ftp_url,
+            size_t range_start, size_t range_len,
+            std::function<size_t(unsigned char *data, size_t len)> fileWriter,
+            std::function<void()> onClose);
+
+    //query file_size and rest_supported. Results are valid when onClose is called
+    bool querySize(const char *ftp_url,
+            std::function<void()> onClose);
+
     //append file
     bool postFile(const char *ftp_url, // ftp[s]://[user[:pass]@]host[:port][/directory]/filename
             std::function<size_t(unsigned char *out, size_t buffsize)> fileReader, //write at most buffsize bytes into out-buffer. Return number of bytes written
             std::function<void()> onClose);
+
+    //append file from the blocks of source. The source must outlive the transfer
+    bool postFile(const char *ftp_url,
+            MongooseFtpSource& source,
+            std::function<void()> onClose);
+
+    bool initUpload(const char *ftp_url, std::function<void()> onClose); //common part of postFile
 };
 
 } //end namespace MicroOcpp
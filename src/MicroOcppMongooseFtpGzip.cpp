@@ -0,0 +1,98 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseFtpGzip.h"
+
+#if MO_FTP_GZIP
+
+#include <MicroOcpp/Debug.h>
+#include <MicroOcpp/Platform.h>
+
+#include <string.h>
+
+using namespace MicroOcpp;
+
+MongooseFtpGzipStage::MongooseFtpGzipStage() {
+    memset(&strm, 0, sizeof(strm));
+}
+
+MongooseFtpGzipStage::~MongooseFtpGzipStage() {
+    if (initialized) {
+        deflateEnd(&strm);
+    }
+}
+
+bool MongooseFtpGzipStage::init(int level, int window_bits, int mem_level) {
+    if (initialized) {
+        deflateEnd(&strm);
+        initialized = false;
+    }
+
+    memset(&strm, 0, sizeof(strm));
+    input_eof = false;
+    finished = false;
+    failed = false;
+    bytes_in = 0;
+    bytes_out = 0;
+    cpu_ms = 0;
+
+    //window_bits + 16 selects the gzip container instead of zlib
+    int ret = deflateInit2(&strm, level, Z_DEFLATED, window_bits + 16, mem_level, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        MO_DBG_ERR("deflateInit2: %i", ret);
+        failed = true;
+        return false;
+    }
+
+    initialized = true;
+    return true;
+}
+
+size_t MongooseFtpGzipStage::read(unsigned char *out, size_t size, Reader reader, void *reader_ctx) {
+    if (!initialized || failed) {
+        return size + 1;
+    }
+
+    if (finished) {
+        return 0;
+    }
+
+    strm.next_out = out;
+    strm.avail_out = (uInt) size;
+
+    while (strm.avail_out > 0 && !finished) {
+        if (strm.avail_in == 0 && !input_eof) {
+            size_t ret = reader(reader_ctx, in_buf, sizeof(in_buf));
+            if (ret > sizeof(in_buf)) {
+                MO_DBG_ERR("read error");
+                failed = true;
+                return size + 1;
+            }
+            if (ret == 0) {
+                input_eof = true;
+            }
+            strm.next_in = in_buf;
+            strm.avail_in = (uInt) ret;
+            bytes_in += ret;
+        }
+
+        auto t_start = mocpp_tick_ms();
+        int ret = deflate(&strm, input_eof ? Z_FINISH : Z_NO_FLUSH);
+        cpu_ms += mocpp_tick_ms() - t_start;
+
+        if (ret == Z_STREAM_END) {
+            finished = true;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            MO_DBG_ERR("deflate: %i", ret);
+            failed = true;
+            return size + 1;
+        }
+    }
+
+    size_t produced = size - strm.avail_out;
+    bytes_out += produced;
+    return produced;
+}
+
+#endif //MO_FTP_GZIP
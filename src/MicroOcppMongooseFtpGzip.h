@@ -0,0 +1,69 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEFTPGZIP_H
+#define MO_MONGOOSEFTPGZIP_H
+
+/*
+ * Streaming gzip compression of FTP uploads. Requires zlib
+ */
+#ifndef MO_FTP_GZIP
+#define MO_FTP_GZIP 0
+#endif
+
+#if MO_FTP_GZIP
+
+#include <stddef.h>
+#include <zlib.h>
+
+#ifndef MO_FTP_GZIP_WINDOW_BITS
+#define MO_FTP_GZIP_WINDOW_BITS 12 //deflate window of 4 KiB. Deflate needs about (1 << (WINDOW_BITS + 2)) + (1 << (MEM_LEVEL + 9)) bytes of RAM
+#endif
+
+#ifndef MO_FTP_GZIP_MEM_LEVEL
+#define MO_FTP_GZIP_MEM_LEVEL 5
+#endif
+
+#ifndef MO_FTP_GZIP_LEVEL
+#define MO_FTP_GZIP_LEVEL 6
+#endif
+
+#ifndef MO_FTP_GZIP_IN_SIZE
+#define MO_FTP_GZIP_IN_SIZE 1024 //size of the input buffer which the uncompressed data is read into
+#endif
+
+namespace MicroOcpp {
+
+class MongooseFtpGzipStage {
+public:
+    typedef size_t (*Reader)(void *ctx, unsigned char *buf, size_t size); //returns 0 at the end of the input
+private:
+    z_stream strm;
+    bool initialized = false;
+    bool input_eof = false;
+    bool finished = false;
+    bool failed = false;
+    unsigned char in_buf [MO_FTP_GZIP_IN_SIZE];
+public:
+    size_t bytes_in = 0; //uncompressed
+    size_t bytes_out = 0; //compressed
+    unsigned long cpu_ms = 0; //time spent in deflate
+
+    MongooseFtpGzipStage();
+    ~MongooseFtpGzipStage();
+
+    bool init(int level = MO_FTP_GZIP_LEVEL, int window_bits = MO_FTP_GZIP_WINDOW_BITS, int mem_level = MO_FTP_GZIP_MEM_LEVEL);
+
+    //fills out with compressed data. Only returns less than size at the end of the stream. Returns 0 after the end of
+    //the stream and a value > size on error
+    size_t read(unsigned char *out, size_t size, Reader reader, void *reader_ctx);
+
+    bool isFinished() {return finished;}
+    bool isFailed() {return failed;}
+};
+
+} //end namespace MicroOcpp
+
+#endif //MO_FTP_GZIP
+#endif
@@ -0,0 +1,187 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseFtpManager.h"
+#include <MicroOcpp/Debug.h>
+
+using namespace MicroOcpp;
+
+MongooseFtpTransferManager::MongooseFtpTransferManager(struct mg_mgr *mgr, std::shared_ptr<MongooseFtpSessionPool> session_pool) : mgr(mgr), session_pool(session_pool) {
+
+}
+
+MongooseFtpTransferManager::~MongooseFtpTransferManager() {
+    //sessions call onClose in their destructor. Detach them from this object first
+    for (auto& transfer : transfers) {
+        if (transfer->session) {
+            transfer->session->onClose = nullptr;
+        }
+    }
+}
+
+MongooseFtpTransferManager::TransferId MongooseFtpTransferManager::enqueue(std::unique_ptr<Transfer> transfer) {
+    id_counter++;
+    if (id_counter == 0) {
+        id_counter = 1; //overflow
+    }
+    transfer->id = id_counter;
+    auto id = transfer->id;
+    transfers.push_back(std::move(transfer));
+    MO_DBG_DEBUG("enqueued transfer %u (%zu active, %zu queued)", id, getActiveCount(), getQueuedCount());
+    //starts with the next loop() call. The caller may be inside a callback of another transfer
+    return id;
+}
+
+MongooseFtpTransferManager::TransferId MongooseFtpTransferManager::getFile(const char *ftp_url, std::function<size_t(unsigned char *data, size_t len)> fileWriter, std::function<void(bool success)> onClose, int priority) {
+    if (!ftp_url || !fileWriter) {
+        MO_DBG_ERR("invalid args");
+        return 0;
+    }
+
+    std::unique_ptr<Transfer> transfer {new Transfer()};
+    transfer->priority = priority;
+    transfer->method = MongooseFtpClient::Method::Retrieve;
+    transfer->ftp_url = ftp_url;
+    transfer->fileWriter = fileWriter;
+    transfer->onClose = onClose;
+    return enqueue(std::move(transfer));
+}
+
+MongooseFtpTransferManager::TransferId MongooseFtpTransferManager::postFile(const char *ftp_url, std::function<size_t(unsigned char *out, size_t bufsize)> fileReader, std::function<void(bool success)> onClose, int priority) {
+    if (!ftp_url || !fileReader) {
+        MO_DBG_ERR("invalid args");
+        return 0;
+    }
+
+    std::unique_ptr<Transfer> transfer {new Transfer()};
+    transfer->priority = priority;
+    transfer->method = MongooseFtpClient::Method::Append;
+    transfer->ftp_url = ftp_url;
+    transfer->fileReader = fileReader;
+    transfer->onClose = onClose;
+    return enqueue(std::move(transfer));
+}
+
+bool MongooseFtpTransferManager::start(Transfer& transfer) {
+    transfer.session.reset(new MongooseFtpClient(mgr));
+    transfer.session->session_pool = session_pool;
+    transfer.session->rate_limiter = rate_limiter;
+
+    Transfer *transfer_ptr = &transfer; //heap-allocated, stable until erased in loop()
+    auto closer = [transfer_ptr] () {
+        transfer_ptr->closed = true;
+    };
+
+    bool success = false;
+    if (transfer.method == MongooseFtpClient::Method::Retrieve) {
+        success = transfer.session->getFile(transfer.ftp_url.c_str(), transfer.fileWriter, closer);
+    } else if (transfer.method == MongooseFtpClient::Method::Append) {
+        success = transfer.session->postFile(transfer.ftp_url.c_str(), transfer.fileReader, closer);
+    }
+
+    if (!success) {
+        MO_DBG_ERR("could not start transfer %u", transfer.id);
+        transfer.closed = true;
+    }
+
+    return success;
+}
+
+bool MongooseFtpTransferManager::cancel(TransferId id) {
+    for (auto& transfer : transfers) {
+        if (transfer->id == id) {
+            MO_DBG_INFO("cancel transfer %u", id);
+            if (transfer->session) {
+                transfer->session->onClose = nullptr;
+                transfer->session.reset(); //closes conns
+            }
+            transfer->closed = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void MongooseFtpTransferManager::loop() {
+
+    for (auto& transfer : transfers) {
+        if (transfer->session && !transfer->closed) {
+            transfer->session->loop();
+        }
+    }
+
+    //report finished transfers
+    auto it = transfers.begin();
+    while (it != transfers.end()) {
+        if ((*it)->closed) {
+            std::unique_ptr<Transfer> transfer = std::move(*it);
+            it = transfers.erase(it);
+
+            bool success = transfer->session && transfer->session->transfer_complete;
+            MO_DBG_DEBUG("transfer %u %s", transfer->id, success ? "complete" : "failed");
+            if (transfer->session) {
+                transfer->session->onClose = nullptr;
+            }
+            if (transfer->onClose) {
+                transfer->onClose(success); //may enqueue new transfers
+            }
+            it = transfers.begin(); //list may have changed
+        } else {
+            it++;
+        }
+    }
+
+    //start waiting transfers with the highest priority first. Equal priorities start in FIFO order
+    while (getActiveCount() < max_concurrent) {
+        Transfer *next = nullptr;
+        for (auto& transfer : transfers) {
+            if (!transfer->session && !transfer->closed && (!next || transfer->priority > next->priority)) {
+                next = transfer.get();
+            }
+        }
+        if (!next) {
+            break;
+        }
+        MO_DBG_DEBUG("start transfer %u", next->id);
+        start(*next);
+    }
+}
+
+MongooseFtpClient *MongooseFtpTransferManager::getSession(TransferId id) {
+    for (auto& transfer : transfers) {
+        if (transfer->id == id) {
+            return transfer->session.get();
+        }
+    }
+    return nullptr;
+}
+
+bool MongooseFtpTransferManager::isQueued(TransferId id) {
+    for (auto& transfer : transfers) {
+        if (transfer->id == id) {
+            return !transfer->session && !transfer->closed;
+        }
+    }
+    return false;
+}
+
+size_t MongooseFtpTransferManager::getActiveCount() {
+    size_t count = 0;
+    for (auto& transfer : transfers) {
+        if (transfer->session && !transfer->closed) {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t MongooseFtpTransferManager::getQueuedCount() {
+    size_t count = 0;
+    for (auto& transfer : transfers) {
+        if (!transfer->session && !transfer->closed) {
+            count++;
+        }
+    }
+    return count;
+}
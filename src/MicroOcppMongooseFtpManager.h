@@ -0,0 +1,79 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEFTPMANAGER_H
+#define MO_MONGOOSEFTPMANAGER_H
+
+#include "MicroOcppMongooseFtp.h"
+
+#include <vector>
+
+#ifndef MO_FTP_MAX_CONCURRENT
+#define MO_FTP_MAX_CONCURRENT 2 //number of transfers which run at the same time
+#endif
+
+namespace MicroOcpp {
+
+/*
+ * Runs multiple independent FTP transfers on one mg_mgr. Each transfer has its own MongooseFtpClient.
+ * Transfers beyond max_concurrent wait in a queue and start in order of priority, then FIFO. New transfers
+ * start with the next loop() call, so getFile / postFile can be called from the onClose of another transfer
+ */
+class MongooseFtpTransferManager {
+public:
+    typedef unsigned int TransferId; //0 is invalid
+
+private:
+    struct Transfer {
+        TransferId id {0};
+        int priority {0};
+        MongooseFtpClient::Method method {MongooseFtpClient::Method::UNDEFINED};
+        std::string ftp_url;
+        std::function<size_t(unsigned char *data, size_t len)> fileWriter;
+        std::function<size_t(unsigned char *out, size_t bufsize)> fileReader;
+        std::function<void(bool success)> onClose;
+        std::unique_ptr<MongooseFtpClient> session; //nullptr while queued
+        bool closed {false};
+    };
+    std::vector<std::unique_ptr<Transfer>> transfers; //in order of submission
+
+    struct mg_mgr *mgr {nullptr};
+    std::shared_ptr<MongooseFtpSessionPool> session_pool;
+    TransferId id_counter {0};
+
+    TransferId enqueue(std::unique_ptr<Transfer> transfer);
+    bool start(Transfer& transfer);
+
+public:
+    size_t max_concurrent = MO_FTP_MAX_CONCURRENT;
+    std::shared_ptr<MongooseFtpRateLimiter> rate_limiter; //optional. Caps the aggregate rate of all transfers
+
+    MongooseFtpTransferManager(struct mg_mgr *mgr, std::shared_ptr<MongooseFtpSessionPool> session_pool = nullptr);
+    ~MongooseFtpTransferManager();
+
+    //see MongooseFtpClient::getFile. Higher priority starts first. Returns 0 on failure
+    TransferId getFile(const char *ftp_url,
+            std::function<size_t(unsigned char *data, size_t len)> fileWriter,
+            std::function<void(bool success)> onClose,
+            int priority = 0);
+
+    //see MongooseFtpClient::postFile. Higher priority starts first. Returns 0 on failure
+    TransferId postFile(const char *ftp_url,
+            std::function<size_t(unsigned char *out, size_t bufsize)> fileReader,
+            std::function<void(bool success)> onClose,
+            int priority = 0);
+
+    bool cancel(TransferId id); //aborts a running or queued transfer. Calls onClose(false)
+
+    void loop();
+
+    MongooseFtpClient *getSession(TransferId id); //state and progress of a running transfer. Nullptr if queued or finished
+    bool isQueued(TransferId id);
+    size_t getActiveCount();
+    size_t getQueuedCount();
+};
+
+} //end namespace MicroOcpp
+
+#endif
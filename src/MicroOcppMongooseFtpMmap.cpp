@@ -0,0 +1,192 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseFtpMmap.h"
+
+#if MO_FTP_MMAP
+
+#include <MicroOcpp/Debug.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace MicroOcpp;
+
+MongooseFtpMmapSink::MongooseFtpMmapSink(size_t window_size) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    block_size = page_size > 0 ? (size_t) page_size : 4096;
+
+    //round up to full pages
+    this->window_size = ((window_size + block_size - 1) / block_size) * block_size;
+    if (this->window_size == 0) {
+        this->window_size = block_size;
+    }
+}
+
+MongooseFtpMmapSink::~MongooseFtpMmapSink() {
+    close();
+}
+
+bool MongooseFtpMmapSink::open(const char *path) {
+    close();
+
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        MO_DBG_ERR("cannot open %s", path);
+        return false;
+    }
+
+    window_offset = 0;
+    window_pos = 0;
+    return true;
+}
+
+bool MongooseFtpMmapSink::mapNextWindow() {
+    if (window) {
+        munmap(window, window_size);
+        window = nullptr;
+        window_offset += window_size;
+        window_pos = 0;
+    }
+
+    if (ftruncate(fd, (off_t) (window_offset + window_size)) != 0) {
+        MO_DBG_ERR("cannot extend file");
+        return false;
+    }
+
+    void *mapped = mmap(nullptr, window_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) window_offset);
+    if (mapped == MAP_FAILED) {
+        MO_DBG_ERR("mmap failed");
+        return false;
+    }
+
+    window = (unsigned char*) mapped;
+    return true;
+}
+
+unsigned char *MongooseFtpMmapSink::getBlock(size_t& size) {
+    size = 0;
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    if (!window || window_pos >= window_size) {
+        if (!mapNextWindow()) {
+            return nullptr;
+        }
+    }
+
+    //page-aligned blocks: up to the next page boundary
+    size = block_size - window_pos % block_size;
+    return window + window_pos;
+}
+
+bool MongooseFtpMmapSink::commitBlock(size_t len) {
+    if (!window || window_pos + len > window_size) {
+        return false;
+    }
+    window_pos += len;
+    return true;
+}
+
+bool MongooseFtpMmapSink::close() {
+    if (fd < 0) {
+        return true;
+    }
+
+    bool success = true;
+
+    if (window) {
+        munmap(window, window_size);
+        window = nullptr;
+    }
+
+    if (ftruncate(fd, (off_t) getSize()) != 0) {
+        MO_DBG_ERR("cannot truncate file");
+        success = false;
+    }
+
+    ::close(fd);
+    fd = -1;
+    return success;
+}
+
+MongooseFtpMmapSource::MongooseFtpMmapSource() {
+    long page_size = sysconf(_SC_PAGESIZE);
+    block_size = page_size > 0 ? (size_t) page_size : 4096;
+}
+
+MongooseFtpMmapSource::~MongooseFtpMmapSource() {
+    close();
+}
+
+bool MongooseFtpMmapSource::open(const char *path) {
+    close();
+
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        MO_DBG_ERR("cannot open %s", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        MO_DBG_ERR("cannot stat %s", path);
+        close();
+        return false;
+    }
+
+    size = (size_t) st.st_size;
+    pos = 0;
+
+    if (size == 0) {
+        return true; //nothing to map
+    }
+
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        MO_DBG_ERR("mmap failed");
+        close();
+        return false;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    data = (const unsigned char*) mapped;
+    return true;
+}
+
+void MongooseFtpMmapSource::close() {
+    if (data) {
+        munmap((void*) data, size);
+        data = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    size = 0;
+    pos = 0;
+}
+
+const unsigned char *MongooseFtpMmapSource::getBlock(size_t& size) {
+    if (!data || pos >= this->size) {
+        size = 0;
+        return nullptr;
+    }
+
+    //page-aligned blocks: up to the next page boundary
+    size = block_size - pos % block_size;
+    if (size > this->size - pos) {
+        size = this->size - pos;
+    }
+    return data + pos;
+}
+
+void MongooseFtpMmapSource::consume(size_t len) {
+    pos = pos + len < size ? pos + len : size;
+}
+
+#endif //MO_FTP_MMAP
@@ -0,0 +1,76 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEFTPMMAP_H
+#define MO_MONGOOSEFTPMMAP_H
+
+/*
+ * Reference implementation of MongooseFtpSink and MongooseFtpSource on Linux which maps the file into
+ * memory. The FtpClient copies the payload directly between the Mongoose iobuf and the page cache
+ */
+#ifndef MO_FTP_MMAP
+#if defined(__linux__)
+#define MO_FTP_MMAP 1
+#else
+#define MO_FTP_MMAP 0
+#endif
+#endif
+
+#if MO_FTP_MMAP
+
+#include "MicroOcppMongooseFtp.h"
+
+#ifndef MO_FTP_MMAP_WINDOW
+#define MO_FTP_MMAP_WINDOW (1024UL * 1024UL) //size of the file region which the sink maps at once
+#endif
+
+namespace MicroOcpp {
+
+class MongooseFtpMmapSink : public MongooseFtpSink {
+private:
+    int fd = -1;
+    unsigned char *window = nullptr;
+    size_t window_size = 0; //multiple of the page size
+    size_t window_offset = 0; //file offset of the mapped region
+    size_t window_pos = 0; //write position in the mapped region
+    size_t block_size = 0; //page size
+
+    bool mapNextWindow();
+public:
+    MongooseFtpMmapSink(size_t window_size = MO_FTP_MMAP_WINDOW);
+    ~MongooseFtpMmapSink(); //calls close()
+
+    bool open(const char *path); //creates or truncates the file
+    bool close(); //unmaps the file and truncates it to the written size
+
+    unsigned char *getBlock(size_t& size) override;
+    bool commitBlock(size_t len) override;
+
+    size_t getSize() {return window_offset + window_pos;}
+};
+
+class MongooseFtpMmapSource : public MongooseFtpSource {
+private:
+    int fd = -1;
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    size_t block_size = 0; //page size
+public:
+    MongooseFtpMmapSource();
+    ~MongooseFtpMmapSource(); //calls close()
+
+    bool open(const char *path);
+    void close();
+
+    const unsigned char *getBlock(size_t& size) override;
+    void consume(size_t len) override;
+
+    size_t getSize() {return size;}
+};
+
+} //end namespace MicroOcpp
+
+#endif //MO_FTP_MMAP
+#endif
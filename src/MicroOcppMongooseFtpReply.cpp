@@ -0,0 +1,71 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseFtpReply.h"
+
+#include <string.h>
+
+using namespace MicroOcpp;
+
+namespace MicroOcpp {
+
+static int ftp_parse_code(const char *text, size_t len) {
+    if (len < 3 ||
+            text[0] < '1' || text[0] > '5' ||
+            text[1] < '0' || text[1] > '9' ||
+            text[2] < '0' || text[2] > '9') {
+        return 0;
+    }
+    return (text[0] - '0') * 100 + (text[1] - '0') * 10 + (text[2] - '0');
+}
+
+} //end namespace MicroOcpp
+
+size_t MongooseFtpReplyParser::next(const char *buf, size_t len, MongooseFtpReplyLine& line) {
+    const char *lf = (const char*) memchr(buf, '\n', len);
+    if (!lf) {
+        return 0; //incomplete line, wait for more data
+    }
+
+    size_t consumed = (size_t) (lf - buf) + 1;
+
+    line.text = buf;
+    line.len = (size_t) (lf - buf);
+    if (line.len > 0 && line.text[line.len - 1] == '\r') {
+        line.len--;
+    }
+
+    int code = ftp_parse_code(line.text, line.len);
+
+    if (multiline_code) {
+        //inside multi-line reply. Only "xyz " with the same code closes it, all other lines are text
+        line.code = multiline_code;
+        line.final = code == multiline_code && (line.len == 3 || line.text[3] == ' ');
+        if (line.final) {
+            multiline_code = 0;
+        }
+    } else if (code && line.len > 3 && line.text[3] == '-') {
+        line.code = code;
+        line.final = false;
+        multiline_code = code;
+    } else {
+        line.code = code;
+        line.final = true;
+    }
+
+    return consumed;
+}
+
+bool MicroOcpp::ftp_line_contains(const MongooseFtpReplyLine& line, const char *token) {
+    size_t token_len = strlen(token);
+    if (token_len == 0) {
+        return true;
+    }
+    for (size_t i = 0; i + token_len <= line.len; i++) {
+        if (!memcmp(line.text + i, token, token_len)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,48 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEFTPREPLY_H
+#define MO_MONGOOSEFTPREPLY_H
+
+#include <stddef.h>
+
+#ifndef MO_FTP_CTRL_LINE_MAX
+#define MO_FTP_CTRL_LINE_MAX 512 //max length of a reply line. Longer lines are treated as protocol error
+#endif
+
+namespace MicroOcpp {
+
+/*
+ * View of one line of an FTP reply. Points into the recv buffer of the ctrl conn and is only valid until
+ * the buffer is modified. The text is not null-terminated
+ */
+struct MongooseFtpReplyLine {
+    const char *text {nullptr}; //line without CRLF
+    size_t len {0};
+    int code {0}; //reply code of the reply which this line belongs to. 0 if malformed
+    bool final {false}; //last line of the reply (single-line replies are always final)
+};
+
+/*
+ * Incremental parser for FTP replies (RFC 959, 4.2). Handles lines which are split over several TCP reads
+ * and multi-line replies ("xyz-" ... "xyz "). The only state kept between reads is the code of an open
+ * multi-line reply; incomplete lines stay in the recv buffer
+ */
+class MongooseFtpReplyParser {
+private:
+    int multiline_code = 0;
+public:
+    //parses the next complete line in buf. Returns the number of consumed bytes including CRLF, or 0 if buf
+    //doesn't contain a complete line yet
+    size_t next(const char *buf, size_t len, MongooseFtpReplyLine& line);
+
+    void reset() {multiline_code = 0;}
+    bool isInReply() {return multiline_code != 0;}
+};
+
+bool ftp_line_contains(const MongooseFtpReplyLine& line, const char *token); //case-sensitive search in the line view
+
+} //end namespace MicroOcpp
+
+#endif
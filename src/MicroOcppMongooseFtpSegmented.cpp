@@ -0,0 +1,173 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseFtpSegmented.h"
+#include <MicroOcpp/Debug.h>
+#include <MicroOcpp/Platform.h>
+
+using namespace MicroOcpp;
+
+MongooseFtpSegmentedDownload::MongooseFtpSegmentedDownload(struct mg_mgr *mgr) : mgr(mgr) {
+
+}
+
+MongooseFtpSegmentedDownload::~MongooseFtpSegmentedDownload() {
+    //sessions call onClose in their destructor. Detach them from this object first
+    if (probe) {
+        probe->onClose = nullptr;
+    }
+    for (auto& segment : segments) {
+        segment.session->onClose = nullptr;
+    }
+}
+
+bool MongooseFtpSegmentedDownload::getFile(const char *ftp_url, unsigned int segments_max, std::function<size_t(size_t offset, unsigned char *data, size_t len)> fileWriterAt, std::function<void(bool success)> onClose) {
+
+    if (!ftp_url || !fileWriterAt || segments_max < 1) {
+        MO_DBG_ERR("invalid args");
+        return false;
+    }
+
+    if (state != State::Idle) {
+        MO_DBG_ERR("download already running");
+        return false;
+    }
+
+    this->ftp_url = ftp_url;
+    this->segments_max = segments_max;
+    this->fileWriterAt = fileWriterAt;
+    this->onClose = onClose;
+    file_size = 0;
+    transfer_start = mocpp_tick_ms();
+
+    if (segments_max == 1) {
+        //no need to probe the server
+        if (!startSegments()) {
+            segments.clear();
+            state = State::Idle;
+            return false;
+        }
+        return true;
+    }
+
+    probe.reset(new MongooseFtpClient(mgr));
+    probe_closed = false;
+    if (!probe->querySize(ftp_url, [this] () {probe_closed = true;})) {
+        probe.reset();
+        return false;
+    }
+
+    state = State::Probe;
+    return true;
+}
+
+bool MongooseFtpSegmentedDownload::startSegments() {
+
+    size_t n_segments = 1;
+
+    if (probe && probe->file_size_known && probe->rest_supported) {
+        file_size = probe->file_size;
+        n_segments = segments_max;
+        while (n_segments > 1 && file_size / n_segments < min_segment_size) {
+            n_segments--;
+        }
+    } else if (segments_max > 1) {
+        MO_DBG_WARN("server does not support SIZE or REST - download over single session");
+    }
+
+    bool rest_supported = probe && probe->rest_supported;
+
+    segments.clear();
+    segments.resize(n_segments);
+
+    bool success = true;
+
+    for (size_t i = 0; i < n_segments; i++) {
+        auto& segment = segments[i];
+        segment.session.reset(new MongooseFtpClient(mgr));
+        segment.session->rate_limiter = rate_limiter;
+
+        auto writer = [this, i] (unsigned char *data, size_t len) -> size_t {
+            auto& segment = segments[i];
+            return fileWriterAt(segment.start + segment.session->transfer_bytes, data, len);
+        };
+        auto closer = [this, i] () {
+            segments[i].closed = true;
+        };
+
+        bool started;
+        if (n_segments == 1) {
+            segment.start = 0;
+            started = segment.session->getFile(ftp_url.c_str(), writer, closer);
+        } else {
+            size_t segment_len = file_size / n_segments;
+            segment.start = i * segment_len;
+            if (i + 1 == n_segments) {
+                segment_len = file_size - segment.start; //last segment takes the remainder
+            }
+            started = segment.session->getFileRange(ftp_url.c_str(), segment.start, segment_len, writer, closer);
+        }
+
+        segment.session->rest_supported = rest_supported; //skip the FEAT check when resuming a segment
+        segment.closed = !started;
+        success &= started;
+    }
+
+    MO_DBG_DEBUG("download %zu bytes over %zu sessions", file_size, n_segments);
+
+    state = State::Transfer;
+    return success;
+}
+
+void MongooseFtpSegmentedDownload::finish(bool success) {
+    auto duration = mocpp_tick_ms() - transfer_start;
+    size_t bytes = 0;
+    for (auto& segment : segments) {
+        bytes += segment.session->transfer_bytes;
+    }
+
+    MO_DBG_INFO("segmented download %s: %zu bytes over %zu sessions in %lu ms (%lu B/s)",
+            success ? "complete" : "failed",
+            bytes, segments.size(), duration,
+            duration > 0 ? (unsigned long) (1000ULL * bytes / duration) : 0UL);
+
+    for (auto& segment : segments) {
+        segment.session->onClose = nullptr;
+    }
+    segments.clear();
+    state = State::Idle;
+
+    auto onClose = std::move(this->onClose);
+    this->onClose = nullptr;
+    if (onClose) {
+        onClose(success);
+    }
+}
+
+void MongooseFtpSegmentedDownload::loop() {
+    if (state == State::Probe) {
+        probe->loop();
+        if (probe_closed) {
+            startSegments();
+            probe.reset();
+        }
+        return;
+    }
+
+    if (state != State::Transfer) {
+        return;
+    }
+
+    bool all_closed = true;
+    bool success = true;
+    for (auto& segment : segments) {
+        segment.session->loop();
+        all_closed &= segment.closed;
+        success &= segment.session->transfer_complete;
+    }
+
+    if (all_closed) {
+        finish(success);
+    }
+}
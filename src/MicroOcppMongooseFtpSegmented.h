@@ -0,0 +1,75 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEFTPSEGMENTED_H
+#define MO_MONGOOSEFTPSEGMENTED_H
+
+#include "MicroOcppMongooseFtp.h"
+
+#include <vector>
+
+#ifndef MO_FTP_SEGMENT_MIN_SIZE
+#define MO_FTP_SEGMENT_MIN_SIZE 65536 //files smaller than two segments are downloaded over a single connection
+#endif
+
+namespace MicroOcpp {
+
+/*
+ * Downloads a file over multiple FTP sessions in parallel. Queries the file size with SIZE, splits
+ * the file into byte ranges and downloads each range with REST over an own ctrl / data conn pair.
+ * Falls back to a single session if the server doesn't support SIZE or REST
+ */
+class MongooseFtpSegmentedDownload {
+private:
+    struct mg_mgr *mgr {nullptr};
+    std::string ftp_url;
+    unsigned int segments_max = 1;
+    std::function<size_t(size_t offset, unsigned char *data, size_t len)> fileWriterAt;
+    std::function<void(bool success)> onClose;
+
+    std::unique_ptr<MongooseFtpClient> probe;
+    bool probe_closed = false;
+
+    struct Segment {
+        std::unique_ptr<MongooseFtpClient> session;
+        size_t start = 0;
+        bool closed = false;
+    };
+    std::vector<Segment> segments;
+
+    enum class State {
+        Idle,
+        Probe,
+        Transfer
+    };
+    State state = State::Idle;
+
+    unsigned long transfer_start = 0;
+    size_t file_size = 0;
+
+    bool startSegments();
+    void finish(bool success);
+
+public:
+    size_t min_segment_size = MO_FTP_SEGMENT_MIN_SIZE;
+    std::shared_ptr<MongooseFtpRateLimiter> rate_limiter; //optional. Shared by all segments
+
+    MongooseFtpSegmentedDownload(struct mg_mgr *mgr);
+    ~MongooseFtpSegmentedDownload();
+
+    bool getFile(const char *ftp_url, // ftp[s]://[user[:pass]@]host[:port][/directory]/filename
+            unsigned int segments, //max number of parallel sessions
+            std::function<size_t(size_t offset, unsigned char *data, size_t len)> fileWriterAt, //write len bytes at file position offset. Return number of bytes written
+            std::function<void(bool success)> onClose);
+
+    void loop();
+
+    bool isActive() {return state != State::Idle;}
+    size_t getFileSize() {return file_size;}
+    size_t getSegmentCount() {return segments.size();}
+};
+
+} //end namespace MicroOcpp
+
+#endif
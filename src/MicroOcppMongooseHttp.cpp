@@ -0,0 +1,849 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseHttp.h"
+#include "MicroOcppMongooseCompat.h"
+#include <MicroOcpp/Debug.h>
+#include <MicroOcpp/Platform.h>
+
+#include <string.h>
+#include <ctype.h>
+
+using namespace MicroOcpp;
+
+void http_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data);
+
+namespace MicroOcpp {
+
+static const char *http_find(const char *buf, size_t len, const char *token) {
+    size_t token_len = strlen(token);
+    for (size_t i = 0; i + token_len <= len; i++) {
+        if (!memcmp(buf + i, token, token_len)) {
+            return buf + i;
+        }
+    }
+    return nullptr;
+}
+
+static bool http_iequals(const char *str, size_t len, const char *token) {
+    if (strlen(token) != len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (tolower((unsigned char) str[i]) != tolower((unsigned char) token[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool http_icontains(const char *str, size_t len, const char *token) {
+    size_t token_len = strlen(token);
+    for (size_t i = 0; i + token_len <= len; i++) {
+        if (http_iequals(str + i, token_len, token)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool http_parse_size(const char *str, size_t len, size_t& out) {
+    size_t val = 0;
+    size_t i = 0;
+    for (; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+        size_t next = val * 10 + (size_t) (str[i] - '0');
+        if (next < val) {
+            return false; //overflow
+        }
+        val = next;
+    }
+    if (i == 0) {
+        return false;
+    }
+    out = val;
+    return true;
+}
+
+//closes the conn after an error and either schedules a resume or reports the failure. The client may be deleted afterwards
+static void http_fail(MongooseHttpClient& client) {
+    client.closeConn();
+    if (!client.scheduleRetry()) {
+        client.finish();
+    }
+}
+
+//feeds the recv buffer into the response state machine. Returns false if the transfer has ended and the client may be deleted
+static bool http_process_response(MongooseHttpClient& client, struct mg_connection *c) {
+    using State = MongooseHttpClient::State;
+
+    while (true) {
+        char *buf = (char*) c->MG_COMPAT_RECV.buf;
+        size_t len = c->MG_COMPAT_RECV.len;
+
+        switch (client.state) {
+            case State::Headers: {
+                const char *end = http_find(buf, len, "\r\n\r\n");
+                if (!end) {
+                    if (len > MO_HTTP_HEADER_MAX) {
+                        MO_DBG_ERR("response header exceeds %i bytes", MO_HTTP_HEADER_MAX);
+                        client.retry_allowed = false;
+                        http_fail(client);
+                        return false;
+                    }
+                    return true; //wait for more data
+                }
+                size_t header_len = (size_t) (end - buf) + 4;
+                bool ok = client.onHeaders(buf, header_len);
+                mg_compat_iobuf_consume(&c->MG_COMPAT_RECV, header_len);
+                if (!ok) {
+                    http_fail(client);
+                    return false;
+                }
+                break;
+            }
+            case State::Body:
+            case State::ChunkData: {
+                if (len == 0) {
+                    return true;
+                }
+                bool delimited = client.state == State::ChunkData || client.resp_has_length;
+                size_t n = delimited && client.resp_remaining < len ? client.resp_remaining : len;
+                size_t ret = n;
+                if (client.method == MongooseHttpClient::Method::Get) {
+                    ret = client.fileWriter((unsigned char*) buf, n);
+                    if (ret > n) {
+                        MO_DBG_ERR("write error");
+                        client.retry_allowed = false;
+                        http_fail(client);
+                        return false;
+                    }
+                    client.transfer_bytes += ret;
+                } //else: discard the response body of uploads
+
+                mg_compat_iobuf_consume(&c->MG_COMPAT_RECV, ret);
+                if (delimited) {
+                    client.resp_remaining -= ret;
+                }
+                if (ret < n) {
+                    return true; //fileWriter is busy, continue with next poll
+                }
+                if (delimited && client.resp_remaining == 0) {
+                    client.state = client.state == State::ChunkData ? State::ChunkDataEnd : State::Done;
+                }
+                break;
+            }
+            case State::ChunkSize: {
+                const char *eol = http_find(buf, len, "\r\n");
+                if (!eol) {
+                    if (len > 64) {
+                        MO_DBG_ERR("invalid chunk size");
+                        client.retry_allowed = false;
+                        http_fail(client);
+                        return false;
+                    }
+                    return true;
+                }
+                size_t size = 0;
+                size_t digits = 0;
+                for (const char *p = buf; p < eol && isxdigit((unsigned char) *p); p++, digits++) {
+                    if (size > ((size_t) -1) / 16) {
+                        digits = 0; //overflow
+                        break;
+                    }
+                    size = size * 16 + (size_t) (isdigit((unsigned char) *p) ? *p - '0' : tolower((unsigned char) *p) - 'a' + 10);
+                }
+                if (!digits) {
+                    MO_DBG_ERR("invalid chunk size");
+                    client.retry_allowed = false;
+                    http_fail(client);
+                    return false;
+                }
+                mg_compat_iobuf_consume(&c->MG_COMPAT_RECV, (size_t) (eol - buf) + 2); //ignores chunk extensions
+                if (size == 0) {
+                    client.state = State::Trailer;
+                } else {
+                    client.resp_remaining = size;
+                    client.state = State::ChunkData;
+                }
+                break;
+            }
+            case State::ChunkDataEnd: {
+                if (len < 2) {
+                    return true;
+                }
+                if (buf[0] != '\r' || buf[1] != '\n') {
+                    MO_DBG_ERR("invalid chunk delimiter");
+                    client.retry_allowed = false;
+                    http_fail(client);
+                    return false;
+                }
+                mg_compat_iobuf_consume(&c->MG_COMPAT_RECV, 2);
+                client.state = State::ChunkSize;
+                break;
+            }
+            case State::Trailer: {
+                const char *eol = http_find(buf, len, "\r\n");
+                if (!eol) {
+                    if (len > MO_HTTP_HEADER_MAX) {
+                        MO_DBG_ERR("trailer exceeds %i bytes", MO_HTTP_HEADER_MAX);
+                        client.retry_allowed = false;
+                        http_fail(client);
+                        return false;
+                    }
+                    return true;
+                }
+                size_t line_len = (size_t) (eol - buf);
+                mg_compat_iobuf_consume(&c->MG_COMPAT_RECV, line_len + 2);
+                if (line_len == 0) {
+                    client.state = State::Done;
+                }
+                break;
+            }
+            case State::Done:
+                client.transfer_complete = true;
+                client.finish();
+                return false;
+            default:
+                c->MG_COMPAT_RECV.len = 0;
+                return true;
+        }
+    }
+}
+
+//fills the send buffer with up to two chunks of the upload body. Returns false if the transfer has ended and the client may be deleted
+static bool http_upload_pump(MongooseHttpClient& client, struct mg_connection *c) {
+    using State = MongooseHttpClient::State;
+
+    if (client.method != MongooseHttpClient::Method::Upload ||
+            client.upload_body_done ||
+            client.state == State::Idle ||
+            client.state == State::Connecting ||
+            !client.fileReader) {
+        return true;
+    }
+
+    //the chunk size has a fixed width so that the payload can be read in place and the header is written afterwards
+    const size_t header_size = 10; // "%08zx\r\n"
+    size_t chunk_size = client.upload_chunk_size > 0 ? client.upload_chunk_size : MO_HTTP_UPLOAD_CHUNK_SIZE;
+    size_t frame_size = header_size + chunk_size + 2;
+
+    while (c->MG_COMPAT_SEND.len <= frame_size) {
+        if (c->MG_COMPAT_SEND.size < c->MG_COMPAT_SEND.len + frame_size) {
+            mg_compat_iobuf_resize(&c->MG_COMPAT_SEND, c->MG_COMPAT_SEND.len + frame_size);
+            if (c->MG_COMPAT_SEND.size < c->MG_COMPAT_SEND.len + frame_size) {
+                MO_DBG_ERR("OOM");
+                return true; //try again with next poll
+            }
+        }
+
+        unsigned char *frame = (unsigned char*) c->MG_COMPAT_SEND.buf + c->MG_COMPAT_SEND.len;
+        size_t ret = client.fileReader(frame + header_size, chunk_size);
+        if (ret > chunk_size) {
+            MO_DBG_ERR("read error");
+            client.closeConn();
+            client.finish();
+            return false;
+        }
+
+        if (ret == 0) {
+            mg_send(c, "0\r\n\r\n", 5);
+            client.upload_body_done = true;
+            MO_DBG_DEBUG("upload body complete: %zu bytes", client.transfer_bytes);
+            return true;
+        }
+
+        char header [header_size + 1];
+        snprintf(header, sizeof(header), "%08zx\r\n", ret);
+        memcpy(frame, header, header_size);
+        memcpy(frame + header_size + ret, "\r\n", 2);
+        c->MG_COMPAT_SEND.len += header_size + ret + 2;
+        client.transfer_bytes += ret;
+    }
+
+    return true;
+}
+
+} //end namespace MicroOcpp
+
+MongooseHttpClient::MongooseHttpClient(struct mg_mgr *mgr) : mgr(mgr) {
+
+}
+
+MongooseHttpClient::~MongooseHttpClient() {
+    if (conn) {
+        conn->MG_COMPAT_FN_DATA = nullptr;
+        mg_compat_drain_conn(conn);
+        conn = nullptr;
+    }
+
+    if (onClose) {
+        onClose();
+        onClose = nullptr;
+    }
+}
+
+void MongooseHttpClient::setCaCert(const char *ca_cert) {
+    this->ca_cert = ca_cert;
+#if MO_MG_CA_CACHE
+    ca_store = getTlsCaStore(ca_cert);
+#endif
+}
+
+bool MongooseHttpClient::readUrl(const char *http_url) {
+    std::string url = http_url;
+
+    size_t pos;
+    if (!url.compare(0, 8, "https://")) {
+        tls = true;
+        pos = 8;
+    } else if (!url.compare(0, 7, "http://")) {
+        tls = false;
+        pos = 7;
+    } else {
+        MO_DBG_ERR("unsupported protocol: %s", http_url);
+        return false;
+    }
+
+    size_t path_pos = url.find('/', pos);
+    std::string authority = url.substr(pos, path_pos == std::string::npos ? std::string::npos : path_pos - pos);
+    path = path_pos == std::string::npos ? "/" : url.substr(path_pos);
+
+    auth.clear();
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos) {
+        std::string userinfo = authority.substr(0, at);
+        authority = authority.substr(at + 1);
+
+        std::string b64 (((userinfo.length() + 2) / 3) * 4 + 1, '\0');
+        mg_base64_encode((const unsigned char*) userinfo.data(), (int) userinfo.length(), &b64[0]);
+        auth = "Basic ";
+        auth += b64.c_str();
+    }
+
+    size_t port_pos = authority.rfind(':');
+    if (port_pos != std::string::npos && authority.find(']', port_pos) != std::string::npos) {
+        port_pos = std::string::npos; //colon belongs to IPv6 literal
+    }
+
+    if (port_pos != std::string::npos) {
+        host = authority.substr(0, port_pos);
+        port = authority.substr(port_pos + 1);
+    } else {
+        host = authority;
+        port = tls ? "443" : "80";
+    }
+
+    if (host.empty() || port.empty()) {
+        MO_DBG_ERR("invalid URL: %s", http_url);
+        return false;
+    }
+
+    return true;
+}
+
+bool MongooseHttpClient::openConn() {
+    std::string key = tls ? "https://" : "http://";
+    key += host;
+    key += ":";
+    key += port;
+
+    conn_reused = false;
+
+    if (conn && state == State::Idle && conn_key == key && method == Method::Get) {
+        MO_DBG_DEBUG("reuse conn %s", key.c_str());
+        conn_reused = true;
+        reuse_count++;
+        sendRequest();
+        return true;
+    }
+
+    closeConn();
+    conn_key = key;
+
+    std::string addr = "tcp://" + host + ":" + port;
+
+    MO_DBG_DEBUG("open conn %s", conn_key.c_str());
+
+#if defined(MO_MG_VERSION_614)
+    struct mg_connect_opts opts;
+    memset(&opts, 0, sizeof(opts));
+#if MG_ENABLE_SSL
+    if (tls) {
+        opts.ssl_ca_cert = ca_cert && *ca_cert ? ca_cert : "*"; //"*" enables TLS without CA verification
+        opts.ssl_server_name = host.c_str();
+    }
+#endif
+    conn = mg_connect_opt(mgr, addr.c_str(), http_cb, this, opts);
+#else
+    conn = mg_connect(mgr, addr.c_str(), http_cb, this);
+#endif
+
+    if (!conn) {
+        MO_DBG_ERR("cannot open conn %s", conn_key.c_str());
+        return false;
+    }
+
+    state = State::Connecting;
+    return true;
+}
+
+void MongooseHttpClient::sendRequest() {
+    std::string req;
+    req.reserve(256);
+    req += method == Method::Get ? "GET" : upload_method;
+    req += " ";
+    req += path;
+    req += " HTTP/1.1\r\nHost: ";
+    req += host;
+    if (port != (tls ? "443" : "80")) {
+        req += ":";
+        req += port;
+    }
+    req += "\r\n";
+
+    if (!auth.empty()) {
+        req += "Authorization: ";
+        req += auth;
+        req += "\r\n";
+    }
+
+    if (method == Method::Get && transfer_bytes > 0) {
+        char range [48];
+        snprintf(range, sizeof(range), "Range: bytes=%zu-\r\n", transfer_bytes);
+        req += range;
+    }
+
+    if (method == Method::Upload) {
+        req += "Content-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n";
+    }
+
+    req += extra_headers;
+    req += "\r\n";
+
+    MO_DBG_DEBUG("%s %s%s (%s)", method == Method::Get ? "GET" : upload_method, conn_key.c_str(), path.c_str(), conn_reused ? "reused conn" : "new conn");
+
+    mg_send(conn, req.data(), req.size());
+
+    state = State::Headers;
+    status_code = 0;
+    resp_chunked = false;
+    resp_has_length = false;
+    resp_keep_alive = true;
+    resp_started = false;
+    resp_remaining = 0;
+    upload_body_done = false;
+
+    if (method == Method::Upload && !transfer_start) {
+        transfer_start = mocpp_tick_ms();
+    }
+}
+
+void MongooseHttpClient::closeConn() {
+    if (conn) {
+        conn->MG_COMPAT_FN_DATA = nullptr;
+        mg_compat_drain_conn(conn);
+        conn = nullptr;
+    }
+    state = State::Idle;
+}
+
+bool MongooseHttpClient::onHeaders(const char *header, size_t len) {
+    //status line: HTTP/1.x SP code SP reason
+    if (len < 12 || strncmp(header, "HTTP/1.", 7) ||
+            !isdigit((unsigned char) header[9]) || !isdigit((unsigned char) header[10]) || !isdigit((unsigned char) header[11])) {
+        MO_DBG_ERR("invalid response");
+        retry_allowed = false;
+        return false;
+    }
+
+    status_code = (header[9] - '0') * 100 + (header[10] - '0') * 10 + (header[11] - '0');
+
+    resp_keep_alive = header[7] != '0'; //HTTP/1.0 closes by default
+    resp_chunked = false;
+    resp_has_length = false;
+    resp_remaining = 0;
+
+    bool has_range = false;
+    size_t range_start = 0;
+    size_t range_total = 0;
+
+    const char *end = header + len - 2; //start of the empty line which terminates the header
+    const char *line = http_find(header, len, "\r\n") + 2;
+
+    while (line < end) {
+        const char *eol = http_find(line, (size_t) (end - line) + 2, "\r\n");
+        const char *colon = (const char*) memchr(line, ':', (size_t) (eol - line));
+        if (colon) {
+            size_t name_len = (size_t) (colon - line);
+            const char *value = colon + 1;
+            while (value < eol && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            size_t value_len = (size_t) (eol - value);
+
+            if (http_iequals(line, name_len, "Content-Length")) {
+                resp_has_length = http_parse_size(value, value_len, resp_remaining);
+            } else if (http_iequals(line, name_len, "Transfer-Encoding")) {
+                resp_chunked = http_icontains(value, value_len, "chunked");
+            } else if (http_iequals(line, name_len, "Connection")) {
+                if (http_icontains(value, value_len, "close")) {
+                    resp_keep_alive = false;
+                } else if (http_icontains(value, value_len, "keep-alive")) {
+                    resp_keep_alive = true;
+                }
+            } else if (http_iequals(line, name_len, "Content-Range")) {
+                //bytes <start>-<end>/<total or *>
+                if (value_len > 6 && http_iequals(value, 6, "bytes ")) {
+                    has_range = http_parse_size(value + 6, value_len - 6, range_start);
+                    const char *slash = (const char*) memchr(value, '/', value_len);
+                    if (slash) {
+                        http_parse_size(slash + 1, (size_t) (eol - slash - 1), range_total);
+                    }
+                }
+            }
+        }
+        line = eol + 2;
+    }
+
+    if (resp_chunked) {
+        resp_has_length = false; //chunked encoding overrides Content-Length (RFC 9112, 6.3)
+    }
+
+    MO_DBG_DEBUG("response %i%s%s", status_code, resp_chunked ? ", chunked" : "", resp_keep_alive ? "" : ", close");
+
+    if (status_code < 200) {
+        return true; //interim response (e.g. 100 Continue). Wait for the final response
+    }
+
+    if (method == Method::Get) {
+        if (status_code == 206) {
+            if (!has_range || range_start != transfer_bytes) {
+                MO_DBG_ERR("Content-Range doesn't match resume offset %zu", transfer_bytes);
+                retry_allowed = false;
+                return false;
+            }
+            if (range_total) {
+                transfer_total = range_total;
+            }
+        } else if (status_code == 200) {
+            if (transfer_bytes > 0) {
+                MO_DBG_ERR("server ignores Range. Cannot resume download at %zu bytes", transfer_bytes);
+                retry_allowed = false;
+                return false;
+            }
+            if (resp_has_length) {
+                transfer_total = resp_remaining;
+            }
+        } else {
+            MO_DBG_WARN("download failed with status %i", status_code);
+            retry_allowed = status_code >= 500; //server errors may be temporary
+            return false;
+        }
+
+        if (!transfer_start) {
+            transfer_start = mocpp_tick_ms();
+        }
+    } else {
+        if (status_code >= 300) {
+            MO_DBG_WARN("upload failed with status %i", status_code);
+            return false;
+        }
+        if (!upload_body_done) {
+            resp_keep_alive = false; //server has answered before the end of the body. The conn can't be reused
+        }
+    }
+
+    if (status_code == 204 || status_code == 304) {
+        state = State::Done;
+    } else if (resp_chunked) {
+        state = State::ChunkSize;
+    } else if (resp_has_length) {
+        state = resp_remaining > 0 ? State::Body : State::Done;
+    } else {
+        state = State::Body; //body ends when the server closes the conn
+        resp_keep_alive = false;
+    }
+
+    return true;
+}
+
+void MongooseHttpClient::finish() {
+    transfer_end = mocpp_tick_ms();
+
+    if (conn && transfer_complete && resp_keep_alive && state == State::Done && conn->MG_COMPAT_RECV.len == 0) {
+        state = State::Idle;
+        idle_since = transfer_end;
+    } else {
+        closeConn();
+    }
+
+    MO_DBG_INFO("%s %s: %zu bytes in %lu ms, status %i, %u retries%s",
+            method == Method::Get ? "download" : "upload",
+            transfer_complete ? "complete" : "failed",
+            transfer_bytes,
+            getDuration(),
+            status_code,
+            retry_count,
+            conn_reused ? ", reused conn" : "");
+
+    if (onClose) {
+        auto onClose = std::move(this->onClose);
+        this->onClose = nullptr;
+        onClose(); //may delete this client
+    }
+}
+
+bool MongooseHttpClient::scheduleRetry() {
+    if (method != Method::Get || transfer_complete || !retry_allowed) {
+        return false;
+    }
+
+    if (retry_count >= max_retries) {
+        MO_DBG_WARN("download failed after %u retries", retry_count);
+        return false;
+    }
+
+    closeConn();
+
+    //exponential backoff
+    retry_delay = retry_delay_ms;
+    for (unsigned int i = 0; i < retry_count && retry_delay < MO_HTTP_RETRY_DELAY_MAX; i++) {
+        retry_delay *= 2;
+    }
+
+    retry_count++;
+    retry_pending = true;
+    retry_scheduled = mocpp_tick_ms();
+
+    MO_DBG_WARN("download interrupted at %zu bytes, retry in %lu ms", transfer_bytes, retry_delay);
+    return true;
+}
+
+unsigned long MongooseHttpClient::getDuration() {
+    return (transfer_end ? transfer_end : mocpp_tick_ms()) - request_start;
+}
+
+void MongooseHttpClient::loop() {
+    if (state == State::Body && !conn && !body_tail.empty()) {
+        //conn has closed while fileWriter was busy. Pass the rest of the body before completing the download
+        size_t ret = fileWriter(body_tail.data(), body_tail.size());
+        if (ret > body_tail.size()) {
+            MO_DBG_ERR("write error");
+            body_tail.clear();
+            retry_allowed = false;
+            state = State::Idle;
+            finish(); //may delete this client
+            return;
+        }
+        transfer_bytes += ret;
+        body_tail.erase(body_tail.begin(), body_tail.begin() + ret);
+        if (body_tail.empty()) {
+            state = State::Done;
+            transfer_complete = true;
+            finish(); //may delete this client
+        }
+        return;
+    }
+
+    if (conn && state == State::Idle && mocpp_tick_ms() - idle_since >= keepalive_timeout_ms) {
+        MO_DBG_DEBUG("close idle conn %s", conn_key.c_str());
+        closeConn();
+    }
+
+    if (retry_pending && mocpp_tick_ms() - retry_scheduled >= retry_delay) {
+        retry_pending = false;
+
+        MO_DBG_INFO("resume download %s at %zu bytes (retry %u/%u)", path.c_str(), transfer_bytes, retry_count, max_retries);
+
+        if (!openConn() && !scheduleRetry()) {
+            finish();
+        }
+    }
+}
+
+bool MongooseHttpClient::getFile(const char *http_url, std::function<size_t(unsigned char *data, size_t len)> fileWriter, std::function<void()> onClose) {
+    if (!http_url || !fileWriter) {
+        MO_DBG_ERR("invalid args");
+        return false;
+    }
+
+    if ((state != State::Idle && state != State::Done) || retry_pending) {
+        MO_DBG_ERR("transfer already running");
+        return false;
+    }
+
+    MO_DBG_DEBUG("init download %s", http_url);
+
+    if (!readUrl(http_url)) {
+        return false;
+    }
+
+    this->method = Method::Get;
+    this->fileWriter = fileWriter;
+    this->fileReader = nullptr;
+    this->onClose = onClose;
+    body_tail.clear();
+
+    transfer_bytes = 0;
+    transfer_total = 0;
+    transfer_complete = false;
+    request_start = mocpp_tick_ms();
+    transfer_start = 0;
+    transfer_end = 0;
+
+    retry_count = 0;
+    retry_allowed = true;
+    retry_pending = false;
+
+    return openConn();
+}
+
+bool MongooseHttpClient::postFile(const char *http_url, std::function<size_t(unsigned char *out, size_t buffsize)> fileReader, std::function<void()> onClose) {
+    if (!http_url || !fileReader) {
+        MO_DBG_ERR("invalid args");
+        return false;
+    }
+
+    if ((state != State::Idle && state != State::Done) || retry_pending) {
+        MO_DBG_ERR("transfer already running");
+        return false;
+    }
+
+    MO_DBG_DEBUG("init upload %s", http_url);
+
+    if (!readUrl(http_url)) {
+        return false;
+    }
+
+    this->method = Method::Upload;
+    this->fileReader = fileReader;
+    this->fileWriter = nullptr;
+    this->onClose = onClose;
+
+    transfer_bytes = 0;
+    transfer_total = 0;
+    transfer_complete = false;
+    request_start = mocpp_tick_ms();
+    transfer_start = 0;
+    transfer_end = 0;
+
+    retry_count = 0;
+    retry_allowed = false; //the body can't be replayed
+    retry_pending = false;
+
+    return openConn();
+}
+
+void http_cb(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
+
+#if MO_MG_CA_CACHE
+    if (ev == MG_EV_CLOSE) {
+        releaseTlsCaStore(c);
+    }
+#endif
+
+#if defined(MO_MG_VERSION_614)
+    if (ev == MG_EV_CONNECT && *(int *) ev_data != 0) {
+        MO_DBG_WARN("connection error %i", *(int *) ev_data);
+        return; //followed by MG_EV_CLOSE
+    }
+#else
+    if (ev == MG_EV_ERROR) {
+        MO_DBG_WARN("connection error: %s", ev_data ? (const char*) ev_data : "");
+        return; //followed by MG_EV_CLOSE
+    }
+#endif
+
+    if (!fn_data) {
+        return; //conn has been released by the client
+    }
+
+    auto& client = *reinterpret_cast<MongooseHttpClient*>(fn_data);
+    using State = MongooseHttpClient::State;
+
+    if (ev == MG_EV_CONNECT) {
+        MO_DBG_DEBUG("connection %s -- connected", client.conn_key.c_str());
+#if !defined(MO_MG_VERSION_614)
+        if (client.tls) {
+            struct mg_tls_opts opts;
+            memset(&opts, 0, sizeof(opts));
+            opts.srvname = mg_url_host(client.conn_key.c_str());
+            #if MO_MG_CA_CACHE
+            if (client.ca_store) {
+                mg_tls_init(c, &opts);
+                if (!c->tls || !client.ca_store->apply(c, opts.srvname)) {
+                    MO_DBG_ERR("TLS init failure");
+                    mg_compat_close_conn(c);
+                    return;
+                }
+            } else
+            #endif
+            {
+                opts.ca = client.ca_cert && *client.ca_cert ? client.ca_cert : nullptr;
+                mg_tls_init(c, &opts);
+            }
+        }
+#endif
+        client.sendRequest();
+        http_upload_pump(client, c);
+    } else if (ev == MG_COMPAT_EV_READ) {
+        if (client.state == State::Idle) {
+            //unsolicited data on idle conn, e.g. 408 Request Timeout. The conn can't be reused
+            c->MG_COMPAT_RECV.len = 0;
+            client.closeConn();
+            return;
+        }
+        client.resp_started = true;
+        http_process_response(client, c);
+    } else if (ev == MG_COMPAT_EV_WRITE) {
+        http_upload_pump(client, c);
+    } else if (ev == MG_EV_POLL) {
+        if (!http_upload_pump(client, c)) {
+            return;
+        }
+        if (c->MG_COMPAT_RECV.len > 0 && (client.state == State::Body || client.state == State::ChunkData)) {
+            http_process_response(client, c); //fileWriter was busy during last read
+        }
+    } else if (ev == MG_EV_CLOSE) {
+        MO_DBG_DEBUG("connection %s -- closed", client.conn_key.c_str());
+        client.conn = nullptr;
+
+        if (client.state == State::Idle) {
+            return; //idle conn closed by the server
+        }
+
+        if (client.state == State::Body && !client.resp_has_length && !client.resp_chunked) {
+            //body delimited by the end of the conn. The recv buffer may still hold bytes if fileWriter is busy
+            if (c->MG_COMPAT_RECV.len > 0) {
+                if (!http_process_response(client, c)) {
+                    return; //write error
+                }
+                if (c->MG_COMPAT_RECV.len > 0) {
+                    //recv buffer is freed with the conn. Keep the rest and pass it in loop()
+                    client.body_tail.assign(c->MG_COMPAT_RECV.buf, c->MG_COMPAT_RECV.buf + c->MG_COMPAT_RECV.len);
+                    c->MG_COMPAT_RECV.len = 0;
+                    return;
+                }
+            }
+            client.state = State::Done;
+            client.transfer_complete = true;
+            client.finish();
+            return;
+        }
+
+        if (client.conn_reused && !client.resp_started) {
+            //server has closed the idle conn before receiving the request. Repeat on a new conn
+            MO_DBG_DEBUG("stale conn, reconnect");
+            client.state = State::Idle;
+            if (client.openConn()) {
+                return;
+            }
+        }
+
+        client.state = State::Idle;
+        if (!client.scheduleRetry()) {
+            client.finish();
+        }
+    }
+}
@@ -0,0 +1,158 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEHTTPCLIENT_H
+#define MO_MONGOOSEHTTPCLIENT_H
+
+#if defined(ARDUINO) //fix for conflicting definitions of IPAddress on Arduino
+#include <Arduino.h>
+#include <IPAddress.h>
+#endif
+
+#include "mongoose.h"
+#include "MicroOcppMongooseTls.h"
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+
+#ifndef MO_HTTP_MAX_RETRIES
+#define MO_HTTP_MAX_RETRIES 3 //number of times an interrupted download is resumed with a Range request
+#endif
+
+#ifndef MO_HTTP_RETRY_DELAY
+#define MO_HTTP_RETRY_DELAY 5000UL //delay before the first resume trial in ms. Doubles with each retry
+#endif
+
+#define MO_HTTP_RETRY_DELAY_MAX 300000UL
+
+#ifndef MO_HTTP_KEEPALIVE_TIMEOUT
+#define MO_HTTP_KEEPALIVE_TIMEOUT 30000UL //time in ms which an idle conn is kept open for the next request
+#endif
+
+#ifndef MO_HTTP_UPLOAD_CHUNK_SIZE
+#define MO_HTTP_UPLOAD_CHUNK_SIZE 4096 //payload size of the upload chunks. The conn buffers up to two chunks
+#endif
+
+#ifndef MO_HTTP_HEADER_MAX
+#define MO_HTTP_HEADER_MAX 2048 //max size of the response header
+#endif
+
+namespace MicroOcpp {
+
+/*
+ * HTTP/1.1 transfer client for firmware downloads and diagnostics uploads, as alternative to the FtpClient.
+ * Runs on the same mg_mgr and needs only one (TLS) conn per transfer:
+ *
+ * - getFile streams the response body into fileWriter. If the conn breaks, the download is resumed with a
+ *   Range request
+ * - postFile sends the output of fileReader with chunked transfer encoding, so the file size needn't be known
+ * - After a successful transfer, the conn is kept open and is reused by the next download to the same server.
+ *   Uploads always open a new conn, because they can't be repeated if a stale conn fails
+ */
+class MongooseHttpClient {
+public:
+    struct mg_mgr *mgr {nullptr};
+    struct mg_connection *conn {nullptr};
+
+    bool tls = false;
+    std::string host;
+    std::string port;
+    std::string path; //including query
+    std::string auth; //value of the Authorization header. Empty if none
+    std::string conn_key; //scheme, host and port of conn
+
+    const char *ca_cert {nullptr}; //zero-copy. Nullptr disables CA verification
+#if MO_MG_CA_CACHE
+    std::shared_ptr<TlsCaStore> ca_store;
+#endif
+    void setCaCert(const char *ca_cert); //the string must outlive this class. Shares the parsed CA store with other connections using the same string
+
+    std::string extra_headers; //appended to each request. Each line must end with CRLF
+    const char *upload_method = "POST";
+
+    bool readUrl(const char *http_url);
+
+    std::function<size_t(unsigned char *data, size_t len)> fileWriter;
+    std::function<size_t(unsigned char *out, size_t bufsize)> fileReader;
+    std::function<void()> onClose;
+
+    enum class Method {
+        Get,
+        Upload,
+        UNDEFINED
+    };
+    Method method = Method::UNDEFINED;
+
+    enum class State {
+        Idle,         //no request on the conn
+        Connecting,
+        Headers,      //waiting for status line and headers
+        Body,         //Content-Length delimited or until the conn closes
+        ChunkSize,
+        ChunkData,
+        ChunkDataEnd, //CRLF after chunk data
+        Trailer,
+        Done
+    };
+    State state = State::Idle;
+
+    int status_code = 0;
+    bool resp_chunked = false;
+    bool resp_has_length = false;
+    bool resp_keep_alive = true;
+    bool resp_started = false; //received any byte of the response
+    size_t resp_remaining = 0; //remaining bytes of the body (Content-Length) or of the current chunk
+    std::vector<unsigned char> body_tail; //end of a body delimited by the conn close which fileWriter hasn't accepted before the close
+
+    size_t upload_chunk_size = MO_HTTP_UPLOAD_CHUNK_SIZE;
+    bool upload_body_done = false;
+
+    bool conn_reused = false;
+    unsigned long idle_since = 0;
+    unsigned long keepalive_timeout_ms = MO_HTTP_KEEPALIVE_TIMEOUT;
+    unsigned int reuse_count = 0;
+
+    size_t transfer_bytes = 0; //bytes committed by fileWriter or read from fileReader
+    size_t transfer_total = 0; //size of the file if announced by the server. 0 if unknown
+    unsigned long request_start = 0;
+    unsigned long transfer_start = 0;
+    unsigned long transfer_end = 0;
+    bool transfer_complete = false;
+
+    //resume interrupted downloads with Range requests
+    unsigned int max_retries = MO_HTTP_MAX_RETRIES;
+    unsigned long retry_delay_ms = MO_HTTP_RETRY_DELAY;
+    unsigned int retry_count = 0;
+    bool retry_allowed = true; //false after permanent errors
+    bool retry_pending = false;
+    unsigned long retry_scheduled = 0;
+    unsigned long retry_delay = 0;
+
+    bool openConn(); //reuses the idle conn if it goes to the same server
+    void sendRequest();
+    void closeConn();
+    bool onHeaders(const char *header, size_t len); //returns false if the response can't be processed
+    void finish(); //keeps or closes the conn, then calls onClose
+    bool scheduleRetry(); //returns true if the download will be resumed in loop()
+    unsigned long getDuration(); //duration from request until completion in ms
+
+    MongooseHttpClient(struct mg_mgr *mgr);
+    ~MongooseHttpClient();
+
+    void loop(); //delivers the end of close-delimited bodies, resumes interrupted downloads and closes idle conns
+
+    bool getFile(const char *http_url, // http[s]://[user[:pass]@]host[:port][/path]
+            std::function<size_t(unsigned char *data, size_t len)> fileWriter,
+            std::function<void()> onClose);
+
+    bool postFile(const char *http_url, // http[s]://[user[:pass]@]host[:port][/path]
+            std::function<size_t(unsigned char *out, size_t buffsize)> fileReader, //write at most buffsize bytes into out-buffer. Return number of bytes written
+            std::function<void()> onClose);
+};
+
+} //end namespace MicroOcpp
+
+#endif
@@ -0,0 +1,313 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseShards.h"
+
+#if MO_MG_SHARDS
+
+#include <MicroOcpp/Debug.h>
+
+#include <chrono>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace MicroOcpp;
+
+namespace MicroOcpp {
+
+static double shard_now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool shard_pin(std::thread& thread, int cpu) {
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset) == 0;
+#else
+    (void) thread;
+    (void) cpu;
+    return false;
+#endif
+}
+
+} //end namespace MicroOcpp
+
+MongooseShardedRuntime::MongooseShardedRuntime(unsigned int n_shards, bool pin_threads) : pin_threads(pin_threads) {
+    if (n_shards == 0) {
+        n_shards = std::thread::hardware_concurrency();
+        if (n_shards == 0) {
+            n_shards = 1;
+        }
+    }
+
+    for (unsigned int i = 0; i < n_shards; i++) {
+        std::unique_ptr<Shard> shard {new Shard()};
+        shard->index = i;
+        shard->metrics.shard = i;
+        mg_mgr_init(&shard->mgr);
+#if MO_MG_EPOLL
+        shard->poller.reset(new MongooseEpollPoller(&shard->mgr));
+#endif
+        shards.push_back(std::move(shard));
+    }
+}
+
+MongooseShardedRuntime::~MongooseShardedRuntime() {
+    stop();
+
+    for (auto& shard : shards) {
+        shard->clients.clear(); //the shard threads have finished. Close the conns from this thread
+        shard->tasks.clear();
+#if MO_MG_EPOLL
+        shard->poller.reset();
+#endif
+        mg_mgr_free(&shard->mgr);
+    }
+}
+
+bool MongooseShardedRuntime::start() {
+    if (started) {
+        return true;
+    }
+
+    unsigned int n_cpus = std::thread::hardware_concurrency();
+
+    for (auto& shard : shards) {
+        shard->running = true;
+        shard->thread = std::thread(run, std::ref(*shard));
+
+        shard->cpu = -1;
+        if (pin_threads && n_cpus > 0) {
+            int cpu = (int) (shard->index % n_cpus);
+            if (shard_pin(shard->thread, cpu)) {
+                shard->cpu = cpu;
+            } else {
+                MO_DBG_DEBUG("cannot pin shard %u", shard->index);
+            }
+        }
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->metrics.cpu = shard->cpu;
+    }
+
+    started = true;
+    MO_DBG_INFO("started %u shards", (unsigned int) shards.size());
+    return true;
+}
+
+void MongooseShardedRuntime::stop() {
+    if (!started) {
+        return;
+    }
+
+    for (auto& shard : shards) {
+        shard->running = false;
+#if MO_MG_EPOLL
+        shard->poller->wakeup();
+#endif
+    }
+    for (auto& shard : shards) {
+        if (shard->thread.joinable()) {
+            shard->thread.join();
+        }
+    }
+
+    started = false; //the clients stay on their shards and continue after the next start()
+}
+
+void MongooseShardedRuntime::run(Shard& shard) {
+    double period_start = shard_now_us();
+    unsigned long period_polls = 0;
+    double period_iter_us = 0., period_iter_max = 0., period_busy_us = 0.;
+    unsigned long polls = 0, tasks_run = 0;
+
+    std::vector<std::function<void(Shard&)>> tasks;
+
+    while (shard.running) {
+        double t_start = shard_now_us();
+
+#if MO_MG_EPOLL
+        shard.poller->poll(MO_MG_SHARD_EPOLL_TICK_MS);
+#else
+        mg_mgr_poll(&shard.mgr, MO_MG_SHARD_POLL_MS);
+#endif
+
+        double t_work = shard_now_us();
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            tasks.swap(shard.tasks);
+        }
+        for (auto& task : tasks) {
+            task(shard);
+        }
+        tasks_run += tasks.size();
+        tasks.clear();
+
+        unsigned long connected = 0;
+        for (auto& client : shard.clients) {
+            client.second->loop();
+            if (client.second->isConnected()) {
+                connected++;
+            }
+        }
+
+        double t_end = shard_now_us();
+
+        polls++;
+        period_polls++;
+        period_iter_us += t_end - t_start;
+        period_busy_us += t_end - t_work;
+        if (t_end - t_start > period_iter_max) {
+            period_iter_max = t_end - t_start;
+        }
+
+        if (t_end - period_start >= MO_MG_SHARD_METRICS_MS * 1000.) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.metrics.clients = (unsigned long) shard.clients.size();
+            shard.metrics.connected = connected;
+            shard.metrics.polls = polls;
+            shard.metrics.tasks = tasks_run;
+            shard.metrics.poll_us_avg = period_iter_us / (double) period_polls;
+            shard.metrics.poll_us_max = period_iter_max;
+            shard.metrics.busy_ratio = period_busy_us / (t_end - period_start);
+
+            period_start = t_end;
+            period_polls = 0;
+            period_iter_us = period_iter_max = period_busy_us = 0.;
+        }
+    }
+}
+
+bool MongooseShardedRuntime::postToShard(unsigned int shard, std::function<void(Shard&)> task) {
+    if (shard >= shards.size()) {
+        MO_DBG_ERR("invalid shard");
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shards[shard]->mutex);
+        shards[shard]->tasks.push_back(std::move(task));
+    }
+#if MO_MG_EPOLL
+    shards[shard]->poller->wakeup();
+#endif
+    return true;
+}
+
+unsigned int MongooseShardedRuntime::selectShard() {
+    //clients weighted by how busy the shard is, so that shards with heavy clients get fewer new ones
+    unsigned int best = 0;
+    double best_score = 0.;
+    for (unsigned int i = 0; i < shards.size(); i++) {
+        double busy_ratio;
+        {
+            std::lock_guard<std::mutex> lock(shards[i]->mutex);
+            busy_ratio = shards[i]->metrics.busy_ratio;
+        }
+        double score = (double) (shards[i]->load + 1) * (1. + busy_ratio);
+        if (i == 0 || score < best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+MongooseShardedRuntime::ClientId MongooseShardedRuntime::addClient(ClientFactory factory) {
+    if (!factory) {
+        MO_DBG_ERR("invalid argument");
+        return 0;
+    }
+
+    ClientId id;
+    unsigned int shard;
+    {
+        std::lock_guard<std::mutex> lock(placement_mutex);
+        id = ++id_counter;
+        shard = selectShard();
+        placement[id] = shard;
+        shards[shard]->load++;
+    }
+
+    postToShard(shard, [this, id, factory] (Shard& shard) {
+        auto client = factory(&shard.mgr);
+        if (!client) {
+            MO_DBG_ERR("client factory failed");
+            std::lock_guard<std::mutex> lock(placement_mutex);
+            if (placement.erase(id)) {
+                shard.load--;
+            }
+            return;
+        }
+        shard.clients[id] = std::move(client);
+    });
+
+    return id;
+}
+
+bool MongooseShardedRuntime::removeClient(ClientId id) {
+    unsigned int shard;
+    {
+        std::lock_guard<std::mutex> lock(placement_mutex);
+        auto entry = placement.find(id);
+        if (entry == placement.end()) {
+            return false;
+        }
+        shard = entry->second;
+        placement.erase(entry);
+        shards[shard]->load--;
+    }
+
+    return postToShard(shard, [id] (Shard& shard) {
+        shard.clients.erase(id);
+    });
+}
+
+bool MongooseShardedRuntime::post(ClientId id, std::function<void(MOcppMongooseClient& client)> fn) {
+    int shard = getShard(id);
+    if (shard < 0) {
+        return false;
+    }
+
+    return postToShard((unsigned int) shard, [id, fn] (Shard& shard) {
+        auto client = shard.clients.find(id);
+        if (client != shard.clients.end()) {
+            fn(*client->second);
+        }
+    });
+}
+
+bool MongooseShardedRuntime::runOnShard(unsigned int shard, std::function<void(struct mg_mgr *mgr)> fn) {
+    return postToShard(shard, [fn] (Shard& shard) {
+        fn(&shard.mgr);
+    });
+}
+
+int MongooseShardedRuntime::getShard(ClientId id) {
+    std::lock_guard<std::mutex> lock(placement_mutex);
+    auto entry = placement.find(id);
+    if (entry == placement.end()) {
+        return -1;
+    }
+    return (int) entry->second;
+}
+
+unsigned int MongooseShardedRuntime::getShardCount() {
+    return (unsigned int) shards.size();
+}
+
+MongooseShardMetrics MongooseShardedRuntime::getMetrics(unsigned int shard) {
+    if (shard >= shards.size()) {
+        return MongooseShardMetrics();
+    }
+    std::lock_guard<std::mutex> lock(shards[shard]->mutex);
+    return shards[shard]->metrics;
+}
+
+#endif //MO_MG_SHARDS
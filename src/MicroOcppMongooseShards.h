@@ -0,0 +1,134 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSESHARDS_H
+#define MO_MONGOOSESHARDS_H
+
+/*
+ * Sharded runtime for high connection counts. mg_mgr_poll walks every connection of its mg_mgr, so a single
+ * event loop stops scaling at a few thousand clients. MongooseShardedRuntime spreads the MOcppMongooseClient
+ * instances over N shards; each shard owns one mg_mgr and one thread (pinned to a core on Linux) and is the only
+ * thread which touches its clients.
+ *
+ * Clients on different shards run concurrently. They must not share the global WS configs, i.e. construct them
+ * with a private config_store (see MOcppMongooseClient). Other threads reach a client only through post()
+ */
+#ifndef MO_MG_SHARDS
+#if defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
+#define MO_MG_SHARDS 1
+#else
+#define MO_MG_SHARDS 0
+#endif
+#endif
+
+#if MO_MG_SHARDS
+
+#include "MicroOcppMongooseClient.h"
+#include "MicroOcppMongooseEpoll.h"
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#ifndef MO_MG_SHARD_POLL_MS
+#define MO_MG_SHARD_POLL_MS 5 //poll timeout of each shard. Upper bound of the latency of post()
+#endif
+
+#ifndef MO_MG_SHARD_EPOLL_TICK_MS
+#define MO_MG_SHARD_EPOLL_TICK_MS 100 //with MO_MG_EPOLL: max wait time of an idle shard. post() wakes the shard up immediately
+#endif
+
+#ifndef MO_MG_SHARD_METRICS_MS
+#define MO_MG_SHARD_METRICS_MS 1000 //update period of the shard metrics
+#endif
+
+namespace MicroOcpp {
+
+struct MongooseShardMetrics {
+    unsigned int shard = 0;
+    int cpu = -1; //core which the thread is pinned to. -1 if not pinned
+    unsigned long clients = 0;
+    unsigned long connected = 0; //clients with an established WS connection
+    unsigned long polls = 0; //mg_mgr_poll calls since start
+    unsigned long tasks = 0; //executed posts since start
+    double poll_us_avg = 0.; //duration of one loop iteration (mg_mgr_poll, client loops and posts) in the last period
+    double poll_us_max = 0.;
+    double busy_ratio = 0.; //share of the last period spent in client loops and posts, i.e. not waiting for I/O
+};
+
+class MongooseShardedRuntime {
+public:
+    typedef unsigned long ClientId; //0 is invalid
+    typedef std::function<std::unique_ptr<MOcppMongooseClient>(struct mg_mgr *mgr)> ClientFactory;
+
+private:
+    struct Shard {
+        unsigned int index {0};
+        int cpu {-1};
+        struct mg_mgr mgr;
+#if MO_MG_EPOLL
+        std::unique_ptr<MongooseEpollPoller> poller;
+#endif
+        std::thread thread;
+        std::atomic<bool> running {false};
+
+        std::mutex mutex; //guards tasks and metrics
+        std::vector<std::function<void(Shard&)>> tasks;
+        MongooseShardMetrics metrics;
+
+        std::atomic<unsigned long> load {0}; //placed clients, including those which are still being constructed
+
+        //owned by the shard thread
+        std::map<ClientId, std::unique_ptr<MOcppMongooseClient>> clients;
+    };
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::mutex placement_mutex; //guards placement
+    std::map<ClientId, unsigned int> placement; //client -> shard index
+    ClientId id_counter {0};
+
+    bool pin_threads {true};
+    bool started {false};
+
+    static void run(Shard& shard);
+    bool postToShard(unsigned int shard, std::function<void(Shard&)> task);
+    unsigned int selectShard();
+
+public:
+    MongooseShardedRuntime(unsigned int n_shards = 0, bool pin_threads = true); //0 for one shard per core
+    ~MongooseShardedRuntime(); //stops the shards and destroys all clients
+
+    bool start();
+    void stop();
+
+    /*
+     * Places a new client on the least loaded shard. The factory runs on the shard thread and must construct the
+     * client on the passed mg_mgr. Thread-safe. Returns 0 on failure
+     */
+    ClientId addClient(ClientFactory factory);
+
+    bool removeClient(ClientId id); //destroys the client on its shard. Thread-safe
+
+    /*
+     * Runs fn with the client on its shard thread. fn must not block and must not keep the reference. Thread-safe.
+     * Returns false if the client doesn't exist. If the client is removed before fn runs, fn is dropped
+     */
+    bool post(ClientId id, std::function<void(MOcppMongooseClient& client)> fn);
+
+    //runs fn on the shard thread, e.g. to add other mg_mgr users like FTP transfers to the shard. Thread-safe
+    bool runOnShard(unsigned int shard, std::function<void(struct mg_mgr *mgr)> fn);
+
+    int getShard(ClientId id); //-1 if the client doesn't exist
+    unsigned int getShardCount();
+    MongooseShardMetrics getMetrics(unsigned int shard); //snapshot of the last period. Thread-safe
+};
+
+} //end namespace MicroOcpp
+
+#endif //MO_MG_SHARDS
+#endif
@@ -0,0 +1,398 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseSnapshot.h"
+#include "MicroOcppMongooseDigest.h"
+#include <MicroOcpp/Core/ConfigurationContainerFlash.h>
+#include <MicroOcpp/Version.h>
+#include <MicroOcpp/Platform.h>
+#include <MicroOcpp/Debug.h>
+
+#include <string.h>
+#include <memory>
+
+using namespace MicroOcpp;
+
+namespace MicroOcpp {
+namespace Snapshot {
+
+void writeU16(std::string& out, uint16_t val) {
+    out.push_back((char) (val & 0xFF));
+    out.push_back((char) ((val >> 8) & 0xFF));
+}
+
+void writeU32(std::string& out, uint32_t val) {
+    writeU16(out, (uint16_t) (val & 0xFFFF));
+    writeU16(out, (uint16_t) ((val >> 16) & 0xFFFF));
+}
+
+bool writeStr(std::string& out, const std::string& str) {
+    if (str.length() > 0xFFFF) {
+        return false;
+    }
+    writeU16(out, (uint16_t) str.length());
+    out.append(str);
+    return true;
+}
+
+uint16_t readU16(const unsigned char *in) {
+    return (uint16_t) in[0] | ((uint16_t) in[1] << 8);
+}
+
+uint32_t readU32(const unsigned char *in) {
+    return (uint32_t) readU16(in) | ((uint32_t) readU16(in + 2) << 16);
+}
+
+//reads a length-prefixed string and advances the read position. Returns false if out of bounds
+bool readStr(const unsigned char *in, size_t len, size_t& pos, std::string& out) {
+    if (pos + 2 > len) {
+        return false;
+    }
+    size_t str_len = readU16(in + pos);
+    pos += 2;
+    if (pos + str_len > len) {
+        return false;
+    }
+    out.assign((const char*) in + pos, str_len);
+    pos += str_len;
+    return true;
+}
+
+std::string altFn(const char *fn) {
+    return std::string(fn) + ".alt";
+}
+
+bool loadFile(FilesystemAdapter& filesystem, const char *fn, WsConnSnapshot& out, uint8_t& seq);
+
+//loads the newer valid slot. Returns the slot index (0: fn, 1: fn + ".alt") or -1 if none is valid
+int loadSlots(FilesystemAdapter& filesystem, const char *fn, WsConnSnapshot& out, uint8_t& seq);
+
+bool writeFile(FilesystemAdapter& filesystem, const char *fn, const std::string& buf) {
+    auto file = filesystem.open(fn, "w");
+    if (!file) {
+        MO_DBG_ERR("could not open %s", fn);
+        return false;
+    }
+
+    if (file->write(buf.data(), buf.length()) != buf.length()) {
+        MO_DBG_ERR("could not write %s", fn);
+        return false;
+    }
+
+    return true;
+}
+
+} //end namespace Snapshot
+} //end namespace MicroOcpp
+
+using namespace MicroOcpp::Snapshot;
+
+bool MicroOcpp::Snapshot::loadFile(FilesystemAdapter& filesystem, const char *fn, WsConnSnapshot& out, uint8_t& seq) {
+
+    size_t size = 0;
+    if (filesystem.stat(fn, &size) != 0) {
+        MO_DBG_DEBUG("no snapshot %s", fn);
+        return false;
+    }
+
+    if (size < MO_WSCONN_SNAPSHOT_HEADER_LEN || size > MO_WSCONN_SNAPSHOT_MAXSIZE) {
+        MO_DBG_WARN("snapshot %s has invalid size %zu", fn, size);
+        return false;
+    }
+
+    auto file = filesystem.open(fn, "r");
+    if (!file) {
+        MO_DBG_ERR("could not open %s", fn);
+        return false;
+    }
+
+    std::unique_ptr<unsigned char[]> buf_ptr {new unsigned char[size]};
+    unsigned char *buf = buf_ptr.get();
+    if (file->read((char*) buf, size) != size) {
+        MO_DBG_ERR("could not read %s", fn);
+        return false;
+    }
+
+    if (memcmp(buf, "MOWS", 4) || buf[4] != MO_WSCONN_SNAPSHOT_VERSION) {
+        MO_DBG_WARN("snapshot %s has unsupported format", fn);
+        return false;
+    }
+
+    size_t payload_len = readU16(buf + 6);
+    if (MO_WSCONN_SNAPSHOT_HEADER_LEN + payload_len != size) {
+        MO_DBG_WARN("snapshot %s is truncated", fn);
+        return false;
+    }
+
+    const unsigned char *payload = buf + MO_WSCONN_SNAPSHOT_HEADER_LEN;
+
+    if (digest_crc32(payload, payload_len) != readU32(buf + 8)) {
+        MO_DBG_WARN("snapshot %s failed checksum test", fn);
+        return false;
+    }
+
+    if (payload_len < 3 * 4) {
+        MO_DBG_WARN("snapshot %s is truncated", fn);
+        return false;
+    }
+
+    WsConnSnapshot snapshot;
+    snapshot.ws_ping_interval = (int32_t) readU32(payload);
+    snapshot.reconnect_interval = (int32_t) readU32(payload + 4);
+    snapshot.stale_timeout = (int32_t) readU32(payload + 8);
+
+    size_t pos = 3 * 4;
+    if (!readStr(payload, payload_len, pos, snapshot.backend_url) ||
+            !readStr(payload, payload_len, pos, snapshot.cb_id) ||
+            !readStr(payload, payload_len, pos, snapshot.auth_key_hex)) {
+        MO_DBG_WARN("snapshot %s is malformed", fn);
+        return false;
+    }
+
+    out = std::move(snapshot);
+    seq = buf[5];
+    return true;
+}
+
+int MicroOcpp::Snapshot::loadSlots(FilesystemAdapter& filesystem, const char *fn, WsConnSnapshot& out, uint8_t& seq) {
+    WsConnSnapshot slot [2];
+    uint8_t slot_seq [2] = {0, 0};
+    bool valid [2];
+    valid[0] = loadFile(filesystem, fn, slot[0], slot_seq[0]);
+    valid[1] = loadFile(filesystem, altFn(fn).c_str(), slot[1], slot_seq[1]);
+
+    int newer;
+    if (valid[0] && valid[1]) {
+        newer = (uint8_t) (slot_seq[1] - slot_seq[0]) < 0x80 ? 1 : 0; //sequence numbers wrap around
+    } else if (valid[0] || valid[1]) {
+        newer = valid[0] ? 0 : 1;
+    } else {
+        return -1;
+    }
+
+    out = std::move(slot[newer]);
+    seq = slot_seq[newer];
+    return newer;
+}
+
+bool MicroOcpp::loadWsConnSnapshot(FilesystemAdapter& filesystem, const char *fn, WsConnSnapshot& out) {
+    uint8_t seq;
+    return loadSlots(filesystem, fn, out, seq) >= 0;
+}
+
+bool MicroOcpp::storeWsConnSnapshot(FilesystemAdapter& filesystem, const char *fn, const WsConnSnapshot& snapshot) {
+
+    std::string payload;
+    writeU32(payload, (uint32_t) snapshot.ws_ping_interval);
+    writeU32(payload, (uint32_t) snapshot.reconnect_interval);
+    writeU32(payload, (uint32_t) snapshot.stale_timeout);
+    bool success = true;
+    success &= writeStr(payload, snapshot.backend_url);
+    success &= writeStr(payload, snapshot.cb_id);
+    success &= writeStr(payload, snapshot.auth_key_hex);
+
+    if (!success || MO_WSCONN_SNAPSHOT_HEADER_LEN + payload.length() > MO_WSCONN_SNAPSHOT_MAXSIZE) {
+        MO_DBG_ERR("WS configs exceed snapshot size");
+        return false;
+    }
+
+    //overwrite the older slot. If the write is torn, the newer slot is still intact
+    WsConnSnapshot current;
+    uint8_t seq = 0;
+    int slot = loadSlots(filesystem, fn, current, seq);
+    std::string slot_fn = slot == 0 ? altFn(fn) : std::string(fn);
+    if (slot >= 0) {
+        seq++;
+    }
+
+    std::string buf;
+    buf.reserve(MO_WSCONN_SNAPSHOT_HEADER_LEN + payload.length());
+    buf.append("MOWS");
+    buf.push_back((char) MO_WSCONN_SNAPSHOT_VERSION);
+    buf.push_back((char) seq);
+    writeU16(buf, (uint16_t) payload.length());
+    writeU32(buf, digest_crc32((const unsigned char*) payload.data(), payload.length()));
+    buf.append(payload);
+
+    return writeFile(filesystem, slot_fn.c_str(), buf);
+}
+
+void MicroOcpp::removeWsConnSnapshot(FilesystemAdapter& filesystem, const char *fn) {
+    filesystem.remove(altFn(fn).c_str());
+    filesystem.remove(fn);
+}
+
+WsConnSnapshotContainer::WsConnSnapshotContainer(std::shared_ptr<FilesystemAdapter> filesystem, const char *json_fn, const char *snapshot_fn) :
+        ConfigurationContainerVolatile(json_fn, true), filesystem(filesystem), snapshot_fn(snapshot_fn) {
+
+}
+
+uint32_t WsConnSnapshotContainer::getRevision() {
+    uint32_t revision = 0;
+    for (size_t i = 0; i < size(); i++) {
+        revision = 31 * revision + getConfiguration(i)->getValueRevision();
+    }
+    return revision;
+}
+
+void WsConnSnapshotContainer::toSnapshot(WsConnSnapshot& out) {
+    if (auto config = getConfiguration(MO_CONFIG_EXT_PREFIX "BackendUrl")) {
+        out.backend_url = config->getString();
+    }
+    if (auto config = getConfiguration(MO_CONFIG_EXT_PREFIX "ChargeBoxId")) {
+        out.cb_id = config->getString();
+    }
+    if (auto config = getConfiguration("AuthorizationKey")) {
+        out.auth_key_hex = config->getString();
+    }
+    if (auto config = getConfiguration("WebSocketPingInterval")) {
+        out.ws_ping_interval = config->getInt();
+    }
+    if (auto config = getConfiguration(MO_CONFIG_EXT_PREFIX "ReconnectInterval")) {
+        out.reconnect_interval = config->getInt();
+    }
+    if (auto config = getConfiguration(MO_CONFIG_EXT_PREFIX "StaleTimeout")) {
+        out.stale_timeout = config->getInt();
+    }
+}
+
+void WsConnSnapshotContainer::fromSnapshot(const WsConnSnapshot& snapshot) {
+    //only assign changed values to keep the config revisions untouched otherwise
+    auto assignString = [this] (const char *key, const std::string& val) {
+        auto config = getConfiguration(key);
+        if (config && strcmp(config->getString(), val.c_str())) {
+            config->setString(val.c_str());
+        }
+    };
+    auto assignInt = [this] (const char *key, int val) {
+        auto config = getConfiguration(key);
+        if (config && config->getInt() != val) {
+            config->setInt(val);
+        }
+    };
+
+    assignString(MO_CONFIG_EXT_PREFIX "BackendUrl", snapshot.backend_url);
+    assignString(MO_CONFIG_EXT_PREFIX "ChargeBoxId", snapshot.cb_id);
+    assignString("AuthorizationKey", snapshot.auth_key_hex);
+    assignInt("WebSocketPingInterval", snapshot.ws_ping_interval);
+    assignInt(MO_CONFIG_EXT_PREFIX "ReconnectInterval", snapshot.reconnect_interval);
+    assignInt(MO_CONFIG_EXT_PREFIX "StaleTimeout", snapshot.stale_timeout);
+}
+
+std::unique_ptr<ConfigurationContainer> WsConnSnapshotContainer::makeJsonContainer() {
+    auto json = makeConfigurationContainerFlash(filesystem, getFilename(), false);
+    if (!json) {
+        MO_DBG_ERR("OOM");
+        return nullptr;
+    }
+
+    //same configs with the current values. load() only overwrites what the file contains
+    for (size_t i = 0; i < size(); i++) {
+        auto config = getConfiguration(i);
+        auto copy = json->createConfiguration(config->getType(), config->getKey());
+        if (!copy) {
+            MO_DBG_ERR("OOM");
+            return nullptr;
+        }
+        switch (config->getType()) {
+            case TConfig::Int:
+                copy->setInt(config->getInt());
+                break;
+            case TConfig::Bool:
+                copy->setBool(config->getBool());
+                break;
+            case TConfig::String:
+                copy->setString(config->getString());
+                break;
+        }
+    }
+    return json;
+}
+
+bool WsConnSnapshotContainer::loadJson() {
+    auto json = makeJsonContainer();
+    if (!json || !json->load()) {
+        MO_DBG_ERR("could not load %s", getFilename());
+        return false;
+    }
+
+    for (size_t i = 0; i < size(); i++) {
+        auto config = getConfiguration(i);
+        auto copy = json->getConfiguration(config->getKey());
+        if (!copy) {
+            continue;
+        }
+        switch (config->getType()) {
+            case TConfig::Int:
+                config->setInt(copy->getInt());
+                break;
+            case TConfig::Bool:
+                config->setBool(copy->getBool());
+                break;
+            case TConfig::String:
+                config->setString(copy->getString());
+                break;
+        }
+    }
+    return true;
+}
+
+bool WsConnSnapshotContainer::storeJson() {
+    auto json = makeJsonContainer();
+    return json && json->save();
+}
+
+bool WsConnSnapshotContainer::storeSnapshot() {
+    auto t_start = mocpp_tick_ms();
+
+    WsConnSnapshot snapshot;
+    toSnapshot(snapshot);
+
+    revision = getRevision(); //on failure, don't retry before the configs change again
+
+    if (!storeWsConnSnapshot(*filesystem, snapshot_fn, snapshot)) {
+        MO_DBG_WARN("fall back to JSON");
+        removeWsConnSnapshot(*filesystem, snapshot_fn); //outdated snapshot must not override the JSON file at next boot
+        return storeJson();
+    }
+
+    size_t json_size = 0;
+    if (filesystem->stat(getFilename(), &json_size) == 0) {
+        filesystem->remove(getFilename()); //migrated or outdated
+    }
+
+    MO_DBG_DEBUG("stored snapshot %s in %lu ms", snapshot_fn, mocpp_tick_ms() - t_start);
+    return true;
+}
+
+bool WsConnSnapshotContainer::load() {
+    auto t_start = mocpp_tick_ms();
+
+    WsConnSnapshot snapshot;
+    if (loadWsConnSnapshot(*filesystem, snapshot_fn, snapshot)) {
+        fromSnapshot(snapshot);
+        revision = getRevision();
+        MO_DBG_DEBUG("loaded snapshot %s in %lu ms", snapshot_fn, mocpp_tick_ms() - t_start);
+        return true;
+    }
+
+    size_t json_size = 0;
+    if (filesystem->stat(getFilename(), &json_size) != 0) {
+        revision = getRevision();
+        return true; //nothing stored yet. Keep the factory defaults
+    }
+
+    //migrate the JSON configs or recover them after a failed snapshot write
+    if (!loadJson()) {
+        return false;
+    }
+    return storeSnapshot();
+}
+
+bool WsConnSnapshotContainer::save() {
+    if (getRevision() == revision) {
+        return true; //no WS config changed since the last load or store
+    }
+    return storeSnapshot();
+}
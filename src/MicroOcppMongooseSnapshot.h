@@ -0,0 +1,100 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSESNAPSHOT_H
+#define MO_MONGOOSESNAPSHOT_H
+
+/*
+ * Binary snapshot of the WS configs. With MO_WSCONN_SNAPSHOT, it is the storage of the WS configs: they are
+ * kept in a WsConnSnapshotContainer which MicroOcpp loads and saves like its JSON config files, so that
+ * ChangeConfiguration and the setters of MOcppMongooseClient write the snapshot directly. MO_WSCONN_FN is only
+ * read to migrate existing configs or if the snapshot is missing or corrupt, and only written if the snapshot
+ * can't be written.
+ *
+ * FilesystemAdapter has no rename. To survive a power loss during the write, the snapshot has two slots, fn and
+ * fn + ".alt". Each store overwrites the older slot with an incremented sequence number, so a torn write only
+ * destroys the older copy. The loader takes the newer slot which passes the checksum test.
+ *
+ * File layout (all integers little-endian):
+ *
+ *     offset  size  field
+ *          0     4  magic "MOWS"
+ *          4     1  format version (MO_WSCONN_SNAPSHOT_VERSION)
+ *          5     1  sequence number, incremented by each store (wraps around)
+ *          6     2  payload length
+ *          8     4  CRC-32 of the payload
+ *         12     -  payload:
+ *                      int32  WebSocketPingInterval
+ *                      int32  Cst_ReconnectInterval
+ *                      int32  Cst_StaleTimeout
+ *                      uint16 length + chars  Cst_BackendUrl
+ *                      uint16 length + chars  Cst_ChargeBoxId
+ *                      uint16 length + chars  AuthorizationKey (hex)
+ */
+
+#include <MicroOcpp/Core/ConfigurationContainer.h>
+#include <MicroOcpp/Core/FilesystemAdapter.h>
+
+#include <string>
+#include <stdint.h>
+
+#ifndef MO_WSCONN_SNAPSHOT_FN
+#define MO_WSCONN_SNAPSHOT_FN (MO_FILENAME_PREFIX "ws-conn.bin")
+#endif
+
+#define MO_WSCONN_SNAPSHOT_VERSION 1
+#define MO_WSCONN_SNAPSHOT_HEADER_LEN 12
+#ifndef MO_WSCONN_SNAPSHOT_MAXSIZE
+#define MO_WSCONN_SNAPSHOT_MAXSIZE 4096
+#endif
+
+namespace MicroOcpp {
+
+struct WsConnSnapshot {
+    int32_t ws_ping_interval = 0;
+    int32_t reconnect_interval = 0;
+    int32_t stale_timeout = 0;
+    std::string backend_url;
+    std::string cb_id;
+    std::string auth_key_hex;
+};
+
+//returns false if both slots are missing, have a different version or fail the checksum test
+bool loadWsConnSnapshot(FilesystemAdapter& filesystem, const char *fn, WsConnSnapshot& out);
+
+//overwrites the older slot. Reads both slots first to find it
+bool storeWsConnSnapshot(FilesystemAdapter& filesystem, const char *fn, const WsConnSnapshot& snapshot);
+
+//removes both slots, so that the next boot loads MO_WSCONN_FN
+void removeWsConnSnapshot(FilesystemAdapter& filesystem, const char *fn);
+
+/*
+ * Config container of the WS configs with the snapshot as storage. Its name is the JSON file json_fn (i.e.
+ * MO_WSCONN_FN), so that declareConfiguration(..., MO_WSCONN_FN) declares the WS configs in it. save() writes
+ * the snapshot only if one of the values has changed since the last load or store
+ */
+class WsConnSnapshotContainer : public ConfigurationContainerVolatile {
+private:
+    std::shared_ptr<FilesystemAdapter> filesystem;
+    const char *snapshot_fn;
+    uint32_t revision {0}; //revision of the configs when they have been loaded or stored
+
+    uint32_t getRevision();
+    void toSnapshot(WsConnSnapshot& out);
+    void fromSnapshot(const WsConnSnapshot& snapshot);
+
+    std::unique_ptr<ConfigurationContainer> makeJsonContainer(); //JSON file with the name of this container
+    bool loadJson();
+    bool storeJson();
+    bool storeSnapshot();
+public:
+    WsConnSnapshotContainer(std::shared_ptr<FilesystemAdapter> filesystem, const char *json_fn, const char *snapshot_fn = MO_WSCONN_SNAPSHOT_FN);
+
+    bool load() override;
+    bool save() override;
+};
+
+} //end namespace MicroOcpp
+
+#endif
@@ -0,0 +1,176 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseTls.h"
+
+#if MO_MG_CA_CACHE
+
+#include <MicroOcpp/Debug.h>
+#include <MicroOcpp/Platform.h>
+
+#if MG_ENABLE_OPENSSL
+#include <openssl/pem.h>
+#endif
+
+#include <string.h>
+#include <string>
+#include <map>
+
+#if MO_MG_CA_CACHE_LOCK
+#include <mutex>
+#endif
+
+using namespace MicroOcpp;
+
+namespace MicroOcpp {
+std::weak_ptr<TlsCaStore> ca_store_cache;
+std::map<struct mg_connection*, std::shared_ptr<TlsCaStore>> ca_store_conns; //stores which are in use by a conn
+#if MO_MG_CA_CACHE_LOCK
+std::mutex ca_store_mutex; //guards ca_store_cache and ca_store_conns
+#endif
+}
+
+TlsCaStore::TlsCaStore(const char *ca_cert) : ca_cert(ca_cert) {
+
+    auto t_start = mocpp_tick_ms();
+
+#if MG_ENABLE_MBEDTLS
+    mbedtls_x509_crt_init(&chain);
+
+    if (!ca_cert) {
+        MO_DBG_ERR("invalid argument");
+        return;
+    }
+
+    int ret = mbedtls_x509_crt_parse(&chain, (const unsigned char*) ca_cert, strlen(ca_cert) + 1);
+    if (ret < 0) {
+        MO_DBG_ERR("cannot parse CA cert: -0x%04x", (unsigned int) -ret);
+        return;
+    } else if (ret > 0) {
+        MO_DBG_WARN("skipped %i invalid certs in CA chain", ret);
+    }
+
+    for (auto crt = &chain; crt && crt->raw.len > 0; crt = crt->next) {
+        stats.cert_count++;
+        stats.parsed_size += crt->raw.len;
+    }
+#elif MG_ENABLE_OPENSSL
+    if (!ca_cert) {
+        MO_DBG_ERR("invalid argument");
+        return;
+    }
+
+    store = X509_STORE_new();
+    BIO *bio = BIO_new_mem_buf(ca_cert, -1);
+    if (!store || !bio) {
+        MO_DBG_ERR("OOM");
+        BIO_free(bio);
+        return;
+    }
+
+    while (X509 *crt = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) {
+        if (X509_STORE_add_cert(store, crt) == 1) {
+            stats.cert_count++;
+            stats.parsed_size += (size_t) i2d_X509(crt, nullptr);
+        }
+        X509_free(crt); //store holds its own reference
+    }
+    BIO_free(bio);
+#endif
+
+    stats.parse_ms = mocpp_tick_ms() - t_start;
+
+    if (stats.cert_count == 0) {
+        MO_DBG_ERR("CA cert contains no valid certificates");
+        return;
+    }
+
+    MO_DBG_DEBUG("parsed %zu CA certs (%zu bytes DER) in %lu ms", stats.cert_count, stats.parsed_size, stats.parse_ms);
+    valid = true;
+}
+
+TlsCaStore::~TlsCaStore() {
+#if MG_ENABLE_MBEDTLS
+    mbedtls_x509_crt_free(&chain);
+#elif MG_ENABLE_OPENSSL
+    X509_STORE_free(store);
+#endif
+}
+
+bool TlsCaStore::apply(struct mg_connection *c, struct mg_str srvname) {
+    if (!valid || !c || !c->tls) {
+        MO_DBG_ERR("invalid state");
+        return false;
+    }
+
+    struct mg_tls *tls = (struct mg_tls*) c->tls;
+
+#if MG_ENABLE_MBEDTLS
+    mbedtls_ssl_conf_ca_chain(&tls->conf, &chain, nullptr);
+    mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    if (srvname.len > 0) {
+        //Mongoose only sets the host name if opts.ca is set. Without it, any cert of the CA chain would be accepted
+        std::string host {srvname.ptr, srvname.len};
+        if (mbedtls_ssl_set_hostname(&tls->ssl, host.c_str()) != 0) {
+            MO_DBG_ERR("OOM");
+            return false;
+        }
+    }
+#elif MG_ENABLE_OPENSSL
+    if (X509_STORE_up_ref(store) != 1) {
+        MO_DBG_ERR("OOM");
+        return false;
+    }
+    SSL_CTX_set_cert_store(tls->ctx, store); //takes ownership of one reference
+    SSL_set_verify(tls->ssl, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+    if (srvname.len > 0) {
+        std::string host {srvname.ptr, srvname.len};
+        SSL_set1_host(tls->ssl, host.c_str());
+    }
+#endif
+
+    {
+#if MO_MG_CA_CACHE_LOCK
+        std::lock_guard<std::mutex> lock(ca_store_mutex);
+#endif
+        ca_store_conns[c] = shared_from_this();
+    }
+
+    unsigned int use_count = ++stats.use_count;
+
+    MO_DBG_VERBOSE("use shared CA store (%u connections, saved parsing %zu bytes each)", use_count, stats.parsed_size);
+    return true;
+}
+
+void MicroOcpp::releaseTlsCaStore(struct mg_connection *c) {
+#if MO_MG_CA_CACHE_LOCK
+    std::lock_guard<std::mutex> lock(ca_store_mutex);
+#endif
+    ca_store_conns.erase(c);
+}
+
+std::shared_ptr<TlsCaStore> MicroOcpp::getTlsCaStore(const char *ca_cert) {
+    if (!ca_cert || !*ca_cert) {
+        return nullptr;
+    }
+
+#if MO_MG_CA_CACHE_LOCK
+    std::lock_guard<std::mutex> lock(ca_store_mutex); //concurrent callers with the same ca_cert parse it only once
+#endif
+
+    auto ca_store = ca_store_cache.lock();
+    if (ca_store && ca_store->getCaCert() == ca_cert) {
+        return ca_store;
+    }
+
+    ca_store = std::make_shared<TlsCaStore>(ca_cert);
+    if (!ca_store->isValid()) {
+        return nullptr;
+    }
+
+    ca_store_cache = ca_store;
+    return ca_store;
+}
+
+#endif //MO_MG_CA_CACHE
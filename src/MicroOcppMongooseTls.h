@@ -0,0 +1,102 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSETLS_H
+#define MO_MONGOOSETLS_H
+
+#if defined(ARDUINO) //fix for conflicting definitions of IPAddress on Arduino
+#include <Arduino.h>
+#include <IPAddress.h>
+#endif
+
+#include "mongoose.h"
+
+#include <memory>
+#include <stddef.h>
+
+/*
+ * Parsed CA certificate store which is shared by all TLS connections of this adapter (WS and FTP).
+ * Mongoose parses the PEM string in every mg_tls_init. With the shared store, the PEM string is
+ * parsed once and each connection references the parsed chain. Requires Mongoose v7 with MbedTLS
+ * or OpenSSL
+ */
+#ifndef MO_MG_CA_CACHE
+#if !defined(MO_MG_VERSION_614) && (MG_ENABLE_MBEDTLS || MG_ENABLE_OPENSSL)
+#define MO_MG_CA_CACHE 1
+#else
+#define MO_MG_CA_CACHE 0
+#endif
+#endif
+
+/*
+ * The cached store and the references of the conns are guarded by a mutex, so that clients can be created and
+ * closed on several threads (e.g. MongooseShardedRuntime). Can be disabled on single-threaded targets
+ */
+#ifndef MO_MG_CA_CACHE_LOCK
+#if defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
+#define MO_MG_CA_CACHE_LOCK 1
+#else
+#define MO_MG_CA_CACHE_LOCK 0
+#endif
+#endif
+
+#if MO_MG_CA_CACHE
+
+#if MO_MG_CA_CACHE_LOCK
+#include <atomic>
+#endif
+
+namespace MicroOcpp {
+
+class TlsCaStore : public std::enable_shared_from_this<TlsCaStore> {
+private:
+    const char *ca_cert; //zero-copy
+#if MG_ENABLE_MBEDTLS
+    mbedtls_x509_crt chain;
+#elif MG_ENABLE_OPENSSL
+    X509_STORE *store {nullptr};
+#endif
+    bool valid {false};
+public:
+    struct Stats {
+        unsigned long parse_ms = 0; //time spent parsing the PEM string
+        size_t cert_count = 0; //number of certificates in the chain
+        size_t parsed_size = 0; //DER size of the parsed chain. Approximately the heap which each connection saves
+#if MO_MG_CA_CACHE_LOCK
+        std::atomic<unsigned int> use_count {0}; //number of TLS connections which used this store
+#else
+        unsigned int use_count = 0; //number of TLS connections which used this store
+#endif
+    };
+private:
+    Stats stats;
+public:
+    TlsCaStore(const char *ca_cert); //parses ca_cert. The string must outlive this object
+    ~TlsCaStore();
+
+    TlsCaStore(const TlsCaStore&) = delete;
+    TlsCaStore& operator=(const TlsCaStore&) = delete;
+
+    bool isValid() {return valid;}
+    const char *getCaCert() {return ca_cert;}
+    const Stats& getStats() {return stats;}
+
+    /*
+     * Enable CA verification with the shared chain and check that the server cert is issued for srvname. Call
+     * directly after mg_tls_init(c, opts) with opts.ca = NULL. c references this store until releaseTlsCaStore(c),
+     * so that setCaCert() can replace the store while a handshake is still in progress
+     */
+    bool apply(struct mg_connection *c, struct mg_str srvname);
+};
+
+//drops the reference of c to its CA store. Call on MG_EV_CLOSE of every conn which can have a store applied
+void releaseTlsCaStore(struct mg_connection *c);
+
+//returns the shared store for ca_cert. Parses ca_cert only if it is not the CA cert of the cached store
+std::shared_ptr<TlsCaStore> getTlsCaStore(const char *ca_cert);
+
+} //end namespace MicroOcpp
+
+#endif //MO_MG_CA_CACHE
+#endif
@@ -0,0 +1,649 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#include "MicroOcppMongooseWs.h"
+#include "MicroOcppMongooseCompat.h"
+
+#include <MicroOcpp/Debug.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MO_WS_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define MO_WS_X86_DISPATCH 1 //AVX2 is detected at runtime
+#define MO_WS_TARGET(t) __attribute__((target(t)))
+#else
+#define MO_WS_TARGET(t)
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define MO_WS_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace MicroOcpp;
+
+namespace MicroOcpp {
+
+/*
+ * The key repeats every 4 bytes. All kernels process multiples of 4 bytes from the start of the payload, so
+ * that the key is always applied in phase 0 and only the tail needs the byte index
+ */
+
+static void ws_mask_byte(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char key [4]) {
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = src[i] ^ key[i & 3];
+    }
+}
+
+static void ws_mask_word(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char key [4]) {
+    unsigned char key8 [8];
+    memcpy(key8, key, 4);
+    memcpy(key8 + 4, key, 4);
+    uint64_t k;
+    memcpy(&k, key8, 8); //in memory order, so that the XOR is independent of the endianness
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        uint64_t w [4];
+        memcpy(w, src + i, 32);
+        w[0] ^= k;
+        w[1] ^= k;
+        w[2] ^= k;
+        w[3] ^= k;
+        memcpy(dst + i, w, 32);
+    }
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        w ^= k;
+        memcpy(dst + i, &w, 8);
+    }
+    ws_mask_byte(dst + i, src + i, len - i, key); //i is a multiple of 4
+}
+
+#if MO_WS_X86
+
+static void ws_mask_sse2(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char key [4]) {
+    int32_t k32;
+    memcpy(&k32, key, 4);
+    const __m128i k = _mm_set1_epi32(k32);
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*) (src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*) (src + i + 48));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(a, k));
+        _mm_storeu_si128((__m128i*) (dst + i + 16), _mm_xor_si128(b, k));
+        _mm_storeu_si128((__m128i*) (dst + i + 32), _mm_xor_si128(c, k));
+        _mm_storeu_si128((__m128i*) (dst + i + 48), _mm_xor_si128(d, k));
+    }
+    for (; i + 16 <= len; i += 16) {
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*) (src + i)), k));
+    }
+    ws_mask_word(dst + i, src + i, len - i, key);
+}
+
+MO_WS_TARGET("avx2")
+static void ws_mask_avx2(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char key [4]) {
+    int32_t k32;
+    memcpy(&k32, key, 4);
+    const __m256i k = _mm256_set1_epi32(k32);
+
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*) (src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*) (src + i + 96));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(a, k));
+        _mm256_storeu_si256((__m256i*) (dst + i + 32), _mm256_xor_si256(b, k));
+        _mm256_storeu_si256((__m256i*) (dst + i + 64), _mm256_xor_si256(c, k));
+        _mm256_storeu_si256((__m256i*) (dst + i + 96), _mm256_xor_si256(d, k));
+    }
+    for (; i + 32 <= len; i += 32) {
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (src + i)), k));
+    }
+    _mm256_zeroupper(); //the tail runs with SSE instructions. GCC omits vzeroupper before the tail call
+    ws_mask_sse2(dst + i, src + i, len - i, key);
+}
+
+#endif //MO_WS_X86
+
+#if MO_WS_NEON
+
+static void ws_mask_neon(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char key [4]) {
+    uint32_t k32;
+    memcpy(&k32, key, 4);
+    const uint8x16_t k = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint8x16x4_t v = vld1q_u8_x4(src + i);
+        v.val[0] = veorq_u8(v.val[0], k);
+        v.val[1] = veorq_u8(v.val[1], k);
+        v.val[2] = veorq_u8(v.val[2], k);
+        v.val[3] = veorq_u8(v.val[3], k);
+        vst1q_u8_x4(dst + i, v);
+    }
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), k));
+    }
+    ws_mask_word(dst + i, src + i, len - i, key);
+}
+
+#endif //MO_WS_NEON
+
+static bool ws_kernel_supported(int kernel) {
+    switch (kernel) {
+        case MO_WS_KERNEL_BYTE:
+        case MO_WS_KERNEL_WORD:
+            return true;
+#if MO_WS_X86
+        case MO_WS_KERNEL_SSE2:
+            return true;
+        case MO_WS_KERNEL_AVX2:
+#if MO_WS_X86_DISPATCH
+            return __builtin_cpu_supports("avx2");
+#elif defined(__AVX2__)
+            return true;
+#else
+            return false;
+#endif
+#endif //MO_WS_X86
+#if MO_WS_NEON
+        case MO_WS_KERNEL_NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+static int ws_detect_kernel() {
+    const int preference [] = {MO_WS_KERNEL_AVX2, MO_WS_KERNEL_SSE2, MO_WS_KERNEL_NEON};
+    for (int kernel : preference) {
+        if (ws_kernel_supported(kernel)) {
+            return kernel;
+        }
+    }
+    return MO_WS_KERNEL_WORD;
+}
+
+static int& ws_mask_kernel_ref() {
+    static int kernel = ws_detect_kernel();
+    return kernel;
+}
+
+static int& ws_utf8_kernel_ref() {
+    static int kernel = ws_detect_kernel();
+    return kernel;
+}
+
+/*
+ * Length of the valid UTF-8 sequence at s with avail bytes, or 0 if it's invalid or truncated. Ranges of the
+ * second byte after Unicode, Table 3-7
+ */
+static size_t ws_utf8_seq(const unsigned char *s, size_t avail) {
+    unsigned char c = s[0];
+    if (c < 0x80) {
+        return 1;
+    }
+    size_t n;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (c < 0xC2) {
+        return 0; //continuation byte or overlong 2-byte sequence
+    } else if (c < 0xE0) {
+        n = 2;
+    } else if (c < 0xF0) {
+        n = 3;
+        if (c == 0xE0) {
+            lo = 0xA0; //overlong
+        } else if (c == 0xED) {
+            hi = 0x9F; //surrogates
+        }
+    } else if (c < 0xF5) {
+        n = 4;
+        if (c == 0xF0) {
+            lo = 0x90; //overlong
+        } else if (c == 0xF4) {
+            hi = 0x8F; //above U+10FFFF
+        }
+    } else {
+        return 0;
+    }
+    if (avail < n || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+static bool ws_utf8_byte(const unsigned char *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        size_t n = ws_utf8_seq(data + i, len - i);
+        if (!n) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+static bool ws_utf8_word(const unsigned char *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        if (i + 8 <= len) {
+            uint64_t w;
+            memcpy(&w, data + i, 8);
+            if (!(w & 0x8080808080808080ULL)) {
+                i += 8; //ASCII
+                continue;
+            }
+        }
+        size_t n = ws_utf8_seq(data + i, len - i);
+        if (!n) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+/*
+ * Validation with vector table lookups (Keiser, Lemire: Validating UTF-8 In Less Than One Instruction Per Byte).
+ * Each byte is classified by the high nibble of the previous byte, the low nibble of the previous byte and its
+ * own high nibble. The AND of the three lookups is non-zero for all invalid 2-byte combinations. The bytes which
+ * must be the 3rd or 4th byte of a sequence are checked with saturating subtractions
+ */
+#define MO_UTF8_TOO_SHORT      (1 << 0) //lead byte not followed by a continuation byte
+#define MO_UTF8_TOO_LONG       (1 << 1) //ASCII followed by a continuation byte
+#define MO_UTF8_OVERLONG_3     (1 << 2)
+#define MO_UTF8_TOO_LARGE      (1 << 3)
+#define MO_UTF8_SURROGATE      (1 << 4)
+#define MO_UTF8_OVERLONG_2     (1 << 5)
+#define MO_UTF8_TOO_LARGE_1000 (1 << 6)
+#define MO_UTF8_OVERLONG_4     (1 << 6)
+#define MO_UTF8_TWO_CONTS      (1 << 7) //continuation byte which must be the 3rd or 4th byte
+#define MO_UTF8_CARRY          (MO_UTF8_TOO_SHORT | MO_UTF8_TOO_LONG | MO_UTF8_TWO_CONTS)
+
+#if (MO_WS_X86 && (MO_WS_X86_DISPATCH || defined(__AVX2__))) || MO_WS_NEON
+
+static const uint8_t ws_utf8_byte_1_high [16] = {
+    //0_______: ASCII
+    MO_UTF8_TOO_LONG, MO_UTF8_TOO_LONG, MO_UTF8_TOO_LONG, MO_UTF8_TOO_LONG,
+    MO_UTF8_TOO_LONG, MO_UTF8_TOO_LONG, MO_UTF8_TOO_LONG, MO_UTF8_TOO_LONG,
+    //10______: continuation
+    MO_UTF8_TWO_CONTS, MO_UTF8_TWO_CONTS, MO_UTF8_TWO_CONTS, MO_UTF8_TWO_CONTS,
+    //1100____, 1101____: 2-byte lead
+    MO_UTF8_TOO_SHORT | MO_UTF8_OVERLONG_2,
+    MO_UTF8_TOO_SHORT,
+    //1110____: 3-byte lead
+    MO_UTF8_TOO_SHORT | MO_UTF8_OVERLONG_3 | MO_UTF8_SURROGATE,
+    //1111____: 4-byte lead
+    MO_UTF8_TOO_SHORT | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000 | MO_UTF8_OVERLONG_4
+};
+
+static const uint8_t ws_utf8_byte_1_low [16] = {
+    MO_UTF8_CARRY | MO_UTF8_OVERLONG_3 | MO_UTF8_OVERLONG_2 | MO_UTF8_OVERLONG_4, //____0000
+    MO_UTF8_CARRY | MO_UTF8_OVERLONG_2,                                           //____0001
+    MO_UTF8_CARRY,
+    MO_UTF8_CARRY,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE,                                            //____0100
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000 | MO_UTF8_SURROGATE, //____1101
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000,
+    MO_UTF8_CARRY | MO_UTF8_TOO_LARGE | MO_UTF8_TOO_LARGE_1000
+};
+
+static const uint8_t ws_utf8_byte_2_high [16] = {
+    //0_______: ASCII
+    MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT,
+    MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT,
+    //1000____
+    MO_UTF8_TOO_LONG | MO_UTF8_OVERLONG_2 | MO_UTF8_TWO_CONTS | MO_UTF8_OVERLONG_3 | MO_UTF8_TOO_LARGE_1000 | MO_UTF8_OVERLONG_4,
+    //1001____
+    MO_UTF8_TOO_LONG | MO_UTF8_OVERLONG_2 | MO_UTF8_TWO_CONTS | MO_UTF8_OVERLONG_3 | MO_UTF8_TOO_LARGE,
+    //101_____
+    MO_UTF8_TOO_LONG | MO_UTF8_OVERLONG_2 | MO_UTF8_TWO_CONTS | MO_UTF8_SURROGATE | MO_UTF8_TOO_LARGE,
+    MO_UTF8_TOO_LONG | MO_UTF8_OVERLONG_2 | MO_UTF8_TWO_CONTS | MO_UTF8_SURROGATE | MO_UTF8_TOO_LARGE,
+    //11______: lead
+    MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT, MO_UTF8_TOO_SHORT
+};
+
+/*
+ * The vector kernels validate whole blocks, each in the context of the 3 bytes before it. A sequence which starts
+ * in the last 3 bytes of the last block may continue after it. Validation continues with the scalar code at its
+ * lead byte
+ */
+static size_t ws_utf8_resume(const unsigned char *data, size_t end) {
+    for (size_t k = 1; k <= 3 && k <= end; k++) {
+        if (data[end - k] >= 0xC0) {
+            return end - k;
+        }
+    }
+    return end;
+}
+
+#endif
+
+#if MO_WS_X86
+
+static bool ws_utf8_sse2(const unsigned char *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        if (i + 16 <= len && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (data + i)))) {
+            i += 16; //ASCII
+            continue;
+        }
+        size_t n = ws_utf8_seq(data + i, len - i);
+        if (!n) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+#if MO_WS_X86_DISPATCH || defined(__AVX2__)
+
+MO_WS_TARGET("avx2")
+static bool ws_utf8_avx2(const unsigned char *data, size_t len) {
+    const __m256i byte_1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) ws_utf8_byte_1_high));
+    const __m256i byte_1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) ws_utf8_byte_1_low));
+    const __m256i byte_2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) ws_utf8_byte_2_high));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    //the last 3 bytes of a block must not start a sequence which is longer than the rest of the block
+    const __m256i max_end = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             (char) (0xF0 - 1), (char) (0xE0 - 1), (char) (0xC0 - 1));
+
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i*) (data + i));
+        if (!_mm256_movemask_epi8(input)) {
+            error = _mm256_or_si256(error, prev_incomplete); //ASCII
+        } else {
+            __m256i carried = _mm256_permute2x128_si256(prev_input, input, 0x21); //high half of prev, low half of input
+            __m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+            __m256i prev2 = _mm256_alignr_epi8(input, carried, 14);
+            __m256i prev3 = _mm256_alignr_epi8(input, carried, 13);
+
+            __m256i special = _mm256_and_si256(_mm256_and_si256(
+                _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+            __m256i must_be_cont = _mm256_and_si256(_mm256_or_si256(
+                _mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0 - 0x80))),  //3rd byte
+                _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0 - 0x80)))), //4th byte
+                _mm256_set1_epi8((char) 0x80));
+
+            error = _mm256_or_si256(error, _mm256_xor_si256(must_be_cont, special));
+            prev_incomplete = _mm256_subs_epu8(input, max_end);
+        }
+        prev_input = input;
+    }
+
+    bool valid = _mm256_testz_si256(error, error);
+    _mm256_zeroupper(); //the tail runs with SSE instructions
+    if (!valid) {
+        return false;
+    }
+
+    size_t resume = ws_utf8_resume(data, i);
+    return ws_utf8_sse2(data + resume, len - resume);
+}
+
+#endif
+
+#endif //MO_WS_X86
+
+#if MO_WS_NEON
+
+static bool ws_utf8_neon(const unsigned char *data, size_t len) {
+    const uint8x16_t byte_1_high = vld1q_u8(ws_utf8_byte_1_high);
+    const uint8x16_t byte_1_low = vld1q_u8(ws_utf8_byte_1_low);
+    const uint8x16_t byte_2_high = vld1q_u8(ws_utf8_byte_2_high);
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+    static const uint8_t max_end_bytes [16] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                               0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+    const uint8x16_t max_end = vld1q_u8(max_end_bytes);
+
+    uint8x16_t prev_input = vdupq_n_u8(0);
+    uint8x16_t prev_incomplete = vdupq_n_u8(0);
+    uint8x16_t error = vdupq_n_u8(0);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t input = vld1q_u8(data + i);
+        if (vmaxvq_u8(input) < 0x80) {
+            error = vorrq_u8(error, prev_incomplete); //ASCII
+        } else {
+            uint8x16_t prev1 = vextq_u8(prev_input, input, 15);
+            uint8x16_t prev2 = vextq_u8(prev_input, input, 14);
+            uint8x16_t prev3 = vextq_u8(prev_input, input, 13);
+
+            uint8x16_t special = vandq_u8(vandq_u8(
+                vqtbl1q_u8(byte_1_high, vshrq_n_u8(prev1, 4)),
+                vqtbl1q_u8(byte_1_low, vandq_u8(prev1, nibble))),
+                vqtbl1q_u8(byte_2_high, vshrq_n_u8(input, 4)));
+
+            uint8x16_t must_be_cont = vandq_u8(vorrq_u8(
+                vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)),
+                vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80))),
+                vdupq_n_u8(0x80));
+
+            error = vorrq_u8(error, veorq_u8(must_be_cont, special));
+            prev_incomplete = vqsubq_u8(input, max_end);
+        }
+        prev_input = input;
+    }
+
+    if (vmaxvq_u8(error) != 0) {
+        return false;
+    }
+
+    size_t resume = ws_utf8_resume(data, i);
+    return ws_utf8_word(data + resume, len - resume);
+}
+
+#endif //MO_WS_NEON
+
+} //end namespace MicroOcpp
+
+void MicroOcpp::ws_mask_copy(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char key [4]) {
+    switch (ws_mask_kernel_ref()) {
+        case MO_WS_KERNEL_BYTE:
+            ws_mask_byte(dst, src, len, key);
+            break;
+#if MO_WS_X86
+        case MO_WS_KERNEL_SSE2:
+            ws_mask_sse2(dst, src, len, key);
+            break;
+#if MO_WS_X86_DISPATCH || defined(__AVX2__)
+        case MO_WS_KERNEL_AVX2:
+            if (len >= 256) {
+                ws_mask_avx2(dst, src, len, key);
+            } else {
+                ws_mask_sse2(dst, src, len, key); //setting up the 256-bit registers costs more than it saves
+            }
+            break;
+#endif
+#endif
+#if MO_WS_NEON
+        case MO_WS_KERNEL_NEON:
+            ws_mask_neon(dst, src, len, key);
+            break;
+#endif
+        default:
+            ws_mask_word(dst, src, len, key);
+            break;
+    }
+}
+
+bool MicroOcpp::ws_mask_use_kernel(int kernel) {
+    if (!ws_kernel_supported(kernel)) {
+        return false;
+    }
+    ws_mask_kernel_ref() = kernel;
+    return true;
+}
+
+int MicroOcpp::ws_mask_kernel() {
+    return ws_mask_kernel_ref();
+}
+
+const char *MicroOcpp::ws_kernel_name(int kernel) {
+    switch (kernel) {
+        case MO_WS_KERNEL_BYTE: return "byte";
+        case MO_WS_KERNEL_WORD: return "word";
+        case MO_WS_KERNEL_SSE2: return "sse2";
+        case MO_WS_KERNEL_AVX2: return "avx2";
+        case MO_WS_KERNEL_NEON: return "neon";
+        default:                return "unknown";
+    }
+}
+
+size_t MicroOcpp::ws_send_masked(struct mg_connection *c, const void *buf, size_t len, int op) {
+    if (!c || (!buf && len > 0)) {
+        MO_DBG_ERR("invalid argument");
+        return 0;
+    }
+
+    //frame header (RFC 6455, section 5.2): FIN + opcode, MASK + payload length, extended length, masking key
+    unsigned char hdr [14];
+    size_t hdr_len = 2;
+    hdr[0] = (unsigned char) (0x80 | (op & 0x0F));
+    if (len < 126) {
+        hdr[1] = (unsigned char) (0x80 | len);
+    } else if (len <= 0xFFFF) {
+        hdr[1] = 0x80 | 126;
+        hdr[2] = (unsigned char) (len >> 8);
+        hdr[3] = (unsigned char) len;
+        hdr_len = 4;
+    } else {
+        hdr[1] = 0x80 | 127;
+        for (int i = 0; i < 8; i++) {
+            hdr[2 + i] = (unsigned char) ((uint64_t) len >> (56 - 8 * i));
+        }
+        hdr_len = 10;
+    }
+
+    unsigned char *key = hdr + hdr_len;
+#if defined(MO_MG_VERSION_614)
+    uint32_t rnd = (uint32_t) rand(); //like mg_send_websocket_frame
+    memcpy(key, &rnd, 4);
+#else
+    mg_random(key, 4);
+#endif
+    hdr_len += 4;
+
+    //reserve header and payload at once, so that a failed resize doesn't leave a partial frame
+#if defined(MO_MG_VERSION_614)
+    struct mbuf *io = &c->send_mbuf;
+    size_t ofs = io->len;
+    if (mbuf_append(io, nullptr, hdr_len + len) != hdr_len + len) {
+        MO_DBG_WARN("send buffer full");
+        return 0;
+    }
+#else
+    struct mg_iobuf *io = &c->send;
+    size_t ofs = io->len;
+    if (mg_iobuf_add(io, ofs, nullptr, hdr_len + len) != hdr_len + len) {
+        MO_DBG_WARN("send buffer full");
+        return 0;
+    }
+#endif
+
+    unsigned char *frame = (unsigned char*) io->buf + ofs;
+    memcpy(frame, hdr, hdr_len);
+    ws_mask_copy(frame + hdr_len, (const unsigned char*) buf, len, key);
+
+    return len;
+}
+
+void MicroOcpp::ws_close(struct mg_connection *c, uint16_t code, const char *reason) {
+    if (!c) {
+        MO_DBG_ERR("invalid argument");
+        return;
+    }
+
+    unsigned char payload [125]; //control frames have at most 125 bytes payload
+    payload[0] = (unsigned char) (code >> 8);
+    payload[1] = (unsigned char) code;
+    size_t reason_len = reason ? strlen(reason) : 0;
+    if (reason_len > sizeof(payload) - 2) {
+        reason_len = sizeof(payload) - 2;
+    }
+    if (reason_len > 0) {
+        memcpy(payload + 2, reason, reason_len);
+    }
+
+    ws_send_masked(c, payload, 2 + reason_len, WEBSOCKET_OP_CLOSE);
+    mg_compat_drain_conn(c);
+}
+
+bool MicroOcpp::ws_utf8_valid(const unsigned char *data, size_t len) {
+    if (!data) {
+        return len == 0;
+    }
+
+    switch (ws_utf8_kernel_ref()) {
+        case MO_WS_KERNEL_BYTE:
+            return ws_utf8_byte(data, len);
+#if MO_WS_X86
+        case MO_WS_KERNEL_SSE2:
+            return ws_utf8_sse2(data, len);
+#if MO_WS_X86_DISPATCH || defined(__AVX2__)
+        case MO_WS_KERNEL_AVX2:
+            if (len >= 128) {
+                return ws_utf8_avx2(data, len);
+            } else {
+                return ws_utf8_word(data, len); //short messages are faster with the ASCII fast path
+            }
+#endif
+#endif
+#if MO_WS_NEON
+        case MO_WS_KERNEL_NEON:
+            return ws_utf8_neon(data, len);
+#endif
+        default:
+            return ws_utf8_word(data, len);
+    }
+}
+
+bool MicroOcpp::ws_utf8_use_kernel(int kernel) {
+    if (!ws_kernel_supported(kernel)) {
+        return false;
+    }
+    ws_utf8_kernel_ref() = kernel;
+    return true;
+}
+
+int MicroOcpp::ws_utf8_kernel() {
+    return ws_utf8_kernel_ref();
+}
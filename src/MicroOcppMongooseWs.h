@@ -0,0 +1,72 @@
+// matth-x/MicroOcppMongoose
+// Copyright Matthias Akstaller 2019 - 2024
+// GPL-3.0 License (see LICENSE)
+
+#ifndef MO_MONGOOSEWS_H
+#define MO_MONGOOSEWS_H
+
+/*
+ * WebSocket frame helpers for the client side. Mongoose masks outgoing client frames byte by byte after copying
+ * the payload into the send buffer. ws_send_masked builds the frame itself and masks the payload while copying it,
+ * with 64-bit words or vector instructions (SSE2 / AVX2 on x86, NEON on AArch64).
+ *
+ * Mongoose doesn't check that incoming text frames are UTF-8 (RFC 6455, section 8.1). ws_utf8_valid validates them
+ * before they are passed to the receiveTXT callback
+ */
+
+#include "mongoose.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MO_MG_WS_MASK
+#define MO_MG_WS_MASK 1 //sendTXT frames and masks the payload with ws_send_masked instead of mg_ws_send
+#endif
+
+#ifndef MO_MG_WS_UTF8
+#define MO_MG_WS_UTF8 1 //incoming text frames which aren't valid UTF-8 close the conn with status 1007
+#endif
+
+#define MO_WS_CLOSE_INVALID_DATA 1007 //close status for invalid UTF-8
+
+//kernels of the WS payload functions. The default is the fastest one which the CPU supports
+#define MO_WS_KERNEL_BYTE 0 //byte by byte, like Mongoose
+#define MO_WS_KERNEL_WORD 1 //64-bit words
+#define MO_WS_KERNEL_SSE2 2
+#define MO_WS_KERNEL_AVX2 3
+#define MO_WS_KERNEL_NEON 4
+
+namespace MicroOcpp {
+
+//XORs len bytes of src with the 4-byte masking key and writes them to dst. dst may be equal to src
+void ws_mask_copy(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char key [4]);
+
+//selects the kernel of ws_mask_copy. Returns false if the CPU or build doesn't support it. Not thread-safe, for benchmarks
+bool ws_mask_use_kernel(int kernel);
+int ws_mask_kernel();
+
+const char *ws_kernel_name(int kernel);
+
+/*
+ * Appends a masked frame with a random key to the send buffer of the client conn c, like mg_ws_send (Mongoose v7)
+ * or mg_send_websocket_frame (MG v6.14). Returns len, or 0 if the send buffer cannot grow
+ */
+size_t ws_send_masked(struct mg_connection *c, const void *buf, size_t len, int op);
+
+//sends a close frame with status code and reason and closes the client conn c after sending it
+void ws_close(struct mg_connection *c, uint16_t code, const char *reason);
+
+/*
+ * Checks if data is valid UTF-8 (RFC 3629): no overlong encodings, surrogates, code points above U+10FFFF or
+ * truncated sequences. Blocks of ASCII are skipped with 64-bit words or SSE2; AVX2 and NEON validate all bytes
+ * with vector table lookups
+ */
+bool ws_utf8_valid(const unsigned char *data, size_t len);
+
+//selects the kernel of ws_utf8_valid, see ws_mask_use_kernel
+bool ws_utf8_use_kernel(int kernel);
+int ws_utf8_kernel();
+
+} //end namespace MicroOcpp
+
+#endif
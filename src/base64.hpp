@@ -26,9 +26,51 @@
  * SOFTWARE.
  */
 
+/*
+ * Modified for MicroOcppMongoose: lookup tables instead of per-character range compares, single-pass decoding,
+ * vector kernels for bulk data, the URL-safe alphabet at runtime and strict decoding.
+ *
+ * The vector kernel is chosen once at the first call:
+ * - x86: SSE2 (baseline of x86-64, decoder only), SSSE3 and AVX2. With GCC / Clang, SSSE3 and AVX2 are detected at runtime,
+ *   otherwise they are enabled by the compiler flags (__SSSE3__, __AVX2__)
+ * - AArch64: NEON
+ * Build flag BASE64_SIMD=0 disables the vector kernels, e.g. for microcontrollers where the tables are enough
+ */
+
 #ifndef BASE64_H_INCLUDED
 #define BASE64_H_INCLUDED
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef BASE64_SIMD
+#define BASE64_SIMD 1
+#endif
+
+#if BASE64_SIMD && (defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)))
+#define BASE64_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define BASE64_X86_DISPATCH 1 //runtime detection of SSSE3 / AVX2
+#define BASE64_TARGET(t) __attribute__((target(t)))
+#else
+#define BASE64_TARGET(t)
+#endif
+#endif
+
+#if BASE64_SIMD && (defined(__aarch64__) || defined(_M_ARM64))
+#define BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Vector kernels. base64_use_kernel() selects one explicitly, e.g. for benchmarks */
+#define BASE64_KERNEL_SCALAR 0
+#define BASE64_KERNEL_SSE2   1
+#define BASE64_KERNEL_SSSE3  2
+#define BASE64_KERNEL_AVX2   3
+#define BASE64_KERNEL_NEON   4
+
 /* binary_to_base64:
  *   Description:
  *     Converts a single byte from a binary value to the corresponding base64 character
@@ -38,7 +80,7 @@
  *     ascii code of base64 character. If byte is >= 64, then there is not corresponding base64 character
  *     and 255 is returned
  */
-unsigned char binary_to_base64(unsigned char v);
+inline unsigned char binary_to_base64(unsigned char v);
 
 /* base64_to_binary:
  *   Description:
@@ -48,7 +90,7 @@ unsigned char binary_to_base64(unsigned char v);
  *   Returns:
  *     6-bit binary value
  */
-unsigned char base64_to_binary(unsigned char c);
+inline unsigned char base64_to_binary(unsigned char c);
 
 /* encode_base64_length:
  *   Description:
@@ -58,7 +100,7 @@ unsigned char base64_to_binary(unsigned char c);
  *   Returns:
  *     Number of base64 characters needed to encode input_length bytes of binary data
  */
-unsigned int encode_base64_length(unsigned int input_length);
+inline unsigned int encode_base64_length(unsigned int input_length);
 
 /* decode_base64_length:
  *   Description:
@@ -70,8 +112,8 @@ unsigned int encode_base64_length(unsigned int input_length);
  *   Returns:
  *     Number of bytes of binary data in input
  */
-unsigned int decode_base64_length(const unsigned char input[]);
-unsigned int decode_base64_length(const unsigned char input[], unsigned int input_length);
+inline unsigned int decode_base64_length(const unsigned char input[]);
+inline unsigned int decode_base64_length(const unsigned char input[], unsigned int input_length);
 
 /* encode_base64:
  *   Description:
@@ -83,11 +125,12 @@ unsigned int decode_base64_length(const unsigned char input[], unsigned int inpu
  *   Returns:
  *     Length of encoded string in bytes (not including null terminator)
  */
-unsigned int encode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]);
+inline unsigned int encode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]);
 
 /* decode_base64:
  *   Description:
- *     Converts a base64 null-terminated string to an array of bytes
+ *     Converts a base64 null-terminated string to an array of bytes. Stops at the first character which isn't
+ *     part of the alphabet, e.g. the padding
  *   Parameters:
  *     input - Pointer to input string
  *     input_length (optional) - Number of bytes to read from input pointer
@@ -95,151 +138,661 @@ unsigned int encode_base64(const unsigned char input[], unsigned int input_lengt
  *   Returns:
  *     Number of bytes in the decoded binary
  */
-unsigned int decode_base64(const unsigned char input[], unsigned char output[]);
-unsigned int decode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]);
-
-unsigned char binary_to_base64(unsigned char v) {
-  // Capital letters - 'A' is ascii 65 and base64 0
-  if(v < 26) return v + 'A';
-  
-  // Lowercase letters - 'a' is ascii 97 and base64 26
-  if(v < 52) return v + 71;
-  
-  // Digits - '0' is ascii 48 and base64 52
-  if(v < 62) return v - 4;
-  
-  #ifdef BASE64_URL
-  // '-' is ascii 45 and base64 62
-  if(v == 62) return '-';
-  #else
-  // '+' is ascii 43 and base64 62
-  if(v == 62) return '+';
-  #endif
-
-  #ifdef BASE64_URL
-  // '_' is ascii 95 and base64 62
-  if(v == 63) return '_';
-  #else
-  // '/' is ascii 47 and base64 63
-  if(v == 63) return '/';
-  #endif
-  
-  return 64;
-}
-
-unsigned char base64_to_binary(unsigned char c) {
-  // Capital letters - 'A' is ascii 65 and base64 0
-  if('A' <= c && c <= 'Z') return c - 'A';
-  
-  // Lowercase letters - 'a' is ascii 97 and base64 26
-  if('a' <= c && c <= 'z') return c - 71;
-  
-  // Digits - '0' is ascii 48 and base64 52
-  if('0' <= c && c <= '9') return c + 4;
-  
-  #ifdef BASE64_URL
-  // '-' is ascii 45 and base64 62
-  if(c == '-') return 62;
-  #else
-  // '+' is ascii 43 and base64 62
-  if(c == '+') return 62;
-  #endif
-  
-  #ifdef BASE64_URL
-  // '_' is ascii 95 and base64 62
-  if(c == '_') return 63;
-  #else
-  // '/' is ascii 47 and base64 63
-  if(c == '/') return 63;
-  #endif
-  
-  return 255;
-}
-
-unsigned int encode_base64_length(unsigned int input_length) {
-  return (input_length + 2)/3*4;
+inline unsigned int decode_base64(const unsigned char input[], unsigned char output[]);
+inline unsigned int decode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]);
+
+/* decode_base64_strict:
+ *   Description:
+ *     Converts a base64 string to an array of bytes and rejects everything which isn't canonical base64
+ *     according to RFC 4648: characters outside of the alphabet (including whitespace), missing or misplaced
+ *     padding and non-zero bits after the last byte
+ *   Parameters:
+ *     input - Pointer to input string
+ *     input_length - Number of bytes to read from input pointer
+ *     output - Pointer to output array with space for decode_base64_max_length(input_length) bytes
+ *   Returns:
+ *     Number of bytes in the decoded binary, or -1 if the input is invalid. The output is undefined then
+ */
+inline int decode_base64_strict(const unsigned char input[], unsigned int input_length, unsigned char output[]);
+
+/* encode_base64url / decode_base64url_strict:
+ *   Description:
+ *     URL-safe variant which uses '-' for 62 and '_' for 63 (RFC 4648, section 5). The encoder doesn't write
+ *     padding; the decoder accepts input with and without padding and otherwise validates like
+ *     decode_base64_strict. Independent of BASE64_URL
+ *   Returns:
+ *     Length of the encoded string (not including null terminator), or the number of decoded bytes or -1
+ */
+inline unsigned int encode_base64url_length(unsigned int input_length);
+inline unsigned int encode_base64url(const unsigned char input[], unsigned int input_length, unsigned char output[]);
+inline int decode_base64url_strict(const unsigned char input[], unsigned int input_length, unsigned char output[]);
+
+/* decode_base64_max_length:
+ *   Returns:
+ *     Upper bound of the decoded size of input_length base64 characters
+ */
+inline unsigned int decode_base64_max_length(unsigned int input_length);
+
+/* base64_use_kernel / base64_kernel:
+ *   Description:
+ *     Selects the vector kernel (BASE64_KERNEL_*) or returns the active one. The default is the fastest kernel
+ *     which the CPU supports
+ *   Returns:
+ *     false if the kernel isn't available on this CPU or build. The active kernel stays unchanged then
+ */
+inline bool base64_use_kernel(int kernel);
+inline int base64_kernel();
+inline const char *base64_kernel_name(int kernel);
+
+namespace base64_detail {
+
+struct Alphabet {
+  const unsigned char *enc; // 64 characters
+  const unsigned char *dec; // 256 entries, 255 for characters outside of the alphabet
+  unsigned char c62, c63;
+};
+
+static const unsigned char enc_std[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const unsigned char enc_url[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static const unsigned char dec_std[256] = {
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+   52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+  255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+   15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+  255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+   41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+static const unsigned char dec_url[256] = {
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255,
+   52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+  255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+   15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255,  63,
+  255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+   41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+static const Alphabet alphabet_std = {enc_std, dec_std, '+', '/'};
+static const Alphabet alphabet_url = {enc_url, dec_url, '-', '_'};
+
+#ifdef BASE64_URL
+static const Alphabet &alphabet_default = alphabet_url;
+#else
+static const Alphabet &alphabet_default = alphabet_std;
+#endif
+
+/*
+ * Vector kernels. Each one converts whole blocks and returns the number of consumed input bytes. The scalar code
+ * converts the rest. The decoders stop before the first block which contains a character outside of the alphabet
+ */
+
+#if BASE64_X86
+
+// 6-bit values -> characters
+static inline __m128i enc_translate_sse2(__m128i idx, const Alphabet &a) {
+  __m128i r = _mm_add_epi8(idx, _mm_set1_epi8('A'));
+  r = _mm_add_epi8(r, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(25)), _mm_set1_epi8(6)));
+  r = _mm_add_epi8(r, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(51)), _mm_set1_epi8(-75)));
+  r = _mm_add_epi8(r, _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_set1_epi8(62)), _mm_set1_epi8((char) (a.c62 - 58))));
+  r = _mm_add_epi8(r, _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_set1_epi8(63)), _mm_set1_epi8((char) (a.c63 - 59))));
+  return r;
+}
+
+// 32-bit lanes with 24 bits each (first byte in bits 16..23) -> four 6-bit values per lane in output order
+static inline __m128i enc_split_sse2(__m128i v) {
+  return _mm_or_si128(
+    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 18), _mm_set1_epi32(0x0000003F)),
+                 _mm_and_si128(_mm_srli_epi32(v, 4),  _mm_set1_epi32(0x00003F00))),
+    _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 10), _mm_set1_epi32(0x003F0000)),
+                 _mm_and_si128(_mm_slli_epi32(v, 24), _mm_set1_epi32(0x3F000000))));
 }
 
-unsigned int decode_base64_length(const unsigned char input[]) {
-  return decode_base64_length(input, -1);
+// characters -> 6-bit values. Clears *valid if any character is outside of the alphabet
+static inline __m128i dec_translate_sse2(__m128i c, const Alphabet &a, bool *valid) {
+  __m128i m_upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), c));
+  __m128i m_lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+  __m128i m_digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+  __m128i m_62 = _mm_cmpeq_epi8(c, _mm_set1_epi8((char) a.c62));
+  __m128i m_63 = _mm_cmpeq_epi8(c, _mm_set1_epi8((char) a.c63));
+
+  __m128i m_all = _mm_or_si128(_mm_or_si128(m_upper, m_lower), _mm_or_si128(_mm_or_si128(m_digit, m_62), m_63));
+  *valid = _mm_movemask_epi8(m_all) == 0xFFFF;
+
+  return _mm_or_si128(
+    _mm_or_si128(_mm_and_si128(m_upper, _mm_sub_epi8(c, _mm_set1_epi8(65))),
+                 _mm_and_si128(m_lower, _mm_sub_epi8(c, _mm_set1_epi8(71)))),
+    _mm_or_si128(_mm_and_si128(m_digit, _mm_add_epi8(c, _mm_set1_epi8(4))),
+                 _mm_or_si128(_mm_and_si128(m_62, _mm_set1_epi8(62)), _mm_and_si128(m_63, _mm_set1_epi8(63)))));
 }
 
-unsigned int decode_base64_length(const unsigned char input[], unsigned int input_length) {
-  const unsigned char *start = input;
-  
-  while(base64_to_binary(input[0]) < 64 && (unsigned int) (input - start) < input_length) {
-    ++input;
+// four 6-bit values per 32-bit lane -> 24 bits per lane (first byte in bits 16..23)
+static inline __m128i dec_merge_sse2(__m128i v) {
+  __m128i pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00FF)), 6), _mm_srli_epi16(v, 8));
+  return _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+}
+
+static inline size_t decode_sse2(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    bool valid;
+    __m128i v = dec_translate_sse2(_mm_loadu_si128((const __m128i*) (in + i)), a, &valid);
+    if (!valid) {
+      break;
+    }
+    uint32_t t [4];
+    _mm_storeu_si128((__m128i*) t, dec_merge_sse2(v));
+    for (int k = 0; k < 4; k++) {
+      out[0] = (unsigned char) (t[k] >> 16);
+      out[1] = (unsigned char) (t[k] >> 8);
+      out[2] = (unsigned char) t[k];
+      out += 3;
+    }
   }
-  
-  input_length = (unsigned int) (input - start);
-  return input_length/4*3 + (input_length % 4 ? input_length % 4 - 1 : 0);
+  return i;
 }
 
-unsigned int encode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
-  unsigned int full_sets = input_length/3;
-  
-  // While there are still full sets of 24 bits...
-  for(unsigned int i = 0; i < full_sets; ++i) {
-    output[0] = binary_to_base64(                         input[0] >> 2);
-    output[1] = binary_to_base64((input[0] & 0x03) << 4 | input[1] >> 4);
-    output[2] = binary_to_base64((input[1] & 0x0F) << 2 | input[2] >> 6);
-    output[3] = binary_to_base64( input[2] & 0x3F);
-    
-    input += 3;
-    output += 4;
+#if BASE64_X86_DISPATCH || defined(__SSSE3__)
+
+BASE64_TARGET("ssse3")
+static inline size_t encode_ssse3(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  const __m128i shuf = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 12) { // loads 16 bytes and consumes 12
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (in + i)), shuf);
+    _mm_storeu_si128((__m128i*) out, enc_translate_sse2(enc_split_sse2(v), a));
+    out += 16;
   }
-  
-  switch(input_length % 3) {
-    case 0:
-      output[0] = '\0';
+  return i;
+}
+
+BASE64_TARGET("ssse3")
+static inline size_t decode_ssse3(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    bool valid;
+    __m128i v = dec_translate_sse2(_mm_loadu_si128((const __m128i*) (in + i)), a, &valid);
+    if (!valid) {
       break;
-    case 1:
-      output[0] = binary_to_base64(                         input[0] >> 2);
-      output[1] = binary_to_base64((input[0] & 0x03) << 4);
-      output[2] = '=';
-      output[3] = '=';
-      output[4] = '\0';
+    }
+    __m128i bytes = _mm_shuffle_epi8(dec_merge_sse2(v), shuf);
+    _mm_storel_epi64((__m128i*) out, bytes); // exactly 12 bytes. The output may end here
+    uint32_t tail = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+    memcpy(out + 8, &tail, 4);
+    out += 12;
+  }
+  return i;
+}
+
+#endif //SSSE3
+
+#if BASE64_X86_DISPATCH || defined(__AVX2__)
+
+BASE64_TARGET("avx2")
+static inline size_t encode_avx2(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  const __m256i shuf = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                                        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  size_t i = 0;
+  for (; i + 28 <= len; i += 24) { // each lane loads 16 bytes and consumes 12
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) (in + i))),
+                                        _mm_loadu_si128((const __m128i*) (in + i + 12)), 1);
+    v = _mm256_shuffle_epi8(v, shuf);
+    __m256i idx = _mm256_or_si256(
+      _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 18), _mm256_set1_epi32(0x0000003F)),
+                      _mm256_and_si256(_mm256_srli_epi32(v, 4),  _mm256_set1_epi32(0x00003F00))),
+      _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(v, 10), _mm256_set1_epi32(0x003F0000)),
+                      _mm256_and_si256(_mm256_slli_epi32(v, 24), _mm256_set1_epi32(0x3F000000))));
+    __m256i r = _mm256_add_epi8(idx, _mm256_set1_epi8('A'));
+    r = _mm256_add_epi8(r, _mm256_and_si256(_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)), _mm256_set1_epi8(6)));
+    r = _mm256_add_epi8(r, _mm256_and_si256(_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(51)), _mm256_set1_epi8(-75)));
+    r = _mm256_add_epi8(r, _mm256_and_si256(_mm256_cmpeq_epi8(idx, _mm256_set1_epi8(62)), _mm256_set1_epi8((char) (a.c62 - 58))));
+    r = _mm256_add_epi8(r, _mm256_and_si256(_mm256_cmpeq_epi8(idx, _mm256_set1_epi8(63)), _mm256_set1_epi8((char) (a.c63 - 59))));
+    _mm256_storeu_si256((__m256i*) out, r);
+    out += 32;
+  }
+  return i;
+}
+
+BASE64_TARGET("avx2")
+static inline size_t decode_avx2(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i c = _mm256_loadu_si256((const __m256i*) (in + i));
+    __m256i m_upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+    __m256i m_lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+    __m256i m_digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+    __m256i m_62 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8((char) a.c62));
+    __m256i m_63 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8((char) a.c63));
+    __m256i m_all = _mm256_or_si256(_mm256_or_si256(m_upper, m_lower), _mm256_or_si256(_mm256_or_si256(m_digit, m_62), m_63));
+    if (_mm256_movemask_epi8(m_all) != -1) {
       break;
-    case 2:
-      output[0] = binary_to_base64(                         input[0] >> 2);
-      output[1] = binary_to_base64((input[0] & 0x03) << 4 | input[1] >> 4);
-      output[2] = binary_to_base64((input[1] & 0x0F) << 2);
-      output[3] = '=';
-      output[4] = '\0';
+    }
+    __m256i v = _mm256_or_si256(
+      _mm256_or_si256(_mm256_and_si256(m_upper, _mm256_sub_epi8(c, _mm256_set1_epi8(65))),
+                      _mm256_and_si256(m_lower, _mm256_sub_epi8(c, _mm256_set1_epi8(71)))),
+      _mm256_or_si256(_mm256_and_si256(m_digit, _mm256_add_epi8(c, _mm256_set1_epi8(4))),
+                      _mm256_or_si256(_mm256_and_si256(m_62, _mm256_set1_epi8(62)), _mm256_and_si256(m_63, _mm256_set1_epi8(63)))));
+    __m256i pairs = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x00FF)), 6), _mm256_srli_epi16(v, 8));
+    __m256i bytes = _mm256_shuffle_epi8(_mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000)), shuf);
+
+    __m128i lo = _mm256_castsi256_si128(bytes);
+    __m128i hi = _mm256_extracti128_si256(bytes, 1);
+    uint32_t tail;
+    _mm_storel_epi64((__m128i*) out, lo); // exactly 2 x 12 bytes
+    tail = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(lo, 8));
+    memcpy(out + 8, &tail, 4);
+    _mm_storel_epi64((__m128i*) (out + 12), hi);
+    tail = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(hi, 8));
+    memcpy(out + 20, &tail, 4);
+    out += 24;
+  }
+  return i;
+}
+
+#endif //AVX2
+
+#endif //BASE64_X86
+
+#if BASE64_NEON
+
+static inline size_t encode_neon(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  uint8x16x4_t table;
+  table.val[0] = vld1q_u8(a.enc);
+  table.val[1] = vld1q_u8(a.enc + 16);
+  table.val[2] = vld1q_u8(a.enc + 32);
+  table.val[3] = vld1q_u8(a.enc + 48);
+  size_t i = 0;
+  for (; i + 48 <= len; i += 48) {
+    uint8x16x3_t s = vld3q_u8(in + i);
+    uint8x16x4_t r;
+    r.val[0] = vshrq_n_u8(s.val[0], 2);
+    r.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(s.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(s.val[1], 4));
+    r.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(s.val[1], vdupq_n_u8(0x0F)), 2), vshrq_n_u8(s.val[2], 6));
+    r.val[3] = vandq_u8(s.val[2], vdupq_n_u8(0x3F));
+    for (int k = 0; k < 4; k++) {
+      r.val[k] = vqtbl4q_u8(table, r.val[k]);
+    }
+    vst4q_u8(out, r);
+    out += 64;
+  }
+  return i;
+}
+
+static inline uint8x16_t dec_translate_neon(uint8x16_t c, const Alphabet &a, uint8x16_t *valid) {
+  uint8x16_t m_upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')), vcleq_u8(c, vdupq_n_u8('Z')));
+  uint8x16_t m_lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')), vcleq_u8(c, vdupq_n_u8('z')));
+  uint8x16_t m_digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+  uint8x16_t m_62 = vceqq_u8(c, vdupq_n_u8(a.c62));
+  uint8x16_t m_63 = vceqq_u8(c, vdupq_n_u8(a.c63));
+  *valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(m_upper, m_lower), vorrq_u8(vorrq_u8(m_digit, m_62), m_63)));
+  return vorrq_u8(
+    vorrq_u8(vandq_u8(m_upper, vsubq_u8(c, vdupq_n_u8(65))), vandq_u8(m_lower, vsubq_u8(c, vdupq_n_u8(71)))),
+    vorrq_u8(vandq_u8(m_digit, vaddq_u8(c, vdupq_n_u8(4))),
+             vorrq_u8(vandq_u8(m_62, vdupq_n_u8(62)), vandq_u8(m_63, vdupq_n_u8(63)))));
+}
+
+static inline size_t decode_neon(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint8x16x4_t s = vld4q_u8(in + i);
+    uint8x16_t valid = vdupq_n_u8(0xFF);
+    for (int k = 0; k < 4; k++) {
+      s.val[k] = dec_translate_neon(s.val[k], a, &valid);
+    }
+    if (vminvq_u8(valid) != 0xFF) {
       break;
+    }
+    uint8x16x3_t r;
+    r.val[0] = vorrq_u8(vshlq_n_u8(s.val[0], 2), vshrq_n_u8(s.val[1], 4));
+    r.val[1] = vorrq_u8(vshlq_n_u8(s.val[1], 4), vshrq_n_u8(s.val[2], 2));
+    r.val[2] = vorrq_u8(vshlq_n_u8(s.val[2], 6), s.val[3]);
+    vst3q_u8(out, r);
+    out += 48;
   }
-  
-  return encode_base64_length(input_length);
+  return i;
 }
 
-unsigned int decode_base64(const unsigned char input[], unsigned char output[]) {
-  return decode_base64(input, -1, output);
+#endif //BASE64_NEON
+
+inline bool kernel_supported(int kernel) {
+  switch (kernel) {
+    case BASE64_KERNEL_SCALAR:
+      return true;
+#if BASE64_X86
+    case BASE64_KERNEL_SSE2:
+      return true;
+#if BASE64_X86_DISPATCH
+    case BASE64_KERNEL_SSSE3:
+      return __builtin_cpu_supports("ssse3");
+    case BASE64_KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+#else
+#if defined(__SSSE3__)
+    case BASE64_KERNEL_SSSE3:
+      return true;
+#endif
+#if defined(__AVX2__)
+    case BASE64_KERNEL_AVX2:
+      return true;
+#endif
+#endif
+#endif //BASE64_X86
+#if BASE64_NEON
+    case BASE64_KERNEL_NEON:
+      return true;
+#endif
+    default:
+      return false;
+  }
 }
 
-unsigned int decode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
-  unsigned int output_length = decode_base64_length(input, input_length);
-  
-  // While there are still full sets of 24 bits...
-  for(unsigned int i = 2; i < output_length; i += 3) {
-    output[0] = base64_to_binary(input[0]) << 2 | base64_to_binary(input[1]) >> 4;
-    output[1] = base64_to_binary(input[1]) << 4 | base64_to_binary(input[2]) >> 2;
-    output[2] = base64_to_binary(input[2]) << 6 | base64_to_binary(input[3]);
-    
-    input += 4;
-    output += 3;
+inline int detect_kernel() {
+  const int preference [] = {BASE64_KERNEL_AVX2, BASE64_KERNEL_SSSE3, BASE64_KERNEL_SSE2, BASE64_KERNEL_NEON};
+  for (int kernel : preference) {
+    if (kernel_supported(kernel)) {
+      return kernel;
+    }
   }
-  
-  switch(output_length % 3) {
-    case 1:
-      output[0] = base64_to_binary(input[0]) << 2 | base64_to_binary(input[1]) >> 4;
-      break;
-    case 2:
-      output[0] = base64_to_binary(input[0]) << 2 | base64_to_binary(input[1]) >> 4;
-      output[1] = base64_to_binary(input[1]) << 4 | base64_to_binary(input[2]) >> 2;
-      break;
+  return BASE64_KERNEL_SCALAR;
+}
+
+inline int &active_kernel_ref() {
+  static int kernel = detect_kernel();
+  return kernel;
+}
+
+// vector part of the encoder. Returns the number of consumed input bytes, a multiple of 3
+inline size_t encode_blocks(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  (void)in; (void)len; (void)out; (void)a; // unused without vector kernels
+  switch (active_kernel_ref()) {
+#if BASE64_X86
+    case BASE64_KERNEL_SSE2:
+      return 0; // SSE2 has no byte shuffle. Spreading the input over the lanes is slower than the tables
+#if BASE64_X86_DISPATCH || defined(__SSSE3__)
+    case BASE64_KERNEL_SSSE3:
+      return encode_ssse3(in, len, out, a);
+#endif
+#if BASE64_X86_DISPATCH || defined(__AVX2__)
+    case BASE64_KERNEL_AVX2:
+      return encode_avx2(in, len, out, a);
+#endif
+#endif
+#if BASE64_NEON
+    case BASE64_KERNEL_NEON:
+      return encode_neon(in, len, out, a);
+#endif
+    default:
+      return 0;
+  }
+}
+
+// vector part of the decoder. Returns the number of consumed characters, a multiple of 4
+inline size_t decode_blocks(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  (void)in; (void)len; (void)out; (void)a; // unused without vector kernels
+  switch (active_kernel_ref()) {
+#if BASE64_X86
+    case BASE64_KERNEL_SSE2:
+      return decode_sse2(in, len, out, a);
+#if BASE64_X86_DISPATCH || defined(__SSSE3__)
+    case BASE64_KERNEL_SSSE3:
+      return decode_ssse3(in, len, out, a);
+#endif
+#if BASE64_X86_DISPATCH || defined(__AVX2__)
+    case BASE64_KERNEL_AVX2:
+      return decode_avx2(in, len, out, a);
+#endif
+#endif
+#if BASE64_NEON
+    case BASE64_KERNEL_NEON:
+      return decode_neon(in, len, out, a);
+#endif
+    default:
+      return 0;
+  }
+}
+
+// encodes input_length bytes without padding and null terminator. Returns the number of written characters
+inline size_t encode(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a) {
+  unsigned char *out_start = out;
+
+  size_t done = encode_blocks(in, len, out, a);
+  in += done;
+  out += done / 3 * 4;
+  len -= done;
+
+  const unsigned char *enc = a.enc;
+  for (; len >= 3; len -= 3) {
+    uint32_t v = (uint32_t) in[0] << 16 | (uint32_t) in[1] << 8 | in[2];
+    out[0] = enc[v >> 18];
+    out[1] = enc[(v >> 12) & 0x3F];
+    out[2] = enc[(v >> 6) & 0x3F];
+    out[3] = enc[v & 0x3F];
+    in += 3;
+    out += 4;
+  }
+
+  if (len == 1) {
+    out[0] = enc[in[0] >> 2];
+    out[1] = enc[(in[0] & 0x03) << 4];
+    out += 2;
+  } else if (len == 2) {
+    out[0] = enc[in[0] >> 2];
+    out[1] = enc[(in[0] & 0x03) << 4 | in[1] >> 4];
+    out[2] = enc[(in[1] & 0x0F) << 2];
+    out += 3;
+  }
+
+  return (size_t) (out - out_start);
+}
+
+/*
+ * Decodes the longest prefix of characters of the alphabet in one pass. A trailing group of 2 or 3 characters
+ * gives 1 or 2 bytes, a single trailing character is ignored. *prefix_len is set to the length of the prefix.
+ * Returns the number of written bytes
+ */
+inline size_t decode_prefix(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a, size_t *prefix_len) {
+  const unsigned char *in_start = in;
+  unsigned char *out_start = out;
+
+  size_t done = decode_blocks(in, len, out, a);
+  in += done;
+  out += done / 4 * 3;
+  len -= done;
+
+  const unsigned char *dec = a.dec;
+  for (; len >= 4; len -= 4) {
+    unsigned char d0 = dec[in[0]], d1 = dec[in[1]], d2 = dec[in[2]], d3 = dec[in[3]];
+    if ((d0 | d1 | d2 | d3) & 0xC0) {
+      break; // outside of the alphabet. Continue with the tail
+    }
+    uint32_t v = (uint32_t) d0 << 18 | (uint32_t) d1 << 12 | (uint32_t) d2 << 6 | d3;
+    out[0] = (unsigned char) (v >> 16);
+    out[1] = (unsigned char) (v >> 8);
+    out[2] = (unsigned char) v;
+    in += 4;
+    out += 3;
+  }
+
+  size_t tail = 0;
+  while (tail < len && tail < 4 && dec[in[tail]] < 64) {
+    tail++;
+  }
+  if (tail >= 2) {
+    out[0] = (unsigned char) (dec[in[0]] << 2 | dec[in[1]] >> 4);
+    out++;
+  }
+  if (tail >= 3) {
+    out[0] = (unsigned char) (dec[in[1]] << 4 | dec[in[2]] >> 2);
+    out++;
+  }
+  // tail == 4 is impossible: the loop above would have decoded the group
+
+  *prefix_len = (size_t) (in - in_start) + tail;
+  return (size_t) (out - out_start);
+}
+
+/*
+ * Strict decoding. Padding is required if pad_required, else it's optional. Returns -1 on invalid input
+ */
+inline int decode_strict(const unsigned char *in, size_t len, unsigned char *out, const Alphabet &a, bool pad_required) {
+  size_t body_len = len;
+  size_t pad = 0;
+  while (pad < 2 && body_len > 0 && in[body_len - 1] == '=') {
+    body_len--;
+    pad++;
+  }
+
+  if (pad > 0 || pad_required) {
+    if (len % 4 != 0) {
+      return -1; // padded input must consist of complete groups
+    }
+  }
+  if (body_len % 4 == 1) {
+    return -1; // a single character doesn't carry a full byte
+  }
+  if (pad > 0 && (body_len % 4 == 0 || 4 - body_len % 4 != pad)) {
+    return -1; // more padding than missing characters
+  }
+
+  size_t prefix_len;
+  size_t n = decode_prefix(in, body_len, out, a, &prefix_len);
+  if (prefix_len != body_len) {
+    return -1; // character outside of the alphabet, including misplaced padding
+  }
+
+  // the unused bits of the last character must be zero (canonical encoding)
+  if (body_len % 4 == 2 && (a.dec[in[body_len - 1]] & 0x0F)) {
+    return -1;
+  }
+  if (body_len % 4 == 3 && (a.dec[in[body_len - 1]] & 0x03)) {
+    return -1;
+  }
+
+  if (n > 0x7FFFFFFF) {
+    return -1;
+  }
+  return (int) n;
+}
+
+} // namespace base64_detail
+
+inline unsigned char binary_to_base64(unsigned char v) {
+  if(v >= 64) return 64;
+  return base64_detail::alphabet_default.enc[v];
+}
+
+inline unsigned char base64_to_binary(unsigned char c) {
+  return base64_detail::alphabet_default.dec[c];
+}
+
+inline unsigned int encode_base64_length(unsigned int input_length) {
+  return (input_length + 2)/3*4;
+}
+
+inline unsigned int decode_base64_length(const unsigned char input[]) {
+  return decode_base64_length(input, (unsigned int) strlen((const char*) input));
+}
+
+inline unsigned int decode_base64_length(const unsigned char input[], unsigned int input_length) {
+  const unsigned char *dec = base64_detail::alphabet_default.dec;
+  unsigned int n = 0;
+
+  // groups of 4 characters at once. The OR of the table entries has bit 6 or 7 set if one is outside of the alphabet
+  while(n + 4 <= input_length && !((dec[input[n]] | dec[input[n + 1]] | dec[input[n + 2]] | dec[input[n + 3]]) & 0xC0)) {
+    n += 4;
+  }
+  while(n < input_length && dec[input[n]] < 64) {
+    ++n;
+  }
+
+  return n/4*3 + (n % 4 ? n % 4 - 1 : 0);
+}
+
+inline unsigned int encode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
+  size_t n = base64_detail::encode(input, input_length, output, base64_detail::alphabet_default);
+
+  // padding
+  while(n % 4) {
+    output[n++] = '=';
+  }
+  output[n] = '\0';
+
+  return encode_base64_length(input_length);
+}
+
+inline unsigned int decode_base64(const unsigned char input[], unsigned char output[]) {
+  return decode_base64(input, (unsigned int) strlen((const char*) input), output);
+}
+
+inline unsigned int decode_base64(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
+  size_t prefix_len;
+  return (unsigned int) base64_detail::decode_prefix(input, input_length, output, base64_detail::alphabet_default, &prefix_len);
+}
+
+inline int decode_base64_strict(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
+  return base64_detail::decode_strict(input, input_length, output, base64_detail::alphabet_default, true);
+}
+
+inline unsigned int encode_base64url_length(unsigned int input_length) {
+  return input_length/3*4 + (input_length % 3 ? input_length % 3 + 1 : 0);
+}
+
+inline unsigned int encode_base64url(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
+  size_t n = base64_detail::encode(input, input_length, output, base64_detail::alphabet_url);
+  output[n] = '\0';
+  return (unsigned int) n;
+}
+
+inline int decode_base64url_strict(const unsigned char input[], unsigned int input_length, unsigned char output[]) {
+  return base64_detail::decode_strict(input, input_length, output, base64_detail::alphabet_url, false);
+}
+
+inline unsigned int decode_base64_max_length(unsigned int input_length) {
+  return (input_length + 3)/4*3;
+}
+
+inline bool base64_use_kernel(int kernel) {
+  if(!base64_detail::kernel_supported(kernel)) return false;
+  base64_detail::active_kernel_ref() = kernel;
+  return true;
+}
+
+inline int base64_kernel() {
+  return base64_detail::active_kernel_ref();
+}
+
+inline const char *base64_kernel_name(int kernel) {
+  switch(kernel) {
+    case BASE64_KERNEL_SCALAR: return "scalar";
+    case BASE64_KERNEL_SSE2:   return "sse2";
+    case BASE64_KERNEL_SSSE3:  return "ssse3";
+    case BASE64_KERNEL_AVX2:   return "avx2";
+    case BASE64_KERNEL_NEON:   return "neon";
+    default:                   return "unknown";
   }
-  
-  return output_length;
 }
 
 #endif // ifndef